@@ -839,12 +839,14 @@ static command_t commands[] = {
         "httpd: httpd start|stop\n"
         "    Start or stop the built-in HTTP server on port 80.\n",
         "NAME\n"
-        "    httpd - minimal HTTP/1.0 server\n\n"
+        "    httpd - built-in HTTP/1.1 server\n\n"
         "SYNOPSIS\n"
         "    httpd start|stop\n\n"
         "DESCRIPTION\n"
-        "    Starts a minimal HTTP server on port 80. It serves\n"
-        "    static HTML for / and files from the filesystem.\n"
+        "    Starts an HTTP server on port 80 in a kernel thread. It\n"
+        "    serves static HTML for / and files from the filesystem,\n"
+        "    keeps connections alive between requests and caches\n"
+        "    small files in memory. Statistics are in /proc/httpd.\n"
         "    Use 'httpd stop' to shut it down.\n",
         CMD_FLAG_ROOT
     },
@@ -1747,10 +1749,11 @@ size_t shell_autocomplete(char* buffer, size_t buffer_pos, size_t buffer_size) {
                 if (fs_read_inode(target_inode, &dir_inode) == 0 && dir_inode.type == INODE_DIR) {
                     /* Process one block at a time to avoid 32KB stack allocation */
                     static uint8_t ac_block[BLOCK_SIZE];
-                    int epb = BLOCK_SIZE / (int)sizeof(dir_entry_t);
-                    for (uint8_t bi = 0; bi < dir_inode.num_blocks && completion_matches_count < 32; bi++) {
-                        if (fs_read_block(dir_inode.blocks[bi], ac_block) != 0) break;
+                    uint32_t nbi = fs_inode_blocks(&dir_inode);
+                    for (uint32_t bi = 0; bi < nbi && completion_matches_count < 32; bi++) {
+                        if (fs_read_block(fs_inode_block_at(&dir_inode, bi), ac_block) != 0) break;
                         dir_entry_t* entries = (dir_entry_t*)ac_block;
+                        int epb = (int)fs_dir_slots(&dir_inode, bi);
 
                         for (int ei = 0; ei < epb && completion_matches_count < 32; ei++) {
                             const char* name = entries[ei].name;
@@ -4082,14 +4085,12 @@ static void top_render(void) {
     printf("MiB free)\n");
 
     /* ═══ Disk + Net ════════════════════════════════════════ */
-    int used_inodes = 0, used_blocks = 0;
+    int used_inodes = 0;
+    int used_blocks = (int)(NUM_BLOCKS - DISK_METADATA_BLOCKS - fs_count_free_blocks());
     for (int i = 0; i < NUM_INODES; i++) {
         inode_t tmp;
-        if (fs_read_inode(i, &tmp) == 0 && tmp.type != INODE_FREE) {
+        if (fs_read_inode(i, &tmp) == 0 && tmp.type != INODE_FREE)
             used_inodes++;
-            used_blocks += tmp.num_blocks;
-            if (tmp.indirect_block) used_blocks++;
-        }
     }
     uint32_t rd_ops = 0, rd_bytes = 0, wr_ops = 0, wr_bytes = 0;
     fs_get_io_stats(&rd_ops, &rd_bytes, &wr_ops, &wr_bytes);
@@ -2,6 +2,12 @@
 #include <kernel/win32_types.h>
 #include <kernel/win32_seh.h>
 #include <kernel/fs.h>
+#include <kernel/ata.h>
+#include <kernel/virtio_blk.h>
+#include <kernel/virtio_net.h>
+#include <kernel/netbuf.h>
+#include <kernel/checksum.h>
+#include <kernel/io.h>
 #include <kernel/user.h>
 #include <kernel/group.h>
 #include <kernel/gfx.h>
@@ -15,6 +21,7 @@
 #include <kernel/tls.h>
 #include <kernel/socket.h>
 #include <kernel/tcp.h>
+#include <kernel/httpd.h>
 #include <kernel/udp.h>
 #include <kernel/dns.h>
 #include <kernel/http.h>
@@ -24,6 +31,9 @@
 #include <kernel/vma.h>
 #include <kernel/frame_ref.h>
 #include <kernel/pmm.h>
+#include <kernel/bcache.h>
+#include <kernel/dcache.h>
+#include <kernel/waitq.h>
 #include <kernel/vfs.h>
 #include <kernel/linux_syscall.h>
 #include <kernel/elf_loader.h>
@@ -288,6 +298,94 @@ static void test_stdlib_extra(void) {
     TEST_ASSERT(nf == NULL, "bsearch not found");
 }
 
+/* ---- Heap Allocator Tests ---- */
+
+static void test_heap_alloc(void) {
+    printf("== Heap Allocator Tests ==\n");
+
+    heap_stats_t before, after;
+    heap_get_stats(&before);
+
+    /* Alignment and usable size */
+    void* a = malloc(1);
+    TEST_ASSERT(a != NULL && ((uintptr_t)a & 7) == 0, "malloc 8-byte aligned");
+    TEST_ASSERT(malloc_usable_size(a) >= 1, "usable size >= request");
+
+    /* Double free is ignored */
+    void* b = malloc(48);
+    free(b);
+    free(b);
+    void* c = malloc(48);
+    TEST_ASSERT(c != NULL, "malloc after double free");
+
+    /* ...also once the chunk has merged into a free predecessor */
+    heap_stats_t mid;
+    void* m1 = malloc(200);
+    void* m2 = malloc(200);
+    void* m3 = malloc(200);
+    free(m1);
+    free(m2);
+    heap_get_stats(&mid);
+    free(m2);
+    heap_get_stats(&after);
+    TEST_ASSERT(after.n_free == mid.n_free, "double free after backward merge rejected");
+    free(m3);
+
+    /* Splitting: a freed large block serves many small requests */
+    void* big = malloc(16 * 1024);
+    TEST_ASSERT(big != NULL, "malloc 16K");
+    free(big);
+    void* s1 = malloc(16);
+    void* s2 = malloc(16);
+    TEST_ASSERT(s1 != NULL && s2 != NULL && s1 != s2, "small allocs after free");
+    TEST_ASSERT(malloc_usable_size(s1) < 1024, "small alloc split, not whole block");
+
+    /* Coalescing: freeing the middle of three free neighbours merges
+     * with both sides */
+    char* n1 = (char*)malloc(1000);
+    char* n2 = (char*)malloc(1000);
+    char* n3 = (char*)malloc(1000);
+    free(n1);
+    free(n3);
+    heap_get_stats(&mid);
+    free(n2);
+    heap_get_stats(&after);
+    if (n2 - n1 == n3 - n2 && n2 - n1 < 1100)
+        TEST_ASSERT(after.n_coalesce >= mid.n_coalesce + 2, "neighbours coalesce");
+
+    /* Large buffers take the page-granular path and are recycled */
+    heap_get_stats(&mid);
+    uint8_t* lg = (uint8_t*)malloc(512 * 1024);
+    TEST_ASSERT(lg != NULL, "large malloc");
+    heap_get_stats(&after);
+    TEST_ASSERT(after.n_large == mid.n_large + 1, "large malloc uses page path");
+    TEST_ASSERT(malloc_usable_size(lg) >= 512 * 1024, "large usable size");
+    lg[0] = 1; lg[512 * 1024 - 1] = 2;
+    size_t brk_with_lg = after.heap_bytes;
+    free(lg);
+    uint8_t* lg2 = (uint8_t*)malloc(256 * 1024);
+    heap_get_stats(&after);
+    TEST_ASSERT(lg2 != NULL && after.heap_bytes <= brk_with_lg, "freed large run is reused");
+    free(lg2);
+
+    /* realloc keeps data across the small/large boundary */
+    char* r = (char*)malloc(100);
+    strcpy(r, "heap");
+    r = (char*)realloc(r, 300 * 1024);
+    TEST_ASSERT(r && strcmp(r, "heap") == 0, "realloc small -> large");
+    free(r);
+
+    free(a);
+    free(c);
+    free(s1);
+    free(s2);
+
+    heap_get_stats(&after);
+    TEST_ASSERT(after.n_malloc > before.n_malloc, "heap stats count mallocs");
+    TEST_ASSERT(after.n_free > before.n_free, "heap stats count frees");
+    TEST_ASSERT(after.in_use_bytes <= before.in_use_bytes + 64, "no leaked bytes");
+}
+
 /* ---- snprintf Tests ---- */
 
 static void test_snprintf(void) {
@@ -663,7 +761,8 @@ static void test_fs_v3(void) {
     TEST_ASSERT(NUM_BLOCKS == 65536, "geometry: 65536 blocks");
     TEST_ASSERT(NUM_INODES == 4096, "geometry: 4096 inodes");
     TEST_ASSERT(BLOCK_SIZE == 4096, "geometry: 4KB blocks");
-    TEST_ASSERT(DIRECT_BLOCKS == 8, "geometry: 8 direct blocks");
+    TEST_ASSERT(sizeof(inode_t) == 64, "geometry: 64-byte inodes");
+    TEST_ASSERT(INODE_EXTENTS == 5, "geometry: 5 inline extents");
 
     if (saved_user)
         user_set_current(saved_user);
@@ -1067,6 +1166,119 @@ void test_crypto(void) {
         TEST_ASSERT(rc_tamper == -2, "AES-GCM rejects tampered ciphertext");
     }
 
+    /* AES-128-GCM: NIST test case 4 (60-byte plaintext, 20-byte AAD) on
+     * both the table-driven and the AES-NI path, then the two paths
+     * against each other on a multi-batch buffer */
+    {
+        uint8_t key[] = {0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,
+                         0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08};
+        uint8_t nonce[] = {0xca,0xfe,0xba,0xbe,0xfa,0xce,0xdb,0xad,
+                           0xde,0xca,0xf8,0x88};
+        uint8_t aad[] = {0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,
+                         0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,
+                         0xab,0xad,0xda,0xd2};
+        uint8_t pt[] = {0xd9,0x31,0x32,0x25,0xf8,0x84,0x06,0xe5,
+                        0xa5,0x59,0x09,0xc5,0xaf,0xf5,0x26,0x9a,
+                        0x86,0xa7,0xa9,0x53,0x15,0x34,0xf7,0xda,
+                        0x2e,0x4c,0x30,0x3d,0x8a,0x31,0x8a,0x72,
+                        0x1c,0x3c,0x0c,0x95,0x95,0x68,0x09,0x53,
+                        0x2f,0xcf,0x0e,0x24,0x49,0xa6,0xb5,0x25,
+                        0xb1,0x6a,0xed,0xf5,0xaa,0x0d,0xe6,0x57,
+                        0xba,0x63,0x7b,0x39};
+        uint8_t expected_tag[] = {0x5b,0xc9,0x4f,0xbc,0x32,0x21,0xa5,0xdb,
+                                  0x94,0xfa,0xe9,0x5a,0xe7,0x12,0x1a,0x47};
+        uint8_t ct_head[] = {0x42,0x83,0x1e,0xc2};
+
+        aes128_ctx_t ctx;
+        aes128_init(&ctx, key);
+        int accel = aes128_accel();
+        printf("  AES-NI: %s\n", accel ? "yes" : "no");
+
+        for (int path = 0; path <= accel; path++) {
+            aes128_set_accel(path);
+            uint8_t ct[60], tag[16], dec[60];
+            aes128_gcm_encrypt(&ctx, nonce, 12, aad, 20, pt, 60, ct, tag);
+            TEST_ASSERT(memcmp(tag, expected_tag, 16) == 0 &&
+                        memcmp(ct, ct_head, 4) == 0, "AES-GCM NIST TC4");
+            TEST_ASSERT(aes128_gcm_decrypt(&ctx, nonce, 12, aad, 20,
+                                           ct, 60, dec, tag) == 0 &&
+                        memcmp(dec, pt, 60) == 0, "AES-GCM TC4 decrypt");
+        }
+
+        if (accel) {
+            static uint8_t buf[1000], ct_a[1000], ct_b[1000];
+            uint8_t tag_a[16], tag_b[16], iv[16] = {0};
+            for (int i = 0; i < 1000; i++)
+                buf[i] = (uint8_t)(i * 7 + 3);
+
+            aes128_set_accel(0);
+            aes128_gcm_encrypt(&ctx, nonce, 12, aad, 20, buf, 1000, ct_a, tag_a);
+            aes128_set_accel(1);
+            aes128_gcm_encrypt(&ctx, nonce, 12, aad, 20, buf, 1000, ct_b, tag_b);
+            TEST_ASSERT(memcmp(ct_a, ct_b, 1000) == 0 &&
+                        memcmp(tag_a, tag_b, 16) == 0, "AES-GCM AES-NI matches tables");
+
+            aes128_cbc_encrypt(&ctx, iv, buf, 992, ct_a);
+            aes128_set_accel(0);
+            aes128_cbc_decrypt(&ctx, iv, ct_a, 992, ct_b);
+            TEST_ASSERT(memcmp(ct_b, buf, 992) == 0, "AES-CBC AES-NI matches tables");
+            aes128_set_accel(1);
+        }
+    }
+
+    /* ChaCha20-Poly1305: RFC 8439 section 2.8.2 on the 32-bit and the
+     * SSE2 path, then the two paths against each other on a buffer
+     * long enough for the four-block SSE2 loop */
+    {
+        uint8_t key[32];
+        for (int i = 0; i < 32; i++)
+            key[i] = (uint8_t)(0x80 + i);
+        uint8_t nonce[] = {0x07,0x00,0x00,0x00,0x40,0x41,0x42,0x43,
+                           0x44,0x45,0x46,0x47};
+        uint8_t aad[] = {0x50,0x51,0x52,0x53,0xc0,0xc1,0xc2,0xc3,
+                         0xc4,0xc5,0xc6,0xc7};
+        const char *pt = "Ladies and Gentlemen of the class of '99: If I could "
+                         "offer you only one tip for the future, sunscreen "
+                         "would be it.";
+        uint8_t expected_tag[] = {0x1a,0xe1,0x0b,0x59,0x4f,0x09,0xe2,0x6a,
+                                  0x7e,0x90,0x2e,0xcb,0xd0,0x60,0x06,0x91};
+        uint8_t ct_head[] = {0xd3,0x1a,0x8d,0x34};
+        size_t len = strlen(pt);
+
+        int accel = chacha20_accel();
+        printf("  ChaCha20 SSE2: %s\n", accel ? "yes" : "no");
+
+        for (int path = 0; path <= accel; path++) {
+            chacha20_set_accel(path);
+            uint8_t ct[114], tag[16], dec[114];
+            chacha20_poly1305_encrypt(key, nonce, aad, 12,
+                                      (const uint8_t *)pt, len, ct, tag);
+            TEST_ASSERT(len == 114 && memcmp(tag, expected_tag, 16) == 0 &&
+                        memcmp(ct, ct_head, 4) == 0, "ChaCha20-Poly1305 RFC 8439");
+            TEST_ASSERT(chacha20_poly1305_decrypt(key, nonce, aad, 12,
+                                                  ct, len, dec, tag) == 0 &&
+                        memcmp(dec, pt, len) == 0, "ChaCha20-Poly1305 decrypt");
+            ct[0] ^= 0x01;
+            TEST_ASSERT(chacha20_poly1305_decrypt(key, nonce, aad, 12,
+                                                  ct, len, dec, tag) == -2,
+                        "ChaCha20-Poly1305 rejects tampered ciphertext");
+        }
+
+        if (accel) {
+            static uint8_t buf[1000], ct_a[1000], ct_b[1000];
+            uint8_t tag_a[16], tag_b[16];
+            for (int i = 0; i < 1000; i++)
+                buf[i] = (uint8_t)(i * 7 + 3);
+
+            chacha20_set_accel(0);
+            chacha20_poly1305_encrypt(key, nonce, aad, 12, buf, 1000, ct_a, tag_a);
+            chacha20_set_accel(1);
+            chacha20_poly1305_encrypt(key, nonce, aad, 12, buf, 1000, ct_b, tag_b);
+            TEST_ASSERT(memcmp(ct_a, ct_b, 1000) == 0 &&
+                        memcmp(tag_a, tag_b, 16) == 0, "ChaCha20 SSE2 matches 32-bit");
+        }
+    }
+
     /* Bignum: 3^10 mod 7 = 4 */
     {
         bignum_t base, exp, mod, result;
@@ -1128,6 +1340,90 @@ void test_crypto(void) {
         TEST_ASSERT(result.d[0] == 1 && result.top == 1, "modexp (m-1)^2 mod m = 1");
     }
 
+    /* RSA-512 private key: CRT decrypt inverts encrypt and matches a
+     * plain c^d mod n */
+    {
+        static const uint8_t rsa_n[64] = {
+            0xc2, 0x60, 0x6d, 0x02, 0x10, 0x77, 0x81, 0x16, 0x30, 0xd4, 0x5c, 0x64,
+            0x62, 0xb3, 0x90, 0xf6, 0x65, 0xc8, 0x7d, 0xc9, 0x58, 0x5b, 0xeb, 0x6c,
+            0xb8, 0x35, 0x09, 0xc0, 0x84, 0x46, 0x5d, 0xf4, 0x11, 0xc7, 0x73, 0xd2,
+            0x83, 0x6e, 0x0e, 0x4a, 0x9f, 0x98, 0xf9, 0xfb, 0x90, 0x88, 0xef, 0xf2,
+            0x85, 0xf8, 0x7b, 0x55, 0xd5, 0x65, 0x35, 0x61, 0x49, 0x0d, 0x1a, 0xd3,
+            0xf9, 0xd7, 0x4d, 0x7d
+        };
+        static const uint8_t rsa_d[64] = {
+            0x7b, 0xbf, 0xe0, 0x26, 0xbc, 0x4d, 0x19, 0x06, 0x03, 0xb8, 0x6f, 0xca,
+            0x09, 0x7c, 0xc1, 0x01, 0xdd, 0xf3, 0x33, 0x02, 0x09, 0x1b, 0x1c, 0x5b,
+            0x6f, 0x3b, 0x75, 0x25, 0xf8, 0x10, 0xc4, 0xa7, 0x0d, 0xa2, 0x3a, 0x97,
+            0x8d, 0xc2, 0xc3, 0x0a, 0x47, 0xb3, 0xbe, 0xbe, 0x40, 0x0f, 0x64, 0xc4,
+            0xc5, 0x2d, 0x5f, 0xad, 0xaa, 0x87, 0x9f, 0x9a, 0x98, 0x84, 0x77, 0x31,
+            0xf1, 0xcc, 0xc0, 0x91
+        };
+        static const uint8_t rsa_p[32] = {
+            0xf4, 0x5d, 0x67, 0x28, 0xb5, 0x4c, 0x63, 0x9c, 0x62, 0x7c, 0xbb, 0x90,
+            0x45, 0x70, 0x6d, 0xec, 0xa1, 0x18, 0x4a, 0x70, 0x8e, 0x76, 0x93, 0xd9,
+            0xa6, 0x7a, 0xad, 0x5b, 0xef, 0x4d, 0x87, 0x57
+        };
+        static const uint8_t rsa_q[32] = {
+            0xcb, 0xa1, 0xb5, 0xb9, 0x4a, 0x07, 0xf1, 0x09, 0x6b, 0xba, 0x67, 0x4b,
+            0x52, 0x79, 0x0d, 0x4c, 0x96, 0x98, 0xf0, 0x8d, 0x41, 0x4d, 0xd7, 0x7c,
+            0x0c, 0xe5, 0x09, 0xdc, 0x9b, 0xef, 0x31, 0x4b
+        };
+        static const uint8_t rsa_dp[32] = {
+            0xab, 0x73, 0x75, 0x53, 0xac, 0x90, 0xa2, 0x3b, 0x31, 0x26, 0xce, 0xfa,
+            0xd4, 0x9d, 0xa3, 0xa2, 0xa9, 0x0c, 0xbf, 0xfd, 0xe5, 0x16, 0xf1, 0x79,
+            0x7e, 0x43, 0x08, 0xab, 0x3e, 0x65, 0xa9, 0x15
+        };
+        static const uint8_t rsa_dq[32] = {
+            0xae, 0xc5, 0xcf, 0x8c, 0x05, 0xaf, 0x45, 0x40, 0xf9, 0xb6, 0x56, 0x5b,
+            0xbe, 0xa0, 0x69, 0x3a, 0xb7, 0xf2, 0xf2, 0x5b, 0xba, 0x96, 0x0e, 0x01,
+            0xc9, 0xab, 0x77, 0x48, 0x62, 0x89, 0xec, 0x7b
+        };
+        static const uint8_t rsa_qinv[32] = {
+            0x87, 0x87, 0xdf, 0x68, 0x2a, 0x5f, 0xa3, 0x1b, 0x41, 0x8d, 0xa9, 0x0c,
+            0x91, 0x1d, 0xe7, 0x4f, 0x8c, 0xb5, 0x71, 0x31, 0xf9, 0xff, 0xa1, 0x55,
+            0x87, 0x24, 0xe2, 0xc4, 0xc1, 0x39, 0xc9, 0x55
+        };
+        static const uint8_t rsa_e[3] = { 0x01, 0x00, 0x01 };
+        rsa_privkey_t *key = malloc(sizeof(rsa_privkey_t));
+        rsa_pubkey_t *pub = malloc(sizeof(rsa_pubkey_t));
+        bignum_t *bn = malloc(2 * sizeof(bignum_t));
+        if (key && pub && bn) {
+            bn_from_bytes(&key->n, rsa_n, 64);
+            bn_from_bytes(&key->e, rsa_e, 3);
+            bn_from_bytes(&key->d, rsa_d, 64);
+            bn_from_bytes(&key->p, rsa_p, 32);
+            bn_from_bytes(&key->q, rsa_q, 32);
+            bn_from_bytes(&key->dp, rsa_dp, 32);
+            bn_from_bytes(&key->dq, rsa_dq, 32);
+            bn_from_bytes(&key->qinv, rsa_qinv, 32);
+            key->n_bytes = 64;
+            pub->n = key->n;
+            pub->e = key->e;
+            pub->n_bytes = 64;
+
+            const char *msg = "premaster secret";
+            uint8_t ct[64], pt[64], raw[64];
+            int ok = rsa_encrypt(pub, (const uint8_t *)msg, 16, ct, 64) == 0;
+            ok = ok && rsa_decrypt(key, ct, 64, pt, sizeof(pt)) == 16 &&
+                 memcmp(pt, msg, 16) == 0;
+            TEST_ASSERT(ok, "RSA CRT decrypt round trip");
+
+            bn_from_bytes(&bn[0], ct, 64);
+            bn_modexp(&bn[1], &bn[0], &key->d, &key->n);
+            bn_to_bytes(&bn[1], pt, 64);
+            TEST_ASSERT(rsa_private(key, ct, raw) == 0 &&
+                        memcmp(raw, pt, 64) == 0, "RSA CRT matches c^d mod n");
+
+            ct[10] ^= 1;
+            TEST_ASSERT(rsa_decrypt(key, ct, 64, pt, sizeof(pt)) != 16 ||
+                        memcmp(pt, msg, 16) != 0, "RSA corrupted ciphertext rejected");
+        }
+        free(key);
+        free(pub);
+        free(bn);
+    }
+
     /* P-256: 2*G via scalar_mul must match point_double(G) */
     {
         ec_point_t g, dbl, mul;
@@ -1155,6 +1451,38 @@ void test_crypto(void) {
         TEST_ASSERT(memcmp(&res.y, &g.y, sizeof(ec_fe_t)) == 0, "P256 1*G == G (y)");
     }
 
+    /* P-256 known answer for a random scalar: the fixed-base comb and
+     * the windowed variable-base multiply must both give k*G */
+    {
+        static const uint8_t k[32] = {0xd7,0x6d,0x43,0x30,0xf1,0x44,0x6b,0xea,
+                        0xb0,0xc1,0x1f,0xde,0xcb,0x91,0xce,0x37,
+                        0x5b,0xc8,0xfb,0xbc,0xbd,0xe5,0xc0,0x99,
+                        0x41,0x64,0xd8,0x39,0x9f,0x76,0x7c,0x45};
+        static const uint8_t qx[32] = {0xfd,0x60,0xdc,0xa3,0xef,0xc3,0xe0,0x52,
+                        0x94,0xf4,0x63,0xa6,0xc3,0x4e,0xcf,0x8a,
+                        0x32,0xbe,0xeb,0xa1,0x4a,0xc1,0x7f,0xe5,
+                        0x7b,0x9d,0x28,0x97,0x6b,0x9b,0x91,0xdc};
+        static const uint8_t qy[32] = {0xe3,0x8b,0x0f,0xdf,0x86,0xa5,0x9d,0x5c,
+                        0xdd,0xb7,0x9d,0x8f,0x24,0x90,0x7f,0xc9,
+                        0xee,0x01,0x3a,0x1c,0x58,0xa5,0x9e,0x25,
+                        0x9b,0x5c,0xfc,0xe9,0x60,0x8d,0xae,0x13};
+        ec_point_t g, comb, win;
+        uint8_t bx[32], by[32];
+        ec_get_generator(&g);
+
+        ec_scalar_mul_base(&comb, k);
+        ec_fe_to_bytes(&comb.x, bx);
+        ec_fe_to_bytes(&comb.y, by);
+        TEST_ASSERT(!comb.infinity && memcmp(bx, qx, 32) == 0 &&
+                    memcmp(by, qy, 32) == 0, "P256 comb k*G known answer");
+
+        ec_scalar_mul(&win, k, 32, &g);
+        ec_fe_to_bytes(&win.x, bx);
+        ec_fe_to_bytes(&win.y, by);
+        TEST_ASSERT(!win.infinity && memcmp(bx, qx, 32) == 0 &&
+                    memcmp(by, qy, 32) == 0, "P256 window k*G known answer");
+    }
+
     /* ECDH roundtrip: privA*pubB == privB*pubA */
     {
         uint8_t privA[32], privB[32];
@@ -1232,6 +1560,22 @@ void test_tls(void) {
         TEST_ASSERT(has_html, "tls: response contains HTML");
         printf("  Received %u bytes of HTML\n", (unsigned)req.body_len);
         free(req.body);
+
+        /* A second fetch offers the cached session */
+        tls_stats_t before, after;
+        tls_get_stats(&before);
+        if (https_get_async(&req) == 0) {
+            while (!req.done) {
+                keyboard_run_idle();
+                task_yield();
+            }
+            TEST_ASSERT(req.result > 0, "tls: second fetch");
+            tls_get_stats(&after);
+            printf("  Second handshake: %s\n",
+                   after.resumed > before.resumed ? "resumed" : "full");
+            if (req.body)
+                free(req.body);
+        }
     } else {
         printf("  HTTPS GET failed (ret=%d) - server may not support our cipher\n", req.result);
     }
@@ -3276,6 +3620,30 @@ static void test_futex(void) {
     TEST_ASSERT(ret == -1 || ret == 0, "futex: NULL addr no crash");
 }
 
+static void test_kmutex(void) {
+    printf("[KMUTEX] ");
+
+    /* The owner may re-take it, the last unlock frees it */
+    kmutex_t m = KMUTEX_INIT;
+    TEST_ASSERT(kmutex_lock(&m) == 0, "kmutex: taken");
+    kmutex_lock(&m);
+    TEST_ASSERT(m.owner == task_get_current() && m.depth == 2, "kmutex: recursive");
+    kmutex_unlock(&m);
+    TEST_ASSERT(m.owner == task_get_current(), "kmutex: still held");
+    kmutex_unlock(&m);
+    TEST_ASSERT(m.owner == -1 && m.depth == 0, "kmutex: released");
+
+    /* Held elsewhere with interrupts off: fail rather than wait */
+    m.owner = task_get_current() + 1;
+    m.depth = 1;
+    uint32_t irqf = irq_save();
+    int rc = kmutex_lock(&m);
+    int still_off = !(irq_save() & 0x200);
+    irq_restore(irqf);
+    TEST_ASSERT(rc == -1 && still_off, "kmutex: contended lock fails with irqs off");
+    TEST_ASSERT(m.owner == task_get_current() + 1, "kmutex: owner untouched");
+}
+
 static void test_pthreads(void) {
     printf("== Pthreads Tests ==\n");
 
@@ -3444,6 +3812,1299 @@ static void test_frame_ref(void) {
     TEST_ASSERT(frame_ref_get(0xFFFFFFFF) == 0, "frame_ref: out-of-range get returns 0");
 }
 
+static void test_pmm_buddy(void) {
+    printf("[PMM_BUDDY] ");
+
+    uint32_t free0 = pmm_free_frame_count();
+
+    /* Order allocations are naturally aligned */
+    uint32_t b4 = pmm_alloc_order(4);
+    TEST_ASSERT(b4 != 0, "buddy: alloc order 4");
+    TEST_ASSERT((b4 & ((16 * 4096) - 1)) == 0, "buddy: order 4 block aligned");
+    TEST_ASSERT(pmm_free_frame_count() == free0 - 16, "buddy: free count drops by 16");
+    TEST_ASSERT(frame_ref_get(b4 + 15 * 4096) == 1, "buddy: refcount set on every frame");
+
+    /* Non power-of-two contiguous request only consumes what it asks for */
+    uint32_t c5 = pmm_alloc_contiguous(5);
+    TEST_ASSERT(c5 != 0, "buddy: contiguous 5 frames");
+    TEST_ASSERT(pmm_free_frame_count() == free0 - 21, "buddy: tail of block returned");
+
+    /* Double free is ignored */
+    pmm_free_contiguous(c5, 5);
+    pmm_free_frame(c5);
+    TEST_ASSERT(pmm_free_frame_count() == free0 - 16, "buddy: double free ignored");
+
+    /* Freed buddies merge back into larger blocks */
+    pmm_free_contiguous(b4, 16);
+    TEST_ASSERT(pmm_free_frame_count() == free0, "buddy: all frames returned");
+    uint32_t again = pmm_alloc_order(4);
+    TEST_ASSERT(again != 0, "buddy: order 4 available after merge");
+    pmm_free_contiguous(again, 16);
+
+    /* buddyinfo report */
+    char info[256];
+    int n = pmm_buddyinfo(info, sizeof(info));
+    TEST_ASSERT(n > 0 && strncmp(info, "Node 0", 6) == 0, "buddy: buddyinfo format");
+    n = pmm_buddyinfo(info, 16);
+    TEST_ASSERT(n == 15 && strlen(info) == 15, "buddy: buddyinfo truncated length");
+}
+
+static void test_pmm_highmem(void) {
+    printf("[HIGHMEM] ");
+
+    /* Zone accounting adds up */
+    uint32_t lo_total, lo_free, hi_total, hi_free;
+    pmm_zone_counts(PMM_ZONE_NORMAL, &lo_total, &lo_free);
+    pmm_zone_counts(PMM_ZONE_HIGH, &hi_total, &hi_free);
+    TEST_ASSERT(lo_total + hi_total == pmm_total_frame_count(), "highmem: zone totals sum");
+    TEST_ASSERT(lo_free + hi_free == pmm_free_frame_count(), "highmem: zone free sums");
+    TEST_ASSERT(lo_total <= PMM_LOWMEM_FRAMES, "highmem: lowmem zone bounded");
+
+    /* Lowmem frames are returned as their identity address */
+    uint32_t lo = pmm_alloc_frame();
+    TEST_ASSERT(lo != 0 && lo < PMM_LOWMEM_LIMIT, "highmem: pmm_alloc_frame is lowmem");
+    TEST_ASSERT(kmap(lo) == (void *)lo, "highmem: kmap lowmem is identity");
+    kunmap((void *)lo);
+
+    /* High frame round-trip through the kmap window */
+    uint32_t hi = pmm_alloc_frame_high();
+    TEST_ASSERT(hi != 0, "highmem: alloc_frame_high");
+    if (hi_free > 0)
+        TEST_ASSERT(hi >= PMM_LOWMEM_LIMIT, "highmem: prefers high zone");
+    uint32_t *p = kmap(hi);
+    TEST_ASSERT(p != NULL, "highmem: kmap");
+    if (p) {
+        if (hi >= PMM_LOWMEM_LIMIT)
+            TEST_ASSERT((uint32_t)p >= KMAP_BASE, "highmem: mapped in window");
+        p[0] = 0xDEADBEEF;
+        p[1023] = 0x12345678;
+        kunmap(p);
+    }
+
+    /* Copy and zero work on unmapped frames */
+    TEST_ASSERT(vmm_copy_frame(lo, hi) == 0, "highmem: copy_frame ok");
+    TEST_ASSERT(((uint32_t *)lo)[0] == 0xDEADBEEF &&
+                ((uint32_t *)lo)[1023] == 0x12345678, "highmem: copy_frame");
+    TEST_ASSERT(vmm_zero_frame(hi) == 0, "highmem: zero_frame ok");
+    p = kmap(hi);
+    TEST_ASSERT(p && p[0] == 0 && p[1023] == 0, "highmem: zero_frame");
+    kunmap(p);
+
+    /* Slots are recycled */
+    void *a = kmap(hi);
+    kunmap(a);
+    void *b = kmap(hi);
+    TEST_ASSERT(a == b, "highmem: kmap slot reused");
+    kunmap(b);
+
+    /* The heap can't grow into highmem or over a frame someone else owns */
+    TEST_ASSERT(pmm_claim_heap(PMM_LOWMEM_LIMIT + 4096) != 0, "highmem: heap stays in lowmem");
+    TEST_ASSERT(pmm_claim_heap(lo + 4096) != 0, "highmem: heap refuses allocated frame");
+
+    pmm_free_frame(hi);
+    pmm_free_frame(lo);
+    TEST_ASSERT(pmm_free_frame_count() == lo_free + hi_free, "highmem: frames returned");
+}
+
+static void test_ata_dma(void) {
+    printf("[ATA] ");
+
+    if (!ata_is_available()) {
+        printf("(no disk) ");
+        return;
+    }
+
+    /* 300 sectors: more than one command, crosses 64KB PRD boundaries */
+    uint32_t n = 300;
+    uint8_t *dma = (uint8_t *)malloc(n * ATA_SECTOR_SIZE);
+    uint8_t *raw = (uint8_t *)malloc(n * ATA_SECTOR_SIZE + 1);
+    TEST_ASSERT(dma && raw, "ata: malloc buffers");
+    if (!dma || !raw) {
+        free(dma);
+        free(raw);
+        return;
+    }
+
+    TEST_ASSERT(ata_read_sectors(0, n, dma) == 0, "ata: multi-command read");
+    /* An odd address can't be used by the bus master: forces PIO */
+    uint8_t *pio = raw + 1;
+    int ok = 1;
+    for (uint32_t s = 0; s < n; s += 8) {
+        uint32_t c = n - s < 8 ? n - s : 8;
+        if (ata_read_sectors(s, c, pio + s * ATA_SECTOR_SIZE) != 0)
+            ok = 0;
+    }
+    TEST_ASSERT(ok, "ata: PIO reads");
+    TEST_ASSERT(memcmp(dma, pio, n * ATA_SECTOR_SIZE) == 0, "ata: DMA matches PIO");
+    TEST_ASSERT(ata_read_sectors(0, 0, dma) != 0, "ata: zero count rejected");
+
+    free(dma);
+    free(raw);
+}
+
+static void test_virtio_blk(void) {
+    printf("[VIRTIO_BLK] ");
+
+    if (!virtio_blk_active()) {
+        printf("(no device) ");
+        return;
+    }
+
+    /* 256 sectors as four requests in flight at once */
+    uint32_t n = 256;
+    uint8_t *ref = (uint8_t *)malloc(n * ATA_SECTOR_SIZE);
+    uint8_t *buf = (uint8_t *)malloc(n * ATA_SECTOR_SIZE);
+    TEST_ASSERT(ref && buf, "virtio-blk: malloc buffers");
+    if (!ref || !buf) {
+        free(ref);
+        free(buf);
+        return;
+    }
+
+    TEST_ASSERT(virtio_blk_read(0, n, ref) == 0, "virtio-blk: read");
+
+    int ids[4];
+    memset(buf, 0, n * ATA_SECTOR_SIZE);
+    for (int i = 0; i < 4; i++)
+        ids[i] = virtio_blk_submit(i * 64, 64, buf + i * 64 * ATA_SECTOR_SIZE, 0);
+    int ok = 1;
+    /* Reaped out of order */
+    for (int i = 3; i >= 0; i--)
+        if (ids[i] < 0 || virtio_blk_wait(ids[i]) != 0)
+            ok = 0;
+    TEST_ASSERT(ok, "virtio-blk: batched submit");
+    TEST_ASSERT(memcmp(buf, ref, n * ATA_SECTOR_SIZE) == 0, "virtio-blk: batch data");
+
+    free(ref);
+    free(buf);
+}
+
+static void test_bcache(void) {
+    printf("[BCACHE] ");
+
+    const char* saved_user = user_get_current();
+    user_set_current("root");
+
+    uint8_t *blk = (uint8_t *)malloc(BLOCK_SIZE);
+    TEST_ASSERT(blk != NULL, "bcache: malloc block buf");
+    int ret = fs_create_file("/tmp_bcache", 0);
+    TEST_ASSERT(ret == 0, "bcache: create file");
+    uint32_t parent;
+    char fname[MAX_NAME_LEN];
+    int ino = fs_resolve_path("/tmp_bcache", &parent, fname);
+    TEST_ASSERT(ino >= 0, "bcache: resolve file");
+    if (!blk || ino < 0) {
+        free(blk);
+        fs_delete_file("/tmp_bcache");
+        if (saved_user) user_set_current(saved_user);
+        return;
+    }
+
+    /* 16 blocks, each stamped with its index */
+    int write_ok = 1;
+    for (uint32_t i = 0; i < 16; i++) {
+        memset(blk, (int)(0xA0 + i), BLOCK_SIZE);
+        if (fs_write_at((uint32_t)ino, blk, i * BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE)
+            write_ok = 0;
+    }
+    TEST_ASSERT(write_ok, "bcache: write 16 blocks");
+
+    bcache_stats_t before, after;
+    bcache_get_stats(&before);
+    TEST_ASSERT(before.cached >= 16, "bcache: written blocks cached");
+
+    /* Squeeze the cache: data must survive eviction (or stay pinned
+     * as dirty when there is no disk to write back to) */
+    bcache_set_limit(8);
+    int read_ok = 1;
+    for (uint32_t pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < 16; i++) {
+            if (fs_read_at((uint32_t)ino, blk, i * BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE ||
+                blk[0] != (uint8_t)(0xA0 + i) || blk[BLOCK_SIZE - 1] != (uint8_t)(0xA0 + i))
+                read_ok = 0;
+        }
+    }
+    bcache_get_stats(&after);
+    bcache_set_limit(before.limit);
+    TEST_ASSERT(read_ok, "bcache: data intact under small limit");
+    TEST_ASSERT(after.hits + after.misses > before.hits + before.misses,
+                "bcache: lookups counted");
+    if (ata_is_available())
+        TEST_ASSERT(after.evictions > before.evictions, "bcache: evicts over limit");
+
+    /* Freed blocks leave the cache */
+    ret = fs_delete_file("/tmp_bcache");
+    TEST_ASSERT(ret == 0, "bcache: delete file");
+    bcache_stats_t gone;
+    bcache_get_stats(&gone);
+    TEST_ASSERT(gone.cached < after.cached, "bcache: freed blocks forgotten");
+
+    free(blk);
+    if (saved_user) user_set_current(saved_user);
+}
+
+static void test_fs_sync(void) {
+    printf("[FSSYNC] ");
+
+    if (!ata_is_available()) {
+        TEST_ASSERT(fs_sync() == -1, "fssync: no disk reports failure");
+        return;
+    }
+
+    const char* saved_user = user_get_current();
+    user_set_current("root");
+
+    TEST_ASSERT(fs_sync() == 0, "fssync: initial sync");
+    uint32_t meta0 = fs_get_meta_writes();
+    bcache_stats_t s0, s1, s2;
+    bcache_get_stats(&s0);
+
+    /* A fresh file of 16 blocks: nothing reaches the disk until sync */
+    uint8_t *data = (uint8_t *)malloc(16 * BLOCK_SIZE);
+    TEST_ASSERT(data != NULL, "fssync: malloc");
+    if (!data) {
+        if (saved_user) user_set_current(saved_user);
+        return;
+    }
+    for (uint32_t i = 0; i < 16 * BLOCK_SIZE; i++)
+        data[i] = (uint8_t)(i * 7 + 3);
+    TEST_ASSERT(fs_create_file("/tmp_fssync", 0) == 0, "fssync: create");
+    TEST_ASSERT(fs_write_file("/tmp_fssync", data, 16 * BLOCK_SIZE) == 0, "fssync: write");
+    TEST_ASSERT(fs_chmod("/tmp_fssync", 0600) == 0, "fssync: chmod");
+    bcache_get_stats(&s1);
+    TEST_ASSERT(fs_get_meta_writes() == meta0, "fssync: metadata write deferred");
+    TEST_ASSERT(s1.write_ops == s0.write_ops, "fssync: data write deferred");
+    TEST_ASSERT(s1.dirty >= 16, "fssync: data blocks dirty");
+
+    /* Only changed metadata blocks go out, and adjacent data blocks
+     * are merged into a few large writes */
+    TEST_ASSERT(fs_sync() == 0, "fssync: sync");
+    bcache_get_stats(&s2);
+    uint32_t meta = fs_get_meta_writes() - meta0;
+    TEST_ASSERT(meta >= 2 && meta <= 8, "fssync: few metadata writes");
+    TEST_ASSERT(s2.dirty == 0, "fssync: cache clean after sync");
+    TEST_ASSERT(s2.writebacks - s1.writebacks >= 16, "fssync: data written");
+    TEST_ASSERT(s2.write_ops - s1.write_ops < 8, "fssync: data writes coalesced");
+
+    uint32_t meta1 = fs_get_meta_writes();
+    TEST_ASSERT(fs_sync() == 0 && fs_get_meta_writes() == meta1,
+                "fssync: clean sync writes nothing");
+
+    size_t size = 16 * BLOCK_SIZE;
+    uint8_t *back = (uint8_t *)malloc(size);
+    if (back) {
+        TEST_ASSERT(fs_read_file("/tmp_fssync", back, &size) == 0 &&
+                    size == 16 * BLOCK_SIZE && memcmp(back, data, size) == 0,
+                    "fssync: data round-trips");
+        free(back);
+    }
+
+    fs_delete_file("/tmp_fssync");
+    fs_sync();
+    free(data);
+    if (saved_user) user_set_current(saved_user);
+}
+
+static int extent_count(const char *path) {
+    uint32_t parent;
+    char fname[MAX_NAME_LEN];
+    inode_t node;
+    int ino = fs_resolve_path(path, &parent, fname);
+    if (ino < 0 || fs_read_inode((uint32_t)ino, &node) != 0)
+        return -1;
+    return node.num_extents;
+}
+
+static void test_fs_extents(void) {
+    printf("[EXTENT] ");
+
+    const char* saved_user = user_get_current();
+    user_set_current("root");
+
+    uint32_t free0 = fs_count_free_blocks();
+    size_t big = 256 * BLOCK_SIZE;  /* 1MB */
+    uint8_t *data = (uint8_t *)malloc(big);
+    uint8_t *back = (uint8_t *)malloc(big);
+    TEST_ASSERT(data != NULL && back != NULL, "extent: malloc");
+    if (!data || !back) {
+        free(data);
+        free(back);
+        if (saved_user) user_set_current(saved_user);
+        return;
+    }
+    for (uint32_t i = 0; i < big; i++)
+        data[i] = (uint8_t)(i * 13 + (i >> 12));
+
+    /* A whole-file write is allocated in one go */
+    TEST_ASSERT(fs_create_file("/tmp_extent", 0) == 0, "extent: create");
+    TEST_ASSERT(fs_write_file("/tmp_extent", data, big) == 0, "extent: write 1MB");
+    int n = extent_count("/tmp_extent");
+    TEST_ASSERT(n >= 1 && n <= 4, "extent: 1MB file in few extents");
+    TEST_ASSERT(free0 - fs_count_free_blocks() == 256, "extent: 256 blocks used");
+
+    size_t size = big;
+    TEST_ASSERT(fs_read_file("/tmp_extent", back, &size) == 0 &&
+                size == big && memcmp(back, data, big) == 0,
+                "extent: data round-trips");
+
+    /* Shrinking returns the tail to the free index */
+    TEST_ASSERT(fs_truncate("/tmp_extent", 100 * BLOCK_SIZE + 1) == 0, "extent: truncate");
+    TEST_ASSERT(free0 - fs_count_free_blocks() == 101, "extent: tail freed");
+    TEST_ASSERT(fs_delete_file("/tmp_extent") == 0, "extent: delete");
+    TEST_ASSERT(fs_count_free_blocks() == free0, "extent: all blocks freed");
+
+    /* Two files appended block by block in turn still grow mostly in
+     * place instead of interleaving one extent per block */
+    uint32_t p1, p2;
+    char fname[MAX_NAME_LEN];
+    fs_create_file("/tmp_ext_a", 0);
+    fs_create_file("/tmp_ext_b", 0);
+    int ia = fs_resolve_path("/tmp_ext_a", &p1, fname);
+    int ib = fs_resolve_path("/tmp_ext_b", &p2, fname);
+    TEST_ASSERT(ia >= 0 && ib >= 0, "extent: create append files");
+    int append_ok = ia >= 0 && ib >= 0;
+    for (uint32_t i = 0; append_ok && i < 48; i++) {
+        if (fs_write_at((uint32_t)ia, data + i * BLOCK_SIZE, i * BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE ||
+            fs_write_at((uint32_t)ib, data + i * BLOCK_SIZE, i * BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE)
+            append_ok = 0;
+    }
+    TEST_ASSERT(append_ok, "extent: interleaved appends");
+    n = extent_count("/tmp_ext_a");
+    TEST_ASSERT(n >= 1 && n <= 8, "extent: appends stay contiguous (a)");
+    n = extent_count("/tmp_ext_b");
+    TEST_ASSERT(n >= 1 && n <= 8, "extent: appends stay contiguous (b)");
+    TEST_ASSERT(fs_read_at((uint32_t)ia, back, 0, 48 * BLOCK_SIZE) == 48 * BLOCK_SIZE &&
+                memcmp(back, data, 48 * BLOCK_SIZE) == 0, "extent: appended data intact");
+
+    /* Writing past the end leaves a hole: the skipped blocks and the rest
+     * of a partly written new block must read back as zeros */
+    uint8_t acc = 0;
+    TEST_ASSERT(fs_write_at((uint32_t)ib, data, 51 * BLOCK_SIZE + 100, 200) == 200,
+                "extent: write past a hole");
+    TEST_ASSERT(fs_read_at((uint32_t)ib, back, 48 * BLOCK_SIZE, 4 * BLOCK_SIZE) ==
+                3 * BLOCK_SIZE + 300, "extent: read over the hole");
+    for (uint32_t k = 0; k < 3 * BLOCK_SIZE + 100; k++)
+        acc |= back[k];
+    TEST_ASSERT(acc == 0, "extent: hole reads as zeros");
+    TEST_ASSERT(memcmp(back + 3 * BLOCK_SIZE + 100, data, 200) == 0,
+                "extent: data after the hole");
+    TEST_ASSERT(fs_write_at((uint32_t)ib, data, 52 * BLOCK_SIZE - 1, 1) == 1 &&
+                fs_read_at((uint32_t)ib, back, 51 * BLOCK_SIZE + 300, BLOCK_SIZE - 301) ==
+                BLOCK_SIZE - 301, "extent: extend to the block end");
+    acc = 0;
+    for (uint32_t k = 0; k < BLOCK_SIZE - 301; k++)
+        acc |= back[k];
+    TEST_ASSERT(acc == 0, "extent: partly written block zero-filled");
+
+    fs_delete_file("/tmp_ext_a");
+    fs_delete_file("/tmp_ext_b");
+    TEST_ASSERT(fs_count_free_blocks() == free0, "extent: free count restored");
+
+    free(data);
+    free(back);
+    if (saved_user) user_set_current(saved_user);
+}
+
+static void test_fs_dir_index(void) {
+    printf("[DIRIDX] ");
+
+    const char* saved_user = user_get_current();
+    user_set_current("root");
+    uint32_t saved_cwd = fs_get_cwd_inode();
+    uint32_t free0 = fs_count_free_blocks();
+    char path[48];
+    uint32_t parent;
+    char fname[MAX_NAME_LEN];
+
+    TEST_ASSERT(fs_create_file("/tmp_dx", 1) == 0, "diridx: mkdir");
+    TEST_ASSERT(fs_create_file("/tmp_dx/f", 0) == 0, "diridx: create file");
+    int fino = fs_resolve_path("/tmp_dx/f", &parent, fname);
+
+    /* Hard links add names without using up inodes */
+    const int n = 1100;
+    int link_ok = 1;
+    for (int i = 0; i < n && link_ok; i++) {
+        snprintf(path, sizeof(path), "/tmp_dx/link_%d", i);
+        if (fs_link("/tmp_dx/f", path) != 0)
+            link_ok = 0;
+    }
+    TEST_ASSERT(link_ok, "diridx: 1100 entries added");
+
+    inode_t dir;
+    int dino = fs_resolve_path("/tmp_dx", &parent, fname);
+    TEST_ASSERT(dino >= 0 && fs_read_inode((uint32_t)dino, &dir) == 0, "diridx: stat dir");
+    TEST_ASSERT(dir.flags & INODE_FL_INDEX, "diridx: directory indexed");
+    TEST_ASSERT(fs_inode_blocks(&dir) > 8, "diridx: grows past 8 blocks");
+
+    int lookup_ok = 1;
+    for (int i = 0; i < n; i += 7) {
+        snprintf(path, sizeof(path), "/tmp_dx/link_%d", i);
+        if (fs_resolve_path(path, &parent, fname) != fino)
+            lookup_ok = 0;
+    }
+    TEST_ASSERT(lookup_ok, "diridx: lookups hit");
+    TEST_ASSERT(fs_resolve_path("/tmp_dx/link_x", &parent, fname) < 0, "diridx: miss");
+    TEST_ASSERT(fs_resolve_path("/tmp_dx/..", &parent, fname) == ROOT_INODE, "diridx: dotdot");
+
+    /* Rename re-files the entry under its new hash */
+    TEST_ASSERT(fs_change_directory("/tmp_dx") == 0, "diridx: cd");
+    TEST_ASSERT(fs_rename("link_7", "renamed_7") == 0, "diridx: rename");
+    TEST_ASSERT(fs_resolve_path("/tmp_dx/renamed_7", &parent, fname) == fino &&
+                fs_resolve_path("/tmp_dx/link_7", &parent, fname) < 0,
+                "diridx: rename visible");
+    TEST_ASSERT(strcmp(fs_get_cwd(), "/tmp_dx") == 0, "diridx: cwd path");
+
+    fs_dir_entry_info_t *ents = (fs_dir_entry_info_t *)malloc(1200 * sizeof(fs_dir_entry_info_t));
+    if (ents) {
+        TEST_ASSERT(fs_enumerate_directory(ents, 1200, 0) == n + 1, "diridx: enumerate all");
+        free(ents);
+    }
+    fs_change_directory_by_inode(saved_cwd);
+
+    TEST_ASSERT(fs_delete_file("/tmp_dx") != 0, "diridx: rmdir non-empty fails");
+    int del_ok = 1;
+    for (int i = 0; i < n; i++) {
+        if (i == 7)
+            snprintf(path, sizeof(path), "/tmp_dx/renamed_7");
+        else
+            snprintf(path, sizeof(path), "/tmp_dx/link_%d", i);
+        if (fs_delete_file(path) != 0)
+            del_ok = 0;
+    }
+    TEST_ASSERT(del_ok, "diridx: unlink all");
+    TEST_ASSERT(fs_resolve_path("/tmp_dx/link_500", &parent, fname) < 0, "diridx: gone");
+    TEST_ASSERT(fs_delete_file("/tmp_dx/f") == 0, "diridx: delete file");
+    TEST_ASSERT(fs_delete_file("/tmp_dx") == 0, "diridx: rmdir");
+    TEST_ASSERT(fs_count_free_blocks() == free0, "diridx: blocks freed");
+
+    if (saved_user) user_set_current(saved_user);
+}
+
+static void test_dcache(void) {
+    printf("[DCACHE] ");
+
+    const char* saved_user = user_get_current();
+    user_set_current("root");
+    uint32_t saved_cwd = fs_get_cwd_inode();
+    uint32_t parent;
+    char fname[MAX_NAME_LEN];
+    dcache_stats_t s0, s1;
+
+    /* Hot path: the second walk is all hash hits */
+    int home = fs_resolve_path("/home/root", &parent, fname);
+    TEST_ASSERT(home >= 0, "dcache: resolve /home/root");
+    dcache_get_stats(&s0);
+    TEST_ASSERT(fs_resolve_path("/home/root", &parent, fname) == home, "dcache: same inode");
+    dcache_get_stats(&s1);
+    TEST_ASSERT(s1.hits - s0.hits >= 2 && s1.misses == s0.misses, "dcache: positive hits");
+
+    /* Misses are cached, and creating the name replaces the negative entry */
+    fs_delete_file("/tmp_dc");
+    TEST_ASSERT(fs_resolve_path("/tmp_dc", &parent, fname) < 0, "dcache: absent");
+    dcache_get_stats(&s0);
+    TEST_ASSERT(fs_resolve_path("/tmp_dc", &parent, fname) < 0, "dcache: still absent");
+    dcache_get_stats(&s1);
+    TEST_ASSERT(s1.neg_hits > s0.neg_hits, "dcache: negative hit");
+    TEST_ASSERT(fs_create_file("/tmp_dc", 1) == 0, "dcache: mkdir");
+    int dc = fs_resolve_path("/tmp_dc", &parent, fname);
+    TEST_ASSERT(dc >= 0, "dcache: create visible");
+
+    /* Rename and unlink invalidate */
+    TEST_ASSERT(fs_create_file("/tmp_dc/a", 0) == 0, "dcache: create file");
+    int a = fs_resolve_path("/tmp_dc/a", &parent, fname);
+    TEST_ASSERT(fs_resolve_path("/tmp_dc/b", &parent, fname) < 0, "dcache: b absent");
+    fs_change_directory("/tmp_dc");
+    TEST_ASSERT(fs_rename("a", "b") == 0, "dcache: rename");
+    fs_change_directory_by_inode(saved_cwd);
+    TEST_ASSERT(fs_resolve_path("/tmp_dc/a", &parent, fname) < 0, "dcache: old name gone");
+    TEST_ASSERT(fs_resolve_path("/tmp_dc/b", &parent, fname) == a, "dcache: new name found");
+    TEST_ASSERT(fs_delete_file("/tmp_dc/b") == 0, "dcache: unlink");
+    TEST_ASSERT(fs_resolve_path("/tmp_dc/b", &parent, fname) < 0, "dcache: unlinked name gone");
+
+    /* rmdir purges names cached under the directory, so a new directory
+     * that reuses the inode number starts clean */
+    TEST_ASSERT(fs_delete_file("/tmp_dc") == 0, "dcache: rmdir");
+    TEST_ASSERT(fs_resolve_path("/tmp_dc", &parent, fname) < 0, "dcache: rmdir visible");
+    TEST_ASSERT(fs_create_file("/tmp_dc", 1) == 0 && fs_create_file("/tmp_dc/b", 0) == 0,
+                "dcache: recreate");
+    TEST_ASSERT(fs_resolve_path("/tmp_dc/b", &parent, fname) >= 0, "dcache: fresh lookup");
+    fs_delete_file("/tmp_dc/b");
+    fs_delete_file("/tmp_dc");
+
+    dcache_get_stats(&s1);
+    TEST_ASSERT(s1.entries <= DCACHE_ENTRIES && s1.invalidations > 0, "dcache: stats");
+
+    if (saved_user) user_set_current(saved_user);
+}
+
+static void test_net_rx(void) {
+    printf("[NETRX] ");
+
+    /* Wait queue: a wakeup between snapshot and sleep isn't lost */
+    waitq_t q;
+    waitq_init(&q);
+    uint32_t seq = waitq_seq(&q);
+    waitq_wake(&q);
+    TEST_ASSERT(waitq_seq(&q) != seq, "netrx: wake bumps seq");
+    uint32_t t0 = pit_get_ticks();
+    waitq_sleep(&q, seq, 600);
+    TEST_ASSERT(pit_get_ticks() - t0 < 60, "netrx: stale seq doesn't sleep");
+
+    /* A timed sleep with no waker returns on its own */
+    seq = waitq_seq(&q);
+    t0 = pit_get_ticks();
+    waitq_sleep(&q, seq, 2);
+    TEST_ASSERT(pit_get_ticks() - t0 < 60, "netrx: timed sleep returns");
+    TEST_ASSERT(q.waiters == 0, "netrx: sleeper dequeued");
+
+    /* Receive path: polls respect the budget */
+    net_rx_stats_t st0, st1;
+    net_get_rx_stats(&st0);
+    int n = net_poll(NET_RX_BUDGET);
+    TEST_ASSERT(n >= 0 && n <= NET_RX_BUDGET, "netrx: poll within budget");
+    net_get_rx_stats(&st1);
+    TEST_ASSERT(st1.budget_hits <= st1.polls, "netrx: stats");
+    if (!net_get_config()->link_up)
+        TEST_ASSERT(!st1.threaded && n == 0, "netrx: no NIC, polled mode");
+    else if (st1.threaded)
+        TEST_ASSERT(st1.irq > 0 && st1.irq < 16, "netrx: irq line");
+
+    /* Blocking receive with nothing queued times out instead of hanging */
+    int idx = tcp_open(0, 0);
+    TEST_ASSERT(idx >= 0, "netrx: tcp_open");
+    if (idx >= 0) {
+        uint8_t buf[16];
+        t0 = pit_get_ticks();
+        int r = tcp_recv(idx, buf, sizeof(buf), 50);
+        TEST_ASSERT(r <= 0, "netrx: idle recv");
+        TEST_ASSERT(pit_get_ticks() - t0 < 120, "netrx: recv timeout honoured");
+        tcp_close(idx);
+    }
+}
+
+static void test_virtio_net(void) {
+    printf("[VNET] ");
+
+    uint8_t big[VNET_MAX_FRAME + 1];
+    memset(big, 0, sizeof(big));
+    TEST_ASSERT(virtio_net_send_packet(big, sizeof(big)) < 0, "vnet: oversized frame rejected");
+
+    if (!virtio_net_is_initialized()) {
+        TEST_ASSERT(!virtio_net_has_csum_offload(), "vnet: inactive, no offload");
+        TEST_ASSERT(virtio_net_get_irq() < 0, "vnet: inactive, no irq");
+        return;
+    }
+
+    uint8_t mac[6] = {0};
+    virtio_net_get_mac(mac);
+    TEST_ASSERT(memcmp(mac, net_get_config()->mac, 6) == 0, "vnet: MAC in net config");
+
+    /* A burst larger than the TX ring completes asynchronously */
+    uint8_t frame[64];
+    memset(frame, 0xFF, 6);
+    memcpy(frame + 6, mac, 6);
+    frame[12] = 0x88; frame[13] = 0xB5;    /* local experimental ethertype */
+    memset(frame + 14, 0, sizeof(frame) - 14);
+    int ok = 0;
+    for (int i = 0; i < VNET_TX_BUFS * 2; i++) {
+        if (virtio_net_send_packet(frame, sizeof(frame)) == 0)
+            ok++;
+        if (i == VNET_TX_BUFS)
+            pit_sleep_ms(20);
+    }
+    TEST_ASSERT(ok > VNET_TX_BUFS, "vnet: TX buffers recycled");
+}
+
+static void test_netbuf(void) {
+    printf("[NETBUF] ");
+
+    netbuf_stats_t st0, st;
+    netbuf_get_stats(&st0);
+    TEST_ASSERT(st0.total == NETBUF_COUNT, "netbuf: pool size");
+
+    netbuf_t *nb = netbuf_alloc();
+    TEST_ASSERT(nb != NULL, "netbuf: alloc");
+    if (!nb) return;
+    TEST_ASSERT(nb->len == 0 && netbuf_headroom(nb) == NETBUF_HEADROOM,
+                "netbuf: empty with headroom");
+
+    /* Payload, then headers pushed in front of it in place */
+    uint8_t *pl = netbuf_put(nb, 100);
+    TEST_ASSERT(pl != NULL && nb->len == 100, "netbuf: put");
+    memset(pl, 0xAB, 100);
+    uint8_t *tcp = netbuf_push(nb, 20);
+    uint8_t *ip = netbuf_push(nb, 20);
+    uint8_t *eth = netbuf_push(nb, 14);
+    TEST_ASSERT(tcp == pl - 20 && ip == tcp - 20 && eth == ip - 14,
+                "netbuf: headers contiguous");
+    TEST_ASSERT(nb->len == 154 && nb->data == eth, "netbuf: push");
+    TEST_ASSERT(((uint32_t)eth & 3) == 0, "netbuf: frame 4-byte aligned");
+    TEST_ASSERT(pl[0] == 0xAB && pl[99] == 0xAB, "netbuf: payload untouched");
+
+    TEST_ASSERT(netbuf_pull(nb, 14) == ip && nb->len == 140, "netbuf: pull");
+    TEST_ASSERT(netbuf_push(nb, NETBUF_SIZE) == NULL, "netbuf: push past headroom");
+    TEST_ASSERT(netbuf_put(nb, NETBUF_SIZE) == NULL, "netbuf: put past tailroom");
+    TEST_ASSERT(nb->len == 140, "netbuf: failed ops leave len");
+    netbuf_free(nb);
+    netbuf_free(NULL);
+
+    /* Exhaustion: alloc fails cleanly and everything comes back */
+    static netbuf_t *all[NETBUF_COUNT];
+    uint32_t flags = irq_save();
+    int n = 0;
+    while (n < NETBUF_COUNT && (all[n] = netbuf_alloc()) != NULL)
+        n++;
+    netbuf_get_stats(&st);
+    int dry = netbuf_alloc() == NULL;
+    for (int i = 0; i < n; i++)
+        netbuf_free(all[i]);
+    irq_restore(flags);
+    TEST_ASSERT(dry && st.free == 0 && st.min_free == 0, "netbuf: pool exhausted");
+    netbuf_get_stats(&st);
+    TEST_ASSERT(st.free == st0.free, "netbuf: all buffers returned");
+    TEST_ASSERT(st.fails > st0.fails, "netbuf: failure counted");
+}
+
+/* ---- Scripted TCP peer ----
+ * The TCP behaviour tests play the remote end themselves: a peer at
+ * 127.0.0.2 whose segments are built here and handed straight to
+ * tcp_handle_packet().  What the stack sends back goes out over
+ * loopback to a port nobody listens on and is dropped, so only the
+ * segments a test writes ever reach the connection. */
+
+#define TP_PORT 7601
+#define TP_ISN  1000000u
+
+static const uint8_t tp_ip[4] = {127, 0, 0, 2};
+static int tp_conn;
+static volatile int tp_connected;    /* 1 established, -1 failed */
+
+typedef struct {
+    uint16_t mss;           /* SYN only, 0 for none */
+    int      ws;            /* SYN only: carry a window scale... */
+    uint8_t  wscale;        /* ...of this shift */
+    int      sack_perm;     /* SYN only */
+    int      ts;
+    uint32_t tsval, tsecr;
+    int      nsack;
+    tcp_sack_t sack[3];
+} tp_opts_t;
+
+static void tp_connect_thread(void) {
+    tp_connected = tcp_connect(tp_conn, tp_ip, TP_PORT) == 0 ? 1 : -1;
+}
+
+static uint8_t *tp_put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+/* Deliver one segment from the peer to our local `port` */
+static void tp_input(uint16_t port, uint32_t seq, uint32_t ack, uint8_t flags,
+                     uint16_t window, const tp_opts_t *o,
+                     const uint8_t *data, size_t len) {
+    static uint8_t seg[60 + TCP_MSS];
+    uint8_t *p = seg + sizeof(tcp_header_t);
+    if (o && o->mss) {
+        *p++ = TCPOPT_MSS; *p++ = 4;
+        *p++ = o->mss >> 8; *p++ = o->mss;
+    }
+    if (o && o->ws) {
+        *p++ = TCPOPT_NOP; *p++ = TCPOPT_WSCALE; *p++ = 3; *p++ = o->wscale;
+    }
+    if (o && o->sack_perm) {
+        *p++ = TCPOPT_NOP; *p++ = TCPOPT_NOP; *p++ = TCPOPT_SACK_PERM; *p++ = 2;
+    }
+    if (o && o->ts) {
+        *p++ = TCPOPT_NOP; *p++ = TCPOPT_NOP; *p++ = TCPOPT_TS; *p++ = 10;
+        p = tp_put32(tp_put32(p, o->tsval), o->tsecr);
+    }
+    if (o && o->nsack) {
+        *p++ = TCPOPT_NOP; *p++ = TCPOPT_NOP;
+        *p++ = TCPOPT_SACK; *p++ = 2 + 8 * o->nsack;
+        for (int i = 0; i < o->nsack; i++)
+            p = tp_put32(tp_put32(p, o->sack[i].start), o->sack[i].end);
+    }
+    size_t hdr_len = p - seg;
+
+    tcp_header_t *hdr = (tcp_header_t *)seg;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->src_port = htons(TP_PORT);
+    hdr->dst_port = htons(port);
+    hdr->seq_num = htonl(seq);
+    hdr->ack_num = htonl(ack);
+    hdr->data_offset = (hdr_len / 4) << 4;
+    hdr->flags = flags;
+    hdr->window = htons(window);
+    if (len) memcpy(p, data, len);
+
+    uint32_t irqf = irq_save();
+    tcp_handle_packet(seg, hdr_len + len, tp_ip);
+    irq_restore(irqf);
+}
+
+/* Actively open a connection to the peer, which answers with a SYN-ACK
+ * (ISN TP_ISN) carrying `o` and offering `window`.  Returns the handle
+ * and its local port, or -1. */
+static int tp_open(const tp_opts_t *o, uint16_t window, uint16_t *port) {
+    int c = tcp_open(0, 0);
+    if (c < 0) return -1;
+    tp_conn = c;
+    tp_connected = 0;
+    if (task_create_thread("tcppeer", tp_connect_thread, 0) < 0) {
+        tcp_close(c);
+        return -1;
+    }
+    while (!tp_connected && tcp_get_state(c) != TCP_SYN_SENT)
+        task_yield();
+
+    tcp_info_t ti;
+    if (tcp_get_info(c, &ti) == 0 && ti.state == TCP_SYN_SENT)
+        tp_input(ti.local_port, TP_ISN, ti.snd_nxt, TCP_SYN | TCP_ACK, window,
+                 o, NULL, 0);
+    while (!tp_connected)
+        task_yield();
+    if (tp_connected < 0) {
+        tcp_close(c);
+        return -1;
+    }
+    *port = ti.local_port;
+    return c;
+}
+
+/* Acknowledge everything sent and close from the peer's side first, so
+ * our end finishes in LAST_ACK and is freed rather than left behind */
+static void tp_close(int c, uint16_t port) {
+    tcp_info_t ti;
+    tcp_get_info(c, &ti);
+    uint32_t end = ti.snd_una + ti.in_flight;
+    tp_input(port, ti.rcv_nxt, end, TCP_FIN | TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_close(c);
+    tp_input(port, ti.rcv_nxt + 1, end + 1, TCP_ACK, 65535, NULL, NULL, 0);
+}
+
+/* Run the TCP timers until connection `c` has had `n` retransmission
+ * timeouts or `ms` have passed */
+static void tp_wait_timeouts(int c, uint32_t n, uint32_t ms) {
+    uint32_t start = pit_get_ticks();
+    tcp_info_t ti;
+    while (tcp_get_info(c, &ti) == 0 && ti.timeouts < n &&
+           pit_get_ticks() - start < ms * 120 / 1000) {
+        pit_sleep_ms(10);
+        uint32_t irqf = irq_save();
+        tcp_timer_tick();
+        irq_restore(irqf);
+    }
+}
+
+static void test_tcp_window(void) {
+    printf("[TCPWIN] ");
+
+    tcp_info_t ti;
+    TEST_ASSERT(tcp_get_info(-1, &ti) < 0, "tcpwin: bad index");
+
+    int idx = tcp_open(0, 0);
+    TEST_ASSERT(idx >= 0, "tcpwin: tcp_open");
+    if (idx < 0) return;
+
+    TEST_ASSERT(tcp_get_info(idx, &ti) == 0, "tcpwin: get_info");
+    TEST_ASSERT(ti.cwnd == TCP_INIT_CWND, "tcpwin: initial cwnd");
+    TEST_ASSERT(ti.rto_ms == TCP_RTO_INIT * 1000 / 120, "tcpwin: initial rto");
+    TEST_ASSERT(ti.in_flight == 0 && ti.queued == 0, "tcpwin: nothing queued");
+    TEST_ASSERT(ti.srtt_ms == 0, "tcpwin: no rtt sample yet");
+    TEST_ASSERT(TCP_BUF_INIT >= 4 * TCP_MSS, "tcpwin: several segments fit in flight");
+    TEST_ASSERT(ti.snd_buf == 0 && ti.rcv_buf == 0, "tcpwin: buffers allocated on demand");
+    TEST_ASSERT(!ti.ws_ok && !ti.ts_ok && !ti.sack_ok, "tcpwin: no options before handshake");
+    TEST_ASSERT((65535u << TCP_WSCALE) >= TCP_BUF_MAX, "tcpwin: window scale covers max buffer");
+
+    uint8_t data[64] = {0};
+    TEST_ASSERT(tcp_send(idx, data, sizeof(data)) < 0, "tcpwin: send on closed rejected");
+    tcp_get_info(idx, &ti);
+    TEST_ASSERT(ti.queued == 0, "tcpwin: nothing buffered on failure");
+    tcp_close(idx);
+
+    static uint8_t buf[8192];
+    for (int i = 0; i < (int)sizeof(buf); i++)
+        buf[i] = (uint8_t)(i * 13 + 5);
+    tp_opts_t syn = { .mss = TCP_MSS };
+    uint16_t port;
+
+    /* The peer's window caps what is in flight, whatever cwnd allows */
+    uint32_t mss = TCP_MSS;
+    int c = tp_open(&syn, 2 * mss, &port);
+    TEST_ASSERT(c >= 0, "tcpwin: scripted connection");
+    if (c < 0) return;
+    tcp_get_info(c, &ti);
+    uint32_t una = ti.snd_una;
+    TEST_ASSERT(ti.state == TCP_ESTABLISHED && ti.snd_wnd == 2 * mss, "tcpwin: peer window");
+    tcp_send(c, buf, 5 * mss);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.cwnd > 2 * mss && ti.in_flight == 2 * mss && ti.queued == 5 * mss,
+                "tcpwin: flight limited by send window");
+    tp_input(port, TP_ISN + 1, una + 2 * mss, TCP_ACK, 2 * mss, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.snd_una == una + 2 * mss && ti.in_flight == 2 * mss &&
+                ti.queued == 3 * mss, "tcpwin: ACK slides the window");
+    tp_input(port, TP_ISN + 1, una + 4 * mss, TCP_ACK, 0, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.in_flight == 0 && ti.queued == mss, "tcpwin: zero window stops sending");
+    tp_input(port, TP_ISN + 1, una + 4 * mss, TCP_ACK, 2 * mss, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.in_flight == mss, "tcpwin: window update resumes");
+    tp_close(c, port);
+
+    /* Three duplicate ACKs: fast retransmit and NewReno recovery */
+    c = tp_open(&syn, 65535, &port);
+    TEST_ASSERT(c >= 0, "tcpwin: scripted connection 2");
+    if (c < 0) return;
+    tcp_get_info(c, &ti);
+    una = ti.snd_una;
+    tcp_send(c, buf, 5 * mss);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.in_flight == 5 * mss, "tcpwin: five segments out");
+    for (int i = 0; i < 2; i++)
+        tp_input(port, TP_ISN + 1, una, TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.fast_rtx == 0 && ti.retrans == 0, "tcpwin: two dup ACKs wait");
+    tp_input(port, TP_ISN + 1, una, TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.fast_rtx == 1 && ti.retrans == 1, "tcpwin: third dup ACK retransmits");
+    TEST_ASSERT(ti.ssthresh == 5 * mss / 2, "tcpwin: ssthresh halves the flight");
+    TEST_ASSERT(ti.cwnd == ti.ssthresh + 3 * mss, "tcpwin: cwnd inflated by three segments");
+    tp_input(port, TP_ISN + 1, una, TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.cwnd == 5 * mss / 2 + 4 * mss && ti.retrans == 1,
+                "tcpwin: further dup ACKs inflate cwnd");
+    tp_input(port, TP_ISN + 1, una + mss, TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.retrans == 2 && ti.fast_rtx == 1, "tcpwin: partial ACK resends next segment");
+    tp_input(port, TP_ISN + 1, una + 5 * mss, TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.in_flight == 0 && ti.cwnd == ti.ssthresh, "tcpwin: recovery deflates cwnd");
+    tp_close(c, port);
+
+    /* Retransmission timeouts back off exponentially */
+    c = tp_open(&syn, 65535, &port);
+    TEST_ASSERT(c >= 0, "tcpwin: scripted connection 3");
+    if (c < 0) return;
+    tcp_get_info(c, &ti);
+    una = ti.snd_una;
+    tcp_send(c, buf, 100);
+    tp_input(port, TP_ISN + 1, una + 100, TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    uint32_t rto0 = ti.rto_ms;
+    TEST_ASSERT(ti.srtt_ms < 1000 && rto0 >= TCP_RTO_MIN * 1000 / 120,
+                "tcpwin: rto from rtt sample");
+    tcp_send(c, buf, 100);
+    tp_wait_timeouts(c, 1, 2 * rto0 + 500);
+    tcp_get_info(c, &ti);
+    uint32_t rto1 = ti.rto_ms;
+    TEST_ASSERT(ti.timeouts == 1 && ti.retrans == 1, "tcpwin: first timeout resends");
+    TEST_ASSERT(rto1 >= 2 * rto0 && rto1 <= 2 * rto0 + 1, "tcpwin: rto doubled");
+    TEST_ASSERT(ti.cwnd == mss && ti.ssthresh == 2 * mss, "tcpwin: cwnd collapses to one segment");
+    tp_wait_timeouts(c, 2, 2 * rto1 + 500);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.timeouts == 2 && ti.retrans == 2, "tcpwin: second timeout resends");
+    TEST_ASSERT(ti.rto_ms >= 2 * rto1 && ti.rto_ms <= 2 * rto1 + 1, "tcpwin: rto doubled again");
+    tp_input(port, TP_ISN + 1, una + 200, TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.in_flight == 0 && ti.rto_ms == rto0, "tcpwin: ACK undoes the backoff");
+    tp_close(c, port);
+}
+
+static void test_tcp_options(void) {
+    printf("[TCPOPT] ");
+
+    static uint8_t buf[8192];
+    for (int i = 0; i < (int)sizeof(buf); i++)
+        buf[i] = (uint8_t)(i * 13 + 5);
+    uint32_t mss = TCP_MSS;
+    tcp_info_t ti;
+    uint16_t port;
+
+    /* SACK: with segments 1 and 3 of 0..4 lost, recovery resends just
+     * those two, the second before any partial ACK, and nothing SACKed */
+    tp_opts_t syn = { .mss = TCP_MSS, .sack_perm = 1 };
+    int c = tp_open(&syn, 65535, &port);
+    TEST_ASSERT(c >= 0, "tcpopt: sack connection");
+    if (c < 0) return;
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.sack_ok && !ti.ws_ok && !ti.ts_ok, "tcpopt: sack negotiated alone");
+    uint32_t una = ti.snd_una;
+    tcp_send(c, buf, 5 * mss);
+    tp_input(port, TP_ISN + 1, una + mss, TCP_ACK, 65535, NULL, NULL, 0);
+    tp_opts_t sack = { .nsack = 2, .sack = {
+        { una + 2 * mss, una + 3 * mss }, { una + 4 * mss, una + 5 * mss } } };
+    for (int i = 0; i < 3; i++)
+        tp_input(port, TP_ISN + 1, una + mss, TCP_ACK, 65535, &sack, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.fast_rtx == 1 && ti.retrans == 1, "tcpopt: first hole resent");
+    tp_input(port, TP_ISN + 1, una + mss, TCP_ACK, 65535, &sack, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.retrans == 2, "tcpopt: second hole resent on the next dup ACK");
+    tp_input(port, TP_ISN + 1, una + mss, TCP_ACK, 65535, &sack, NULL, 0);
+    tp_input(port, TP_ISN + 1, una + mss, TCP_ACK, 65535, &sack, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.retrans == 2, "tcpopt: SACKed segments not resent");
+    tp_input(port, TP_ISN + 1, una + 5 * mss, TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.in_flight == 0 && ti.retrans == 2, "tcpopt: recovered");
+    tp_close(c, port);
+
+    /* Window scaling only when both SYNs carry the option */
+    tp_opts_t syn_ws = { .mss = TCP_MSS, .ws = 1, .wscale = 2 };
+    c = tp_open(&syn_ws, 1000, &port);
+    TEST_ASSERT(c >= 0, "tcpopt: wscale connection");
+    if (c < 0) return;
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.ws_ok && ti.snd_wscale == 2 && ti.rcv_wscale == TCP_WSCALE,
+                "tcpopt: wscale negotiated");
+    TEST_ASSERT(ti.snd_wnd == 1000, "tcpopt: SYN-ACK window unscaled");
+    tp_input(port, TP_ISN + 1, ti.snd_una, TCP_ACK, 1000, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.snd_wnd == 4000, "tcpopt: later windows scaled");
+    tp_close(c, port);
+
+    syn.sack_perm = 0;
+    c = tp_open(&syn, 1000, &port);
+    TEST_ASSERT(c >= 0, "tcpopt: plain connection");
+    if (c < 0) return;
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(!ti.ws_ok && ti.snd_wscale == 0 && ti.rcv_wscale == 0,
+                "tcpopt: no wscale without the peer's option");
+    tp_input(port, TP_ISN + 1, ti.snd_una, TCP_ACK, 1000, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.snd_wnd == 1000, "tcpopt: windows taken as is");
+    tp_close(c, port);
+
+    /* PAWS: a segment with an older timestamp than the last is dropped */
+    tp_opts_t syn_ts = { .mss = TCP_MSS, .ts = 1, .tsval = 1000 };
+    c = tp_open(&syn_ts, 65535, &port);
+    TEST_ASSERT(c >= 0, "tcpopt: timestamp connection");
+    if (c < 0) return;
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.ts_ok, "tcpopt: timestamps negotiated");
+    una = ti.snd_una;
+    tp_opts_t ts = { .ts = 1, .tsval = 2000 };
+    tp_input(port, TP_ISN + 1, una, TCP_ACK, 65535, &ts, buf, 10);
+    TEST_ASSERT(tcp_rx_available(c) == 10, "tcpopt: newer timestamp accepted");
+    ts.tsval = 1500;
+    tp_input(port, TP_ISN + 11, una, TCP_ACK, 65535, &ts, buf, 10);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(tcp_rx_available(c) == 10 && ti.rcv_nxt == TP_ISN + 11,
+                "tcpopt: stale timestamp dropped");
+    ts.tsval = 2001;
+    tp_input(port, TP_ISN + 11, una, TCP_ACK, 65535, &ts, buf, 10);
+    TEST_ASSERT(tcp_rx_available(c) == 20, "tcpopt: retransmission accepted");
+    tp_close(c, port);
+}
+
+static void test_tcp_table(void) {
+    printf("[TCPTAB] ");
+
+    tcp_stats_t st0, st;
+    tcp_get_stats(&st0);
+
+    /* Many more connections than the old static table held */
+    int idx[32];
+    int n = 0;
+    while (n < 32 && (idx[n] = tcp_open(0, 0)) >= 0)
+        n++;
+    TEST_ASSERT(n == 32, "tcptab: 32 connections open");
+    tcp_get_stats(&st);
+    TEST_ASSERT(st.tcbs == st0.tcbs + 32, "tcptab: one TCB each");
+    for (int i = 0; i < n; i++)
+        tcp_close(idx[i]);
+    tcp_get_stats(&st);
+    TEST_ASSERT(st.tcbs == st0.tcbs && st.orphans == st0.orphans,
+                "tcptab: closing frees them");
+    TEST_ASSERT(tcp_get_state(idx[0]) == TCP_CLOSED, "tcptab: closed handle is dead");
+
+    int l = tcp_open(7777, 1);
+    TEST_ASSERT(l >= 0, "tcptab: listen");
+    TEST_ASSERT(tcp_open(7777, 1) < 0, "tcptab: one listener per port");
+    TEST_ASSERT(tcp_set_backlog(l, 8) == 0, "tcptab: set backlog");
+    TEST_ASSERT(!tcp_has_backlog(l), "tcptab: accept queue empty");
+    tcp_close(l);
+    int l2 = tcp_open(7777, 1);
+    TEST_ASSERT(l2 >= 0, "tcptab: port free after close");
+    tcp_close(l2);
+}
+
+static void test_tcp_nagle(void) {
+    printf("[TCPNAGLE] ");
+
+    TEST_ASSERT(TCP_DELACK_TICKS > 0 && TCP_DELACK_TICKS < TCP_RTO_MIN,
+                "nagle: delayed ACK well inside the RTO");
+    TEST_ASSERT(TCP_QUICKACKS > 0, "nagle: quick ACKs after loss");
+
+    int c = tcp_open(0, 0);
+    TEST_ASSERT(c >= 0, "nagle: open");
+    TEST_ASSERT(tcp_set_nodelay(c, 1) == 0, "nagle: set nodelay");
+    TEST_ASSERT(tcp_set_nodelay(c, 0) == 0, "nagle: clear nodelay");
+    tcp_close(c);
+    TEST_ASSERT(tcp_set_nodelay(c, 1) < 0, "nagle: closed handle rejected");
+
+    /* The socket remembers the option until it has a connection */
+    int s = socket_create(SOCK_STREAM);
+    TEST_ASSERT(s >= 0 && socket_set_nodelay(s, 1) == 0, "nagle: socket option");
+    socket_close(s);
+    int u = socket_create(SOCK_DGRAM);
+    TEST_ASSERT(u >= 0 && socket_set_nodelay(u, 1) < 0, "nagle: not for UDP");
+    socket_close(u);
+
+    static uint8_t buf[TCP_MSS];
+    memset(buf, 'n', sizeof(buf));
+    tp_opts_t syn = { .mss = TCP_MSS };
+    uint16_t port;
+    c = tp_open(&syn, 65535, &port);
+    TEST_ASSERT(c >= 0, "nagle: scripted connection");
+    if (c < 0) return;
+    tcp_info_t ti;
+    tcp_get_info(c, &ti);
+    uint32_t una = ti.snd_una;
+
+    /* A small write goes out at once, the next waits for its ACK */
+    tcp_send(c, buf, 100);
+    tcp_send(c, buf, 100);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.in_flight == 100 && ti.queued == 200, "nagle: sub-MSS write held");
+    tp_input(port, TP_ISN + 1, una + 100, TCP_ACK, 65535, NULL, NULL, 0);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.snd_una == una + 100 && ti.in_flight == 100 && ti.queued == 100,
+                "nagle: held data sent on ACK");
+    tcp_set_nodelay(c, 1);
+    tcp_send(c, buf, 100);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.in_flight == 200, "nagle: nodelay sends at once");
+    tp_input(port, TP_ISN + 1, una + 300, TCP_ACK, 65535, NULL, NULL, 0);
+
+    /* Receiving: the first segments are ACKed at once, then a lone one
+     * waits for the delayed-ACK timer */
+    uint32_t seq = TP_ISN + 1;
+    tcp_get_info(c, &ti);
+    uint32_t segs = ti.segs_out;
+    for (int i = 0; i < TCP_QUICKACKS; i++, seq += 10)
+        tp_input(port, seq, una + 300, TCP_ACK, 65535, NULL, buf, 10);
+    tcp_get_info(c, &ti);
+    TEST_ASSERT(ti.segs_out == segs + TCP_QUICKACKS, "nagle: quick ACKs at start");
+
+    segs = ti.segs_out;
+    uint32_t irqf = irq_save();
+    uint32_t start = pit_get_ticks();
+    tp_input(port, seq, una + 300, TCP_ACK, 65535, NULL, buf, 10);
+    tcp_get_info(c, &ti);
+    irq_restore(irqf);
+    seq += 10;
+    TEST_ASSERT(ti.segs_out == segs, "nagle: lone segment's ACK delayed");
+    while (ti.segs_out == segs && pit_get_ticks() - start < 60) {
+        pit_sleep_ms(5);
+        irqf = irq_save();
+        tcp_timer_tick();
+        irq_restore(irqf);
+        tcp_get_info(c, &ti);
+    }
+    TEST_ASSERT(ti.segs_out == segs + 1 && pit_get_ticks() - start >= TCP_DELACK_TICKS,
+                "nagle: ACK sent by the timer");
+
+    /* ...but every second full segment is ACKed straight away */
+    segs = ti.segs_out;
+    irqf = irq_save();
+    tp_input(port, seq, una + 300, TCP_ACK, 65535, NULL, buf, TCP_MSS);
+    tcp_get_info(c, &ti);
+    uint32_t after_one = ti.segs_out;
+    tp_input(port, seq + TCP_MSS, una + 300, TCP_ACK, 65535, NULL, buf, TCP_MSS);
+    tcp_get_info(c, &ti);
+    irq_restore(irqf);
+    TEST_ASSERT(after_one == segs, "nagle: one full segment waits");
+    TEST_ASSERT(ti.segs_out == segs + 1, "nagle: second full segment ACKed at once");
+    tp_close(c, port);
+}
+
+static void test_loopback(void) {
+    printf("[LOOPBACK] ");
+
+    uint8_t lo[4] = {127, 0, 0, 1};
+    uint8_t gw[4];
+    memcpy(gw, net_get_config()->gateway, 4);
+    TEST_ASSERT(net_is_local(lo), "lo: 127.0.0.1 is local");
+    TEST_ASSERT(!net_is_local(gw), "lo: gateway is not");
+
+    net_rx_stats_t st0, st1;
+    net_get_rx_stats(&st0);
+
+    /* UDP datagram to ourselves, no NIC involved */
+    TEST_ASSERT(udp_bind(7979) == 0, "lo: udp bind");
+    TEST_ASSERT(udp_send(lo, 7979, 7980, (const uint8_t *)"ping", 4) == 0, "lo: udp send");
+    uint8_t ubuf[16], src[4];
+    size_t ulen = sizeof(ubuf);
+    uint16_t sport = 0;
+    int r = udp_recv(7979, ubuf, &ulen, src, &sport, 500);
+    TEST_ASSERT(r == 0 && ulen == 4 && memcmp(ubuf, "ping", 4) == 0, "lo: udp recv");
+    TEST_ASSERT(memcmp(src, lo, 4) == 0 && sport == 7980, "lo: udp source");
+
+    /* With interrupts off, as in a system call, the receive thread can't
+     * run: a blocking receive has to poll for itself */
+    uint32_t irqf = irq_save();
+    udp_send(lo, 7979, 7980, (const uint8_t *)"irq", 3);
+    ulen = sizeof(ubuf);
+    r = udp_recv(7979, ubuf, &ulen, src, &sport, 500);
+    irq_restore(irqf);
+    TEST_ASSERT(r == 0 && ulen == 3 && memcmp(ubuf, "irq", 3) == 0, "lo: udp recv with irqs off");
+    udp_unbind(7979);
+
+    /* TCP: handshake, data both ways, close */
+    int l = tcp_open(7878, 1);
+    int c = tcp_open(0, 0);
+    TEST_ASSERT(l >= 0 && c >= 0, "lo: tcp open");
+    TEST_ASSERT(tcp_connect(c, lo, 7878) == 0, "lo: tcp connect");
+    int a = tcp_accept(l, 500);
+    TEST_ASSERT(a >= 0, "lo: tcp accept");
+
+    static uint8_t out[8192], in[8192];
+    for (int i = 0; i < (int)sizeof(out); i++)
+        out[i] = (uint8_t)(i * 7 + 3);
+    TEST_ASSERT(tcp_send(c, out, sizeof(out)) == (int)sizeof(out), "lo: tcp send");
+    size_t got = 0;
+    while (a >= 0 && got < sizeof(in)) {
+        int n = tcp_recv(a, in + got, sizeof(in) - got, 500);
+        if (n <= 0) break;
+        got += n;
+    }
+    TEST_ASSERT(got == sizeof(in) && memcmp(in, out, sizeof(in)) == 0, "lo: tcp data intact");
+    TEST_ASSERT(a >= 0 && tcp_send(a, (const uint8_t *)"ok", 2) == 2, "lo: tcp reply");
+    TEST_ASSERT(tcp_recv(c, in, sizeof(in), 500) == 2 && memcmp(in, "ok", 2) == 0,
+                "lo: tcp reply received");
+
+    tcp_set_nodelay(c, 1);
+    irqf = irq_save();
+    int sent = tcp_send(c, (const uint8_t *)"irq", 3);
+    r = a >= 0 ? tcp_recv(a, in, sizeof(in), 500) : -1;
+    irq_restore(irqf);
+    TEST_ASSERT(sent == 3 && r == 3 && memcmp(in, "irq", 3) == 0, "lo: tcp recv with irqs off");
+
+    net_get_rx_stats(&st1);
+    TEST_ASSERT(st1.lo_packets > st0.lo_packets + 4, "lo: counted");
+    TEST_ASSERT(st1.lo_drops == st0.lo_drops, "lo: no drops");
+
+    tcp_close(c);
+    if (a >= 0) tcp_close(a);
+    tcp_close(l);
+}
+
+static void test_checksum(void) {
+    printf("[CSUM] ");
+
+    /* Against a plain 16-bit reference at every alignment and at odd
+     * lengths, straddling the 32-byte main loop */
+    static uint8_t buf[300];
+    for (int i = 0; i < (int)sizeof(buf); i++)
+        buf[i] = (uint8_t)(i * 151 + 77);
+    int mismatches = 0;
+    for (int off = 0; off < 4; off++) {
+        for (int len = 0; len <= 260; len++) {
+            uint32_t ref = 0;
+            int i = 0;
+            for (; i + 1 < len; i += 2)
+                ref += buf[off + i] | (buf[off + i + 1] << 8);
+            if (i < len) ref += buf[off + i];
+            while (ref >> 16) ref = (ref & 0xFFFF) + (ref >> 16);
+            if (csum_finish(csum_partial(buf + off, len, 0)) != (uint16_t)~ref)
+                mismatches++;
+        }
+    }
+    TEST_ASSERT(mismatches == 0, "csum: matches reference");
+
+    /* Carries: all-ones data */
+    memset(buf, 0xFF, sizeof(buf));
+    TEST_ASSERT(csum_finish(csum_partial(buf, 256, 0)) == 0, "csum: all ones");
+
+    /* Chaining even-length pieces gives the same sum */
+    for (int i = 0; i < (int)sizeof(buf); i++)
+        buf[i] = (uint8_t)(i * 13 + 5);
+    uint32_t part = csum_partial(buf + 40, 101, csum_partial(buf, 40, 0));
+    TEST_ASSERT(csum_fold(part) == csum_fold(csum_partial(buf, 141, 0)), "csum: chained");
+
+    /* Incremental update (RFC 1624) agrees with recomputing */
+    uint16_t *w = (uint16_t *)buf;
+    uint16_t check = csum_finish(csum_partial(buf, 64, 0));
+    uint16_t from = w[5];
+    w[5] = 0x1234;
+    check = csum_update16(check, from, w[5]);
+    TEST_ASSERT(check == csum_finish(csum_partial(buf, 64, 0)), "csum: update16");
+    uint32_t from32;
+    memcpy(&from32, buf + 12, 4);
+    uint32_t to32 = 0x0A00020F;
+    memcpy(buf + 12, &to32, 4);
+    check = csum_update32(check, from32, to32);
+    TEST_ASSERT(check == csum_finish(csum_partial(buf, 64, 0)), "csum: update32");
+
+    /* Pseudo-header + segment verifies to zero once the field is set */
+    uint8_t src[4] = {10, 0, 2, 15}, dst[4] = {10, 0, 2, 2};
+    uint8_t seg[33];
+    for (int i = 0; i < (int)sizeof(seg); i++)
+        seg[i] = (uint8_t)(i + 1);
+    seg[16] = seg[17] = 0;
+    uint16_t c = csum_finish(csum_partial(seg, sizeof(seg),
+                                          csum_pseudo(src, dst, 6, sizeof(seg))));
+    memcpy(seg + 16, &c, 2);
+    TEST_ASSERT(csum_fold(csum_partial(seg, sizeof(seg),
+                          csum_pseudo(src, dst, 6, sizeof(seg)))) == 0xFFFF,
+                "csum: tcp verifies");
+}
+
+static void test_httpd(void) {
+    printf("[HTTPD] ");
+
+    int started = 0;
+    if (!httpd_is_running()) {
+        if (httpd_start() != 0) {
+            printf("  (no scheduler, skipping httpd test)\n");
+            return;
+        }
+        started = 1;
+    }
+
+    /* Two pipelined requests and a 404 on one keep-alive connection */
+    uint8_t lo[4] = {127, 0, 0, 1};
+    int c = tcp_open(0, 0);
+    TEST_ASSERT(c >= 0 && tcp_connect(c, lo, HTTPD_PORT) == 0, "httpd: connect");
+    static const char req[] =
+        "GET / HTTP/1.1\r\nHost: lo\r\n\r\n"
+        "GET / HTTP/1.1\r\nHost: lo\r\n\r\n"
+        "GET /no/such/file HTTP/1.1\r\n\r\n";
+    TEST_ASSERT(tcp_send(c, (const uint8_t *)req, sizeof(req) - 1) == (int)sizeof(req) - 1,
+                "httpd: send requests");
+
+    static char resp[2048];
+    int got = 0, oks = 0, nf = 0;
+    while (got < (int)sizeof(resp) - 1) {
+        int n = tcp_recv(c, (uint8_t *)resp + got, sizeof(resp) - 1 - got, 1000);
+        if (n <= 0) break;
+        got += n;
+        resp[got] = '\0';
+        oks = nf = 0;
+        for (char *p = resp; (p = strstr(p, "HTTP/1.1 ")) != NULL; p++) {
+            if (strncmp(p + 9, "200", 3) == 0) oks++;
+            else if (strncmp(p + 9, "404", 3) == 0) nf++;
+        }
+        if (oks == 2 && nf == 1 && strstr(resp, "404 Not Found</h1>")) break;
+    }
+    TEST_ASSERT(oks == 2, "httpd: pipelined responses");
+    TEST_ASSERT(nf == 1, "httpd: 404 in order");
+    TEST_ASSERT(tcp_get_state(c) == TCP_ESTABLISHED, "httpd: kept alive");
+
+    httpd_stats_t st;
+    httpd_get_stats(&st);
+    TEST_ASSERT(st.reused >= 2, "httpd: connection reused");
+
+    tcp_close(c);
+    if (started) httpd_stop();
+}
+
 static void test_memory_phase3(void) {
     printf("[MEMORY_P3] ");
 
@@ -4101,7 +5762,7 @@ static void test_phase6_networking(void) {
     TEST_ASSERT(LINUX_EINPROGRESS == 115, "LINUX_EINPROGRESS == 115");
 
     /* ── TCP backlog defines ───────────────────────────────────────── */
-    TEST_ASSERT(TCP_BACKLOG_MAX == 4, "TCP_BACKLOG_MAX == 4");
+    TEST_ASSERT(TCP_BACKLOG_MAX == 128, "TCP_BACKLOG_MAX == 128");
 
     /* ── Socket create/close round-trip ────────────────────────────── */
     {
@@ -4664,6 +6325,7 @@ void test_run_all(void) {
     test_string_extra();
     test_stdlib();
     test_stdlib_extra();
+    test_heap_alloc();
     test_snprintf();
     test_sscanf();
     test_fs();
@@ -4695,9 +6357,29 @@ void test_run_all(void) {
     test_signals_phase2();
     test_fd_table();
     test_futex();
+    test_kmutex();
     test_pthreads();
     test_vma();
     test_frame_ref();
+    test_pmm_buddy();
+    test_pmm_highmem();
+    test_ata_dma();
+    test_virtio_blk();
+    test_bcache();
+    test_fs_sync();
+    test_fs_extents();
+    test_fs_dir_index();
+    test_dcache();
+    test_net_rx();
+    test_virtio_net();
+    test_netbuf();
+    test_tcp_window();
+    test_tcp_options();
+    test_tcp_table();
+    test_tcp_nagle();
+    test_loopback();
+    test_checksum();
+    test_httpd();
     test_memory_phase3();
     test_phase4_syscalls();
     test_nanosleep_execve();
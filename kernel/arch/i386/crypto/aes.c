@@ -1,7 +1,7 @@
-/* AES-128 — FIPS 197 */
+/* AES-128 — FIPS 197, with T-tables and an AES-NI/PCLMULQDQ path */
 #include <kernel/crypto.h>
+#include <kernel/fpu.h>
 #include <string.h>
-#include <stdlib.h>
 
 /* S-box */
 static const uint8_t sbox[256] = {
@@ -48,7 +48,7 @@ static const uint8_t rcon[11] = {
     0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
 };
 
-/* GF(2^8) multiplication */
+/* GF(2^8) multiplication, used to build the tables */
 static uint8_t gf_mul(uint8_t a, uint8_t b) {
     uint8_t p = 0;
     for (int i = 0; i < 8; i++) {
@@ -61,142 +61,400 @@ static uint8_t gf_mul(uint8_t a, uint8_t b) {
     return p;
 }
 
-static uint32_t word_be(const uint8_t *p) {
-    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
-           ((uint32_t)p[2] << 8) | p[3];
+/* ── Tables and CPU features ──────────────────────────────────────
+ *
+ * State and round keys are held as little-endian column words, so a
+ * word's bytes sit in memory in AES order and the same schedule feeds
+ * both the T-tables and AESENC.  Te0[x] is MixColumns applied to the
+ * column (S[x], 0, 0, 0); Te1..3 are the same column for rows 1..3,
+ * i.e. byte rotations of Te0.  Td0..3 do the same for InvMixColumns. */
+
+static uint32_t Te0[256], Te1[256], Te2[256], Te3[256];
+static uint32_t Td0[256], Td1[256], Td2[256], Td3[256];
+static int aes_tables_ready;
+static int aes_ni_present;      /* CPU has AES-NI, PCLMULQDQ and SSSE3 */
+static int aes_ni_enabled;
+
+#define ROTL(w, n) (((w) << (n)) | ((w) >> (32 - (n))))
+#define B0(w) ((w) & 0xff)
+#define B1(w) (((w) >> 8) & 0xff)
+#define B2(w) (((w) >> 16) & 0xff)
+#define B3(w) ((w) >> 24)
+
+typedef uint32_t __attribute__((may_alias, aligned(1))) aes_u32;
+
+static inline uint32_t ld32(const uint8_t *p) { return *(const aes_u32 *)p; }
+static inline void st32(uint8_t *p, uint32_t w) { *(aes_u32 *)p = w; }
+
+static void aes_tables_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint8_t s = sbox[i], s2 = gf_mul(s, 2), s3 = s2 ^ s;
+        uint32_t e = s2 | (uint32_t)s << 8 | (uint32_t)s << 16 | (uint32_t)s3 << 24;
+        Te0[i] = e;
+        Te1[i] = ROTL(e, 8);
+        Te2[i] = ROTL(e, 16);
+        Te3[i] = ROTL(e, 24);
+
+        uint8_t v = inv_sbox[i];
+        uint32_t d = gf_mul(v, 14) | (uint32_t)gf_mul(v, 9) << 8 |
+                     (uint32_t)gf_mul(v, 13) << 16 | (uint32_t)gf_mul(v, 11) << 24;
+        Td0[i] = d;
+        Td1[i] = ROTL(d, 8);
+        Td2[i] = ROTL(d, 16);
+        Td3[i] = ROTL(d, 24);
+    }
+
+    aes_ni_present = cpu_has(CPU_FEAT_AES | CPU_FEAT_PCLMUL |
+                             CPU_FEAT_SSSE3 | CPU_FEAT_FXSR);
+    aes_ni_enabled = aes_ni_present;
+    aes_tables_ready = 1;
+}
+
+int aes128_accel(void) {
+    if (!aes_tables_ready)
+        aes_tables_init();
+    return aes_ni_enabled;
+}
+
+void aes128_set_accel(int on) {
+    if (!aes_tables_ready)
+        aes_tables_init();
+    aes_ni_enabled = on && aes_ni_present;
+}
+
+/* ── AES-NI ───────────────────────────────────────────────────────
+ *
+ * Every stretch of XMM code sits between kernel_fpu_begin() and
+ * kernel_fpu_end(), GCM_SIMD_CHUNK bytes at most.  The kernel is built
+ * without SSE, so the functions touching XMM registers carry
+ * target("sse2") as in gfx.c; the assembler takes the AES and PCLMUL
+ * opcodes as they are. */
+
+/* One block with the encryption schedule */
+__attribute__((target("sse2")))
+static void ni_enc1(const uint32_t *rk, const uint8_t in[16], uint8_t out[16]) {
+    int n = AES128_ROUNDS - 1;
+    __asm__ volatile(
+        "movdqu  (%[in]), %%xmm0\n\t"
+        "movdqu  (%[k]), %%xmm1\n\t"
+        "pxor    %%xmm1, %%xmm0\n\t"
+        "1:\n\t"
+        "add     $16, %[k]\n\t"
+        "movdqu  (%[k]), %%xmm1\n\t"
+        "aesenc  %%xmm1, %%xmm0\n\t"
+        "dec     %[n]\n\t"
+        "jnz     1b\n\t"
+        "movdqu  16(%[k]), %%xmm1\n\t"
+        "aesenclast %%xmm1, %%xmm0\n\t"
+        "movdqu  %%xmm0, (%[out])\n\t"
+        : [k] "+r"(rk), [n] "+r"(n)
+        : [in] "r"(in), [out] "r"(out)
+        : "memory", "cc", "xmm0", "xmm1");
+}
+
+/* Four independent blocks in place; AESENC has a latency of several
+ * cycles but issues every cycle, so interleaving hides most of it */
+__attribute__((target("sse2")))
+static void ni_enc4(const uint32_t *rk, uint8_t blk[64]) {
+    int n = AES128_ROUNDS - 1;
+    __asm__ volatile(
+        "movdqu    (%[b]), %%xmm0\n\t"
+        "movdqu  16(%[b]), %%xmm1\n\t"
+        "movdqu  32(%[b]), %%xmm2\n\t"
+        "movdqu  48(%[b]), %%xmm3\n\t"
+        "movdqu  (%[k]), %%xmm4\n\t"
+        "pxor    %%xmm4, %%xmm0\n\t"
+        "pxor    %%xmm4, %%xmm1\n\t"
+        "pxor    %%xmm4, %%xmm2\n\t"
+        "pxor    %%xmm4, %%xmm3\n\t"
+        "1:\n\t"
+        "add     $16, %[k]\n\t"
+        "movdqu  (%[k]), %%xmm4\n\t"
+        "aesenc  %%xmm4, %%xmm0\n\t"
+        "aesenc  %%xmm4, %%xmm1\n\t"
+        "aesenc  %%xmm4, %%xmm2\n\t"
+        "aesenc  %%xmm4, %%xmm3\n\t"
+        "dec     %[n]\n\t"
+        "jnz     1b\n\t"
+        "movdqu  16(%[k]), %%xmm4\n\t"
+        "aesenclast %%xmm4, %%xmm0\n\t"
+        "aesenclast %%xmm4, %%xmm1\n\t"
+        "aesenclast %%xmm4, %%xmm2\n\t"
+        "aesenclast %%xmm4, %%xmm3\n\t"
+        "movdqu  %%xmm0,   (%[b])\n\t"
+        "movdqu  %%xmm1, 16(%[b])\n\t"
+        "movdqu  %%xmm2, 32(%[b])\n\t"
+        "movdqu  %%xmm3, 48(%[b])\n\t"
+        : [k] "+r"(rk), [n] "+r"(n)
+        : [b] "r"(blk)
+        : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+}
+
+/* Four blocks in place with the decryption schedule */
+__attribute__((target("sse2")))
+static void ni_dec4(const uint32_t *drk, uint8_t blk[64]) {
+    int n = AES128_ROUNDS - 1;
+    __asm__ volatile(
+        "movdqu    (%[b]), %%xmm0\n\t"
+        "movdqu  16(%[b]), %%xmm1\n\t"
+        "movdqu  32(%[b]), %%xmm2\n\t"
+        "movdqu  48(%[b]), %%xmm3\n\t"
+        "movdqu  (%[k]), %%xmm4\n\t"
+        "pxor    %%xmm4, %%xmm0\n\t"
+        "pxor    %%xmm4, %%xmm1\n\t"
+        "pxor    %%xmm4, %%xmm2\n\t"
+        "pxor    %%xmm4, %%xmm3\n\t"
+        "1:\n\t"
+        "add     $16, %[k]\n\t"
+        "movdqu  (%[k]), %%xmm4\n\t"
+        "aesdec  %%xmm4, %%xmm0\n\t"
+        "aesdec  %%xmm4, %%xmm1\n\t"
+        "aesdec  %%xmm4, %%xmm2\n\t"
+        "aesdec  %%xmm4, %%xmm3\n\t"
+        "dec     %[n]\n\t"
+        "jnz     1b\n\t"
+        "movdqu  16(%[k]), %%xmm4\n\t"
+        "aesdeclast %%xmm4, %%xmm0\n\t"
+        "aesdeclast %%xmm4, %%xmm1\n\t"
+        "aesdeclast %%xmm4, %%xmm2\n\t"
+        "aesdeclast %%xmm4, %%xmm3\n\t"
+        "movdqu  %%xmm0,   (%[b])\n\t"
+        "movdqu  %%xmm1, 16(%[b])\n\t"
+        "movdqu  %%xmm2, 32(%[b])\n\t"
+        "movdqu  %%xmm3, 48(%[b])\n\t"
+        : [k] "+r"(drk), [n] "+r"(n)
+        : [b] "r"(blk)
+        : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
 }
 
-static void word_put(uint8_t *p, uint32_t w) {
-    p[0] = w >> 24; p[1] = w >> 16; p[2] = w >> 8; p[3] = w;
+static const uint8_t bswap_mask[16] __attribute__((aligned(16))) = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+};
+
+/* X = (X ^ block) * H for each of n blocks, with carry-less multiply.
+ * GHASH's bit order is reflected, so operands are byte-swapped and the
+ * 256-bit product shifted left one bit before the reduction (Intel's
+ * "Carry-Less Multiplication and Its Usage for Computing the GCM
+ * Mode", algorithm 5).  Only xmm0-7 exist in 32-bit mode, so H and the
+ * swap mask are reloaded for every block. */
+__attribute__((target("sse2")))
+static void ni_ghash(uint8_t x[16], const uint8_t h[16],
+                     const uint8_t *p, size_t n) {
+    __asm__ volatile(
+        "movdqu  (%[x]), %%xmm0\n\t"
+        "movdqa  (%[m]), %%xmm2\n\t"
+        "pshufb  %%xmm2, %%xmm0\n\t"
+        "1:\n\t"
+        "movdqu  (%[p]), %%xmm1\n\t"
+        "movdqa  (%[m]), %%xmm2\n\t"
+        "pshufb  %%xmm2, %%xmm1\n\t"
+        "pxor    %%xmm1, %%xmm0\n\t"
+        "movdqu  (%[h]), %%xmm1\n\t"
+        "pshufb  %%xmm2, %%xmm1\n\t"
+        /* 128x128 -> 256 bit product in xmm6:xmm3 */
+        "movdqa  %%xmm0, %%xmm3\n\t"
+        "pclmulqdq $0x00, %%xmm1, %%xmm3\n\t"
+        "movdqa  %%xmm0, %%xmm4\n\t"
+        "pclmulqdq $0x10, %%xmm1, %%xmm4\n\t"
+        "movdqa  %%xmm0, %%xmm5\n\t"
+        "pclmulqdq $0x01, %%xmm1, %%xmm5\n\t"
+        "movdqa  %%xmm0, %%xmm6\n\t"
+        "pclmulqdq $0x11, %%xmm1, %%xmm6\n\t"
+        "pxor    %%xmm5, %%xmm4\n\t"
+        "movdqa  %%xmm4, %%xmm5\n\t"
+        "psrldq  $8, %%xmm4\n\t"
+        "pslldq  $8, %%xmm5\n\t"
+        "pxor    %%xmm5, %%xmm3\n\t"
+        "pxor    %%xmm4, %%xmm6\n\t"
+        /* shift left by one bit */
+        "movdqa  %%xmm3, %%xmm7\n\t"
+        "movdqa  %%xmm6, %%xmm0\n\t"
+        "pslld   $1, %%xmm3\n\t"
+        "pslld   $1, %%xmm6\n\t"
+        "psrld   $31, %%xmm7\n\t"
+        "psrld   $31, %%xmm0\n\t"
+        "movdqa  %%xmm7, %%xmm1\n\t"
+        "pslldq  $4, %%xmm0\n\t"
+        "pslldq  $4, %%xmm7\n\t"
+        "psrldq  $12, %%xmm1\n\t"
+        "por     %%xmm7, %%xmm3\n\t"
+        "por     %%xmm0, %%xmm6\n\t"
+        "por     %%xmm1, %%xmm6\n\t"
+        /* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+        "movdqa  %%xmm3, %%xmm7\n\t"
+        "movdqa  %%xmm3, %%xmm0\n\t"
+        "movdqa  %%xmm3, %%xmm1\n\t"
+        "pslld   $31, %%xmm7\n\t"
+        "pslld   $30, %%xmm0\n\t"
+        "pslld   $25, %%xmm1\n\t"
+        "pxor    %%xmm0, %%xmm7\n\t"
+        "pxor    %%xmm1, %%xmm7\n\t"
+        "movdqa  %%xmm7, %%xmm0\n\t"
+        "pslldq  $12, %%xmm7\n\t"
+        "psrldq  $4, %%xmm0\n\t"
+        "pxor    %%xmm7, %%xmm3\n\t"
+        "movdqa  %%xmm3, %%xmm2\n\t"
+        "movdqa  %%xmm3, %%xmm4\n\t"
+        "movdqa  %%xmm3, %%xmm5\n\t"
+        "psrld   $1, %%xmm2\n\t"
+        "psrld   $2, %%xmm4\n\t"
+        "psrld   $7, %%xmm5\n\t"
+        "pxor    %%xmm4, %%xmm2\n\t"
+        "pxor    %%xmm5, %%xmm2\n\t"
+        "pxor    %%xmm0, %%xmm2\n\t"
+        "pxor    %%xmm2, %%xmm3\n\t"
+        "pxor    %%xmm3, %%xmm6\n\t"
+        "movdqa  %%xmm6, %%xmm0\n\t"
+        "add     $16, %[p]\n\t"
+        "dec     %[n]\n\t"
+        "jnz     1b\n\t"
+        "movdqa  (%[m]), %%xmm2\n\t"
+        "pshufb  %%xmm2, %%xmm0\n\t"
+        "movdqu  %%xmm0, (%[x])\n\t"
+        : [p] "+r"(p), [n] "+r"(n)
+        : [x] "r"(x), [h] "r"(h), [m] "r"(bswap_mask)
+        : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3",
+          "xmm4", "xmm5", "xmm6", "xmm7");
 }
 
-#define SUBWORD(w) ((uint32_t)sbox[(w)>>24]<<24 | (uint32_t)sbox[((w)>>16)&0xff]<<16 | \
-                    (uint32_t)sbox[((w)>>8)&0xff]<<8 | (uint32_t)sbox[(w)&0xff])
-#define ROTWORD(w) (((w) << 8) | ((w) >> 24))
+/* ── Block cipher ──────────────────────────────────────────────── */
+
+#define SUBWORD(w) ((uint32_t)sbox[B0(w)] | (uint32_t)sbox[B1(w)] << 8 | \
+                    (uint32_t)sbox[B2(w)] << 16 | (uint32_t)sbox[B3(w)] << 24)
+#define ROTWORD(w) (((w) >> 8) | ((w) << 24))
+
+/* InvMixColumns of one column: Td applied to S[S^-1[x]] = x */
+#define INVMIX(w) (Td0[sbox[B0(w)]] ^ Td1[sbox[B1(w)]] ^ \
+                   Td2[sbox[B2(w)]] ^ Td3[sbox[B3(w)]])
+
+static void ghash_table_init(aes128_ctx_t *ctx);
 
 void aes128_init(aes128_ctx_t *ctx, const uint8_t key[AES128_KEY_SIZE]) {
-    /* Copy key words */
-    for (int i = 0; i < 4; i++)
-        ctx->rk[i] = word_be(key + i * 4);
+    if (!aes_tables_ready)
+        aes_tables_init();
 
-    /* Expand */
-    for (int i = 4; i < 44; i++) {
+    for (int i = 0; i < 4; i++)
+        ctx->rk[i] = ld32(key + i * 4);
+    for (int i = 4; i < AES128_EXPANDED_KEY_SIZE; i++) {
         uint32_t tmp = ctx->rk[i - 1];
         if (i % 4 == 0)
-            tmp = SUBWORD(ROTWORD(tmp)) ^ ((uint32_t)rcon[i/4] << 24);
+            tmp = SUBWORD(ROTWORD(tmp)) ^ rcon[i / 4];
         ctx->rk[i] = ctx->rk[i - 4] ^ tmp;
     }
+
+    /* Equivalent inverse cipher (FIPS 197 5.3.5): rounds in reverse,
+     * InvMixColumns folded into the middle ones.  This is also the
+     * schedule AESDEC expects. */
+    for (int i = 0; i < 4; i++) {
+        ctx->drk[i] = ctx->rk[AES128_ROUNDS * 4 + i];
+        ctx->drk[AES128_ROUNDS * 4 + i] = ctx->rk[i];
+    }
+    for (int r = 1; r < AES128_ROUNDS; r++)
+        for (int i = 0; i < 4; i++)
+            ctx->drk[r * 4 + i] = INVMIX(ctx->rk[(AES128_ROUNDS - r) * 4 + i]);
+
+    /* GHASH subkey H = E(K, 0^128) */
+    memset(ctx->h, 0, 16);
+    aes128_encrypt_block(ctx, ctx->h, ctx->h);
+    ghash_table_init(ctx);
 }
 
 void aes128_encrypt_block(const aes128_ctx_t *ctx,
                           const uint8_t in[AES_BLOCK_SIZE],
                           uint8_t out[AES_BLOCK_SIZE]) {
-    uint8_t s[16];
-    memcpy(s, in, 16);
-
-    /* AddRoundKey(0) */
-    for (int i = 0; i < 4; i++) {
-        uint8_t rk[4];
-        word_put(rk, ctx->rk[i]);
-        s[i*4+0] ^= rk[0]; s[i*4+1] ^= rk[1];
-        s[i*4+2] ^= rk[2]; s[i*4+3] ^= rk[3];
+    const uint32_t *rk = ctx->rk;
+    uint32_t s0 = ld32(in)      ^ rk[0];
+    uint32_t s1 = ld32(in + 4)  ^ rk[1];
+    uint32_t s2 = ld32(in + 8)  ^ rk[2];
+    uint32_t s3 = ld32(in + 12) ^ rk[3];
+
+    for (int r = 1; r < AES128_ROUNDS; r++) {
+        rk += 4;
+        uint32_t t0 = Te0[B0(s0)] ^ Te1[B1(s1)] ^ Te2[B2(s2)] ^ Te3[B3(s3)] ^ rk[0];
+        uint32_t t1 = Te0[B0(s1)] ^ Te1[B1(s2)] ^ Te2[B2(s3)] ^ Te3[B3(s0)] ^ rk[1];
+        uint32_t t2 = Te0[B0(s2)] ^ Te1[B1(s3)] ^ Te2[B2(s0)] ^ Te3[B3(s1)] ^ rk[2];
+        uint32_t t3 = Te0[B0(s3)] ^ Te1[B1(s0)] ^ Te2[B2(s1)] ^ Te3[B3(s2)] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
     }
 
-    for (int round = 1; round <= 10; round++) {
-        /* SubBytes */
-        for (int i = 0; i < 16; i++)
-            s[i] = sbox[s[i]];
-
-        /* ShiftRows */
-        uint8_t t;
-        t = s[1]; s[1] = s[5]; s[5] = s[9]; s[9] = s[13]; s[13] = t;
-        t = s[2]; s[2] = s[10]; s[10] = t; t = s[6]; s[6] = s[14]; s[14] = t;
-        t = s[15]; s[15] = s[11]; s[11] = s[7]; s[7] = s[3]; s[3] = t;
-
-        /* MixColumns (skip in last round) */
-        if (round < 10) {
-            for (int c = 0; c < 4; c++) {
-                uint8_t a0 = s[c*4+0], a1 = s[c*4+1];
-                uint8_t a2 = s[c*4+2], a3 = s[c*4+3];
-                s[c*4+0] = gf_mul(2,a0) ^ gf_mul(3,a1) ^ a2 ^ a3;
-                s[c*4+1] = a0 ^ gf_mul(2,a1) ^ gf_mul(3,a2) ^ a3;
-                s[c*4+2] = a0 ^ a1 ^ gf_mul(2,a2) ^ gf_mul(3,a3);
-                s[c*4+3] = gf_mul(3,a0) ^ a1 ^ a2 ^ gf_mul(2,a3);
-            }
-        }
-
-        /* AddRoundKey */
-        for (int i = 0; i < 4; i++) {
-            uint8_t rk[4];
-            word_put(rk, ctx->rk[round * 4 + i]);
-            s[i*4+0] ^= rk[0]; s[i*4+1] ^= rk[1];
-            s[i*4+2] ^= rk[2]; s[i*4+3] ^= rk[3];
-        }
-    }
-    memcpy(out, s, 16);
+    /* Last round: SubBytes + ShiftRows, no MixColumns */
+    rk += 4;
+    st32(out, ((uint32_t)sbox[B0(s0)] | (uint32_t)sbox[B1(s1)] << 8 |
+               (uint32_t)sbox[B2(s2)] << 16 | (uint32_t)sbox[B3(s3)] << 24) ^ rk[0]);
+    st32(out + 4, ((uint32_t)sbox[B0(s1)] | (uint32_t)sbox[B1(s2)] << 8 |
+                   (uint32_t)sbox[B2(s3)] << 16 | (uint32_t)sbox[B3(s0)] << 24) ^ rk[1]);
+    st32(out + 8, ((uint32_t)sbox[B0(s2)] | (uint32_t)sbox[B1(s3)] << 8 |
+                   (uint32_t)sbox[B2(s0)] << 16 | (uint32_t)sbox[B3(s1)] << 24) ^ rk[2]);
+    st32(out + 12, ((uint32_t)sbox[B0(s3)] | (uint32_t)sbox[B1(s0)] << 8 |
+                    (uint32_t)sbox[B2(s1)] << 16 | (uint32_t)sbox[B3(s2)] << 24) ^ rk[3]);
 }
 
 void aes128_decrypt_block(const aes128_ctx_t *ctx,
                           const uint8_t in[AES_BLOCK_SIZE],
                           uint8_t out[AES_BLOCK_SIZE]) {
-    uint8_t s[16];
-    memcpy(s, in, 16);
-
-    /* AddRoundKey(10) */
-    for (int i = 0; i < 4; i++) {
-        uint8_t rk[4];
-        word_put(rk, ctx->rk[10 * 4 + i]);
-        s[i*4+0] ^= rk[0]; s[i*4+1] ^= rk[1];
-        s[i*4+2] ^= rk[2]; s[i*4+3] ^= rk[3];
+    const uint32_t *rk = ctx->drk;
+    uint32_t s0 = ld32(in)      ^ rk[0];
+    uint32_t s1 = ld32(in + 4)  ^ rk[1];
+    uint32_t s2 = ld32(in + 8)  ^ rk[2];
+    uint32_t s3 = ld32(in + 12) ^ rk[3];
+
+    for (int r = 1; r < AES128_ROUNDS; r++) {
+        rk += 4;
+        uint32_t t0 = Td0[B0(s0)] ^ Td1[B1(s3)] ^ Td2[B2(s2)] ^ Td3[B3(s1)] ^ rk[0];
+        uint32_t t1 = Td0[B0(s1)] ^ Td1[B1(s0)] ^ Td2[B2(s3)] ^ Td3[B3(s2)] ^ rk[1];
+        uint32_t t2 = Td0[B0(s2)] ^ Td1[B1(s1)] ^ Td2[B2(s0)] ^ Td3[B3(s3)] ^ rk[2];
+        uint32_t t3 = Td0[B0(s3)] ^ Td1[B1(s2)] ^ Td2[B2(s1)] ^ Td3[B3(s0)] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
     }
 
-    for (int round = 9; round >= 0; round--) {
-        /* InvShiftRows */
-        uint8_t t;
-        t = s[13]; s[13] = s[9]; s[9] = s[5]; s[5] = s[1]; s[1] = t;
-        t = s[2]; s[2] = s[10]; s[10] = t; t = s[6]; s[6] = s[14]; s[14] = t;
-        t = s[3]; s[3] = s[7]; s[7] = s[11]; s[11] = s[15]; s[15] = t;
-
-        /* InvSubBytes */
-        for (int i = 0; i < 16; i++)
-            s[i] = inv_sbox[s[i]];
-
-        /* AddRoundKey */
-        for (int i = 0; i < 4; i++) {
-            uint8_t rk[4];
-            word_put(rk, ctx->rk[round * 4 + i]);
-            s[i*4+0] ^= rk[0]; s[i*4+1] ^= rk[1];
-            s[i*4+2] ^= rk[2]; s[i*4+3] ^= rk[3];
-        }
+    rk += 4;
+    st32(out, ((uint32_t)inv_sbox[B0(s0)] | (uint32_t)inv_sbox[B1(s3)] << 8 |
+               (uint32_t)inv_sbox[B2(s2)] << 16 | (uint32_t)inv_sbox[B3(s1)] << 24) ^ rk[0]);
+    st32(out + 4, ((uint32_t)inv_sbox[B0(s1)] | (uint32_t)inv_sbox[B1(s0)] << 8 |
+                   (uint32_t)inv_sbox[B2(s3)] << 16 | (uint32_t)inv_sbox[B3(s2)] << 24) ^ rk[1]);
+    st32(out + 8, ((uint32_t)inv_sbox[B0(s2)] | (uint32_t)inv_sbox[B1(s1)] << 8 |
+                   (uint32_t)inv_sbox[B2(s0)] << 16 | (uint32_t)inv_sbox[B3(s3)] << 24) ^ rk[2]);
+    st32(out + 12, ((uint32_t)inv_sbox[B0(s3)] | (uint32_t)inv_sbox[B1(s2)] << 8 |
+                    (uint32_t)inv_sbox[B2(s1)] << 16 | (uint32_t)inv_sbox[B3(s0)] << 24) ^ rk[3]);
+}
 
-        /* InvMixColumns (skip in round 0) */
-        if (round > 0) {
-            for (int c = 0; c < 4; c++) {
-                uint8_t a0 = s[c*4+0], a1 = s[c*4+1];
-                uint8_t a2 = s[c*4+2], a3 = s[c*4+3];
-                s[c*4+0] = gf_mul(14,a0)^gf_mul(11,a1)^gf_mul(13,a2)^gf_mul(9,a3);
-                s[c*4+1] = gf_mul(9,a0)^gf_mul(14,a1)^gf_mul(11,a2)^gf_mul(13,a3);
-                s[c*4+2] = gf_mul(13,a0)^gf_mul(9,a1)^gf_mul(14,a2)^gf_mul(11,a3);
-                s[c*4+3] = gf_mul(11,a0)^gf_mul(13,a1)^gf_mul(9,a2)^gf_mul(14,a3);
-            }
-        }
-    }
-    memcpy(out, s, 16);
+static inline void xor16(uint8_t *dst, const uint8_t *a, const uint8_t *b) {
+    for (int i = 0; i < 16; i += 4)
+        st32(dst + i, ld32(a + i) ^ ld32(b + i));
 }
 
+/* Bytes of bulk data handled per interrupts-off SIMD stretch */
+#define GCM_SIMD_CHUNK 4096
+
 void aes128_cbc_encrypt(const aes128_ctx_t *ctx,
                         const uint8_t *iv,
                         const uint8_t *plain, size_t len,
                         uint8_t *cipher) {
-    uint8_t prev[AES_BLOCK_SIZE];
-    memcpy(prev, iv, AES_BLOCK_SIZE);
-
-    for (size_t off = 0; off + AES_BLOCK_SIZE <= len; off += AES_BLOCK_SIZE) {
-        uint8_t tmp[AES_BLOCK_SIZE];
-        for (int i = 0; i < AES_BLOCK_SIZE; i++)
-            tmp[i] = plain[off + i] ^ prev[i];
-        aes128_encrypt_block(ctx, tmp, cipher + off);
-        memcpy(prev, cipher + off, AES_BLOCK_SIZE);
+    const uint8_t *prev = iv;
+    size_t off = 0;
+
+    /* Chained, so one block at a time either way */
+    while (off + AES_BLOCK_SIZE <= len) {
+        size_t end = len - len % AES_BLOCK_SIZE;
+        if (aes_ni_enabled) {
+            if (end - off > GCM_SIMD_CHUNK)
+                end = off + GCM_SIMD_CHUNK;
+            uint32_t fl = kernel_fpu_begin();
+            for (; off < end; off += AES_BLOCK_SIZE) {
+                uint8_t tmp[AES_BLOCK_SIZE];
+                xor16(tmp, plain + off, prev);
+                ni_enc1(ctx->rk, tmp, cipher + off);
+                prev = cipher + off;
+            }
+            kernel_fpu_end(fl);
+        } else {
+            for (; off < end; off += AES_BLOCK_SIZE) {
+                uint8_t tmp[AES_BLOCK_SIZE];
+                xor16(tmp, plain + off, prev);
+                aes128_encrypt_block(ctx, tmp, cipher + off);
+                prev = cipher + off;
+            }
+        }
     }
 }
 
@@ -204,69 +462,203 @@ void aes128_cbc_decrypt(const aes128_ctx_t *ctx,
                         const uint8_t *iv,
                         const uint8_t *cipher, size_t len,
                         uint8_t *plain) {
-    const uint8_t *prev = iv;
+    uint8_t prev[AES_BLOCK_SIZE];
+    memcpy(prev, iv, AES_BLOCK_SIZE);
+    size_t off = 0;
+
+    /* Independent blocks: four at a time with AES-NI.  `prev` is a
+     * copy so that plain may overlap cipher. */
+    if (aes_ni_enabled) {
+        while (off + 4 * AES_BLOCK_SIZE <= len) {
+            size_t end = off + GCM_SIMD_CHUNK;
+            uint32_t fl = kernel_fpu_begin();
+            for (; off + 4 * AES_BLOCK_SIZE <= len && off < end;
+                 off += 4 * AES_BLOCK_SIZE) {
+                uint8_t c[4 * AES_BLOCK_SIZE], blk[4 * AES_BLOCK_SIZE];
+                memcpy(c, cipher + off, sizeof(c));
+                memcpy(blk, c, sizeof(blk));
+                ni_dec4(ctx->drk, blk);
+                xor16(plain + off, blk, prev);
+                xor16(plain + off + 16, blk + 16, c);
+                xor16(plain + off + 32, blk + 32, c + 16);
+                xor16(plain + off + 48, blk + 48, c + 32);
+                memcpy(prev, c + 48, AES_BLOCK_SIZE);
+            }
+            kernel_fpu_end(fl);
+        }
+    }
 
-    for (size_t off = 0; off + AES_BLOCK_SIZE <= len; off += AES_BLOCK_SIZE) {
-        uint8_t tmp[AES_BLOCK_SIZE];
-        aes128_decrypt_block(ctx, cipher + off, tmp);
-        for (int i = 0; i < AES_BLOCK_SIZE; i++)
-            plain[off + i] = tmp[i] ^ prev[i];
-        prev = cipher + off;
+    for (; off + AES_BLOCK_SIZE <= len; off += AES_BLOCK_SIZE) {
+        uint8_t tmp[AES_BLOCK_SIZE], next[AES_BLOCK_SIZE];
+        memcpy(next, cipher + off, AES_BLOCK_SIZE);
+        aes128_decrypt_block(ctx, next, tmp);
+        xor16(plain + off, tmp, prev);
+        memcpy(prev, next, AES_BLOCK_SIZE);
     }
 }
 
 /* ── AES-128-GCM ───────────────────────────────────────────────── */
 
-/* GF(2^128) multiplication for GHASH.
- * Irreducible polynomial: x^128 + x^7 + x^2 + x + 1
- * Inputs/outputs are 16-byte big-endian blocks. */
-static void ghash_mul(uint8_t *x, const uint8_t *y) {
-    uint8_t v[16], z[16];
-    memcpy(v, y, 16);
-    memset(z, 0, 16);
-
-    for (int i = 0; i < 128; i++) {
-        if (x[i / 8] & (0x80 >> (i % 8))) {
-            for (int j = 0; j < 16; j++)
-                z[j] ^= v[j];
+static uint64_t be64(const uint8_t *p) {
+    return (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 |
+           (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+           (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 |
+           (uint64_t)p[6] << 8  | p[7];
+}
+
+/* Store 64-bit big-endian */
+static void gcm_put_be64(uint8_t *p, uint64_t v) {
+    p[0] = (uint8_t)(v >> 56); p[1] = (uint8_t)(v >> 48);
+    p[2] = (uint8_t)(v >> 40); p[3] = (uint8_t)(v >> 32);
+    p[4] = (uint8_t)(v >> 24); p[5] = (uint8_t)(v >> 16);
+    p[6] = (uint8_t)(v >> 8);  p[7] = (uint8_t)v;
+}
+
+/* Shoup's 4-bit tables: gh_hh/gh_hl[i] = i * H, with i read as a
+ * 4-bit polynomial in GHASH's reflected order.  256 bytes per key;
+ * the 8-bit variant needs 4 KB per key for a modest gain, and the
+ * PCLMULQDQ path is used whenever the CPU has it anyway. */
+static void ghash_table_init(aes128_ctx_t *ctx) {
+    uint64_t vh = be64(ctx->h), vl = be64(ctx->h + 8);
+
+    ctx->gh_hh[0] = 0;
+    ctx->gh_hl[0] = 0;
+    ctx->gh_hh[8] = vh;
+    ctx->gh_hl[8] = vl;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t r = (vl & 1) ? 0xe100000000000000ULL : 0;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ r;
+        ctx->gh_hh[i] = vh;
+        ctx->gh_hl[i] = vl;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            ctx->gh_hh[i + j] = ctx->gh_hh[i] ^ ctx->gh_hh[j];
+            ctx->gh_hl[i + j] = ctx->gh_hl[i] ^ ctx->gh_hl[j];
         }
-        /* Multiply v by x in GF(2^128): right-shift + conditional XOR */
-        int carry = v[15] & 1;
-        for (int j = 15; j > 0; j--)
-            v[j] = (v[j] >> 1) | (v[j - 1] << 7);
-        v[0] >>= 1;
-        if (carry)
-            v[0] ^= 0xe1;  /* reduction: x^128 = x^7 + x^2 + x + 1 */
     }
-    memcpy(x, z, 16);
 }
 
-/* GHASH: hash data in 16-byte blocks using subkey H */
-static void ghash(const uint8_t h[16], const uint8_t *data, size_t len,
-                  uint8_t out[16]) {
-    memset(out, 0, 16);
-    for (size_t i = 0; i < len; i += 16) {
-        size_t blen = len - i;
-        if (blen > 16) blen = 16;
-        for (size_t j = 0; j < blen; j++)
-            out[j] ^= data[i + j];
-        ghash_mul(out, h);
+/* Reduction of the four bits shifted out per step */
+static const uint16_t ghash_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/* x = x * H in GF(2^128), a nibble at a time from the last byte */
+static void ghash_mul(const aes128_ctx_t *ctx, uint8_t x[16]) {
+    uint8_t lo = x[15] & 0x0f;
+    uint64_t zh = ctx->gh_hh[lo], zl = ctx->gh_hl[lo];
+
+    for (int i = 15; i >= 0; i--) {
+        uint8_t hi = x[i] >> 4, rem;
+        lo = x[i] & 0x0f;
+        if (i != 15) {
+            rem = (uint8_t)(zl & 0x0f);
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ ((uint64_t)ghash_last4[rem] << 48);
+            zh ^= ctx->gh_hh[lo];
+            zl ^= ctx->gh_hl[lo];
+        }
+        rem = (uint8_t)(zl & 0x0f);
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ ((uint64_t)ghash_last4[rem] << 48);
+        zh ^= ctx->gh_hh[hi];
+        zl ^= ctx->gh_hl[hi];
     }
+    gcm_put_be64(x, zh);
+    gcm_put_be64(x + 8, zl);
 }
 
-/* Increment the last 4 bytes (32-bit big-endian counter) of a 16-byte block */
-static void gcm_inc32(uint8_t blk[16]) {
-    for (int i = 15; i >= 12; i--) {
-        if (++blk[i] != 0) break;
+/* Fold `len` bytes into the running hash x; a trailing partial block
+ * is zero-padded, so only the last call for AAD or ciphertext may
+ * pass a length that isn't a multiple of 16 */
+static void gcm_ghash(const aes128_ctx_t *ctx, int ni, uint8_t x[16],
+                      const uint8_t *p, size_t len) {
+    size_t n = len / 16;
+    if (n) {
+        if (ni) {
+            ni_ghash(x, ctx->h, p, n);
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                xor16(x, x, p + i * 16);
+                ghash_mul(ctx, x);
+            }
+        }
+        p += n * 16;
+        len -= n * 16;
+    }
+    if (len) {
+        uint8_t blk[16] = {0};
+        memcpy(blk, p, len);
+        if (ni) {
+            ni_ghash(x, ctx->h, blk, 1);
+        } else {
+            xor16(x, x, blk);
+            ghash_mul(ctx, x);
+        }
     }
 }
 
-/* Store 64-bit big-endian */
-static void gcm_put_be64(uint8_t *p, uint64_t v) {
-    p[0] = (uint8_t)(v >> 56); p[1] = (uint8_t)(v >> 48);
-    p[2] = (uint8_t)(v >> 40); p[3] = (uint8_t)(v >> 32);
-    p[4] = (uint8_t)(v >> 24); p[5] = (uint8_t)(v >> 16);
-    p[6] = (uint8_t)(v >> 8);  p[7] = (uint8_t)v;
+static void gcm_put_ctr(uint8_t blk[16], const uint8_t *nonce, uint32_t ctr) {
+    memcpy(blk, nonce, 12);
+    blk[12] = (uint8_t)(ctr >> 24); blk[13] = (uint8_t)(ctr >> 16);
+    blk[14] = (uint8_t)(ctr >> 8);  blk[15] = (uint8_t)ctr;
+}
+
+/* CTR keystream over `len` bytes, counter blocks nonce || *ctr.  Four
+ * blocks per AESENC pass with AES-NI. */
+static void gcm_ctr(const aes128_ctx_t *ctx, int ni, const uint8_t *nonce,
+                    uint32_t *ctr, const uint8_t *in, size_t len, uint8_t *out) {
+    uint8_t ks[4 * AES_BLOCK_SIZE];
+
+    if (ni) {
+        while (len >= sizeof(ks)) {
+            for (int b = 0; b < 4; b++)
+                gcm_put_ctr(ks + b * 16, nonce, (*ctr)++);
+            ni_enc4(ctx->rk, ks);
+            for (int b = 0; b < 4; b++)
+                xor16(out + b * 16, in + b * 16, ks + b * 16);
+            in += sizeof(ks);
+            out += sizeof(ks);
+            len -= sizeof(ks);
+        }
+    }
+    while (len) {
+        gcm_put_ctr(ks, nonce, (*ctr)++);
+        if (ni)
+            ni_enc1(ctx->rk, ks, ks);
+        else
+            aes128_encrypt_block(ctx, ks, ks);
+        if (len >= AES_BLOCK_SIZE) {
+            xor16(out, in, ks);
+        } else {
+            for (size_t j = 0; j < len; j++)
+                out[j] = in[j] ^ ks[j];
+            break;
+        }
+        in += AES_BLOCK_SIZE;
+        out += AES_BLOCK_SIZE;
+        len -= AES_BLOCK_SIZE;
+    }
+}
+
+/* Tag = E(K, J0) ^ GHASH(... || len(A) || len(C)) */
+static void gcm_tag(const aes128_ctx_t *ctx, int ni, const uint8_t *nonce,
+                    uint8_t x[16], size_t aad_len, size_t text_len,
+                    uint8_t tag[16]) {
+    uint8_t blk[16];
+    gcm_put_be64(blk, (uint64_t)aad_len * 8);
+    gcm_put_be64(blk + 8, (uint64_t)text_len * 8);
+    gcm_ghash(ctx, ni, x, blk, 16);
+
+    gcm_put_ctr(blk, nonce, 1);
+    if (ni)
+        ni_enc1(ctx->rk, blk, blk);
+    else
+        aes128_encrypt_block(ctx, blk, blk);
+    xor16(tag, x, blk);
 }
 
 int aes128_gcm_encrypt(const aes128_ctx_t *ctx,
@@ -276,51 +668,27 @@ int aes128_gcm_encrypt(const aes128_ctx_t *ctx,
                        uint8_t *cipher, uint8_t tag[16]) {
     if (nonce_len != 12) return -1;  /* only 96-bit nonces */
 
-    /* H = AES(K, 0^128) — GHASH subkey */
-    uint8_t h[16] = {0};
-    aes128_encrypt_block(ctx, h, h);
-
-    /* J0 = nonce || 0x00000001 */
-    uint8_t j0[16] = {0};
-    memcpy(j0, nonce, 12);
-    j0[15] = 1;
-
-    /* CTR encryption starting from J0 + 1 */
-    uint8_t counter[16];
-    memcpy(counter, j0, 16);
-
-    for (size_t i = 0; i < plain_len; i += 16) {
-        gcm_inc32(counter);
-        uint8_t ks[16];
-        aes128_encrypt_block(ctx, counter, ks);
-        size_t blen = plain_len - i;
-        if (blen > 16) blen = 16;
-        for (size_t j = 0; j < blen; j++)
-            cipher[i + j] = plain[i + j] ^ ks[j];
+    int ni = aes_ni_enabled;
+    uint32_t fl = ni ? kernel_fpu_begin() : 0;
+    uint8_t x[16] = {0};
+    uint32_t ctr = 2;   /* J0 + 1 */
+
+    gcm_ghash(ctx, ni, x, aad, aad_len);
+
+    /* Encrypt and hash a chunk at a time while it is still in cache */
+    for (size_t off = 0; off < plain_len; off += GCM_SIMD_CHUNK) {
+        size_t n = plain_len - off;
+        if (n > GCM_SIMD_CHUNK) n = GCM_SIMD_CHUNK;
+        gcm_ctr(ctx, ni, nonce, &ctr, plain + off, n, cipher + off);
+        gcm_ghash(ctx, ni, x, cipher + off, n);
+        if (ni && off + n < plain_len) {
+            kernel_fpu_end(fl);   /* let pending interrupts in */
+            fl = kernel_fpu_begin();
+        }
     }
 
-    /* GHASH over: pad(AAD) || pad(cipher) || len_A(8) || len_C(8) */
-    size_t aad_padded = ((aad_len + 15) / 16) * 16;
-    size_t ct_padded  = ((plain_len + 15) / 16) * 16;
-    size_t ghash_len  = aad_padded + ct_padded + 16;
-
-    uint8_t *ghash_buf = calloc(1, ghash_len);
-    if (!ghash_buf) return -1;
-    memcpy(ghash_buf, aad, aad_len);
-    memcpy(ghash_buf + aad_padded, cipher, plain_len);
-    gcm_put_be64(ghash_buf + ghash_len - 16, (uint64_t)aad_len * 8);
-    gcm_put_be64(ghash_buf + ghash_len - 8,  (uint64_t)plain_len * 8);
-
-    uint8_t s[16];
-    ghash(h, ghash_buf, ghash_len, s);
-    free(ghash_buf);
-
-    /* Tag = AES(K, J0) XOR S */
-    uint8_t enc_j0[16];
-    aes128_encrypt_block(ctx, j0, enc_j0);
-    for (int i = 0; i < 16; i++)
-        tag[i] = enc_j0[i] ^ s[i];
-
+    gcm_tag(ctx, ni, nonce, x, aad_len, plain_len, tag);
+    if (ni) kernel_fpu_end(fl);
     return 0;
 }
 
@@ -331,54 +699,45 @@ int aes128_gcm_decrypt(const aes128_ctx_t *ctx,
                        uint8_t *plain, const uint8_t tag[16]) {
     if (nonce_len != 12) return -1;
 
-    /* H = AES(K, 0^128) */
-    uint8_t h[16] = {0};
-    aes128_encrypt_block(ctx, h, h);
-
-    /* J0 = nonce || 0x00000001 */
-    uint8_t j0[16] = {0};
-    memcpy(j0, nonce, 12);
-    j0[15] = 1;
+    int ni = aes_ni_enabled;
+    uint32_t fl = ni ? kernel_fpu_begin() : 0;
+    uint8_t x[16] = {0};
 
     /* Verify tag BEFORE decryption (authenticate-then-decrypt) */
-    size_t aad_padded = ((aad_len + 15) / 16) * 16;
-    size_t ct_padded  = ((cipher_len + 15) / 16) * 16;
-    size_t ghash_len  = aad_padded + ct_padded + 16;
-
-    uint8_t *ghash_buf = calloc(1, ghash_len);
-    if (!ghash_buf) return -1;
-    memcpy(ghash_buf, aad, aad_len);
-    memcpy(ghash_buf + aad_padded, cipher, cipher_len);
-    gcm_put_be64(ghash_buf + ghash_len - 16, (uint64_t)aad_len * 8);
-    gcm_put_be64(ghash_buf + ghash_len - 8,  (uint64_t)cipher_len * 8);
-
-    uint8_t s[16];
-    ghash(h, ghash_buf, ghash_len, s);
-    free(ghash_buf);
-
-    uint8_t enc_j0[16];
-    aes128_encrypt_block(ctx, j0, enc_j0);
+    gcm_ghash(ctx, ni, x, aad, aad_len);
+    for (size_t off = 0; off < cipher_len; off += GCM_SIMD_CHUNK) {
+        size_t n = cipher_len - off;
+        if (n > GCM_SIMD_CHUNK) n = GCM_SIMD_CHUNK;
+        gcm_ghash(ctx, ni, x, cipher + off, n);
+        if (ni && off + n < cipher_len) {
+            kernel_fpu_end(fl);
+            fl = kernel_fpu_begin();
+        }
+    }
 
     uint8_t computed_tag[16];
-    for (int i = 0; i < 16; i++)
-        computed_tag[i] = enc_j0[i] ^ s[i];
+    gcm_tag(ctx, ni, nonce, x, aad_len, cipher_len, computed_tag);
 
-    if (memcmp(computed_tag, tag, 16) != 0)
+    uint8_t diff = 0;
+    for (int i = 0; i < 16; i++)
+        diff |= computed_tag[i] ^ tag[i];
+    if (diff) {
+        if (ni) kernel_fpu_end(fl);
         return -2;  /* authentication failed */
+    }
 
     /* CTR decryption (same as encryption — CTR is symmetric) */
-    uint8_t counter[16];
-    memcpy(counter, j0, 16);
-
-    for (size_t i = 0; i < cipher_len; i += 16) {
-        gcm_inc32(counter);
-        uint8_t ks[16];
-        aes128_encrypt_block(ctx, counter, ks);
-        size_t blen = cipher_len - i;
-        if (blen > 16) blen = 16;
-        for (size_t j = 0; j < blen; j++)
-            plain[i + j] = cipher[i + j] ^ ks[j];
+    uint32_t ctr = 2;
+    for (size_t off = 0; off < cipher_len; off += GCM_SIMD_CHUNK) {
+        size_t n = cipher_len - off;
+        if (n > GCM_SIMD_CHUNK) n = GCM_SIMD_CHUNK;
+        gcm_ctr(ctx, ni, nonce, &ctr, cipher + off, n, plain + off);
+        if (ni && off + n < cipher_len) {
+            kernel_fpu_end(fl);
+            fl = kernel_fpu_begin();
+        }
     }
 
+    if (ni) kernel_fpu_end(fl);
     return 0;
 }
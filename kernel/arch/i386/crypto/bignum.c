@@ -1,6 +1,10 @@
-/* Big number arithmetic — 2048-bit integers for RSA */
+/* Big number arithmetic for RSA — integers of up to BN_WORDS words.
+ * Routines only walk the words in use (`top`), so a 1024-bit modulus
+ * costs a quarter of a 2048-bit one; words at and above top are
+ * always zero. */
 #include <kernel/crypto.h>
 #include <string.h>
+#include <stdlib.h>
 
 void bn_zero(bignum_t *a) {
     memset(a->d, 0, sizeof(a->d));
@@ -13,6 +17,14 @@ static void bn_fix_top(bignum_t *a) {
     a->top = i + 1;
 }
 
+/* Set top from the first n words and clear everything above */
+static void bn_set_len(bignum_t *a, int n) {
+    if (n < BN_WORDS)
+        memset(a->d + n, 0, (BN_WORDS - n) * sizeof(uint32_t));
+    while (n > 0 && a->d[n - 1] == 0) n--;
+    a->top = n;
+}
+
 void bn_from_bytes(bignum_t *a, const uint8_t *buf, size_t len) {
     bn_zero(a);
     /* buf is big-endian */
@@ -36,7 +48,8 @@ void bn_to_bytes(const bignum_t *a, uint8_t *buf, size_t len) {
 }
 
 int bn_cmp(const bignum_t *a, const bignum_t *b) {
-    for (int i = BN_WORDS - 1; i >= 0; i--) {
+    int n = a->top > b->top ? a->top : b->top;
+    for (int i = n - 1; i >= 0; i--) {
         if (a->d[i] > b->d[i]) return 1;
         if (a->d[i] < b->d[i]) return -1;
     }
@@ -44,57 +57,61 @@ int bn_cmp(const bignum_t *a, const bignum_t *b) {
 }
 
 void bn_add(bignum_t *r, const bignum_t *a, const bignum_t *b) {
+    int n = a->top > b->top ? a->top : b->top;
     uint64_t carry = 0;
-    for (int i = 0; i < BN_WORDS; i++) {
-        uint64_t sum = (uint64_t)a->d[i] + b->d[i] + carry;
-        r->d[i] = (uint32_t)sum;
-        carry = sum >> 32;
+    for (int i = 0; i < n; i++) {
+        carry += (uint64_t)a->d[i] + b->d[i];
+        r->d[i] = (uint32_t)carry;
+        carry >>= 32;
     }
-    bn_fix_top(r);
+    if (n < BN_WORDS)
+        r->d[n++] = (uint32_t)carry;
+    bn_set_len(r, n);
 }
 
+/* r = a - b; a >= b, or the result wraps modulo 2^(32 * BN_WORDS) */
 void bn_sub(bignum_t *r, const bignum_t *a, const bignum_t *b) {
+    int n = a->top > b->top ? a->top : b->top;
     int64_t borrow = 0;
-    for (int i = 0; i < BN_WORDS; i++) {
-        int64_t diff = (int64_t)a->d[i] - b->d[i] - borrow;
-        if (diff < 0) {
-            diff += (int64_t)1 << 32;
-            borrow = 1;
-        } else {
-            borrow = 0;
-        }
-        r->d[i] = (uint32_t)diff;
+    for (int i = 0; i < n; i++) {
+        borrow += (int64_t)a->d[i] - b->d[i];
+        r->d[i] = (uint32_t)borrow;
+        borrow >>= 32;
     }
-    bn_fix_top(r);
-}
-
-/* Shift left by 1 bit */
-static void bn_shl1(bignum_t *a) {
-    uint32_t carry = 0;
-    for (int i = 0; i < BN_WORDS; i++) {
-        uint32_t next_carry = a->d[i] >> 31;
-        a->d[i] = (a->d[i] << 1) | carry;
-        carry = next_carry;
+    if (borrow) {
+        for (int i = n; i < BN_WORDS; i++)
+            r->d[i] = 0xFFFFFFFF;
+        n = BN_WORDS;
     }
-    bn_fix_top(a);
+    bn_set_len(r, n);
 }
 
-/* Shift right by 1 bit */
-static void bn_shr1(bignum_t *a) {
-    uint32_t carry = 0;
-    for (int i = BN_WORDS - 1; i >= 0; i--) {
-        uint32_t next_carry = a->d[i] & 1;
-        a->d[i] = (a->d[i] >> 1) | (carry << 31);
-        carry = next_carry;
+/* r = a * b; the product must fit in BN_WORDS words */
+void bn_mul(bignum_t *r, const bignum_t *a, const bignum_t *b) {
+    uint32_t t[BN_WORDS];
+    int n = a->top + b->top;
+    if (n > BN_WORDS) n = BN_WORDS;
+
+    memset(t, 0, n * sizeof(uint32_t));
+    for (int i = 0; i < a->top; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < b->top && i + j < n; j++) {
+            carry += (uint64_t)a->d[i] * b->d[j] + t[i + j];
+            t[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (i + b->top < n)
+            t[i + b->top] = (uint32_t)carry;
     }
-    bn_fix_top(a);
+    memcpy(r->d, t, n * sizeof(uint32_t));
+    bn_set_len(r, n);
 }
 
 /* Get bit at position n */
 static int bn_bit(const bignum_t *a, int n) {
     int word = n / 32;
     int bit = n % 32;
-    if (word >= BN_WORDS) return 0;
+    if (word >= a->top) return 0;
     return (a->d[word] >> bit) & 1;
 }
 
@@ -107,95 +124,430 @@ static int bn_num_bits(const bignum_t *a) {
     return bits;
 }
 
-/* r = a mod m  (for a < 2*m, simple subtract; general: binary division) */
-void bn_mod(bignum_t *r, const bignum_t *a, const bignum_t *m) {
-    bignum_t tmp;
-    memcpy(&tmp, a, sizeof(bignum_t));
+/* Shift left by 1 bit within n words; returns the bit shifted out */
+static uint32_t words_shl1(uint32_t *d, int n) {
+    uint32_t carry = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t next = d[i] >> 31;
+        d[i] = (d[i] << 1) | carry;
+        carry = next;
+    }
+    return carry;
+}
 
-    if (bn_cmp(&tmp, m) < 0) {
-        memcpy(r, &tmp, sizeof(bignum_t));
+/* d -= m over n words; returns the borrow */
+static uint32_t words_sub(uint32_t *d, const uint32_t *m, int n) {
+    int64_t borrow = 0;
+    for (int i = 0; i < n; i++) {
+        borrow += (int64_t)d[i] - m[i];
+        d[i] = (uint32_t)borrow;
+        borrow >>= 32;
+    }
+    return (uint32_t)-borrow;
+}
+
+static int words_cmp(const uint32_t *a, const uint32_t *b, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        if (a[i] > b[i]) return 1;
+        if (a[i] < b[i]) return -1;
+    }
+    return 0;
+}
+
+/* r = a mod m — binary long division, a bit of a per step */
+void bn_mod(bignum_t *r, const bignum_t *a, const bignum_t *m) {
+    if (bn_cmp(a, m) < 0) {
+        if (r != a) memcpy(r, a, sizeof(bignum_t));
         return;
     }
 
-    /* Binary long division */
-    int nbits = bn_num_bits(&tmp);
-    int mbits = bn_num_bits(m);
+    /* Shift a's bits into rem from the top; rem < 2m throughout */
+    uint32_t rem[BN_WORDS + 1];
+    int n = m->top;
+    memset(rem, 0, sizeof(rem));
+    for (int i = bn_num_bits(a) - 1; i >= 0; i--) {
+        words_shl1(rem, n + 1);
+        rem[0] |= (uint32_t)bn_bit(a, i);
+        if (rem[n] || words_cmp(rem, m->d, n) >= 0) {
+            rem[n] -= words_sub(rem, m->d, n);
+        }
+    }
+    memcpy(r->d, rem, n * sizeof(uint32_t));
+    bn_set_len(r, n);
+}
 
-    bignum_t shifted_m;
-    memcpy(&shifted_m, m, sizeof(bignum_t));
+/* ── Montgomery arithmetic ─────────────────────────────────────────
+ *
+ * For odd n of nw words and R = 2^(32 nw), values are kept as aR mod n
+ * and multiplied with REDC, which divides by R instead of by n:
+ * one pass of word multiply-adds, no long division.  Montgomery,
+ * "Modular multiplication without trial division", 1985; the
+ * word-serial CIOS loop of Koç, Acar and Kaliski. */
 
-    /* Shift m left so MSBs align */
-    int shift = nbits - mbits;
-    for (int i = 0; i < shift; i++)
-        bn_shl1(&shifted_m);
+/* r = t - n if t >= n, where t has an extra top word `hi`.  Masked,
+ * so the timing doesn't say whether the subtraction happened. */
+static void mont_final_sub(uint32_t *r, const uint32_t *t, uint32_t hi,
+                           const uint32_t *n, int nw) {
+    uint32_t s[BN_WORDS];
+    int64_t borrow = 0;
+    for (int i = 0; i < nw; i++) {
+        borrow += (int64_t)t[i] - n[i];
+        s[i] = (uint32_t)borrow;
+        borrow >>= 32;
+    }
+    borrow += hi;                       /* 0: t >= n, -1: t < n */
+    uint32_t keep = (uint32_t)borrow;   /* all ones to keep t */
+    for (int i = 0; i < nw; i++)
+        r[i] = (t[i] & keep) | (s[i] & ~keep);
+}
+
+/* r = a b R^-1 mod n, a and b below n */
+static void mont_mul_words(uint32_t *r, const uint32_t *a, const uint32_t *b,
+                           const uint32_t *n, uint32_t n0, int nw) {
+    uint32_t t[BN_WORDS + 2];
+    memset(t, 0, (nw + 2) * sizeof(uint32_t));
+
+    for (int i = 0; i < nw; i++) {
+        uint64_t c = 0;
+        uint32_t bi = b[i];
+        for (int j = 0; j < nw; j++) {
+            c += (uint64_t)a[j] * bi + t[j];
+            t[j] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += t[nw];
+        t[nw] = (uint32_t)c;
+        t[nw + 1] = (uint32_t)(c >> 32);
 
-    for (int i = shift; i >= 0; i--) {
-        if (bn_cmp(&tmp, &shifted_m) >= 0)
-            bn_sub(&tmp, &tmp, &shifted_m);
-        bn_shr1(&shifted_m);
+        /* Add m n so the low word clears, then shift down a word */
+        uint32_t m = t[0] * n0;
+        c = ((uint64_t)m * n[0] + t[0]) >> 32;
+        for (int j = 1; j < nw; j++) {
+            c += (uint64_t)m * n[j] + t[j];
+            t[j - 1] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += t[nw];
+        t[nw - 1] = (uint32_t)c;
+        t[nw] = t[nw + 1] + (uint32_t)(c >> 32);
     }
+    mont_final_sub(r, t, t[nw], n, nw);
+}
 
-    memcpy(r, &tmp, sizeof(bignum_t));
+/* r = t R^-1 mod n for a 2nw-word t below n R; t is clobbered */
+static void mont_redc_words(uint32_t *r, uint32_t *t, const uint32_t *n,
+                            uint32_t n0, int nw) {
+    uint32_t hi = 0;
+    for (int i = 0; i < nw; i++) {
+        uint32_t m = t[i] * n0;
+        uint64_t c = 0;
+        for (int j = 0; j < nw; j++) {
+            c += (uint64_t)m * n[j] + t[i + j];
+            t[i + j] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += (uint64_t)t[i + nw] + hi;
+        t[i + nw] = (uint32_t)c;
+        hi = (uint32_t)(c >> 32);
+    }
+    mont_final_sub(r, t + nw, hi, n, nw);
 }
 
-/* r = (a * b) mod m — doubling-and-add with proper carry tracking */
-void bn_mulmod(bignum_t *r, const bignum_t *a, const bignum_t *b, const bignum_t *m) {
-    bignum_t result;
-    bn_zero(&result);
-
-    int nbits = bn_num_bits(b);
-
-    for (int i = nbits - 1; i >= 0; i--) {
-        /* result = result * 2 mod m — inline shift with carry */
-        uint32_t shl_carry = 0;
-        for (int j = 0; j < BN_WORDS; j++) {
-            uint32_t nc = result.d[j] >> 31;
-            result.d[j] = (result.d[j] << 1) | shl_carry;
-            shl_carry = nc;
+/* r = a^2 R^-1 mod n — each cross product once, doubled, then REDC;
+ * about three quarters of the work of mont_mul_words */
+static void mont_sqr_words(uint32_t *r, const uint32_t *a,
+                           const uint32_t *n, uint32_t n0, int nw) {
+    uint32_t t[2 * BN_WORDS];
+    memset(t, 0, 2 * nw * sizeof(uint32_t));
+
+    for (int i = 0; i < nw - 1; i++) {
+        uint64_t c = 0;
+        for (int j = i + 1; j < nw; j++) {
+            c += (uint64_t)a[i] * a[j] + t[i + j];
+            t[i + j] = (uint32_t)c;
+            c >>= 32;
         }
-        /* If carry overflowed or result >= m, subtract m.
-         * When carry is set, actual value = result + 2^2048 > m,
-         * and bn_sub produces correct result via unsigned wrapping. */
-        if (shl_carry || bn_cmp(&result, m) >= 0)
-            bn_sub(&result, &result, m);
+        t[i + nw] = (uint32_t)c;
+    }
+    words_shl1(t, 2 * nw);
 
-        /* if bit i of b is set: result = (result + a) mod m */
-        if (bn_bit(b, i)) {
-            uint64_t add_carry = 0;
-            for (int j = 0; j < BN_WORDS; j++) {
-                uint64_t sum = (uint64_t)result.d[j] + a->d[j] + add_carry;
-                result.d[j] = (uint32_t)sum;
-                add_carry = sum >> 32;
-            }
-            if (add_carry || bn_cmp(&result, m) >= 0)
-                bn_sub(&result, &result, m);
+    uint64_t c = 0;
+    for (int i = 0; i < nw; i++) {
+        uint64_t sq = (uint64_t)a[i] * a[i];
+        c += (uint64_t)t[2 * i] + (uint32_t)sq;
+        t[2 * i] = (uint32_t)c;
+        c >>= 32;
+        c += (uint64_t)t[2 * i + 1] + (uint32_t)(sq >> 32);
+        t[2 * i + 1] = (uint32_t)c;
+        c >>= 32;
+    }
+    mont_redc_words(r, t, n, n0, nw);
+}
+
+int bn_mont_init(bn_mont_t *mont, const bignum_t *n) {
+    if (n->top == 0 || !(n->d[0] & 1))
+        return -1;
+
+    int nw = n->top;
+    mont->n = *n;
+    mont->nw = nw;
+
+    /* n0 = -n^-1 mod 2^32 by Newton's iteration; x = n[0] is already
+     * right to 3 bits and every step doubles that */
+    uint32_t x = n->d[0];
+    for (int i = 0; i < 4; i++)
+        x *= 2 - n->d[0] * x;
+    mont->n0 = -x;
+
+    /* R mod n: start from the top bit of n and double the rest of the
+     * way to 2^(32 nw) */
+    bignum_t *one = &mont->one;
+    int bits = bn_num_bits(n);
+    bn_zero(one);
+    one->d[(bits - 1) / 32] = 1u << ((bits - 1) % 32);
+    for (int i = bits - 1; i < 32 * nw; i++) {
+        uint32_t out = words_shl1(one->d, nw);
+        if (out || words_cmp(one->d, n->d, nw) >= 0)
+            words_sub(one->d, n->d, nw);
+    }
+    bn_set_len(one, nw);
+
+    /* R^2 mod n = 2^(32 nw) R: walk the bits of 32 nw from the top;
+     * squaring 2^e R gives 2^(2e) R, doubling gives 2^(e+1) R */
+    uint32_t e = 32 * nw;
+    int top = 31;
+    while (!(e >> top & 1)) top--;
+    uint32_t *rr = mont->rr.d;
+    memcpy(rr, one->d, nw * sizeof(uint32_t));
+    for (int b = top; b >= 0; b--) {
+        if (b != top)
+            mont_sqr_words(rr, rr, n->d, mont->n0, nw);
+        if (e >> b & 1) {
+            uint32_t out = words_shl1(rr, nw);
+            if (out || words_cmp(rr, n->d, nw) >= 0)
+                words_sub(rr, n->d, nw);
         }
     }
+    bn_set_len(&mont->rr, nw);
+    return 0;
+}
 
-    bn_fix_top(&result);
-    memcpy(r, &result, sizeof(bignum_t));
+void bn_mont_mul(const bn_mont_t *mont, bignum_t *r,
+                 const bignum_t *a, const bignum_t *b) {
+    mont_mul_words(r->d, a->d, b->d, mont->n.d, mont->n0, mont->nw);
+    bn_set_len(r, mont->nw);
 }
 
-/* r = base^exp mod mod — binary method (square-and-multiply) */
-void bn_modexp(bignum_t *r, const bignum_t *base, const bignum_t *exp, const bignum_t *mod) {
-    bignum_t result, b;
+void bn_mont_sqr(const bn_mont_t *mont, bignum_t *r, const bignum_t *a) {
+    mont_sqr_words(r->d, a->d, mont->n.d, mont->n0, mont->nw);
+    bn_set_len(r, mont->nw);
+}
 
-    /* result = 1 */
-    bn_zero(&result);
-    result.d[0] = 1;
-    result.top = 1;
+/* r = a mod n for a below n R (for CRT: c < p q with q < R): REDC
+ * divides by R, the multiply by R^2 in Montgomery form puts it back */
+void bn_mont_reduce(const bn_mont_t *mont, bignum_t *r, const bignum_t *a) {
+    uint32_t t[2 * BN_WORDS];
+    int nw = mont->nw;
 
-    /* b = base mod mod */
-    bn_mod(&b, base, mod);
+    memset(t, 0, sizeof(t));
+    memcpy(t, a->d, (a->top < 2 * nw ? a->top : 2 * nw) * sizeof(uint32_t));
+    mont_redc_words(r->d, t, mont->n.d, mont->n0, nw);
+    mont_mul_words(r->d, r->d, mont->rr.d, mont->n.d, mont->n0, nw);
+    bn_set_len(r, nw);
+}
+
+/* ── Exponentiation ────────────────────────────────────────────── */
+
+/* Window size for an exponent of `bits` bits (as OpenSSL picks it) */
+static int exp_window(int bits) {
+    if (bits > 671) return 6;
+    if (bits > 239) return 5;
+    if (bits > 79)  return 4;
+    if (bits > 23)  return 3;
+    return 1;
+}
 
+int bn_mont_exp(const bn_mont_t *mont, bignum_t *r, const bignum_t *base,
+                const bignum_t *exp, int consttime) {
     int nbits = bn_num_bits(exp);
+    int w = exp_window(nbits);
+    if (consttime && w > 5) w = 5;
+    int entries = consttime ? 1 << w : 1 << (w - 1);
 
-    for (int i = 0; i < nbits; i++) {
-        if (bn_bit(exp, i)) {
-            bn_mulmod(&result, &result, &b, mod);
+    /* Table on the heap: thread stacks are 8 KB */
+    bignum_t *tab = malloc((entries + 2) * sizeof(bignum_t));
+    if (!tab) return -1;
+    bignum_t *acc = &tab[entries], *b = &tab[entries + 1];
+
+    /* b = base in Montgomery form */
+    if (bn_cmp(base, &mont->n) >= 0)
+        bn_mod(b, base, &mont->n);
+    else
+        *b = *base;
+    bn_mont_mul(mont, b, b, &mont->rr);
+
+    if (consttime) {
+        /* Fixed windows over every power, each picked by a masked
+         * scan of the whole table */
+        tab[0] = mont->one;
+        for (int i = 1; i < entries; i++)
+            bn_mont_mul(mont, &tab[i], &tab[i - 1], b);
+
+        *acc = mont->one;
+        int top = ((nbits + w - 1) / w) * w;
+        for (int i = top - w; i >= 0; i -= w) {
+            uint32_t idx = 0;
+            for (int k = w - 1; k >= 0; k--) {
+                idx = (idx << 1) | (uint32_t)bn_bit(exp, i + k);
+                bn_mont_sqr(mont, acc, acc);
+            }
+            for (int k = 0; k < mont->nw; k++) {
+                uint32_t v = 0;
+                for (uint32_t e = 0; e < (uint32_t)entries; e++) {
+                    uint32_t x = e ^ idx;
+                    uint32_t m = -(((x | -x) >> 31) ^ 1);
+                    v |= tab[e].d[k] & m;
+                }
+                b->d[k] = v;
+            }
+            bn_set_len(b, mont->nw);
+            bn_mont_mul(mont, acc, acc, b);
+        }
+    } else {
+        /* Sliding window: odd powers b, b^3, ..., b^(2^w - 1) */
+        tab[0] = *b;
+        if (entries > 1) {
+            bn_mont_sqr(mont, acc, b);
+            for (int i = 1; i < entries; i++)
+                bn_mont_mul(mont, &tab[i], &tab[i - 1], acc);
+        }
+
+        int started = 0;
+        *acc = mont->one;
+        for (int i = nbits - 1; i >= 0; ) {
+            if (!bn_bit(exp, i)) {
+                if (started)
+                    bn_mont_sqr(mont, acc, acc);
+                i--;
+                continue;
+            }
+            /* Longest window ending in a set bit */
+            int j = i - w + 1;
+            if (j < 0) j = 0;
+            while (!bn_bit(exp, j)) j++;
+            uint32_t val = 0;
+            for (int k = i; k >= j; k--) {
+                val = (val << 1) | (uint32_t)bn_bit(exp, k);
+                if (started)
+                    bn_mont_sqr(mont, acc, acc);
+            }
+            if (started) {
+                bn_mont_mul(mont, acc, acc, &tab[val >> 1]);
+            } else {
+                *acc = tab[val >> 1];
+                started = 1;
+            }
+            i = j - 1;
+        }
+    }
+
+    /* Out of Montgomery form: multiply by plain 1 */
+    bn_zero(b);
+    b->d[0] = 1;
+    b->top = 1;
+    bn_mont_mul(mont, r, acc, b);
+
+    memset(tab, 0, (entries + 2) * sizeof(bignum_t));
+    free(tab);
+    return 0;
+}
+
+/* Generic fallback for even moduli — doubling-and-add */
+static void mulmod_slow(bignum_t *r, const bignum_t *a, const bignum_t *b,
+                        const bignum_t *m) {
+    uint32_t res[BN_WORDS + 1];
+    int n = m->top;
+    memset(res, 0, sizeof(res));
+
+    for (int i = bn_num_bits(b) - 1; i >= 0; i--) {
+        res[n] = words_shl1(res, n);
+        if (res[n] || words_cmp(res, m->d, n) >= 0)
+            res[n] -= words_sub(res, m->d, n);
+
+        if (bn_bit(b, i)) {
+            uint64_t carry = 0;
+            for (int j = 0; j < n; j++) {
+                carry += (uint64_t)res[j] + a->d[j];
+                res[j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            res[n] = (uint32_t)carry;
+            if (res[n] || words_cmp(res, m->d, n) >= 0)
+                res[n] -= words_sub(res, m->d, n);
         }
-        bn_mulmod(&b, &b, &b, mod);
     }
+    memcpy(r->d, res, n * sizeof(uint32_t));
+    bn_set_len(r, n);
+}
+
+/* r = (a * b) mod m */
+void bn_mulmod(bignum_t *r, const bignum_t *a, const bignum_t *b, const bignum_t *m) {
+    bn_mont_t *mont = malloc(sizeof(bn_mont_t));
+    bignum_t *x = malloc(2 * sizeof(bignum_t));
+    if (!mont || !x) {
+        free(mont);
+        free(x);
+        bn_zero(r);
+        return;
+    }
+    bignum_t *y = x + 1;
+    bn_mod(x, a, m);
+    bn_mod(y, b, m);
+
+    if (bn_mont_init(mont, m) == 0) {
+        /* (x y R^-1) R^2 R^-1 = x y */
+        bn_mont_mul(mont, x, x, y);
+        bn_mont_mul(mont, r, x, &mont->rr);
+    } else {
+        mulmod_slow(r, x, y, m);
+    }
+    free(mont);
+    free(x);
+}
 
-    memcpy(r, &result, sizeof(bignum_t));
+/* r = base^exp mod mod — Montgomery sliding window for odd moduli */
+void bn_modexp(bignum_t *r, const bignum_t *base, const bignum_t *exp, const bignum_t *mod) {
+    bn_mont_t *mont = malloc(sizeof(bn_mont_t));
+    if (mont && bn_mont_init(mont, mod) == 0 &&
+        bn_mont_exp(mont, r, base, exp, 0) == 0) {
+        free(mont);
+        return;
+    }
+    free(mont);
+
+    /* Even modulus (or out of memory): square-and-multiply */
+    bignum_t *t = malloc(2 * sizeof(bignum_t));
+    if (!t) {
+        bn_zero(r);
+        return;
+    }
+    bignum_t *result = t, *b = t + 1;
+    bn_zero(result);
+    if (mod->top == 1 && mod->d[0] == 1) {
+        *r = *result;
+        free(t);
+        return;
+    }
+    result->d[0] = 1;
+    result->top = 1;
+    bn_mod(b, base, mod);
+
+    int nbits = bn_num_bits(exp);
+    for (int i = 0; i < nbits; i++) {
+        if (bn_bit(exp, i))
+            mulmod_slow(result, result, b, mod);
+        mulmod_slow(b, b, b, mod);
+    }
+    *r = *result;
+    free(t);
 }
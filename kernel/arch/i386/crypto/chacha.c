@@ -0,0 +1,377 @@
+/* ChaCha20, Poly1305 and their AEAD construction (RFC 8439), for the
+ * TLS 1.2 CHACHA20_POLY1305 suites (RFC 7905).  Both are built from
+ * 32-bit adds, xors and rotates, so they are fast without AES-NI. */
+#include <kernel/crypto.h>
+#include <kernel/fpu.h>
+#include <string.h>
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QR(a, b, c, d) do {                      \
+    a += b; d ^= a; d = ROTL32(d, 16);           \
+    c += d; b ^= c; b = ROTL32(b, 12);           \
+    a += b; d ^= a; d = ROTL32(d, 8);            \
+    c += d; b ^= c; b = ROTL32(b, 7);            \
+} while (0)
+
+typedef uint32_t __attribute__((may_alias, aligned(1))) cc_u32;
+
+static inline uint32_t ld32(const uint8_t *p) { return *(const cc_u32 *)p; }
+static inline void st32(uint8_t *p, uint32_t w) { *(cc_u32 *)p = w; }
+
+static int cc_ready, sse2_present, sse2_enabled;
+
+static void chacha_cpu_init(void) {
+    sse2_present = cpu_has(CPU_FEAT_SSE2 | CPU_FEAT_FXSR);
+    sse2_enabled = sse2_present;
+    cc_ready = 1;
+}
+
+int chacha20_accel(void) {
+    if (!cc_ready)
+        chacha_cpu_init();
+    return sse2_enabled;
+}
+
+void chacha20_set_accel(int on) {
+    if (!cc_ready)
+        chacha_cpu_init();
+    sse2_enabled = on && sse2_present;
+}
+
+/* ── ChaCha20 ───────────────────────────────────────────────────── */
+
+/* "expand 32-byte k" || key || counter || nonce */
+static void chacha_setup(uint32_t st[16], const uint8_t key[32],
+                         const uint8_t nonce[12], uint32_t counter) {
+    st[0] = 0x61707865;
+    st[1] = 0x3320646e;
+    st[2] = 0x79622d32;
+    st[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++)
+        st[4 + i] = ld32(key + 4 * i);
+    st[12] = counter;
+    st[13] = ld32(nonce);
+    st[14] = ld32(nonce + 4);
+    st[15] = ld32(nonce + 8);
+}
+
+/* One 64-byte keystream block; the state's counter is not advanced */
+static void chacha_block(const uint32_t st[16], uint8_t out[64]) {
+    uint32_t x0 = st[0],   x1 = st[1],   x2 = st[2],   x3 = st[3];
+    uint32_t x4 = st[4],   x5 = st[5],   x6 = st[6],   x7 = st[7];
+    uint32_t x8 = st[8],   x9 = st[9],   x10 = st[10], x11 = st[11];
+    uint32_t x12 = st[12], x13 = st[13], x14 = st[14], x15 = st[15];
+
+    for (int i = 0; i < 10; i++) {
+        QR(x0, x4, x8,  x12);
+        QR(x1, x5, x9,  x13);
+        QR(x2, x6, x10, x14);
+        QR(x3, x7, x11, x15);
+        QR(x0, x5, x10, x15);
+        QR(x1, x6, x11, x12);
+        QR(x2, x7, x8,  x13);
+        QR(x3, x4, x9,  x14);
+    }
+
+    st32(out + 0,  x0 + st[0]);   st32(out + 4,  x1 + st[1]);
+    st32(out + 8,  x2 + st[2]);   st32(out + 12, x3 + st[3]);
+    st32(out + 16, x4 + st[4]);   st32(out + 20, x5 + st[5]);
+    st32(out + 24, x6 + st[6]);   st32(out + 28, x7 + st[7]);
+    st32(out + 32, x8 + st[8]);   st32(out + 36, x9 + st[9]);
+    st32(out + 40, x10 + st[10]); st32(out + 44, x11 + st[11]);
+    st32(out + 48, x12 + st[12]); st32(out + 52, x13 + st[13]);
+    st32(out + 56, x14 + st[14]); st32(out + 60, x15 + st[15]);
+}
+
+/* ── SSE2: four blocks at once ──────────────────────────────────────
+ *
+ * Word i of four consecutive blocks shares one vector, so the rounds
+ * are the scalar ones on vectors and no shuffles are needed until
+ * the end.  The vector code runs between kernel_fpu_begin() and
+ * kernel_fpu_end(), at most CHACHA_SIMD_CHUNK bytes at a time. */
+
+#define CHACHA_SIMD_CHUNK 4096
+
+typedef uint32_t cc_v4 __attribute__((vector_size(16)));
+
+#define VROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define VQR(a, b, c, d) do {                     \
+    a += b; d ^= a; d = VROTL(d, 16);            \
+    c += d; b ^= c; b = VROTL(b, 12);            \
+    a += b; d ^= a; d = VROTL(d, 8);             \
+    c += d; b ^= c; b = VROTL(b, 7);             \
+} while (0)
+
+/* XOR n four-block groups of keystream into in, from counter st[12] */
+__attribute__((target("sse2")))
+static void chacha_xor4_sse2(const uint32_t st[16], const uint8_t *in,
+                             uint8_t *out, size_t n) {
+    uint32_t ctr = st[12];
+    uint32_t ks[64] __attribute__((aligned(16)));
+
+    while (n--) {
+        cc_v4 x[16], o[16];
+        for (int i = 0; i < 16; i++)
+            o[i] = (cc_v4){ st[i], st[i], st[i], st[i] };
+        o[12] = (cc_v4){ ctr, ctr + 1, ctr + 2, ctr + 3 };
+        for (int i = 0; i < 16; i++)
+            x[i] = o[i];
+
+        for (int i = 0; i < 10; i++) {
+            VQR(x[0], x[4], x[8],  x[12]);
+            VQR(x[1], x[5], x[9],  x[13]);
+            VQR(x[2], x[6], x[10], x[14]);
+            VQR(x[3], x[7], x[11], x[15]);
+            VQR(x[0], x[5], x[10], x[15]);
+            VQR(x[1], x[6], x[11], x[12]);
+            VQR(x[2], x[7], x[8],  x[13]);
+            VQR(x[3], x[4], x[9],  x[14]);
+        }
+
+        /* Word i of block b is lane b of x[i] */
+        for (int i = 0; i < 16; i++) {
+            cc_v4 v = x[i] + o[i];
+            ks[i] = v[0];
+            ks[16 + i] = v[1];
+            ks[32 + i] = v[2];
+            ks[48 + i] = v[3];
+        }
+        for (int i = 0; i < 64; i++)
+            st32(out + 4 * i, ld32(in + 4 * i) ^ ks[i]);
+
+        in += 256;
+        out += 256;
+        ctr += 4;
+    }
+}
+
+void chacha20_xor(const uint8_t key[32], const uint8_t nonce[12],
+                  uint32_t counter, const uint8_t *in, uint8_t *out,
+                  size_t len) {
+    uint32_t st[16];
+    uint8_t ks[64];
+    chacha_setup(st, key, nonce, counter);
+
+    if (chacha20_accel()) {
+        while (len >= 256) {
+            size_t n = len < CHACHA_SIMD_CHUNK ? len : CHACHA_SIMD_CHUNK;
+            n /= 256;
+            uint32_t fl = kernel_fpu_begin();
+            chacha_xor4_sse2(st, in, out, n);
+            kernel_fpu_end(fl);
+            st[12] += 4 * n;
+            in += 256 * n;
+            out += 256 * n;
+            len -= 256 * n;
+        }
+    }
+
+    while (len >= 64) {
+        chacha_block(st, ks);
+        for (int i = 0; i < 64; i += 4)
+            st32(out + i, ld32(in + i) ^ ld32(ks + i));
+        st[12]++;
+        in += 64;
+        out += 64;
+        len -= 64;
+    }
+    if (len) {
+        chacha_block(st, ks);
+        for (size_t i = 0; i < len; i++)
+            out[i] = in[i] ^ ks[i];
+    }
+    memset(ks, 0, sizeof(ks));
+}
+
+/* ── Poly1305 ──────────────────────────────────────────────────────
+ *
+ * The accumulator and r in five 26-bit limbs, so every partial
+ * product fits 64 bits with room for the sums (poly1305-donna's
+ * 32-bit layout).  2^130 = 5 mod p folds the top limbs back in. */
+
+static void poly1305_blocks(poly1305_ctx_t *ctx, const uint8_t *m,
+                            size_t len, uint32_t hibit) {
+    const uint32_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2],
+                   r3 = ctx->r[3], r4 = ctx->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2],
+             h3 = ctx->h[3], h4 = ctx->h[4];
+
+    while (len >= 16) {
+        h0 += ld32(m) & 0x3ffffff;
+        h1 += (ld32(m + 3) >> 2) & 0x3ffffff;
+        h2 += (ld32(m + 6) >> 4) & 0x3ffffff;
+        h3 += (ld32(m + 9) >> 6) & 0x3ffffff;
+        h4 += (ld32(m + 12) >> 8) | hibit;
+
+        uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 +
+                      (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 +
+                      (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 +
+                      (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 +
+                      (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 +
+                      (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        uint32_t c;
+        c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+        d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+        d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+        d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+        d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        m += 16;
+        len -= 16;
+    }
+
+    ctx->h[0] = h0; ctx->h[1] = h1; ctx->h[2] = h2;
+    ctx->h[3] = h3; ctx->h[4] = h4;
+}
+
+void poly1305_init(poly1305_ctx_t *ctx, const uint8_t key[32]) {
+    /* r is clamped: the top four bits of every word and the low two
+     * of the upper three are cleared */
+    ctx->r[0] = ld32(key) & 0x3ffffff;
+    ctx->r[1] = (ld32(key + 3) >> 2) & 0x3ffff03;
+    ctx->r[2] = (ld32(key + 6) >> 4) & 0x3ffc0ff;
+    ctx->r[3] = (ld32(key + 9) >> 6) & 0x3f03fff;
+    ctx->r[4] = (ld32(key + 12) >> 8) & 0x00fffff;
+    memset(ctx->h, 0, sizeof(ctx->h));
+    for (int i = 0; i < 4; i++)
+        ctx->pad[i] = ld32(key + 16 + 4 * i);
+    ctx->buf_len = 0;
+}
+
+void poly1305_update(poly1305_ctx_t *ctx, const uint8_t *data, size_t len) {
+    if (ctx->buf_len) {
+        size_t take = 16 - ctx->buf_len;
+        if (take > len) take = len;
+        memcpy(ctx->buf + ctx->buf_len, data, take);
+        ctx->buf_len += take;
+        data += take;
+        len -= take;
+        if (ctx->buf_len < 16)
+            return;
+        poly1305_blocks(ctx, ctx->buf, 16, 1u << 24);
+        ctx->buf_len = 0;
+    }
+    size_t full = len & ~(size_t)15;
+    if (full) {
+        poly1305_blocks(ctx, data, full, 1u << 24);
+        data += full;
+        len -= full;
+    }
+    if (len) {
+        memcpy(ctx->buf, data, len);
+        ctx->buf_len = len;
+    }
+}
+
+void poly1305_final(poly1305_ctx_t *ctx, uint8_t tag[16]) {
+    /* A short last block gets its 1 bit inside the 16 bytes */
+    if (ctx->buf_len) {
+        ctx->buf[ctx->buf_len] = 1;
+        memset(ctx->buf + ctx->buf_len + 1, 0, 15 - ctx->buf_len);
+        poly1305_blocks(ctx, ctx->buf, 16, 0);
+    }
+
+    uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2],
+             h3 = ctx->h[3], h4 = ctx->h[4], c;
+    c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    /* g = h + 5 - 2^130; keep it instead of h if it didn't go negative */
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1u << 26);
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    /* tag = (h + s) mod 2^128 */
+    uint32_t w0 = h0 | h1 << 26;
+    uint32_t w1 = h1 >> 6 | h2 << 20;
+    uint32_t w2 = h2 >> 12 | h3 << 14;
+    uint32_t w3 = h3 >> 18 | h4 << 8;
+    uint64_t f;
+    f = (uint64_t)w0 + ctx->pad[0];             st32(tag, (uint32_t)f);
+    f = (uint64_t)w1 + ctx->pad[1] + (f >> 32); st32(tag + 4, (uint32_t)f);
+    f = (uint64_t)w2 + ctx->pad[2] + (f >> 32); st32(tag + 8, (uint32_t)f);
+    f = (uint64_t)w3 + ctx->pad[3] + (f >> 32); st32(tag + 12, (uint32_t)f);
+
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/* ── AEAD ──────────────────────────────────────────────────────────
+ *
+ * The Poly1305 key is the first half of keystream block 0; the data
+ * is encrypted from block 1.  The tag covers aad and ciphertext, each
+ * zero-padded to 16 bytes, then both lengths as 64-bit LE. */
+
+static void aead_tag(const uint8_t key[32], const uint8_t nonce[12],
+                     const uint8_t *aad, size_t aad_len,
+                     const uint8_t *cipher, size_t len, uint8_t tag[16]) {
+    static const uint8_t zero[16];
+    uint32_t st[16];
+    uint8_t block[64];
+    poly1305_ctx_t poly;
+
+    chacha_setup(st, key, nonce, 0);
+    chacha_block(st, block);
+    poly1305_init(&poly, block);
+    memset(block, 0, sizeof(block));
+
+    poly1305_update(&poly, aad, aad_len);
+    poly1305_update(&poly, zero, (16 - aad_len % 16) % 16);
+    poly1305_update(&poly, cipher, len);
+    poly1305_update(&poly, zero, (16 - len % 16) % 16);
+    uint8_t lens[16];
+    st32(lens, (uint32_t)aad_len);
+    st32(lens + 4, 0);
+    st32(lens + 8, (uint32_t)len);
+    st32(lens + 12, 0);
+    poly1305_update(&poly, lens, 16);
+    poly1305_final(&poly, tag);
+}
+
+int chacha20_poly1305_encrypt(const uint8_t key[32], const uint8_t nonce[12],
+                              const uint8_t *aad, size_t aad_len,
+                              const uint8_t *plain, size_t len,
+                              uint8_t *cipher, uint8_t tag[16]) {
+    chacha20_xor(key, nonce, 1, plain, cipher, len);
+    aead_tag(key, nonce, aad, aad_len, cipher, len, tag);
+    return 0;
+}
+
+int chacha20_poly1305_decrypt(const uint8_t key[32], const uint8_t nonce[12],
+                              const uint8_t *aad, size_t aad_len,
+                              const uint8_t *cipher, size_t len,
+                              uint8_t *plain, const uint8_t tag[16]) {
+    uint8_t want[16];
+    aead_tag(key, nonce, aad, aad_len, cipher, len, want);
+
+    /* Constant-time compare; nothing is decrypted on a mismatch */
+    uint8_t diff = 0;
+    for (int i = 0; i < 16; i++)
+        diff |= want[i] ^ tag[i];
+    if (diff)
+        return -2;
+
+    chacha20_xor(key, nonce, 1, cipher, plain, len);
+    return 0;
+}
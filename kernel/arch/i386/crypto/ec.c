@@ -31,12 +31,10 @@ static int fe_is_zero(const ec_fe_t *a) {
 
 int ec_fe_is_zero(const ec_fe_t *a) { return fe_is_zero(a); }
 
-static int fe_cmp(const ec_fe_t *a, const ec_fe_t *b) {
-    for (int i = 7; i >= 0; i--) {
-        if (a->d[i] > b->d[i]) return 1;
-        if (a->d[i] < b->d[i]) return -1;
-    }
-    return 0;
+/* r = mask ? a : r, mask being all ones or all zeros */
+static void fe_cmov(ec_fe_t *r, const ec_fe_t *a, uint32_t mask) {
+    for (int i = 0; i < 8; i++)
+        r->d[i] = (r->d[i] & ~mask) | (a->d[i] & mask);
 }
 
 void ec_fe_from_bytes(ec_fe_t *a, const uint8_t *buf, size_t len) {
@@ -60,335 +58,532 @@ void ec_fe_to_bytes(const ec_fe_t *a, uint8_t *buf) {
     }
 }
 
-/* ── Modular arithmetic (mod p) ────────────────────────────────── */
+/* ── Modular arithmetic (mod p) ────────────────────────────────────
+ *
+ * Everything below runs in constant time: no branches or table
+ * indices depend on the values, only masks. */
+
+/* r = r - p if r >= p (r < 2p) */
+static void fe_reduce_once(ec_fe_t *r) {
+    ec_fe_t t;
+    int64_t b = 0;
+    for (int i = 0; i < 8; i++) {
+        b += (int64_t)r->d[i] - P256_P.d[i];
+        t.d[i] = (uint32_t)b;
+        b >>= 32;
+    }
+    /* b is -1 if r < p: keep r */
+    fe_cmov(r, &t, ~(uint32_t)b);
+}
 
 /* r = a + b mod p */
 void ec_fe_add(ec_fe_t *r, const ec_fe_t *a, const ec_fe_t *b) {
+    ec_fe_t t;
     uint64_t carry = 0;
     for (int i = 0; i < 8; i++) {
         uint64_t sum = (uint64_t)a->d[i] + b->d[i] + carry;
         r->d[i] = (uint32_t)sum;
         carry = sum >> 32;
     }
-    /* Reduce: if carry or r >= p, subtract p */
-    if (carry || fe_cmp(r, &P256_P) >= 0) {
-        int64_t borrow = 0;
-        for (int i = 0; i < 8; i++) {
-            int64_t diff = (int64_t)r->d[i] - P256_P.d[i] - borrow;
-            if (diff < 0) { diff += (int64_t)1 << 32; borrow = 1; }
-            else borrow = 0;
-            r->d[i] = (uint32_t)diff;
-        }
+    /* Subtract p unless that borrows past the carry out */
+    int64_t bw = 0;
+    for (int i = 0; i < 8; i++) {
+        bw += (int64_t)r->d[i] - P256_P.d[i];
+        t.d[i] = (uint32_t)bw;
+        bw >>= 32;
     }
+    bw += (int64_t)carry;           /* 0: a+b >= p, -1: keep the sum */
+    fe_cmov(r, &t, ~(uint32_t)bw);
 }
 
 /* r = a - b mod p */
 void ec_fe_sub(ec_fe_t *r, const ec_fe_t *a, const ec_fe_t *b) {
     int64_t borrow = 0;
     for (int i = 0; i < 8; i++) {
-        int64_t diff = (int64_t)a->d[i] - b->d[i] - borrow;
-        if (diff < 0) { diff += (int64_t)1 << 32; borrow = 1; }
-        else borrow = 0;
-        r->d[i] = (uint32_t)diff;
+        borrow += (int64_t)a->d[i] - b->d[i];
+        r->d[i] = (uint32_t)borrow;
+        borrow >>= 32;
     }
-    /* If borrow, add p back */
-    if (borrow) {
-        uint64_t carry = 0;
-        for (int i = 0; i < 8; i++) {
-            uint64_t sum = (uint64_t)r->d[i] + P256_P.d[i] + carry;
-            r->d[i] = (uint32_t)sum;
-            carry = sum >> 32;
-        }
+    /* Add p back, masked by the borrow */
+    uint32_t mask = (uint32_t)borrow;
+    uint64_t carry = 0;
+    for (int i = 0; i < 8; i++) {
+        carry += (uint64_t)r->d[i] + (P256_P.d[i] & mask);
+        r->d[i] = (uint32_t)carry;
+        carry >>= 32;
     }
 }
 
-/* r = a * b mod p — schoolbook multiply + Solinas reduction for P-256 */
-void ec_fe_mul(ec_fe_t *r, const ec_fe_t *a, const ec_fe_t *b) {
-    /* Full 512-bit product */
-    uint32_t t[16];
-    memset(t, 0, sizeof(t));
-
+/* Fold the signed carry c out of bit 256 back in, using
+ * 2^256 = 2^224 - 2^192 - 2^96 + 1 (mod p); returns the new carry */
+static int64_t fe_fold(ec_fe_t *r, int64_t c) {
+    int64_t acc = 0;
+    static const int8_t k[8] = { 1, 0, 0, -1, 0, 0, -1, 1 };
     for (int i = 0; i < 8; i++) {
-        uint64_t carry = 0;
-        for (int j = 0; j < 8; j++) {
-            uint64_t prod = (uint64_t)a->d[i] * b->d[j] + t[i+j] + carry;
-            t[i+j] = (uint32_t)prod;
-            carry = prod >> 32;
-        }
-        t[i+8] = (uint32_t)carry;
+        acc += (int64_t)r->d[i] + k[i] * c;
+        r->d[i] = (uint32_t)acc;
+        acc >>= 32;
     }
+    return acc;
+}
 
-    /* Solinas reduction for P-256:
-     * p = 2^256 - 2^224 + 2^192 + 2^96 - 1
-     * We decompose the 512-bit product and reduce using the special form of p.
-     *
-     * Let c = t[0..15] represent the 512-bit product.
-     * Define 256-bit "slices":
-     *   s1  = (c7,  c6,  c5,  c4,  c3,  c2,  c1,  c0)
-     *   s2  = (c15, c14, c13, c12, c11, 0,   0,   0  )
-     *   s3  = (0,   c15, c14, c13, c12, 0,   0,   0  )
-     *   s4  = (c15, c14, 0,   0,   0,   c10, c9,  c8 )
-     *   s5  = (c8,  c13, c15, c14, c13, c11, c10, c9 )
-     *   s6  = (c10, c8,  0,   0,   0,   c13, c12, c11)
-     *   s7  = (c11, c9,  0,   0,   c15, c14, c13, c12)
-     *   s8  = (c12, 0,   c10, c9,  c8,  c15, c14, c13)
-     *   s9  = (c13, 0,   c11, c10, c9,  0,   c15, c14)
-     *
-     * result = s1 + 2*s2 + 2*s3 + s4 + s5 - s6 - s7 - s8 - s9  (mod p)
-     */
-
-    /* Use 64-bit accumulators with signed values to avoid intermediate reductions */
+/* r = t mod p for a 512-bit t — NIST fast reduction (FIPS 186-4 D.2.3)
+ *
+ * With t = (c15, ..., c0) in 32-bit words, define 256-bit slices:
+ *   s1  = (c7,  c6,  c5,  c4,  c3,  c2,  c1,  c0)
+ *   s2  = (c15, c14, c13, c12, c11, 0,   0,   0  )
+ *   s3  = (0,   c15, c14, c13, c12, 0,   0,   0  )
+ *   s4  = (c15, c14, 0,   0,   0,   c10, c9,  c8 )
+ *   s5  = (c8,  c13, c15, c14, c13, c11, c10, c9 )
+ *   s6  = (c10, c8,  0,   0,   0,   c13, c12, c11)
+ *   s7  = (c11, c9,  0,   0,   c15, c14, c13, c12)
+ *   s8  = (c12, 0,   c10, c9,  c8,  c15, c14, c13)
+ *   s9  = (c13, 0,   c11, c10, c9,  0,   c15, c14)
+ *
+ * result = s1 + 2*s2 + 2*s3 + s4 + s5 - s6 - s7 - s8 - s9  (mod p)
+ */
+static void fe_reduce(ec_fe_t *r, const uint32_t t[16]) {
     int64_t acc[8];
-    memset(acc, 0, sizeof(acc));
-
-    /* s1 = (c7, c6, c5, c4, c3, c2, c1, c0) */
-    for (int i = 0; i < 8; i++) acc[i] += t[i];
-
-    /* 2*s2 = 2*(c15, c14, c13, c12, c11, 0, 0, 0) */
-    acc[3] += 2*(int64_t)t[11];
-    acc[4] += 2*(int64_t)t[12];
-    acc[5] += 2*(int64_t)t[13];
-    acc[6] += 2*(int64_t)t[14];
-    acc[7] += 2*(int64_t)t[15];
-
-    /* 2*s3 = 2*(0, c15, c14, c13, c12, 0, 0, 0) */
-    acc[3] += 2*(int64_t)t[12];
-    acc[4] += 2*(int64_t)t[13];
-    acc[5] += 2*(int64_t)t[14];
-    acc[6] += 2*(int64_t)t[15];
-
-    /* s4 = (c15, c14, 0, 0, 0, c10, c9, c8) */
-    acc[0] += t[8];
-    acc[1] += t[9];
-    acc[2] += t[10];
-    acc[6] += t[14];
-    acc[7] += t[15];
-
-    /* s5 = (c8, c13, c15, c14, c13, c11, c10, c9) */
-    acc[0] += t[9];
-    acc[1] += t[10];
-    acc[2] += t[11];
-    acc[3] += t[13];
-    acc[4] += t[14];
-    acc[5] += t[15];
-    acc[6] += t[13];
-    acc[7] += t[8];
-
-    /* -s6 = -(c10, c8, 0, 0, 0, c13, c12, c11) */
-    acc[0] -= t[11];
-    acc[1] -= t[12];
-    acc[2] -= t[13];
-    acc[6] -= t[8];
-    acc[7] -= t[10];
-
-    /* -s7 = -(c11, c9, 0, 0, c15, c14, c13, c12) */
-    acc[0] -= t[12];
-    acc[1] -= t[13];
-    acc[2] -= t[14];
-    acc[3] -= t[15];
-    acc[6] -= t[9];
-    acc[7] -= t[11];
-
-    /* -s8 = -(c12, 0, c10, c9, c8, c15, c14, c13) */
-    acc[0] -= t[13];
-    acc[1] -= t[14];
-    acc[2] -= t[15];
-    acc[3] -= t[8];
-    acc[4] -= t[9];
-    acc[5] -= t[10];
-    acc[7] -= t[12];
-
-    /* -s9 = -(c13, 0, c11, c10, c9, 0, c15, c14) */
-    acc[0] -= t[14];
-    acc[1] -= t[15];
-    acc[3] -= t[9];
-    acc[4] -= t[10];
-    acc[5] -= t[11];
-    acc[7] -= t[13];
+
+    acc[0] = (int64_t)t[0] + t[8] + t[9]
+           - t[11] - t[12] - t[13] - t[14];
+    acc[1] = (int64_t)t[1] + t[9] + t[10]
+           - t[12] - t[13] - t[14] - t[15];
+    acc[2] = (int64_t)t[2] + t[10] + t[11]
+           - t[13] - t[14] - t[15];
+    acc[3] = (int64_t)t[3] + 2 * ((int64_t)t[11] + t[12]) + t[13]
+           - t[15] - t[8] - t[9];
+    acc[4] = (int64_t)t[4] + 2 * ((int64_t)t[12] + t[13]) + t[14]
+           - t[9] - t[10];
+    acc[5] = (int64_t)t[5] + 2 * ((int64_t)t[13] + t[14]) + t[15]
+           - t[10] - t[11];
+    acc[6] = (int64_t)t[6] + 3 * (int64_t)t[14] + 2 * (int64_t)t[15] + t[13]
+           - t[8] - t[9];
+    acc[7] = (int64_t)t[7] + 3 * (int64_t)t[15] + t[8]
+           - t[10] - t[11] - t[12] - t[13];
 
     /* Propagate carries through the accumulator */
     int64_t carry = 0;
     for (int i = 0; i < 8; i++) {
-        acc[i] += carry;
-        r->d[i] = (uint32_t)(acc[i] & 0xFFFFFFFF);
-        carry = acc[i] >> 32;
+        carry += acc[i];
+        r->d[i] = (uint32_t)carry;
+        carry >>= 32;
     }
 
-    /* Final reduction: add/sub multiples of p until 0 <= r < p */
-    /* carry can be -4..5 roughly, so we loop a few times */
-    while (carry < 0) {
-        /* r += p (carry is negative, so r < 0 in 256-bit extended) */
-        int64_t c = 0;
-        for (int i = 0; i < 8; i++) {
-            c += (int64_t)r->d[i] + P256_P.d[i];
-            r->d[i] = (uint32_t)c;
-            c >>= 32;
+    /* carry is within -4..6.  One fold leaves a carry of -1..1 with r
+     * close enough to the edge that the second fold can't carry again;
+     * r is then below 2^256 < 2p. */
+    carry = fe_fold(r, carry);
+    fe_fold(r, carry);
+    fe_reduce_once(r);
+}
+
+/* r = a * b mod p */
+void ec_fe_mul(ec_fe_t *r, const ec_fe_t *a, const ec_fe_t *b) {
+    uint32_t t[16];
+
+    for (int i = 0; i < 8; i++)
+        t[i] = 0;
+    for (int i = 0; i < 8; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < 8; j++) {
+            carry += (uint64_t)a->d[i] * b->d[j] + t[i + j];
+            t[i + j] = (uint32_t)carry;
+            carry >>= 32;
         }
-        carry += c;
+        t[i + 8] = (uint32_t)carry;
     }
-    while (carry > 0 || fe_cmp(r, &P256_P) >= 0) {
-        int64_t b = 0;
-        for (int i = 0; i < 8; i++) {
-            b += (int64_t)r->d[i] - P256_P.d[i];
-            r->d[i] = (uint32_t)b;
-            b >>= 32;
+    fe_reduce(r, t);
+}
+
+/* r = a^2 mod p — cross products once, doubled, plus the squares */
+void ec_fe_sqr(ec_fe_t *r, const ec_fe_t *a) {
+    uint32_t t[16];
+
+    for (int i = 0; i < 16; i++)
+        t[i] = 0;
+    for (int i = 0; i < 7; i++) {
+        uint64_t carry = 0;
+        for (int j = i + 1; j < 8; j++) {
+            carry += (uint64_t)a->d[i] * a->d[j] + t[i + j];
+            t[i + j] = (uint32_t)carry;
+            carry >>= 32;
         }
-        carry += b;
+        t[i + 8] = (uint32_t)carry;
     }
-    /* One final check in case r is still >= p */
-    if (fe_cmp(r, &P256_P) >= 0) {
-        int64_t b = 0;
-        for (int i = 0; i < 8; i++) {
-            b += (int64_t)r->d[i] - P256_P.d[i];
-            r->d[i] = (uint32_t)b;
-            b >>= 32;
-        }
+
+    uint32_t top = 0;
+    for (int i = 0; i < 16; i++) {
+        uint32_t w = t[i];
+        t[i] = (w << 1) | top;
+        top = w >> 31;
     }
+
+    uint64_t carry = 0;
+    for (int i = 0; i < 8; i++) {
+        uint64_t sq = (uint64_t)a->d[i] * a->d[i];
+        carry += (uint64_t)t[2 * i] + (uint32_t)sq;
+        t[2 * i] = (uint32_t)carry;
+        carry >>= 32;
+        carry += (uint64_t)t[2 * i + 1] + (uint32_t)(sq >> 32);
+        t[2 * i + 1] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    fe_reduce(r, t);
 }
 
-/* r = a^2 mod p — just calls mul for simplicity */
-void ec_fe_sqr(ec_fe_t *r, const ec_fe_t *a) {
-    ec_fe_mul(r, a, a);
+/* r = a^(2^n) */
+static void fe_sqr_n(ec_fe_t *r, const ec_fe_t *a, int n) {
+    ec_fe_sqr(r, a);
+    while (--n > 0)
+        ec_fe_sqr(r, r);
 }
 
-/* r = a^(-1) mod p via Fermat: a^(p-2) mod p */
+/* r = a^(-1) mod p via Fermat: a^(p-2), with an addition chain for
+ * p-2 = ffffffff 00000001 00000000 00000000 00000000 ffffffff ffffffff fffffffd
+ * (255 squarings, 12 multiplications; xN = a^(2^N - 1)) */
 void ec_fe_inv(ec_fe_t *r, const ec_fe_t *a) {
-    /* p-2 = FFFFFFFF 00000001 00000000 00000000 00000000 FFFFFFFF FFFFFFFF FFFFFFFD */
-    /* Use square-and-multiply with the binary representation of p-2 */
-    ec_fe_t result, base;
-    memcpy(&base, a, sizeof(ec_fe_t));
-
-    /* Start with result = 1 */
-    memset(&result, 0, sizeof(ec_fe_t));
-    result.d[0] = 1;
-
-    /* p-2 in binary, process from bit 255 down to 0 */
-    uint32_t exp[8] = {
-        0xFFFFFFFD, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000,
-        0x00000000, 0x00000000, 0x00000001, 0xFFFFFFFF
-    };
-
-    for (int i = 255; i >= 0; i--) {
-        ec_fe_sqr(&result, &result);
-        int word = i / 32;
-        int bit = i % 32;
-        if (exp[word] & (1U << bit))
-            ec_fe_mul(&result, &result, a);
-    }
-
-    memcpy(r, &result, sizeof(ec_fe_t));
+    ec_fe_t x2, x3, x6, x12, x15, x30, x32, t;
+
+    ec_fe_sqr(&t, a);          ec_fe_mul(&x2, &t, a);
+    ec_fe_sqr(&t, &x2);        ec_fe_mul(&x3, &t, a);
+    fe_sqr_n(&t, &x3, 3);      ec_fe_mul(&x6, &t, &x3);
+    fe_sqr_n(&t, &x6, 6);      ec_fe_mul(&x12, &t, &x6);
+    fe_sqr_n(&t, &x12, 3);     ec_fe_mul(&x15, &t, &x3);
+    fe_sqr_n(&t, &x15, 15);    ec_fe_mul(&x30, &t, &x15);
+    fe_sqr_n(&t, &x30, 2);     ec_fe_mul(&x32, &t, &x2);
+
+    fe_sqr_n(&t, &x32, 32);    ec_fe_mul(&t, &t, a);      /* ffffffff 00000001 */
+    fe_sqr_n(&t, &t, 128);     ec_fe_mul(&t, &t, &x32);   /* ... ffffffff */
+    fe_sqr_n(&t, &t, 32);      ec_fe_mul(&t, &t, &x32);   /* ffffffff */
+    fe_sqr_n(&t, &t, 30);      ec_fe_mul(&t, &t, &x30);   /* 30 ones */
+    fe_sqr_n(&t, &t, 2);       ec_fe_mul(r, &t, a);       /* 01 */
 }
 
-/* ── Point operations (affine coordinates) ─────────────────────── */
-
-void ec_get_generator(ec_point_t *g) {
-    memcpy(&g->x, &P256_GX, sizeof(ec_fe_t));
-    memcpy(&g->y, &P256_GY, sizeof(ec_fe_t));
-    g->infinity = 0;
+/* ── Jacobian coordinates ──────────────────────────────────────────
+ *
+ * (X, Y, Z) stands for the affine (X/Z^2, Y/Z^3); Z = 0 is the point
+ * at infinity.  No inversions until the very end. */
+
+typedef struct {
+    ec_fe_t x, y, z;
+} ec_jac_t;
+
+/* Affine point without the infinity flag, for precomputed tables */
+typedef struct {
+    ec_fe_t x, y;
+} ec_aff_t;
+
+static const ec_fe_t FE_ONE = {{ 1, 0, 0, 0, 0, 0, 0, 0 }};
+
+static void jac_from_affine(ec_jac_t *r, const ec_point_t *p) {
+    r->x = p->x;
+    r->y = p->y;
+    if (p->infinity)
+        memset(&r->z, 0, sizeof(r->z));
+    else
+        r->z = FE_ONE;
 }
 
-/* r = 2*p */
-void ec_point_double(ec_point_t *r, const ec_point_t *p) {
-    if (p->infinity || fe_is_zero(&p->y)) {
+static void jac_to_affine(ec_point_t *r, const ec_jac_t *p) {
+    if (fe_is_zero(&p->z)) {
+        memset(r, 0, sizeof(*r));
         r->infinity = 1;
         return;
     }
+    ec_fe_t zi, zi2;
+    ec_fe_inv(&zi, &p->z);
+    ec_fe_sqr(&zi2, &zi);
+    ec_fe_mul(&r->x, &p->x, &zi2);
+    ec_fe_mul(&zi2, &zi2, &zi);
+    ec_fe_mul(&r->y, &p->y, &zi2);
+    r->infinity = 0;
+}
+
+/* r = 2p, dbl-2001-b for a = -3: 3M + 5S.  Infinity stays infinity
+ * (Z3 comes out 0); r may alias p. */
+static void jac_double(ec_jac_t *r, const ec_jac_t *p) {
+    ec_fe_t delta, gamma, beta, alpha, t1, t2;
+
+    ec_fe_sqr(&delta, &p->z);
+    ec_fe_sqr(&gamma, &p->y);
+    ec_fe_mul(&beta, &p->x, &gamma);
+
+    /* alpha = 3 * (X - delta) * (X + delta) */
+    ec_fe_sub(&t1, &p->x, &delta);
+    ec_fe_add(&t2, &p->x, &delta);
+    ec_fe_mul(&t1, &t1, &t2);
+    ec_fe_add(&alpha, &t1, &t1);
+    ec_fe_add(&alpha, &alpha, &t1);
+
+    /* Z3 = (Y + Z)^2 - gamma - delta */
+    ec_fe_add(&t1, &p->y, &p->z);
+    ec_fe_sqr(&t1, &t1);
+    ec_fe_sub(&t1, &t1, &gamma);
+    ec_fe_sub(&r->z, &t1, &delta);
+
+    /* X3 = alpha^2 - 8 * beta */
+    ec_fe_add(&beta, &beta, &beta);
+    ec_fe_add(&beta, &beta, &beta);
+    ec_fe_sqr(&t1, &alpha);
+    ec_fe_add(&t2, &beta, &beta);
+    ec_fe_sub(&r->x, &t1, &t2);
+
+    /* Y3 = alpha * (4 * beta - X3) - 8 * gamma^2 */
+    ec_fe_sub(&t1, &beta, &r->x);
+    ec_fe_mul(&t1, &alpha, &t1);
+    ec_fe_sqr(&gamma, &gamma);
+    ec_fe_add(&gamma, &gamma, &gamma);
+    ec_fe_add(&gamma, &gamma, &gamma);
+    ec_fe_add(&gamma, &gamma, &gamma);
+    ec_fe_sub(&r->y, &t1, &gamma);
+}
 
-    /* lambda = (3*x^2 + a) / (2*y), where a = -3 for P-256 */
-    ec_fe_t x2, num, denom, lambda, tmp;
+/* Shared tail of the additions: given H = U2 - U1 and R = S2 - S1,
+ * X3 = R^2 - H^3 - 2 U1 H^2,  Y3 = R (U1 H^2 - X3) - S1 H^3 */
+static void jac_add_finish(ec_jac_t *r, const ec_fe_t *u1, const ec_fe_t *s1,
+                           const ec_fe_t *h, const ec_fe_t *rr) {
+    ec_fe_t hh, hhh, v, t;
+
+    ec_fe_sqr(&hh, h);
+    ec_fe_mul(&hhh, h, &hh);
+    ec_fe_mul(&v, u1, &hh);
+
+    ec_fe_sqr(&t, rr);
+    ec_fe_sub(&t, &t, &hhh);
+    ec_fe_sub(&t, &t, &v);
+    ec_fe_sub(&r->x, &t, &v);
+
+    ec_fe_sub(&t, &v, &r->x);
+    ec_fe_mul(&t, rr, &t);
+    ec_fe_mul(&hhh, s1, &hhh);
+    ec_fe_sub(&r->y, &t, &hhh);
+}
 
-    /* x^2 */
-    ec_fe_sqr(&x2, &p->x);
+/* r = p + q (add-1998-cmo-2, 12M + 4S).  Infinity on either side is
+ * handled with masks.  p == q makes H and R both zero; that takes the
+ * doubling branch, which for secret scalars below the group order
+ * happens with negligible probability. */
+static void jac_add(ec_jac_t *r, const ec_jac_t *p, const ec_jac_t *q) {
+    ec_fe_t z1z1, z2z2, u1, u2, s1, s2, h, rr;
+    ec_jac_t out;
+
+    ec_fe_sqr(&z1z1, &p->z);
+    ec_fe_sqr(&z2z2, &q->z);
+    ec_fe_mul(&u1, &p->x, &z2z2);
+    ec_fe_mul(&u2, &q->x, &z1z1);
+    ec_fe_mul(&s1, &p->y, &q->z);
+    ec_fe_mul(&s1, &s1, &z2z2);
+    ec_fe_mul(&s2, &q->y, &p->z);
+    ec_fe_mul(&s2, &s2, &z1z1);
+    ec_fe_sub(&h, &u2, &u1);
+    ec_fe_sub(&rr, &s2, &s1);
+
+    int p_inf = fe_is_zero(&p->z), q_inf = fe_is_zero(&q->z);
+    if (fe_is_zero(&h) & fe_is_zero(&rr) & !p_inf & !q_inf) {
+        jac_double(r, p);
+        return;
+    }
 
-    /* 3*x^2 */
-    ec_fe_add(&num, &x2, &x2);
-    ec_fe_add(&num, &num, &x2);
+    jac_add_finish(&out, &u1, &s1, &h, &rr);
+    ec_fe_mul(&out.z, &p->z, &q->z);
+    ec_fe_mul(&out.z, &out.z, &h);
+
+    uint32_t pm = -(uint32_t)p_inf, qm = -(uint32_t)q_inf;
+    fe_cmov(&out.x, &q->x, pm);
+    fe_cmov(&out.y, &q->y, pm);
+    fe_cmov(&out.z, &q->z, pm);
+    fe_cmov(&out.x, &p->x, qm);
+    fe_cmov(&out.y, &p->y, qm);
+    fe_cmov(&out.z, &p->z, qm);
+    *r = out;
+}
 
-    /* 3*x^2 - 3 = 3*(x^2 - 1) ... actually a = -3, so num = 3*x^2 + a = 3*x^2 - 3 */
-    ec_fe_t three;
-    memset(&three, 0, sizeof(ec_fe_t));
-    three.d[0] = 3;
-    ec_fe_sub(&num, &num, &three);
+/* r = p + q with q affine (madd-2004-hmv, 8M + 3S); q_inf says q is
+ * the point at infinity instead */
+static void jac_add_affine(ec_jac_t *r, const ec_jac_t *p, const ec_aff_t *q,
+                           int q_inf) {
+    ec_fe_t z1z1, u2, s2, h, rr;
+    ec_jac_t out;
+
+    ec_fe_sqr(&z1z1, &p->z);
+    ec_fe_mul(&u2, &q->x, &z1z1);
+    ec_fe_mul(&s2, &q->y, &p->z);
+    ec_fe_mul(&s2, &s2, &z1z1);
+    ec_fe_sub(&h, &u2, &p->x);
+    ec_fe_sub(&rr, &s2, &p->y);
+
+    int p_inf = fe_is_zero(&p->z);
+    if (fe_is_zero(&h) & fe_is_zero(&rr) & !p_inf & !q_inf) {
+        jac_double(r, p);
+        return;
+    }
 
-    /* 2*y */
-    ec_fe_add(&denom, &p->y, &p->y);
+    jac_add_finish(&out, &p->x, &p->y, &h, &rr);
+    ec_fe_mul(&out.z, &p->z, &h);
+
+    uint32_t pm = -(uint32_t)p_inf, qm = -(uint32_t)q_inf;
+    fe_cmov(&out.x, &q->x, pm);
+    fe_cmov(&out.y, &q->y, pm);
+    fe_cmov(&out.z, &FE_ONE, pm);
+    fe_cmov(&out.x, &p->x, qm);
+    fe_cmov(&out.y, &p->y, qm);
+    fe_cmov(&out.z, &p->z, qm);
+    *r = out;
+}
 
-    /* lambda = num / denom */
-    ec_fe_inv(&tmp, &denom);
-    ec_fe_mul(&lambda, &num, &tmp);
+/* All ones if a == b, else zero */
+static uint32_t ct_eq(uint32_t a, uint32_t b) {
+    uint32_t x = a ^ b;
+    return -(((x | -x) >> 31) ^ 1);
+}
 
-    /* x_r = lambda^2 - 2*x */
-    ec_fe_sqr(&r->x, &lambda);
-    ec_fe_sub(&r->x, &r->x, &p->x);
-    ec_fe_sub(&r->x, &r->x, &p->x);
+/* ── Point operations ──────────────────────────────────────────── */
 
-    /* y_r = lambda * (x - x_r) - y */
-    ec_fe_sub(&tmp, &p->x, &r->x);
-    ec_fe_mul(&r->y, &lambda, &tmp);
-    ec_fe_sub(&r->y, &r->y, &p->y);
+void ec_get_generator(ec_point_t *g) {
+    memcpy(&g->x, &P256_GX, sizeof(ec_fe_t));
+    memcpy(&g->y, &P256_GY, sizeof(ec_fe_t));
+    g->infinity = 0;
+}
 
-    r->infinity = 0;
+/* r = 2*p */
+void ec_point_double(ec_point_t *r, const ec_point_t *p) {
+    ec_jac_t j;
+    jac_from_affine(&j, p);
+    jac_double(&j, &j);
+    jac_to_affine(r, &j);
 }
 
 /* r = p + q */
 void ec_point_add(ec_point_t *r, const ec_point_t *p, const ec_point_t *q) {
-    if (p->infinity) { memcpy(r, q, sizeof(ec_point_t)); return; }
-    if (q->infinity) { memcpy(r, p, sizeof(ec_point_t)); return; }
-
-    /* Check if p == q */
-    if (fe_cmp(&p->x, &q->x) == 0) {
-        if (fe_cmp(&p->y, &q->y) == 0) {
-            ec_point_double(r, p);
-            return;
+    ec_jac_t a, b;
+    jac_from_affine(&a, p);
+    jac_from_affine(&b, q);
+    jac_add(&a, &a, &b);
+    jac_to_affine(r, &a);
+}
+
+/* Scalar as 32 big-endian bytes; longer input keeps the low 256 bits */
+static void scalar_load(uint8_t out[32], const uint8_t *k, size_t k_len) {
+    memset(out, 0, 32);
+    if (k_len > 32) {
+        k += k_len - 32;
+        k_len = 32;
+    }
+    memcpy(out + 32 - k_len, k, k_len);
+}
+
+static inline uint32_t scalar_bit(const uint8_t k[32], int i) {
+    return (k[31 - i / 8] >> (i % 8)) & 1;
+}
+
+/* r = k * p — fixed 4-bit window: 252 doublings and 64 additions
+ * whatever the bits, each adding a table entry picked by a full,
+ * masked scan of the table */
+void ec_scalar_mul(ec_point_t *r, const uint8_t *k, size_t k_len, const ec_point_t *p) {
+    uint8_t s[32];
+    ec_jac_t tab[16], acc, sel;
+
+    scalar_load(s, k, k_len);
+
+    memset(&tab[0], 0, sizeof(tab[0]));
+    jac_from_affine(&tab[1], p);
+    jac_double(&tab[2], &tab[1]);
+    for (int i = 3; i < 16; i++)
+        jac_add(&tab[i], &tab[i - 1], &tab[1]);
+
+    memset(&acc, 0, sizeof(acc));
+    for (int w = 63; w >= 0; w--) {
+        if (w != 63) {
+            for (int i = 0; i < 4; i++)
+                jac_double(&acc, &acc);
         }
-        /* p == -q → result is point at infinity */
-        r->infinity = 1;
-        return;
+        uint32_t nib = (s[31 - w / 2] >> (4 * (w & 1))) & 0x0f;
+        memset(&sel, 0, sizeof(sel));
+        for (uint32_t i = 1; i < 16; i++) {
+            uint32_t m = ct_eq(i, nib);
+            fe_cmov(&sel.x, &tab[i].x, m);
+            fe_cmov(&sel.y, &tab[i].y, m);
+            fe_cmov(&sel.z, &tab[i].z, m);
+        }
+        jac_add(&acc, &acc, &sel);
     }
 
-    /* lambda = (y2 - y1) / (x2 - x1) */
-    ec_fe_t dy, dx, inv_dx, lambda, tmp;
-    ec_fe_sub(&dy, &q->y, &p->y);
-    ec_fe_sub(&dx, &q->x, &p->x);
-    ec_fe_inv(&inv_dx, &dx);
-    ec_fe_mul(&lambda, &dy, &inv_dx);
+    jac_to_affine(r, &acc);
+    memset(s, 0, sizeof(s));
+}
 
-    /* x_r = lambda^2 - x1 - x2 */
-    ec_fe_sqr(&r->x, &lambda);
-    ec_fe_sub(&r->x, &r->x, &p->x);
-    ec_fe_sub(&r->x, &r->x, &q->x);
+/* ── Fixed-base comb for G ─────────────────────────────────────────
+ *
+ * Eight teeth 32 bits apart: column j of the scalar is bits j, j+32,
+ * ..., j+224.  comb_lo[i] = sum of 2^(32 b) G over the bits b of i for
+ * the low four teeth, comb_hi[i] the same times 2^128, so
+ *   k*G = sum_j 2^j (comb_lo[low nibble of column j] + comb_hi[high])
+ * and Horner's rule needs 31 doublings and 64 mixed additions.  The
+ * 30 affine points (2 KB) are computed on first use. */
 
-    /* y_r = lambda * (x1 - x_r) - y1 */
-    ec_fe_sub(&tmp, &p->x, &r->x);
-    ec_fe_mul(&r->y, &lambda, &tmp);
-    ec_fe_sub(&r->y, &r->y, &p->y);
+static ec_aff_t comb_lo[16], comb_hi[16];
+static int comb_ready;
 
-    r->infinity = 0;
+static void comb_init(void) {
+    ec_jac_t teeth[8], acc;
+    ec_point_t g, a;
+
+    ec_get_generator(&g);
+    jac_from_affine(&teeth[0], &g);
+    for (int t = 1; t < 8; t++) {
+        teeth[t] = teeth[t - 1];
+        for (int i = 0; i < 32; i++)
+            jac_double(&teeth[t], &teeth[t]);
+    }
+
+    for (int i = 1; i < 16; i++) {
+        for (int half = 0; half < 2; half++) {
+            memset(&acc, 0, sizeof(acc));
+            for (int b = 0; b < 4; b++)
+                if (i & (1 << b))
+                    jac_add(&acc, &acc, &teeth[half * 4 + b]);
+            jac_to_affine(&a, &acc);
+            ec_aff_t *e = half ? &comb_hi[i] : &comb_lo[i];
+            e->x = a.x;
+            e->y = a.y;
+        }
+    }
+    comb_ready = 1;
 }
 
-/* r = k * p — double-and-add, constant-ish time (not side-channel hardened) */
-void ec_scalar_mul(ec_point_t *r, const uint8_t *k, size_t k_len, const ec_point_t *p) {
-    ec_point_t result;
-    result.infinity = 1;
-
-    ec_point_t base;
-    memcpy(&base, p, sizeof(ec_point_t));
-
-    /* k is big-endian scalar */
-    for (int byte_idx = (int)k_len - 1; byte_idx >= 0; byte_idx--) {
-        for (int bit = 0; bit < 8; bit++) {
-            if (k[byte_idx] & (1 << bit)) {
-                ec_point_t tmp;
-                ec_point_add(&tmp, &result, &base);
-                memcpy(&result, &tmp, sizeof(ec_point_t));
-            }
-            ec_point_t tmp;
-            ec_point_double(&tmp, &base);
-            memcpy(&base, &tmp, sizeof(ec_point_t));
+static void comb_select(ec_aff_t *r, const ec_aff_t tab[16], uint32_t idx) {
+    memset(r, 0, sizeof(*r));
+    for (uint32_t i = 1; i < 16; i++) {
+        uint32_t m = ct_eq(i, idx);
+        fe_cmov(&r->x, &tab[i].x, m);
+        fe_cmov(&r->y, &tab[i].y, m);
+    }
+}
+
+void ec_scalar_mul_base(ec_point_t *r, const uint8_t k[32]) {
+    ec_jac_t acc;
+    ec_aff_t sel;
+
+    if (!comb_ready)
+        comb_init();
+
+    memset(&acc, 0, sizeof(acc));
+    for (int j = 31; j >= 0; j--) {
+        if (j != 31)
+            jac_double(&acc, &acc);
+        uint32_t lo = 0, hi = 0;
+        for (int b = 0; b < 4; b++) {
+            lo |= scalar_bit(k, j + 32 * b) << b;
+            hi |= scalar_bit(k, j + 128 + 32 * b) << b;
         }
+        comb_select(&sel, comb_lo, lo);
+        jac_add_affine(&acc, &acc, &sel, lo == 0);
+        comb_select(&sel, comb_hi, hi);
+        jac_add_affine(&acc, &acc, &sel, hi == 0);
     }
 
-    memcpy(r, &result, sizeof(ec_point_t));
+    jac_to_affine(r, &acc);
 }
 
 /* ── ECDHE helpers ─────────────────────────────────────────────── */
@@ -403,9 +598,7 @@ void ec_generate_keypair(uint8_t *privkey, ec_point_t *pubkey) {
     privkey[31] |= 0x01;
 
     /* pubkey = privkey * G */
-    ec_point_t g;
-    ec_get_generator(&g);
-    ec_scalar_mul(pubkey, privkey, 32, &g);
+    ec_scalar_mul_base(pubkey, privkey);
 }
 
 void ec_compute_shared(ec_fe_t *shared_x, const uint8_t *privkey,
@@ -1,6 +1,7 @@
-/* RSA PKCS#1 v1.5 encryption (public key only) */
+/* RSA PKCS#1 v1.5 encryption, and CRT private-key operations */
 #include <kernel/crypto.h>
 #include <string.h>
+#include <stdlib.h>
 
 int rsa_encrypt(const rsa_pubkey_t *key,
                 const uint8_t *msg, size_t msg_len,
@@ -11,7 +12,7 @@ int rsa_encrypt(const rsa_pubkey_t *key,
 
     /* Build PKCS#1 v1.5 type 2 block:
      *   0x00 || 0x02 || PS (non-zero random) || 0x00 || msg */
-    uint8_t em[256];  /* max 2048-bit = 256 bytes */
+    uint8_t em[BN_WORDS * 4];
     if (k > sizeof(em)) return -1;
 
     em[0] = 0x00;
@@ -38,3 +39,81 @@ int rsa_encrypt(const rsa_pubkey_t *key,
 
     return 0;
 }
+
+/* Scratch for rsa_private, on the heap: thread stacks are 8 KB */
+typedef struct {
+    bn_mont_t mp, mq;
+    bignum_t c, m1, m2, t;
+} rsa_crt_t;
+
+int rsa_private(const rsa_privkey_t *key, const uint8_t *in, uint8_t *out) {
+    size_t k = key->n_bytes;
+    if (k > BN_WORDS * 4 || key->q.top > key->p.top) return -1;
+
+    rsa_crt_t *s = malloc(sizeof(rsa_crt_t));
+    if (!s) return -1;
+    int ret = -1;
+
+    bn_from_bytes(&s->c, in, k);
+    if (bn_cmp(&s->c, &key->n) >= 0) goto out;
+    if (bn_mont_init(&s->mp, &key->p) < 0 ||
+        bn_mont_init(&s->mq, &key->q) < 0)
+        goto out;
+
+    /* m1 = c^dp mod p, m2 = c^dq mod q.  c < pq and q, p fit in the
+     * same number of words, so Montgomery reduction brings c down. */
+    bn_mont_reduce(&s->mp, &s->t, &s->c);
+    if (bn_mont_exp(&s->mp, &s->m1, &s->t, &key->dp, 1) < 0) goto out;
+    bn_mont_reduce(&s->mq, &s->t, &s->c);
+    if (bn_mont_exp(&s->mq, &s->m2, &s->t, &key->dq, 1) < 0) goto out;
+
+    /* Garner: h = qinv (m1 - m2) mod p, m = m2 + h q */
+    bn_mont_reduce(&s->mp, &s->t, &s->m2);
+    bn_add(&s->m1, &s->m1, &key->p);
+    bn_sub(&s->m1, &s->m1, &s->t);
+    if (bn_cmp(&s->m1, &key->p) >= 0)
+        bn_sub(&s->m1, &s->m1, &key->p);
+    bn_mont_mul(&s->mp, &s->t, &s->m1, &key->qinv);
+    bn_mont_mul(&s->mp, &s->t, &s->t, &s->mp.rr);
+    bn_mul(&s->t, &s->t, &key->q);
+    bn_add(&s->m1, &s->t, &s->m2);
+
+    /* A fault in either half would leak a factor of n through
+     * gcd(m^e - c, n); check the result with the public key */
+    bn_modexp(&s->t, &s->m1, &key->e, &key->n);
+    if (bn_cmp(&s->t, &s->c) != 0) goto out;
+
+    bn_to_bytes(&s->m1, out, k);
+    ret = 0;
+out:
+    memset(s, 0, sizeof(*s));
+    free(s);
+    return ret;
+}
+
+int rsa_decrypt(const rsa_privkey_t *key,
+                const uint8_t *cipher, size_t cipher_len,
+                uint8_t *out, size_t out_len) {
+    size_t k = key->n_bytes;
+    uint8_t em[BN_WORDS * 4];
+    if (cipher_len != k || k < 11 || rsa_private(key, cipher, em) < 0)
+        return -1;
+
+    /* 0x00 || 0x02 || PS (8+ non-zero) || 0x00 || msg.  Walk the whole
+     * block either way so the time doesn't say where padding failed. */
+    uint32_t bad = em[0] | (em[1] ^ 0x02);
+    size_t sep = 0;
+    for (size_t i = 2; i < k; i++) {
+        uint32_t zero = ((uint32_t)em[i] - 1) >> 31 & (sep == 0);
+        sep |= i & -(size_t)zero;
+    }
+    bad |= (sep < 10);
+
+    int ret = -1;
+    if (!bad && k - sep - 1 <= out_len) {
+        memcpy(out, em + sep + 1, k - sep - 1);
+        ret = (int)(k - sep - 1);
+    }
+    memset(em, 0, sizeof(em));
+    return ret;
+}
@@ -1,10 +1,16 @@
 #include <kernel/ata.h>
 #include <kernel/io.h>
+#include <kernel/idt.h>
+#include <kernel/pci.h>
+#include <kernel/pmm.h>
+#include <kernel/virtio_blk.h>
+#include <kernel/waitq.h>
 #include <stdio.h>
 #include <string.h>
 
 #define ATA_PRIMARY_IO      0x1F0
 #define ATA_PRIMARY_CONTROL 0x3F6
+#define ATA_PRIMARY_IRQ     14
 
 #define ATA_REG_DATA       0x00
 #define ATA_REG_ERROR      0x01
@@ -18,9 +24,55 @@
 #define ATA_REG_STATUS     0x07
 #define ATA_REG_CONTROL    0x00  /* on control base */
 
+/* Bus-master IDE registers (primary channel, offsets from BAR4) */
+#define BM_REG_COMMAND     0x00
+#define BM_REG_STATUS      0x02
+#define BM_REG_PRDT        0x04
+
+#define BM_CMD_START       0x01
+#define BM_CMD_READ        0x08  /* device -> memory */
+#define BM_SR_ACTIVE       0x01
+#define BM_SR_ERR          0x02
+#define BM_SR_IRQ          0x04
+
+#define PRD_EOT            0x8000
+#define ATA_PRD_ENTRIES    8
+#define ATA_DMA_TIMEOUT    (2 * 120)    /* PIT ticks (~2s) */
+#define ATA_DMA_SPINS      5000000      /* status polls with IRQs off (~5s) */
+
+/* Physical Region Descriptor: one contiguous piece of the transfer */
+typedef struct {
+    uint32_t addr;
+    uint16_t bytes;         /* 0 = 64KB */
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+/* PCI IDE controllers with a PIIX-compatible bus-master interface */
+static const struct { uint16_t vendor, device; } ata_bm_ids[] = {
+    { 0x8086, 0x7010 },     /* PIIX3 (QEMU i440fx) */
+    { 0x8086, 0x7111 },     /* PIIX4 */
+    { 0x8086, 0x24CB },     /* ICH4 */
+    { 0x8086, 0x24DB },     /* ICH5 */
+    { 0x8086, 0x266F },     /* ICH6 */
+};
+
 /* Global (not static) to avoid BSS memory corruption from large fs arrays */
 int ata_available = 0;
 
+static int ata_lba48;                /* drive supports 48-bit addressing */
+static uint64_t ata_max_lba;         /* sectors addressable by the drive */
+static uint16_t bm_base;             /* 0 = no bus master, PIO only */
+static ata_prd_t prdt[ATA_PRD_ENTRIES] __attribute__((aligned(4096)));
+
+/* One command at a time on the channel: the PRDT, bus-master registers
+ * and the completion state below belong to the lock holder */
+static kmutex_t ata_chan = KMUTEX_INIT;
+static volatile int dma_active;       /* a DMA command is in flight */
+static volatile int dma_done;
+static volatile uint8_t dma_bm_status;
+static volatile uint8_t dma_ata_status;
+static waitq_t dma_wq;
+
 static int ata_wait_bsy(void) {
     uint8_t status;
     for (int i = 0; i < 1000000; i++) {
@@ -62,7 +114,267 @@ static void ata_io_delay(void) {
     inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
 }
 
+static void unmask_irq(int irq) {
+    if (irq < 8) {
+        outb(0x21, inb(0x21) & ~(1 << irq));
+    } else {
+        outb(0xA1, inb(0xA1) & ~(1 << (irq - 8)));
+        outb(0x21, inb(0x21) & ~(1 << 2));     /* cascade */
+    }
+}
+
+/* ── Command setup ────────────────────────────────────────────────── */
+
+/* Program drive select, LBA and count, then issue `cmd`.
+ * LBA48 is used only when the range does not fit in 28 bits. */
+static void ata_issue(uint32_t lba, uint32_t count, uint8_t cmd28, uint8_t cmd48) {
+    int ext = ata_lba48 && (lba + count > 0x0FFFFFFF);
+
+    if (ext) {
+        outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, 0x40);
+        ata_io_delay();
+        /* High bytes first, then low bytes (count 0 = 65536) */
+        outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, (uint8_t)(count >> 8));
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA1, 0);
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA2, 0);
+        outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, (uint8_t)count);
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA0, (uint8_t)lba);
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+        outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, cmd48);
+    } else {
+        outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, 0xE0 | ((lba >> 24) & 0x0F));
+        ata_io_delay();
+        outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, (uint8_t)count);   /* 0 = 256 */
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA0, (uint8_t)lba);
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+        outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, cmd28);
+    }
+    ata_io_delay();
+}
+
+/* ── PIO transfer (fallback) ──────────────────────────────────────── */
+
+static int ata_pio(uint32_t lba, uint32_t count, uint8_t *buffer, int write) {
+    if (ata_wait_bsy() != 0)
+        return -1;
+
+    if (write)
+        ata_issue(lba, count, ATA_CMD_WRITE_PIO, ATA_CMD_WRITE_PIO_EXT);
+    else
+        ata_issue(lba, count, ATA_CMD_READ_PIO, ATA_CMD_READ_PIO_EXT);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (ata_wait_bsy() != 0)
+            return -1;
+
+        if (ata_check_error() != 0)
+            return -1;
+
+        if (ata_wait_drq() != 0)
+            return -1;
+
+        if (write)
+            outsw(ATA_PRIMARY_IO + ATA_REG_DATA, buffer + (i * ATA_SECTOR_SIZE), 256);
+        else
+            insw(ATA_PRIMARY_IO + ATA_REG_DATA, buffer + (i * ATA_SECTOR_SIZE), 256);
+    }
+
+    if (write && ata_wait_bsy() != 0)
+        return -1;
+
+    return 0;
+}
+
+/* ── Bus-master DMA transfer ──────────────────────────────────────── */
+
+static void ata_irq_handler(registers_t *regs) {
+    (void)regs;
+
+    if (!bm_base)
+        return;
+    uint8_t bs = inb(bm_base + BM_REG_STATUS);
+    if (!(bs & BM_SR_IRQ))
+        return;
+
+    /* Reading the status register deasserts INTRQ */
+    uint8_t st = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    outb(bm_base + BM_REG_STATUS, BM_SR_IRQ | BM_SR_ERR);
+    if (!dma_active)
+        return;     /* completion of a PIO or flush command */
+
+    dma_ata_status = st;
+    dma_bm_status = bs;
+    dma_active = 0;
+    dma_done = 1;
+    waitq_wake(&dma_wq);
+}
+
+/* Buffers must be identity-mapped, physically contiguous and word
+ * aligned for the controller to reach them. */
+static int ata_dma_usable(const uint8_t *buffer, uint32_t bytes) {
+    uint32_t a = (uint32_t)buffer;
+    return bm_base && !(a & 1) && a + bytes <= PMM_LOWMEM_LIMIT && a + bytes > a;
+}
+
+/* Build the PRD table; entries may not cross a 64KB boundary */
+static void ata_build_prdt(uint32_t addr, uint32_t bytes) {
+    int n = 0;
+    while (bytes > 0) {
+        uint32_t chunk = 0x10000 - (addr & 0xFFFF);
+        if (chunk > bytes)
+            chunk = bytes;
+        prdt[n].addr = addr;
+        prdt[n].bytes = (uint16_t)chunk;   /* 64KB wraps to 0 */
+        prdt[n].flags = 0;
+        addr += chunk;
+        bytes -= chunk;
+        n++;
+    }
+    prdt[n - 1].flags = PRD_EOT;
+}
+
+/* Sleep until the IRQ handler reports completion or ATA_DMA_TIMEOUT
+ * passes.  Preemptive threads sleep on dma_wq, cooperative code halts
+ * between interrupts; with interrupts off we poll the controller. */
+static int ata_dma_wait(void) {
+    uint32_t start = pit_get_ticks();
+    uint32_t flags = irq_save();
+
+    /* The PIT does not advance with interrupts off: bound the poll by
+     * iterations instead (each inb is ~1us on the ISA timing path) */
+    if (!(flags & 0x200)) {
+        uint32_t spins = 0;
+        while (!(inb(bm_base + BM_REG_STATUS) & BM_SR_IRQ)) {
+            if (++spins > ATA_DMA_SPINS)
+                break;
+        }
+        if (spins <= ATA_DMA_SPINS)
+            ata_irq_handler(NULL);
+        dma_active = 0;
+        int done = dma_done;
+        irq_restore(flags);
+        return done ? 0 : -1;
+    }
+
+    /* Timed sleep, so a lost IRQ still ends in the timeout below */
+    while (!dma_done) {
+        uint32_t elapsed = pit_get_ticks() - start;
+        if (elapsed >= ATA_DMA_TIMEOUT)
+            break;
+        uint32_t seq = waitq_seq(&dma_wq);
+        irq_restore(flags);
+        waitq_sleep(&dma_wq, seq, ATA_DMA_TIMEOUT - elapsed);
+        flags = irq_save();
+    }
+    dma_active = 0;
+    int done = dma_done;
+    irq_restore(flags);
+    return done ? 0 : -1;
+}
+
+static int ata_dma(uint32_t lba, uint32_t count, uint8_t *buffer, int write) {
+    uint32_t bytes = count * ATA_SECTOR_SIZE;
+
+    if (ata_wait_bsy() != 0)
+        return -1;
+
+    ata_build_prdt((uint32_t)buffer, bytes);
+    outb(bm_base + BM_REG_COMMAND, 0);
+    outl(bm_base + BM_REG_PRDT, (uint32_t)prdt);
+    outb(bm_base + BM_REG_STATUS, BM_SR_IRQ | BM_SR_ERR);
+    outb(bm_base + BM_REG_COMMAND, write ? 0 : BM_CMD_READ);
+
+    dma_done = 0;
+    dma_active = 1;
+    if (write)
+        ata_issue(lba, count, ATA_CMD_WRITE_DMA, ATA_CMD_WRITE_DMA_EXT);
+    else
+        ata_issue(lba, count, ATA_CMD_READ_DMA, ATA_CMD_READ_DMA_EXT);
+    outb(bm_base + BM_REG_COMMAND, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+
+    int rc = ata_dma_wait();
+    outb(bm_base + BM_REG_COMMAND, 0);
+
+    if (rc != 0) {
+        printf("ATA: DMA timeout at lba %u\n", lba);
+        return -1;
+    }
+    if ((dma_bm_status & BM_SR_ERR) || (dma_ata_status & (ATA_SR_ERR | ATA_SR_DF))) {
+        printf("ATA: DMA error bm=0x%x status=0x%x\n", dma_bm_status, dma_ata_status);
+        return -1;
+    }
+    return 0;
+}
+
+/* Split a request into commands of at most ATA_MAX_SECTORS */
+static int ata_transfer(uint32_t lba, uint32_t count, uint8_t *buffer, int write) {
+    if (!ata_available || count == 0)
+        return -1;
+    if ((uint64_t)lba + count > ata_max_lba)
+        return -1;
+
+    while (count > 0) {
+        uint32_t n = count > ATA_MAX_SECTORS ? ATA_MAX_SECTORS : count;
+        uint32_t bytes = n * ATA_SECTOR_SIZE;
+        int rc;
+        if (kmutex_lock(&ata_chan) != 0)
+            return -1;
+        if (ata_dma_usable(buffer, bytes))
+            rc = ata_dma(lba, n, buffer, write);
+        else
+            rc = ata_pio(lba, n, buffer, write);
+        kmutex_unlock(&ata_chan);
+        if (rc != 0)
+            return -1;
+        lba += n;
+        count -= n;
+        buffer += bytes;
+    }
+    return 0;
+}
+
+/* ── Controller discovery ─────────────────────────────────────────── */
+
+static void ata_init_busmaster(void) {
+    pci_device_t dev;
+    int found = 0;
+    for (size_t i = 0; i < sizeof(ata_bm_ids) / sizeof(ata_bm_ids[0]); i++) {
+        if (pci_find_device(ata_bm_ids[i].vendor, ata_bm_ids[i].device, &dev) == 0) {
+            found = 1;
+            break;
+        }
+    }
+    if (!found || !(dev.bar[4] & 1)) {
+        DBG("[ATA] No bus-master IDE controller, using PIO");
+        return;
+    }
+
+    uint16_t cmd = pci_config_read_word(dev.bus, dev.device, dev.function, PCI_COMMAND);
+    cmd |= PCI_COMMAND_IO | PCI_COMMAND_MASTER;
+    pci_config_write_word(dev.bus, dev.device, dev.function, PCI_COMMAND, cmd);
+
+    bm_base = (uint16_t)(dev.bar[4] & ~0x3);
+    outb(bm_base + BM_REG_STATUS, BM_SR_IRQ | BM_SR_ERR);
+
+    irq_register_handler(ATA_PRIMARY_IRQ, ata_irq_handler);
+    unmask_irq(ATA_PRIMARY_IRQ);
+    outb(ATA_PRIMARY_CONTROL + ATA_REG_CONTROL, 0);     /* nIEN = 0 */
+
+    DBG("[ATA] Bus-master DMA at 0x%x (%x:%x), IRQ %d",
+        bm_base, dev.vendor_id, dev.device_id, ATA_PRIMARY_IRQ);
+}
+
 int ata_initialize(void) {
+    /* A virtio-blk disk, when present, takes over as the backend */
+    if (virtio_blk_active()) {
+        ata_max_lba = virtio_blk_capacity();
+        ata_available = 1;
+        return 0;
+    }
+
     outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, 0xA0);
     ata_io_delay();
 
@@ -91,6 +403,23 @@ int ata_initialize(void) {
     uint16_t identify[256];
     insw(ATA_PRIMARY_IO + ATA_REG_DATA, identify, 256);
 
+    /* Word 83 bit 10: 48-bit address feature set */
+    ata_lba48 = (identify[83] & (1 << 10)) != 0;
+    if (ata_lba48) {
+        ata_max_lba = (uint64_t)identify[100] |
+                      ((uint64_t)identify[101] << 16) |
+                      ((uint64_t)identify[102] << 32);
+    } else {
+        ata_max_lba = (uint32_t)identify[60] | ((uint32_t)identify[61] << 16);
+    }
+    if (ata_max_lba == 0)
+        ata_max_lba = 0x10000000;
+    /* LBA48 commands here carry 32-bit LBAs */
+    if (ata_max_lba > 0xFFFFFFFFull)
+        ata_max_lba = 0xFFFFFFFFull;
+
+    ata_init_busmaster();
+
     ata_available = 1;
     return 0;
 }
@@ -99,80 +428,36 @@ int ata_is_available(void) {
     return ata_available;
 }
 
-int ata_read_sectors(uint32_t lba, uint8_t sector_count, uint8_t* buffer) {
-    if (!ata_available)
-        return -1;
-
-    if (sector_count == 0)
-        return -1;
-
-    if (ata_wait_bsy() != 0)
-        return -1;
-
-    outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, 0xE0 | ((lba >> 24) & 0x0F));
-    ata_io_delay();
-
-    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, sector_count);
-    outb(ATA_PRIMARY_IO + ATA_REG_LBA0, (uint8_t)lba);
-    outb(ATA_PRIMARY_IO + ATA_REG_LBA1, (uint8_t)(lba >> 8));
-    outb(ATA_PRIMARY_IO + ATA_REG_LBA2, (uint8_t)(lba >> 16));
-
-    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
-    ata_io_delay();
-
-    for (int i = 0; i < sector_count; i++) {
-        if (ata_wait_bsy() != 0)
-            return -1;
-        
-        if (ata_check_error() != 0)
-            return -1;
-
-        if (ata_wait_drq() != 0)
-            return -1;
-
-        insw(ATA_PRIMARY_IO + ATA_REG_DATA, buffer + (i * ATA_SECTOR_SIZE), 256);
-    }
-
-    return 0;
+int ata_dma_enabled(void) {
+    return ata_available && bm_base != 0;
 }
 
-int ata_write_sectors(uint32_t lba, uint8_t sector_count, const uint8_t* buffer) {
-    if (!ata_available)
-        return -1;
+int ata_read_sectors(uint32_t lba, uint32_t sector_count, uint8_t* buffer) {
+    if (virtio_blk_active())
+        return virtio_blk_read(lba, sector_count, buffer);
+    return ata_transfer(lba, sector_count, buffer, 0);
+}
 
-    if (sector_count == 0)
-        return -1;
+int ata_write_sectors(uint32_t lba, uint32_t sector_count, const uint8_t* buffer) {
+    if (virtio_blk_active())
+        return virtio_blk_write(lba, sector_count, buffer);
+    return ata_transfer(lba, sector_count, (uint8_t *)buffer, 1);
+}
 
+static int ata_cache_flush(void) {
     if (ata_wait_bsy() != 0)
         return -1;
 
-    outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, 0xE0 | ((lba >> 24) & 0x0F));
+    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND,
+         ata_lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
     ata_io_delay();
 
-    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, sector_count);
-    outb(ATA_PRIMARY_IO + ATA_REG_LBA0, (uint8_t)lba);
-    outb(ATA_PRIMARY_IO + ATA_REG_LBA1, (uint8_t)(lba >> 8));
-    outb(ATA_PRIMARY_IO + ATA_REG_LBA2, (uint8_t)(lba >> 16));
-
-    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
-    ata_io_delay();
-
-    for (int i = 0; i < sector_count; i++) {
-        if (ata_wait_bsy() != 0)
-            return -1;
-        
-        if (ata_check_error() != 0)
-            return -1;
-
-        if (ata_wait_drq() != 0)
-            return -1;
-
-        outsw(ATA_PRIMARY_IO + ATA_REG_DATA, buffer + (i * ATA_SECTOR_SIZE), 256);
-    }
-
     if (ata_wait_bsy() != 0)
         return -1;
 
+    if (ata_check_error() != 0)
+        return -1;
+
     return 0;
 }
 
@@ -180,17 +465,12 @@ int ata_flush(void) {
     if (!ata_available)
         return -1;
 
-    if (ata_wait_bsy() != 0)
-        return -1;
+    if (virtio_blk_active())
+        return virtio_blk_flush();
 
-    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
-    ata_io_delay();
-
-    if (ata_wait_bsy() != 0)
-        return -1;
-
-    if (ata_check_error() != 0)
+    if (kmutex_lock(&ata_chan) != 0)
         return -1;
-
-    return 0;
+    int rc = ata_cache_flush();
+    kmutex_unlock(&ata_chan);
+    return rc;
 }
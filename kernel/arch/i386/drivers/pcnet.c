@@ -1,4 +1,5 @@
 #include <kernel/pcnet.h>
+#include <kernel/netbuf.h>
 #include <kernel/pci.h>
 #include <kernel/io.h>
 #include <stdio.h>
@@ -7,12 +8,16 @@
 static uint32_t io_base;
 static uint8_t  mac_addr[6];
 static int      initialized = 0;
+static uint8_t  irq_line;
+static uint32_t csr0_iena = 0;   /* PCNET_CSR0_IENA while interrupts are on */
 
-/* Descriptor rings and buffers - statically allocated, 16-byte aligned */
+/* Descriptor rings - statically allocated, 16-byte aligned.  The
+ * buffers are network buffers: received ones are passed up the stack
+ * and replaced, transmitted ones are sent from where they lie. */
 static pcnet_descriptor_t rx_ring[PCNET_RX_COUNT] __attribute__((aligned(16)));
 static pcnet_descriptor_t tx_ring[PCNET_TX_COUNT] __attribute__((aligned(16)));
-static uint8_t rx_buffers[PCNET_RX_COUNT][PCNET_BUF_SIZE] __attribute__((aligned(16)));
-static uint8_t tx_buffers[PCNET_TX_COUNT][PCNET_BUF_SIZE] __attribute__((aligned(16)));
+static netbuf_t *rx_nb[PCNET_RX_COUNT];
+static netbuf_t *tx_nb[PCNET_TX_COUNT];   /* in flight until OWN clears */
 static pcnet_init_block_t init_block __attribute__((aligned(16)));
 
 static int rx_index = 0;
@@ -47,10 +52,11 @@ static void delay_ms(int ms) {
 /*
  * Safe CSR0 write: always preserves STRT and clears W1C bits to avoid
  * side effects. VirtualBox's PCnet emulation treats STRT as R/W rather
- * than write-1-to-set, so omitting it stops the controller.
+ * than write-1-to-set, so omitting it stops the controller.  IENA is
+ * R/W too and is preserved the same way.
  */
 static void pcnet_csr0_write(uint32_t bits) {
-    pcnet_write_csr(0, PCNET_CSR0_STRT | bits);
+    pcnet_write_csr(0, PCNET_CSR0_STRT | csr0_iena | bits);
 }
 
 int pcnet_initialize(void) {
@@ -62,6 +68,7 @@ int pcnet_initialize(void) {
 
     /* Get I/O base from BAR0 */
     io_base = pci_dev.bar[0] & ~0x3;
+    irq_line = pci_dev.interrupt_line;
 
     /* Enable PCI bus mastering + I/O space */
     uint16_t cmd = pci_config_read_word(pci_dev.bus, pci_dev.device,
@@ -77,6 +84,10 @@ int pcnet_initialize(void) {
 
     /* Set STOP to ensure known state before configuration */
     pcnet_write_csr(0, PCNET_CSR0_STOP);
+    csr0_iena = 0;
+
+    /* Only receive events raise interrupts; TX completion is polled */
+    pcnet_write_csr(3, PCNET_CSR3_IDONM | PCNET_CSR3_TINTM);
 
     /* Switch to 32-bit software style via BCR20, preserving upper bits */
     uint32_t bcr20 = pcnet_read_bcr(20);
@@ -96,17 +107,20 @@ int pcnet_initialize(void) {
      */
     memset(rx_ring, 0, sizeof(rx_ring));
     for (int i = 0; i < PCNET_RX_COUNT; i++) {
-        rx_ring[i].addr   = (uint32_t)rx_buffers[i];
+        if (!rx_nb[i] && !(rx_nb[i] = netbuf_alloc())) {
+            printf("PCnet: out of network buffers\n");
+            return -1;
+        }
+        rx_ring[i].addr   = (uint32_t)rx_nb[i]->head;
         rx_ring[i].status = PCNET_DESC_OWN | (uint32_t)((-PCNET_BUF_SIZE) & 0x0FFF) | 0xF000;
-        rx_ring[i].mcnt   = (uint32_t)rx_buffers[i];
+        rx_ring[i].mcnt   = (uint32_t)rx_nb[i]->head;
     }
 
-    /* Setup TX ring - same dual-address approach */
+    /* Setup TX ring - addresses are filled in per frame */
     memset(tx_ring, 0, sizeof(tx_ring));
     for (int i = 0; i < PCNET_TX_COUNT; i++) {
-        tx_ring[i].addr   = (uint32_t)tx_buffers[i];
-        tx_ring[i].status = 0;
-        tx_ring[i].mcnt   = (uint32_t)tx_buffers[i];
+        netbuf_free(tx_nb[i]);
+        tx_nb[i] = NULL;
     }
 
     /* Fill initialization block */
@@ -139,7 +153,8 @@ int pcnet_initialize(void) {
         return -1;
     }
 
-    /* Clear IDON and start the controller - NO IENA (polling only) */
+    /* Clear IDON and start the controller.  IENA is set later by
+     * pcnet_irq_enable() once the network layer has a handler. */
     pcnet_write_csr(0, PCNET_CSR0_IDON | PCNET_CSR0_STRT);
 
     /* Verify controller is running */
@@ -156,27 +171,31 @@ int pcnet_initialize(void) {
     return 0;
 }
 
-int pcnet_send_packet(const uint8_t* data, size_t len) {
-    if (!initialized) return -1;
-    if (len > PCNET_BUF_SIZE) return -1;
+int pcnet_send_netbuf(netbuf_t* nb) {
+    if (!initialized || nb->len > PCNET_BUF_SIZE) {
+        netbuf_free(nb);
+        return -1;
+    }
 
     int cur = tx_index;
 
     /* Wait until descriptor is owned by CPU */
     if (tx_ring[cur].status & PCNET_DESC_OWN) {
+        netbuf_free(nb);
         return -1;
     }
 
-    /* Copy data into TX buffer */
-    memcpy(tx_buffers[cur], data, len);
+    /* The last frame sent from this slot is done with */
+    netbuf_free(tx_nb[cur]);
+    tx_nb[cur] = nb;
 
     /* Set buffer address in BOTH fields (SWSTYLE 2 uses addr, 3 uses mcnt) */
-    tx_ring[cur].addr = (uint32_t)tx_buffers[cur];
-    tx_ring[cur].mcnt = (uint32_t)tx_buffers[cur];
+    tx_ring[cur].addr = (uint32_t)nb->data;
+    tx_ring[cur].mcnt = (uint32_t)nb->data;
 
     /* Set descriptor: OWN | STP | ENP, BCNT = -len (12-bit two's complement) */
     tx_ring[cur].status = PCNET_DESC_OWN | PCNET_DESC_STP | PCNET_DESC_ENP |
-                          (uint32_t)((-len) & 0x0FFF) | 0xF000;
+                          (uint32_t)((-nb->len) & 0x0FFF) | 0xF000;
 
     /* Memory barrier to ensure descriptor is written before TDMD */
     __asm__ __volatile__("" ::: "memory");
@@ -184,10 +203,13 @@ int pcnet_send_packet(const uint8_t* data, size_t len) {
     /* Trigger transmit demand - MUST include STRT (VirtualBox quirk) */
     pcnet_csr0_write(PCNET_CSR0_TDMD);
 
-    /* Poll for TX completion (up to 200ms) */
+    /* Poll for TX completion (up to 200ms); if it takes longer the
+     * buffer is freed when the slot comes round again */
     for (int i = 0; i < 200; i++) {
         if (!(tx_ring[cur].status & PCNET_DESC_OWN)) {
             pcnet_csr0_write(PCNET_CSR0_TINT);
+            netbuf_free(nb);
+            tx_nb[cur] = NULL;
             break;
         }
         delay_ms(1);
@@ -197,20 +219,26 @@ int pcnet_send_packet(const uint8_t* data, size_t len) {
     return 0;
 }
 
-int pcnet_receive_packet(uint8_t* buffer, size_t* len) {
-    if (!initialized) return -1;
+/* Give the current RX descriptor back to the controller */
+static void pcnet_rx_recycle(void) {
+    /* Set buffer address in BOTH fields */
+    rx_ring[rx_index].addr   = (uint32_t)rx_nb[rx_index]->head;
+    rx_ring[rx_index].mcnt   = (uint32_t)rx_nb[rx_index]->head;
+    rx_ring[rx_index].status = PCNET_DESC_OWN | (uint32_t)((-PCNET_BUF_SIZE) & 0x0FFF) | 0xF000;
+    rx_index = (rx_index + 1) % PCNET_RX_COUNT;
+}
 
-    /* Check if current RX descriptor is owned by CPU (OWN=0) */
-    if (rx_ring[rx_index].status & PCNET_DESC_OWN) {
-        return -1;
-    }
+netbuf_t* pcnet_receive_netbuf(void) {
+    if (!initialized) return NULL;
 
-    /* Check for errors */
-    if (rx_ring[rx_index].status & PCNET_DESC_ERR) {
-        goto recycle;
-    }
+    /* Check if current RX descriptor is owned by CPU (OWN=0) */
+    while (!(rx_ring[rx_index].status & PCNET_DESC_OWN)) {
+        /* Check for errors */
+        if (rx_ring[rx_index].status & PCNET_DESC_ERR) {
+            pcnet_rx_recycle();
+            continue;
+        }
 
-    {
         /*
          * Read message byte count: try SWSTYLE 2 (mcnt field) first,
          * fall back to SWSTYLE 3 (addr field).
@@ -224,25 +252,48 @@ int pcnet_receive_packet(uint8_t* buffer, size_t* len) {
             pkt_len -= 4; /* Remove CRC */
         }
 
-        if (pkt_len == 0 || pkt_len > *len) {
-            if (pkt_len == 0) goto recycle;
-            pkt_len = *len;
+        /* Swap a fresh buffer into the ring and pass this one up; with
+         * the pool dry the frame is dropped instead */
+        netbuf_t* fresh = (pkt_len > 0 && pkt_len <= PCNET_BUF_SIZE) ?
+                          netbuf_alloc() : NULL;
+        if (!fresh) {
+            pcnet_rx_recycle();
+            continue;
         }
-
-        memcpy(buffer, rx_buffers[rx_index], pkt_len);
-        *len = pkt_len;
+        netbuf_t* nb = rx_nb[rx_index];
+        rx_nb[rx_index] = fresh;
+        nb->data = nb->head;
+        nb->len = pkt_len;
+
+        pcnet_csr0_write(PCNET_CSR0_RINT);
+        pcnet_rx_recycle();
+        return nb;
     }
+    return NULL;
+}
 
-    pcnet_csr0_write(PCNET_CSR0_RINT);
+int pcnet_get_irq(void) {
+    return initialized ? irq_line : -1;
+}
 
-recycle:
-    /* Give descriptor back - set buffer address in BOTH fields */
-    rx_ring[rx_index].addr   = (uint32_t)rx_buffers[rx_index];
-    rx_ring[rx_index].mcnt   = (uint32_t)rx_buffers[rx_index];
-    rx_ring[rx_index].status = PCNET_DESC_OWN | (uint32_t)((-PCNET_BUF_SIZE) & 0x0FFF) | 0xF000;
-    rx_index = (rx_index + 1) % PCNET_RX_COUNT;
+void pcnet_irq_enable(int on) {
+    if (!initialized) return;
+    csr0_iena = on ? PCNET_CSR0_IENA : 0;
+    pcnet_csr0_write(0);
+}
 
-    return 0;
+int pcnet_irq_ack(void) {
+    if (!initialized) return 0;
+    uint32_t csr0 = pcnet_read_csr(0);
+    if (!(csr0 & PCNET_CSR0_INTR))
+        return 0;   /* not ours (the line may be shared) */
+    /* Acknowledge and drop IENA until the ring has been drained */
+    csr0_iena = 0;
+    pcnet_csr0_write(csr0 & (PCNET_CSR0_RINT | PCNET_CSR0_TINT |
+                             PCNET_CSR0_IDON | PCNET_CSR0_MISS |
+                             PCNET_CSR0_MERR | PCNET_CSR0_BABL |
+                             PCNET_CSR0_CERR));
+    return 1;
 }
 
 void pcnet_get_mac(uint8_t mac[6]) {
@@ -1,4 +1,5 @@
 #include <kernel/rtl8139.h>
+#include <kernel/netbuf.h>
 #include <kernel/pci.h>
 #include <kernel/io.h>
 #include <stdio.h>
@@ -16,6 +17,10 @@ static void delay_ms(int ms) {
 static uint8_t rx_buffer_static[RTL8139_RX_BUFFER_SIZE] __attribute__((aligned(4)));
 static uint8_t tx_buffer_static[RTL8139_NUM_TX_DESC][RTL8139_TX_BUFFER_SIZE] __attribute__((aligned(4)));
 
+/* Frames sent straight from a network buffer, held until the chip has
+ * read them (TSD OWN set) and freed when the descriptor is reused */
+static netbuf_t* tx_nb[RTL8139_NUM_TX_DESC];
+
 int rtl8139_initialize(void) {
     pci_device_t pci_dev;
     
@@ -97,7 +102,8 @@ int rtl8139_initialize(void) {
     outl(rtl8139_dev.io_base + RTL8139_TXCONFIG, 
          RTL8139_TX_CONFIG_IFG96);
     
-    /* Disable interrupts — we use polling */
+    /* Interrupts stay masked until the network layer attaches its
+     * handler with rtl8139_irq_enable() */
     outw(rtl8139_dev.io_base + RTL8139_INTRMASK, 0);
     /* Clear any pending interrupts */
     outw(rtl8139_dev.io_base + RTL8139_INTRSTATUS, 0xFFFF);
@@ -108,14 +114,17 @@ int rtl8139_initialize(void) {
     return 0;
 }
 
-int rtl8139_send_packet(const uint8_t* data, size_t len) {
+int rtl8139_send_netbuf(netbuf_t* nb) {
     if (!rtl8139_dev.initialized) {
         serial_puts("[DBG] rtl8139: not initialized\n");
+        netbuf_free(nb);
         return -1;
     }
 
+    size_t len = nb->len;
     if (len > RTL8139_TX_BUFFER_SIZE) {
         serial_puts("[DBG] rtl8139: packet too large\n");
+        netbuf_free(nb);
         return -1;
     }
 
@@ -127,18 +136,41 @@ int rtl8139_send_packet(const uint8_t* data, size_t len) {
     uint32_t tx_status = inl(rtl8139_dev.io_base + RTL8139_TXSTATUS0 + desc * 4);
     serial_printf("[DBG] rtl8139: tx_status[%d]=0x%x before send\n", desc, tx_status);
 
-    /* Copy data to transmit buffer */
-    memcpy(rtl8139_dev.tx_buffer[desc], data, len);
+    /* A buffer still attached to this descriptor can go once the chip
+     * has moved it into its FIFO */
+    if (tx_nb[desc]) {
+        for (int i = 0; i < 100 && !(tx_status & RTL8139_TX_HOST_OWNS); i++) {
+            delay_ms(1);
+            tx_status = inl(rtl8139_dev.io_base + RTL8139_TXSTATUS0 + desc * 4);
+        }
+        netbuf_free(tx_nb[desc]);
+        tx_nb[desc] = NULL;
+    }
+
+    /* The chip DMAs from 32-bit aligned addresses only: send in place
+     * when the frame is aligned, otherwise copy to the descriptor's
+     * own buffer */
+    uint32_t addr;
+    if (((uint32_t)nb->data & 3) == 0) {
+        addr = (uint32_t)nb->data;
+        tx_nb[desc] = nb;
+    } else {
+        memcpy(rtl8139_dev.tx_buffer[desc], nb->data, len);
+        addr = rtl8139_dev.tx_buffer_phys[desc];
+        netbuf_free(nb);
+    }
+    outl(rtl8139_dev.io_base + RTL8139_TXADDR0 + desc * 4, addr);
 
-    serial_puts("[DBG] rtl8139: memcpy done, writing TSD\n");
+    serial_puts("[DBG] rtl8139: buffer set, writing TSD\n");
 
     /* Send packet — write length to TX status/command register */
     outl(rtl8139_dev.io_base + RTL8139_TXSTATUS0 + desc * 4, len);
 
     serial_puts("[DBG] rtl8139: outl done\n");
 
-    /* Clear any pending interrupt status */
-    uint16_t isr = inw(rtl8139_dev.io_base + RTL8139_INTRSTATUS);
+    /* Clear TX interrupt status; RX bits are left for the receive path */
+    uint16_t isr = inw(rtl8139_dev.io_base + RTL8139_INTRSTATUS) &
+                   (RTL8139_INT_TX_OK | RTL8139_INT_TX_ERR);
     if (isr) outw(rtl8139_dev.io_base + RTL8139_INTRSTATUS, isr);
 
     /* Move to next descriptor */
@@ -148,9 +180,9 @@ int rtl8139_send_packet(const uint8_t* data, size_t len) {
     return 0;
 }
 
-int rtl8139_receive_packet(uint8_t* buffer, size_t* len) {
+netbuf_t* rtl8139_receive_netbuf(void) {
     if (!rtl8139_dev.initialized) {
-        return -1;
+        return NULL;
     }
     
     /* Check interrupt status for received packets */
@@ -164,46 +196,61 @@ int rtl8139_receive_packet(uint8_t* buffer, size_t* len) {
     /* Check if there's data available */
     uint8_t cmd = inb(rtl8139_dev.io_base + RTL8139_CHIPCMD);
     if (cmd & RTL8139_CMD_BUF_EMPTY) {
-        return -1;  /* No packet available */
+        return NULL;  /* No packet available */
     }
     
-    /* We have data! */
-    
     /* Read packet header (4 bytes: status + length) */
     uint16_t* header = (uint16_t*)(rtl8139_dev.rx_buffer + rtl8139_dev.rx_offset);
     uint16_t status = header[0];
     uint16_t packet_len = header[1];
     
-    /* Check if packet is valid */
-    if (!(status & 0x01)) {  /* ROK bit */
-        /* Bad packet, skip it */
-        rtl8139_dev.rx_offset = (rtl8139_dev.rx_offset + packet_len + 4 + 3) & ~3;
-        rtl8139_dev.rx_offset = rtl8139_dev.rx_offset % 8192;
-        outw(rtl8139_dev.io_base + RTL8139_RXBUFTAIL, 
-             (rtl8139_dev.rx_offset - 16) & 0xFFFF);
-        return -1;
-    }
-    
-    /* Remove CRC (4 bytes) from length */
-    packet_len -= 4;
-    
-    if (packet_len > *len) {
-        packet_len = *len;
+    /* The ring is a single buffer the chip keeps writing into, so the
+     * frame is copied out once, into a network buffer */
+    netbuf_t* nb = NULL;
+    if ((status & 0x01) && packet_len >= 4) {  /* ROK bit */
+        nb = netbuf_alloc();
+        uint8_t* p = nb ? netbuf_put(nb, packet_len - 4) : NULL;  /* drop CRC */
+        if (p) {
+            memcpy(p, rtl8139_dev.rx_buffer + rtl8139_dev.rx_offset + 4, nb->len);
+        } else {
+            netbuf_free(nb);
+            nb = NULL;
+        }
     }
     
-    /* Copy packet data */
-    memcpy(buffer, rtl8139_dev.rx_buffer + rtl8139_dev.rx_offset + 4, packet_len);
-    *len = packet_len;
-    
     /* Update read pointer (align to 4 bytes, +4 for header) */
-    rtl8139_dev.rx_offset = (rtl8139_dev.rx_offset + packet_len + 4 + 4 + 3) & ~3;
+    rtl8139_dev.rx_offset = (rtl8139_dev.rx_offset + packet_len + 4 + 3) & ~3;
     rtl8139_dev.rx_offset = rtl8139_dev.rx_offset % 8192;
     
     /* Update CAPR (Current Address of Packet Read) */
     outw(rtl8139_dev.io_base + RTL8139_RXBUFTAIL, 
          (rtl8139_dev.rx_offset - 16) & 0xFFFF);
     
-    return 0;
+    return nb;
+}
+
+/* Receive events the network layer is interrupted for */
+#define RTL8139_RX_INTS (RTL8139_INT_RX_OK | RTL8139_INT_RX_ERR | \
+                         RTL8139_INT_RXBUF_OVERFLOW | RTL8139_INT_RXFIFO_OVERFLOW)
+
+int rtl8139_get_irq(void) {
+    return rtl8139_dev.initialized ? rtl8139_dev.irq : -1;
+}
+
+void rtl8139_irq_enable(int on) {
+    if (!rtl8139_dev.initialized) return;
+    outw(rtl8139_dev.io_base + RTL8139_INTRMASK, on ? RTL8139_RX_INTS : 0);
+}
+
+int rtl8139_irq_ack(void) {
+    if (!rtl8139_dev.initialized) return 0;
+    uint16_t isr = inw(rtl8139_dev.io_base + RTL8139_INTRSTATUS);
+    if (!(isr & RTL8139_RX_INTS))
+        return 0;   /* not ours (the line may be shared) */
+    /* Mask until the ring has been drained, then acknowledge */
+    outw(rtl8139_dev.io_base + RTL8139_INTRMASK, 0);
+    outw(rtl8139_dev.io_base + RTL8139_INTRSTATUS, isr);
+    return 1;
 }
 
 void rtl8139_get_mac(uint8_t mac[6]) {
@@ -0,0 +1,691 @@
+/* virtio_blk.c — VirtIO block device driver
+ *
+ * Alternative storage backend to the IDE driver: when a virtio-blk-pci
+ * disk is present, ata_read_sectors()/ata_write_sectors() are routed
+ * here.  Requests are queued on a single virtqueue with up to
+ * VBLK_MAX_REQS in flight; each uses one ring slot pointing at an
+ * indirect descriptor table (header, data, status).  Completion is
+ * signalled by the device interrupt, and waiters sleep until then.
+ */
+
+#include <kernel/virtio_blk.h>
+#include <kernel/pci.h>
+#include <kernel/io.h>
+#include <kernel/idt.h>
+#include <kernel/pmm.h>
+#include <kernel/task.h>
+#include <kernel/sched.h>
+#include <kernel/waitq.h>
+#include <string.h>
+
+/* ═══ VirtIO legacy I/O registers ══════════════════════════════ */
+
+#define VIRTIO_VENDOR_ID  0x1AF4
+
+#define VIO_FEATURES      0x00
+#define VIO_DRV_FEATURES  0x04
+#define VIO_QUEUE_PFN     0x08
+#define VIO_QUEUE_SIZE    0x0C  /* 16-bit */
+#define VIO_QUEUE_SEL     0x0E  /* 16-bit */
+#define VIO_QUEUE_NOTIFY  0x10  /* 16-bit */
+#define VIO_STATUS        0x12  /* 8-bit  */
+#define VIO_ISR           0x13  /* 8-bit  */
+#define VIO_DEVICE_CFG    0x14  /* device config without MSI-X */
+
+#define VIRTIO_STATUS_ACK         0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+
+/* Feature bits */
+#define VIRTIO_BLK_F_RO           (1u << 5)
+#define VIRTIO_BLK_F_FLUSH        (1u << 9)
+#define VIRTIO_RING_F_INDIRECT    (1u << 28)
+#define VIRTIO_F_VERSION_1_HI     (1u << 0)     /* bit 32 */
+
+/* Descriptor flags */
+#define VRING_DESC_F_NEXT      0x01
+#define VRING_DESC_F_WRITE     0x02
+#define VRING_DESC_F_INDIRECT  0x04
+
+/* Request types / status */
+#define VIRTIO_BLK_T_IN     0
+#define VIRTIO_BLK_T_OUT    1
+#define VIRTIO_BLK_T_FLUSH  4
+#define VIRTIO_BLK_S_OK     0
+
+#define VB_TIMEOUT          (5 * 120)   /* PIT ticks (~5s) */
+
+/* ═══ Virtqueue layout ═════════════════════════════════════════ */
+
+struct vring_desc_vb {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct vring_avail_vb {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed));
+
+struct vring_used_elem_vb {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed));
+
+struct vring_used_vb {
+    uint16_t flags;
+    uint16_t idx;
+    struct vring_used_elem_vb ring[];
+} __attribute__((packed));
+
+struct virtio_blk_req_hdr {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed));
+
+/* ═══ Modern MMIO structures ═══════════════════════════════════ */
+
+#define VIRTIO_PCI_CAP_COMMON_CFG  1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG  2
+#define VIRTIO_PCI_CAP_ISR_CFG     3
+#define VIRTIO_PCI_CAP_DEVICE_CFG  4
+#define PCI_CAP_PTR_VB             0x34
+#define PCI_CAP_ID_VNDR_VB         0x09
+
+struct virtio_pci_common_cfg_vb {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t  device_status;
+    uint8_t  config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint32_t queue_desc_lo;
+    uint32_t queue_desc_hi;
+    uint32_t queue_driver_lo;
+    uint32_t queue_driver_hi;
+    uint32_t queue_device_lo;
+    uint32_t queue_device_hi;
+} __attribute__((packed));
+
+/* ═══ Driver state ═════════════════════════════════════════════ */
+
+static int vb_active = 0;
+static int vb_modern = 0;
+static uint16_t vb_iobase;
+static uint8_t vb_irq;
+static uint64_t vb_capacity;
+static uint32_t vb_features;
+static int vb_indirect;
+static int vb_max_reqs;
+
+/* Modern MMIO pointers */
+static volatile struct virtio_pci_common_cfg_vb *vb_common;
+static volatile uint8_t *vb_notify_base;
+static uint32_t vb_notify_mult;
+static volatile uint8_t *vb_isr;
+static volatile uint32_t *vb_devcfg;
+static volatile uint16_t *vb_queue_notify;
+
+/* Virtqueue memory — page-aligned, room for a 256-entry legacy ring */
+#define VB_QUEUE_MAX 256
+#define VB_QUEUE_PREF 128
+static uint8_t vb_vq_mem[16384] __attribute__((aligned(4096)));
+
+static uint16_t vb_qsz;
+static struct vring_desc_vb  *vb_desc;
+static struct vring_avail_vb *vb_avail;
+static struct vring_used_vb  *vb_used;
+static uint16_t vb_last_used_idx;
+
+/* One slot per in-flight request.  `ind` is the indirect table the ring
+ * descriptor points at; it comes first to keep 16-byte alignment.  A
+ * request whose waiter timed out is `abandoned`: the device still owns
+ * its buffers, so the slot and its bounce frame are freed by vb_reap()
+ * when the completion finally arrives. */
+typedef struct {
+    struct vring_desc_vb ind[3];
+    struct virtio_blk_req_hdr hdr;
+    volatile uint8_t status;
+    volatile uint8_t done;
+    volatile uint8_t busy;
+    uint8_t abandoned;
+    uint32_t bounce;        /* bounce frame lent to the request, or 0 */
+} __attribute__((aligned(16))) vb_slot_t;
+
+static vb_slot_t vb_slots[VBLK_MAX_REQS];
+
+/* Woken by vb_reap() whenever any request completes */
+static waitq_t vb_wq;
+
+/* ═══ Helpers ══════════════════════════════════════════════════ */
+
+static void unmask_irq(int irq) {
+    if (irq < 8) {
+        outb(0x21, inb(0x21) & ~(1 << irq));
+    } else {
+        outb(0xA1, inb(0xA1) & ~(1 << (irq - 8)));
+        outb(0x21, inb(0x21) & ~(1 << 2));     /* cascade */
+    }
+}
+
+static void vb_vq_init(uint16_t qsz) {
+    memset(vb_vq_mem, 0, sizeof(vb_vq_mem));
+
+    vb_qsz = qsz;
+    vb_desc  = (struct vring_desc_vb *)vb_vq_mem;
+    vb_avail = (struct vring_avail_vb *)(vb_vq_mem + qsz * 16);
+    uint32_t avail_end = qsz * 16 + 4 + qsz * 2 + 2;
+    uint32_t used_off  = (avail_end + 4095) & ~4095u;
+    vb_used  = (struct vring_used_vb *)(vb_vq_mem + used_off);
+    vb_last_used_idx = 0;
+
+    vb_max_reqs = vb_indirect ? qsz : qsz / 3;
+    if (vb_max_reqs > VBLK_MAX_REQS)
+        vb_max_reqs = VBLK_MAX_REQS;
+}
+
+static void vb_notify(void) {
+    if (vb_modern) {
+        *vb_queue_notify = 0;
+    } else {
+        outw(vb_iobase + VIO_QUEUE_NOTIFY, 0);
+    }
+}
+
+/* Collect completed requests from the used ring.  Called from the IRQ
+ * handler, and by waiters so a lost interrupt can't hang them. */
+static void vb_reap(void) {
+    int reaped = 0;
+    while (vb_used->idx != vb_last_used_idx) {
+        __asm__ volatile("" ::: "memory");
+        uint16_t slot = vb_last_used_idx % vb_qsz;
+        uint32_t id = vb_used->ring[slot].id;
+        vb_last_used_idx++;
+
+        uint32_t s = vb_indirect ? id : id / 3;
+        if (s >= (uint32_t)vb_max_reqs)
+            continue;
+        vb_slot_t *sl = &vb_slots[s];
+        if (sl->abandoned) {
+            /* Nobody waits for it any more: free it here */
+            if (sl->bounce)
+                pmm_free_frame(sl->bounce);
+            sl->bounce = 0;
+            sl->abandoned = 0;
+            sl->busy = 0;
+        } else {
+            sl->done = 1;
+        }
+        reaped = 1;
+    }
+    if (reaped)
+        waitq_wake(&vb_wq);
+}
+
+static void vb_irq_handler(registers_t *regs) {
+    (void)regs;
+    /* Reading ISR acknowledges the interrupt */
+    if (vb_modern)
+        (void)*vb_isr;
+    else
+        (void)inb(vb_iobase + VIO_ISR);
+    vb_reap();
+}
+
+static int vb_can_block(void) {
+    task_info_t *t = task_get(task_get_current());
+    return sched_is_active() && t && (t->stack_base || t->is_user);
+}
+
+/* Sleep until `cond` is set by vb_reap() or VB_TIMEOUT passes.
+ * Preemptive threads sleep on vb_wq, cooperative code halts between
+ * interrupts, and with interrupts off the used ring is polled. */
+static int vb_sleep_on(volatile uint8_t *cond) {
+    uint32_t start = pit_get_ticks();
+    uint32_t spins = 0;
+    uint32_t flags = irq_save();
+
+    while (!*cond) {
+        if (!(flags & 0x200)) {
+            vb_reap();
+            if (++spins > 50000000)
+                break;
+            continue;
+        }
+        uint32_t elapsed = pit_get_ticks() - start;
+        if (elapsed >= VB_TIMEOUT)
+            break;
+        uint32_t seq = waitq_seq(&vb_wq);
+        irq_restore(flags);
+        waitq_sleep(&vb_wq, seq, VB_TIMEOUT - elapsed);
+        flags = irq_save();
+        vb_reap();
+    }
+    int ok = *cond;
+    irq_restore(flags);
+    return ok ? 0 : -1;
+}
+
+/* ═══ Modern MMIO capability parsing ═══════════════════════════ */
+
+static int vb_parse_caps(pci_device_t *dev) {
+    vb_common = NULL;
+    vb_notify_base = NULL;
+    vb_notify_mult = 0;
+    vb_isr = NULL;
+    vb_devcfg = NULL;
+
+    uint16_t status = pci_config_read_word(dev->bus, dev->device,
+                                            dev->function, PCI_STATUS);
+    if (!(status & (1 << 4))) return 0;
+
+    uint8_t cap_ptr = pci_config_read_byte(dev->bus, dev->device,
+                                            dev->function, PCI_CAP_PTR_VB);
+    cap_ptr &= 0xFC;
+
+    while (cap_ptr) {
+        uint8_t cap_id = pci_config_read_byte(dev->bus, dev->device,
+                                               dev->function, cap_ptr);
+        uint8_t cap_next = pci_config_read_byte(dev->bus, dev->device,
+                                                 dev->function, cap_ptr + 1);
+
+        if (cap_id == PCI_CAP_ID_VNDR_VB) {
+            uint8_t cfg_type = pci_config_read_byte(dev->bus, dev->device,
+                                                     dev->function, cap_ptr + 3);
+            uint8_t bar_idx = pci_config_read_byte(dev->bus, dev->device,
+                                                    dev->function, cap_ptr + 4);
+            uint32_t offset = pci_config_read_dword(dev->bus, dev->device,
+                                                     dev->function, cap_ptr + 8);
+            uint32_t base = (bar_idx < 6 && !(dev->bar[bar_idx] & 1))
+                          ? (dev->bar[bar_idx] & ~0xFu) : 0;
+
+            if (base) {
+                switch (cfg_type) {
+                case VIRTIO_PCI_CAP_COMMON_CFG:
+                    vb_common = (volatile struct virtio_pci_common_cfg_vb *)
+                                (base + offset);
+                    break;
+                case VIRTIO_PCI_CAP_NOTIFY_CFG:
+                    vb_notify_base = (volatile uint8_t *)(base + offset);
+                    vb_notify_mult = pci_config_read_dword(
+                        dev->bus, dev->device, dev->function, cap_ptr + 16);
+                    break;
+                case VIRTIO_PCI_CAP_ISR_CFG:
+                    vb_isr = (volatile uint8_t *)(base + offset);
+                    break;
+                case VIRTIO_PCI_CAP_DEVICE_CFG:
+                    vb_devcfg = (volatile uint32_t *)(base + offset);
+                    break;
+                }
+            }
+        }
+        cap_ptr = cap_next;
+    }
+
+    return vb_common && vb_notify_base && vb_isr && vb_devcfg;
+}
+
+/* ═══ Initialization ═══════════════════════════════════════════ */
+
+static int vb_init_modern(void) {
+    vb_common->device_status = 0;
+    __asm__ volatile("" ::: "memory");
+
+    vb_common->device_status = VIRTIO_STATUS_ACK;
+    vb_common->device_status = VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER;
+
+    vb_common->device_feature_select = 0;
+    uint32_t offered = vb_common->device_feature;
+    vb_features = offered & (VIRTIO_RING_F_INDIRECT | VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_RO);
+    vb_common->driver_feature_select = 0;
+    vb_common->driver_feature = vb_features;
+    vb_common->driver_feature_select = 1;
+    vb_common->driver_feature = VIRTIO_F_VERSION_1_HI;
+
+    vb_common->device_status = VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER
+                             | VIRTIO_STATUS_FEATURES_OK;
+    __asm__ volatile("" ::: "memory");
+
+    if (!(vb_common->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+        DBG("[virtio-blk] FEATURES_OK rejected");
+        return 0;
+    }
+    vb_indirect = (vb_features & VIRTIO_RING_F_INDIRECT) != 0;
+
+    /* Disable MSI-X: completion comes through INTx + ISR */
+    vb_common->msix_config = 0xFFFF;
+
+    /* Request queue (queue 0) */
+    vb_common->queue_select = 0;
+    uint16_t qsz = vb_common->queue_size;
+    if (qsz == 0) return 0;
+    if (qsz > VB_QUEUE_PREF) qsz = VB_QUEUE_PREF;
+    vb_common->queue_size = qsz;
+
+    vb_vq_init(qsz);
+
+    vb_common->queue_desc_lo   = (uint32_t)vb_desc;
+    vb_common->queue_desc_hi   = 0;
+    vb_common->queue_driver_lo = (uint32_t)vb_avail;
+    vb_common->queue_driver_hi = 0;
+    vb_common->queue_device_lo = (uint32_t)vb_used;
+    vb_common->queue_device_hi = 0;
+    vb_common->queue_msix_vector = 0xFFFF;
+    vb_common->queue_enable    = 1;
+
+    uint16_t noff = vb_common->queue_notify_off;
+    vb_queue_notify = (volatile uint16_t *)
+        (vb_notify_base + noff * vb_notify_mult);
+
+    vb_capacity = (uint64_t)vb_devcfg[0] | ((uint64_t)vb_devcfg[1] << 32);
+
+    vb_common->device_status = VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER
+                             | VIRTIO_STATUS_FEATURES_OK | VIRTIO_STATUS_DRIVER_OK;
+    return 1;
+}
+
+static int vb_init_legacy(void) {
+    outb(vb_iobase + VIO_STATUS, 0);
+    outb(vb_iobase + VIO_STATUS, VIRTIO_STATUS_ACK);
+    outb(vb_iobase + VIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    uint32_t offered = inl(vb_iobase + VIO_FEATURES);
+    vb_features = offered & (VIRTIO_RING_F_INDIRECT | VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_RO);
+    outl(vb_iobase + VIO_DRV_FEATURES, vb_features);
+    vb_indirect = (vb_features & VIRTIO_RING_F_INDIRECT) != 0;
+
+    /* Legacy queues have a fixed, device-chosen size */
+    outw(vb_iobase + VIO_QUEUE_SEL, 0);
+    uint16_t qsz = inw(vb_iobase + VIO_QUEUE_SIZE);
+    if (qsz == 0 || qsz > VB_QUEUE_MAX) {
+        DBG("[virtio-blk] Unsupported queue size %u", qsz);
+        return 0;
+    }
+
+    vb_vq_init(qsz);
+    outl(vb_iobase + VIO_QUEUE_PFN, (uint32_t)vb_vq_mem / 4096);
+
+    vb_capacity = (uint64_t)inl(vb_iobase + VIO_DEVICE_CFG) |
+                  ((uint64_t)inl(vb_iobase + VIO_DEVICE_CFG + 4) << 32);
+
+    outb(vb_iobase + VIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER
+                               | VIRTIO_STATUS_DRIVER_OK);
+    return 1;
+}
+
+int virtio_blk_init(void) {
+    pci_device_t dev;
+    int found = 0;
+
+    /* Modern virtio-blk is 0x1042, transitional is 0x1001 */
+    if (pci_find_device(VIRTIO_VENDOR_ID, 0x1042, &dev) == 0 ||
+        pci_find_device(VIRTIO_VENDOR_ID, 0x1001, &dev) == 0)
+        found = 1;
+
+    if (!found) {
+        DBG("[virtio-blk] No VirtIO block device found");
+        return 0;
+    }
+
+    /* Enable PCI bus mastering + I/O + memory, keep INTx enabled */
+    uint16_t cmd = pci_config_read_word(dev.bus, dev.device,
+                                         dev.function, PCI_COMMAND);
+    cmd |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+    cmd &= ~PCI_COMMAND_INTX_DISABLE;
+    pci_config_write_word(dev.bus, dev.device, dev.function,
+                          PCI_COMMAND, cmd);
+
+    vb_iobase = 0;
+    for (int i = 0; i < 6; i++) {
+        if (dev.bar[i] & 0x1) {
+            vb_iobase = (uint16_t)(dev.bar[i] & ~0x3u);
+            break;
+        }
+    }
+
+    int ok;
+    if (vb_parse_caps(&dev)) {
+        vb_modern = 1;
+        ok = vb_init_modern();
+    } else if (vb_iobase) {
+        vb_modern = 0;
+        ok = vb_init_legacy();
+    } else {
+        DBG("[virtio-blk] No usable BAR");
+        return 0;
+    }
+    if (!ok)
+        return 0;
+
+    vb_irq = dev.interrupt_line;
+    irq_register_handler(vb_irq, vb_irq_handler);
+    unmask_irq(vb_irq);
+
+    vb_active = 1;
+    DBG("[virtio-blk] %s, %u MB, queue=%u, in-flight=%d, indirect=%d, IRQ %d",
+        vb_modern ? "modern" : "legacy",
+        (uint32_t)(vb_capacity / 2048), vb_qsz, vb_max_reqs,
+        vb_indirect, vb_irq);
+    return 1;
+}
+
+int virtio_blk_active(void) {
+    return vb_active;
+}
+
+uint64_t virtio_blk_capacity(void) {
+    return vb_capacity;
+}
+
+/* ═══ Requests ═════════════════════════════════════════════════ */
+
+/* Post a request built in slot `s`: header, optional data, status */
+static void vb_post(int s, void *data, uint32_t len, int write) {
+    vb_slot_t *sl = &vb_slots[s];
+    struct vring_desc_vb *d;
+    uint16_t head;
+    int n = 0;
+
+    if (vb_indirect) {
+        d = sl->ind;
+        head = (uint16_t)s;
+    } else {
+        head = (uint16_t)(s * 3);
+        d = &vb_desc[head];
+    }
+
+    d[n].addr  = (uint32_t)&sl->hdr;
+    d[n].len   = sizeof(sl->hdr);
+    d[n].flags = VRING_DESC_F_NEXT;
+    n++;
+    if (len) {
+        d[n].addr  = (uint32_t)data;
+        d[n].len   = len;
+        d[n].flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+        n++;
+    }
+    d[n].addr  = (uint32_t)&sl->status;
+    d[n].len   = 1;
+    d[n].flags = VRING_DESC_F_WRITE;
+    n++;
+    for (int i = 0; i < n - 1; i++)
+        d[i].next = vb_indirect ? (uint16_t)(i + 1) : (uint16_t)(head + i + 1);
+    d[n - 1].next = 0;
+
+    if (vb_indirect) {
+        vb_desc[head].addr  = (uint32_t)sl->ind;
+        vb_desc[head].len   = n * sizeof(struct vring_desc_vb);
+        vb_desc[head].flags = VRING_DESC_F_INDIRECT;
+        vb_desc[head].next  = 0;
+    }
+
+    uint16_t avail_idx = vb_avail->idx;
+    vb_avail->ring[avail_idx % vb_qsz] = head;
+    __asm__ volatile("" ::: "memory");
+    vb_avail->idx = avail_idx + 1;
+    __asm__ volatile("" ::: "memory");
+    vb_notify();
+}
+
+/* Claim a free slot, sleeping while all are in flight */
+static int vb_get_slot(void) {
+    for (;;) {
+        uint32_t flags = irq_save();
+        for (int i = 0; i < vb_max_reqs; i++) {
+            if (!vb_slots[i].busy) {
+                vb_slots[i].busy = 1;
+                vb_slots[i].done = 0;
+                vb_slots[i].bounce = 0;
+                vb_slots[i].status = 0xFF;
+                irq_restore(flags);
+                return i;
+            }
+        }
+        vb_reap();
+        irq_restore(flags);
+        if (!(flags & 0x200))
+            continue;
+        if (vb_can_block())
+            task_yield();
+        else
+            __asm__ volatile("hlt");
+    }
+}
+
+static int vb_submit_type(uint32_t type, uint32_t lba, void *buf, uint32_t len) {
+    int s = vb_get_slot();
+    vb_slots[s].hdr.type = type;
+    vb_slots[s].hdr.reserved = 0;
+    vb_slots[s].hdr.sector = lba;
+
+    uint32_t flags = irq_save();
+    vb_post(s, buf, len, type == VIRTIO_BLK_T_OUT);
+    irq_restore(flags);
+    return s;
+}
+
+int virtio_blk_submit(uint32_t lba, uint32_t count, void *buf, int write) {
+    if (!vb_active || count == 0 || count > VBLK_MAX_SECTORS)
+        return -1;
+    if ((uint64_t)lba + count > vb_capacity)
+        return -1;
+    if (write && (vb_features & VIRTIO_BLK_F_RO))
+        return -1;
+    return vb_submit_type(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,
+                          lba, buf, count * 512);
+}
+
+/* Wait for request `id`; 0 on success, -1 on a device error, -2 on
+ * timeout.  A timed-out request keeps its slot (and the bounce frame
+ * lent to it) until the device completes it after all. */
+static int vb_wait(int id) {
+    if (id < 0 || id >= vb_max_reqs || !vb_slots[id].busy)
+        return -1;
+    vb_slot_t *sl = &vb_slots[id];
+    if (vb_sleep_on(&sl->done) != 0) {
+        uint32_t flags = irq_save();
+        if (!sl->done) {
+            sl->abandoned = 1;
+            irq_restore(flags);
+            DBG("[virtio-blk] Request timeout (sector %u)", (uint32_t)sl->hdr.sector);
+            return -2;
+        }
+        irq_restore(flags);
+    }
+    int rc = sl->status == VIRTIO_BLK_S_OK ? 0 : -1;
+    sl->bounce = 0;
+    sl->busy = 0;
+    return rc;
+}
+
+int virtio_blk_wait(int id) {
+    return vb_wait(id) == 0 ? 0 : -1;
+}
+
+/* Split into VBLK_MAX_SECTORS requests and keep them all in flight.
+ * Buffers outside identity-mapped lowmem go through a bounce frame of
+ * the caller's own, so nothing has to wait for another transfer. */
+static int vb_transfer(uint32_t lba, uint32_t count, uint8_t *buf, int write) {
+    if (!vb_active || count == 0)
+        return -1;
+
+    if ((uint32_t)buf + count * 512 > PMM_LOWMEM_LIMIT) {
+        uint32_t frame = pmm_alloc_frame();
+        if (!frame)
+            return -1;
+        uint8_t *bounce = (uint8_t *)frame;
+        int rc = 0;
+        while (count > 0 && rc == 0) {
+            uint32_t n = count > 8 ? 8 : count;
+            if (write)
+                memcpy(bounce, buf, n * 512);
+            int id = virtio_blk_submit(lba, n, bounce, write);
+            if (id < 0) {
+                rc = -1;
+                break;
+            }
+            vb_slots[id].bounce = frame;
+            rc = vb_wait(id);
+            if (rc == 0 && !write)
+                memcpy(buf, bounce, n * 512);
+            lba += n;
+            count -= n;
+            buf += n * 512;
+        }
+        if (rc != -2)
+            pmm_free_frame(frame);  /* else freed with the late completion */
+        return rc == 0 ? 0 : -1;
+    }
+
+    int ids[VBLK_MAX_REQS];
+    int rc = 0;
+    while (count > 0 && rc == 0) {
+        int nreq = 0;
+        while (count > 0 && nreq < vb_max_reqs) {
+            uint32_t n = count > VBLK_MAX_SECTORS ? VBLK_MAX_SECTORS : count;
+            int id = virtio_blk_submit(lba, n, buf, write);
+            if (id < 0) {
+                rc = -1;
+                break;
+            }
+            ids[nreq++] = id;
+            lba += n;
+            count -= n;
+            buf += n * 512;
+        }
+        for (int i = 0; i < nreq; i++) {
+            if (virtio_blk_wait(ids[i]) != 0)
+                rc = -1;
+        }
+    }
+    return rc;
+}
+
+int virtio_blk_read(uint32_t lba, uint32_t count, void *buf) {
+    return vb_transfer(lba, count, (uint8_t *)buf, 0);
+}
+
+int virtio_blk_write(uint32_t lba, uint32_t count, const void *buf) {
+    return vb_transfer(lba, count, (uint8_t *)buf, 1);
+}
+
+int virtio_blk_flush(void) {
+    if (!vb_active)
+        return -1;
+    if (!(vb_features & VIRTIO_BLK_F_FLUSH))
+        return 0;   /* no volatile cache to flush */
+    int id = vb_submit_type(VIRTIO_BLK_T_FLUSH, 0, NULL, 0);
+    return virtio_blk_wait(id);
+}
@@ -0,0 +1,672 @@
+/* virtio_net.c — VirtIO network device driver
+ *
+ * Preferred NIC when a virtio-net-pci device is present.  The receive
+ * queue keeps VNET_RX_BUFS network buffers (netbuf.h) posted at all
+ * times; a completed one is passed up the stack as is and replaced by
+ * a fresh buffer from the pool, and the device is only kicked once per
+ * batch.  Transmit is asynchronous and zero-copy: the virtio header is
+ * pushed into the frame's headroom, the buffer is posted where it lies,
+ * and it goes back to the pool when a later send reaps the used ring.
+ * TX completion interrupts are suppressed entirely.
+ *
+ * Checksum offload (VIRTIO_NET_F_CSUM / F_GUEST_CSUM) is negotiated
+ * when offered.  Received frames flagged NEEDS_CSUM (typically from a
+ * local peer that skipped the checksum) are completed here, so the
+ * protocol layers always see valid checksums.
+ */
+
+#include <kernel/virtio_net.h>
+#include <kernel/netbuf.h>
+#include <kernel/checksum.h>
+#include <kernel/pci.h>
+#include <kernel/io.h>
+#include <string.h>
+
+/* ═══ VirtIO legacy I/O registers ══════════════════════════════ */
+
+#define VIRTIO_VENDOR_ID  0x1AF4
+
+#define VIO_FEATURES      0x00
+#define VIO_DRV_FEATURES  0x04
+#define VIO_QUEUE_PFN     0x08
+#define VIO_QUEUE_SIZE    0x0C  /* 16-bit */
+#define VIO_QUEUE_SEL     0x0E  /* 16-bit */
+#define VIO_QUEUE_NOTIFY  0x10  /* 16-bit */
+#define VIO_STATUS        0x12  /* 8-bit  */
+#define VIO_ISR           0x13  /* 8-bit  */
+#define VIO_DEVICE_CFG    0x14  /* device config without MSI-X */
+
+#define VIRTIO_STATUS_ACK         0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+
+/* Feature bits */
+#define VIRTIO_NET_F_CSUM         (1u << 0)     /* device finishes TX checksums */
+#define VIRTIO_NET_F_GUEST_CSUM   (1u << 1)     /* RX may carry partial checksums */
+#define VIRTIO_NET_F_MAC          (1u << 5)
+#define VIRTIO_F_ANY_LAYOUT       (1u << 27)
+#define VIRTIO_F_VERSION_1_HI     (1u << 0)     /* bit 32 */
+
+/* Descriptor / ring flags */
+#define VRING_DESC_F_WRITE        0x02
+#define VRING_AVAIL_F_NO_INTERRUPT 0x01
+#define VRING_USED_F_NO_NOTIFY    0x01
+
+/* virtio_net_hdr flags */
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 0x01
+#define VIRTIO_NET_HDR_F_DATA_VALID 0x02
+
+#define VN_RXQ  0
+#define VN_TXQ  1
+
+#define VN_RX_KICK_BATCH  16    /* recycled RX buffers per notify */
+#define VN_TX_KICK_BATCH  16    /* held TX frames per notify */
+
+/* ═══ Virtqueue layout ═════════════════════════════════════════ */
+
+struct vring_desc_vn {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct vring_avail_vn {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed));
+
+struct vring_used_elem_vn {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed));
+
+struct vring_used_vn {
+    uint16_t flags;
+    uint16_t idx;
+    struct vring_used_elem_vn ring[];
+} __attribute__((packed));
+
+/* num_buffers only exists with VERSION_1 (or MRG_RXBUF, not used) */
+struct virtio_net_hdr_vn {
+    uint8_t  flags;
+    uint8_t  gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    uint16_t num_buffers;
+} __attribute__((packed));
+
+/* ═══ Modern MMIO structures ═══════════════════════════════════ */
+
+#define VIRTIO_PCI_CAP_COMMON_CFG  1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG  2
+#define VIRTIO_PCI_CAP_ISR_CFG     3
+#define VIRTIO_PCI_CAP_DEVICE_CFG  4
+#define PCI_CAP_PTR_VN             0x34
+#define PCI_CAP_ID_VNDR_VN         0x09
+
+struct virtio_pci_common_cfg_vn {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t  device_status;
+    uint8_t  config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint32_t queue_desc_lo;
+    uint32_t queue_desc_hi;
+    uint32_t queue_driver_lo;
+    uint32_t queue_driver_hi;
+    uint32_t queue_device_lo;
+    uint32_t queue_device_hi;
+} __attribute__((packed));
+
+/* ═══ Driver state ═════════════════════════════════════════════ */
+
+/* Virtqueue memory — page-aligned, room for a 256-entry legacy ring */
+#define VN_QUEUE_MAX 256
+
+typedef struct {
+    uint8_t mem[16384] __attribute__((aligned(4096)));
+} vn_qmem_t;
+
+typedef struct {
+    uint16_t size;
+    uint16_t last_used;
+    struct vring_desc_vn  *desc;
+    struct vring_avail_vn *avail;
+    struct vring_used_vn  *used;
+    volatile uint16_t     *notify;  /* modern only */
+} vn_queue_t;
+
+static int vn_active = 0;
+static int vn_modern = 0;
+static uint16_t vn_iobase;
+static uint8_t vn_irq;
+static uint32_t vn_features;
+static uint32_t vn_hdr_len;         /* 12 with VERSION_1, else 10 */
+static uint8_t vn_mac[6];
+
+/* Modern MMIO pointers */
+static volatile struct virtio_pci_common_cfg_vn *vn_common;
+static volatile uint8_t *vn_notify_base;
+static uint32_t vn_notify_mult;
+static volatile uint8_t *vn_isr;
+static volatile uint8_t *vn_devcfg;
+
+static vn_qmem_t vn_qmem[2];
+static vn_queue_t vn_q[2];
+
+/* Buffers: descriptor i of a queue carries netbuf vn_*_nb[i] */
+static netbuf_t *vn_rx_nb[VNET_RX_BUFS];
+static netbuf_t *vn_tx_nb[VNET_TX_BUFS];
+static uint16_t vn_rx_count;        /* RX buffers in use (<= queue size) */
+static uint16_t vn_rx_unkicked;     /* recycled since the last notify */
+static uint16_t vn_tx_count;
+static uint16_t vn_tx_free[VNET_TX_BUFS];
+static uint16_t vn_tx_nfree;
+static int vn_tx_held;              /* virtio_net_tx_hold() in effect */
+static uint16_t vn_tx_unkicked;     /* posted since the last notify */
+
+/* ═══ Helpers ══════════════════════════════════════════════════ */
+
+static void vn_vq_init(int qi, uint16_t qsz) {
+    vn_queue_t *q = &vn_q[qi];
+    uint8_t *mem = vn_qmem[qi].mem;
+    memset(mem, 0, sizeof(vn_qmem[qi].mem));
+
+    q->size = qsz;
+    q->desc  = (struct vring_desc_vn *)mem;
+    q->avail = (struct vring_avail_vn *)(mem + qsz * 16);
+    uint32_t avail_end = qsz * 16 + 4 + qsz * 2 + 2;
+    uint32_t used_off  = (avail_end + 4095) & ~4095u;
+    q->used  = (struct vring_used_vn *)(mem + used_off);
+    q->last_used = 0;
+    q->notify = NULL;
+}
+
+static void vn_notify(int qi) {
+    if (vn_q[qi].used->flags & VRING_USED_F_NO_NOTIFY)
+        return;
+    if (vn_modern)
+        *vn_q[qi].notify = (uint16_t)qi;
+    else
+        outw(vn_iobase + VIO_QUEUE_NOTIFY, (uint16_t)qi);
+}
+
+/* Make descriptor `id` available to the device (no notify) */
+static void vn_post(vn_queue_t *q, uint16_t id) {
+    q->avail->ring[q->avail->idx % q->size] = id;
+    __asm__ volatile("" ::: "memory");
+    q->avail->idx++;
+    __asm__ volatile("" ::: "memory");
+}
+
+/* Return completed transmit buffers to the free list */
+static void vn_reap_tx(void) {
+    vn_queue_t *q = &vn_q[VN_TXQ];
+    while (q->used->idx != q->last_used) {
+        __asm__ volatile("" ::: "memory");
+        uint32_t id = q->used->ring[q->last_used % q->size].id;
+        q->last_used++;
+        if (id < vn_tx_count && vn_tx_nb[id]) {
+            netbuf_free(vn_tx_nb[id]);
+            vn_tx_nb[id] = NULL;
+            vn_tx_free[vn_tx_nfree++] = (uint16_t)id;
+        }
+    }
+}
+
+/* Finish a partial checksum: the field at csum_start + csum_offset holds
+ * the pseudo-header sum, the rest of the packet still has to be added */
+static void vn_finish_csum(uint8_t *frame, size_t len,
+                           uint16_t start, uint16_t offset) {
+    if ((size_t)start + offset + 2 > len)
+        return;
+    uint16_t csum = csum_finish(csum_partial(frame + start, len - start, 0));
+    memcpy(frame + start + offset, &csum, 2);
+}
+
+/* ═══ Modern MMIO capability parsing ═══════════════════════════ */
+
+static int vn_parse_caps(pci_device_t *dev) {
+    vn_common = NULL;
+    vn_notify_base = NULL;
+    vn_notify_mult = 0;
+    vn_isr = NULL;
+    vn_devcfg = NULL;
+
+    uint16_t status = pci_config_read_word(dev->bus, dev->device,
+                                            dev->function, PCI_STATUS);
+    if (!(status & (1 << 4))) return 0;
+
+    uint8_t cap_ptr = pci_config_read_byte(dev->bus, dev->device,
+                                            dev->function, PCI_CAP_PTR_VN);
+    cap_ptr &= 0xFC;
+
+    while (cap_ptr) {
+        uint8_t cap_id = pci_config_read_byte(dev->bus, dev->device,
+                                               dev->function, cap_ptr);
+        uint8_t cap_next = pci_config_read_byte(dev->bus, dev->device,
+                                                 dev->function, cap_ptr + 1);
+
+        if (cap_id == PCI_CAP_ID_VNDR_VN) {
+            uint8_t cfg_type = pci_config_read_byte(dev->bus, dev->device,
+                                                     dev->function, cap_ptr + 3);
+            uint8_t bar_idx = pci_config_read_byte(dev->bus, dev->device,
+                                                    dev->function, cap_ptr + 4);
+            uint32_t offset = pci_config_read_dword(dev->bus, dev->device,
+                                                     dev->function, cap_ptr + 8);
+            uint32_t base = (bar_idx < 6 && !(dev->bar[bar_idx] & 1))
+                          ? (dev->bar[bar_idx] & ~0xFu) : 0;
+
+            if (base) {
+                switch (cfg_type) {
+                case VIRTIO_PCI_CAP_COMMON_CFG:
+                    vn_common = (volatile struct virtio_pci_common_cfg_vn *)
+                                (base + offset);
+                    break;
+                case VIRTIO_PCI_CAP_NOTIFY_CFG:
+                    vn_notify_base = (volatile uint8_t *)(base + offset);
+                    vn_notify_mult = pci_config_read_dword(
+                        dev->bus, dev->device, dev->function, cap_ptr + 16);
+                    break;
+                case VIRTIO_PCI_CAP_ISR_CFG:
+                    vn_isr = (volatile uint8_t *)(base + offset);
+                    break;
+                case VIRTIO_PCI_CAP_DEVICE_CFG:
+                    vn_devcfg = (volatile uint8_t *)(base + offset);
+                    break;
+                }
+            }
+        }
+        cap_ptr = cap_next;
+    }
+
+    return vn_common && vn_notify_base && vn_isr && vn_devcfg;
+}
+
+/* ═══ Initialization ═══════════════════════════════════════════ */
+
+#define VN_WANT_FEATURES (VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | \
+                          VIRTIO_NET_F_MAC)
+
+static int vn_setup_queue_modern(int qi) {
+    vn_common->queue_select = (uint16_t)qi;
+    uint16_t qsz = vn_common->queue_size;
+    if (qsz == 0) return 0;
+    if (qsz > VN_QUEUE_MAX) qsz = VN_QUEUE_MAX;
+    vn_common->queue_size = qsz;
+
+    vn_vq_init(qi, qsz);
+    vn_queue_t *q = &vn_q[qi];
+
+    vn_common->queue_desc_lo   = (uint32_t)q->desc;
+    vn_common->queue_desc_hi   = 0;
+    vn_common->queue_driver_lo = (uint32_t)q->avail;
+    vn_common->queue_driver_hi = 0;
+    vn_common->queue_device_lo = (uint32_t)q->used;
+    vn_common->queue_device_hi = 0;
+    vn_common->queue_msix_vector = 0xFFFF;
+    vn_common->queue_enable    = 1;
+
+    uint16_t noff = vn_common->queue_notify_off;
+    q->notify = (volatile uint16_t *)(vn_notify_base + noff * vn_notify_mult);
+    return 1;
+}
+
+static int vn_init_modern(void) {
+    vn_common->device_status = 0;
+    __asm__ volatile("" ::: "memory");
+
+    vn_common->device_status = VIRTIO_STATUS_ACK;
+    vn_common->device_status = VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER;
+
+    vn_common->device_feature_select = 0;
+    uint32_t offered = vn_common->device_feature;
+    vn_features = offered & VN_WANT_FEATURES;
+    vn_common->driver_feature_select = 0;
+    vn_common->driver_feature = vn_features;
+    vn_common->driver_feature_select = 1;
+    vn_common->driver_feature = VIRTIO_F_VERSION_1_HI;
+
+    vn_common->device_status = VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER
+                             | VIRTIO_STATUS_FEATURES_OK;
+    __asm__ volatile("" ::: "memory");
+
+    if (!(vn_common->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+        DBG("[virtio-net] FEATURES_OK rejected");
+        return 0;
+    }
+    vn_hdr_len = sizeof(struct virtio_net_hdr_vn);
+
+    /* Disable MSI-X: interrupts come through INTx + ISR */
+    vn_common->msix_config = 0xFFFF;
+
+    if (!vn_setup_queue_modern(VN_RXQ) || !vn_setup_queue_modern(VN_TXQ))
+        return 0;
+
+    if (vn_features & VIRTIO_NET_F_MAC) {
+        for (int i = 0; i < 6; i++)
+            vn_mac[i] = vn_devcfg[i];
+    }
+    return 1;
+}
+
+static int vn_init_legacy(void) {
+    outb(vn_iobase + VIO_STATUS, 0);
+    outb(vn_iobase + VIO_STATUS, VIRTIO_STATUS_ACK);
+    outb(vn_iobase + VIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    /* Header and frame share one buffer, which legacy devices only
+     * accept with ANY_LAYOUT */
+    uint32_t offered = inl(vn_iobase + VIO_FEATURES);
+    if (!(offered & VIRTIO_F_ANY_LAYOUT)) {
+        DBG("[virtio-net] Legacy device without ANY_LAYOUT");
+        return 0;
+    }
+    vn_features = offered & (VN_WANT_FEATURES | VIRTIO_F_ANY_LAYOUT);
+    outl(vn_iobase + VIO_DRV_FEATURES, vn_features);
+    vn_hdr_len = sizeof(struct virtio_net_hdr_vn) - 2;
+
+    /* Legacy queues have a fixed, device-chosen size */
+    for (int qi = VN_RXQ; qi <= VN_TXQ; qi++) {
+        outw(vn_iobase + VIO_QUEUE_SEL, (uint16_t)qi);
+        uint16_t qsz = inw(vn_iobase + VIO_QUEUE_SIZE);
+        if (qsz == 0 || qsz > VN_QUEUE_MAX) {
+            DBG("[virtio-net] Unsupported queue size %u", qsz);
+            return 0;
+        }
+        vn_vq_init(qi, qsz);
+        outl(vn_iobase + VIO_QUEUE_PFN, (uint32_t)vn_qmem[qi].mem / 4096);
+    }
+
+    if (vn_features & VIRTIO_NET_F_MAC) {
+        for (int i = 0; i < 6; i++)
+            vn_mac[i] = inb(vn_iobase + VIO_DEVICE_CFG + i);
+    }
+    return 1;
+}
+
+/* Point RX descriptor `id` at a network buffer: the device writes the
+ * virtio header at the start and the frame right behind it */
+static void vn_rx_attach(uint16_t id, netbuf_t *nb) {
+    vn_rx_nb[id] = nb;
+    vn_q[VN_RXQ].desc[id].addr = (uint32_t)nb->head;
+    vn_q[VN_RXQ].desc[id].len  = NETBUF_SIZE;
+}
+
+/* Post every receive buffer and set up the transmit free list */
+static int vn_fill_rings(void) {
+    vn_queue_t *rq = &vn_q[VN_RXQ];
+    vn_rx_count = rq->size < VNET_RX_BUFS ? rq->size : VNET_RX_BUFS;
+    for (uint16_t i = 0; i < vn_rx_count; i++) {
+        netbuf_t *nb = vn_rx_nb[i] ? vn_rx_nb[i] : netbuf_alloc();
+        if (!nb) {
+            DBG("[virtio-net] Out of network buffers");
+            return 0;
+        }
+        vn_rx_attach(i, nb);
+        rq->desc[i].flags = VRING_DESC_F_WRITE;
+        rq->desc[i].next  = 0;
+        vn_post(rq, i);
+    }
+    vn_rx_unkicked = 0;
+
+    vn_queue_t *tq = &vn_q[VN_TXQ];
+    vn_tx_count = tq->size < VNET_TX_BUFS ? tq->size : VNET_TX_BUFS;
+    vn_tx_nfree = 0;
+    for (uint16_t i = 0; i < vn_tx_count; i++) {
+        tq->desc[i].addr  = 0;
+        tq->desc[i].flags = 0;
+        tq->desc[i].next  = 0;
+        vn_tx_free[vn_tx_nfree++] = i;
+    }
+    /* TX buffers are reclaimed by later sends: no completion interrupts */
+    tq->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    return 1;
+}
+
+int virtio_net_initialize(void) {
+    pci_device_t dev;
+    int found = 0;
+
+    /* Modern virtio-net is 0x1041, transitional is 0x1000 */
+    if (pci_find_device(VIRTIO_VENDOR_ID, 0x1041, &dev) == 0 ||
+        pci_find_device(VIRTIO_VENDOR_ID, 0x1000, &dev) == 0)
+        found = 1;
+
+    if (!found) {
+        DBG("[virtio-net] No VirtIO network device found");
+        return -1;
+    }
+
+    /* Enable PCI bus mastering + I/O + memory, keep INTx enabled */
+    uint16_t cmd = pci_config_read_word(dev.bus, dev.device,
+                                         dev.function, PCI_COMMAND);
+    cmd |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+    cmd &= ~PCI_COMMAND_INTX_DISABLE;
+    pci_config_write_word(dev.bus, dev.device, dev.function,
+                          PCI_COMMAND, cmd);
+
+    vn_iobase = 0;
+    for (int i = 0; i < 6; i++) {
+        if (dev.bar[i] & 0x1) {
+            vn_iobase = (uint16_t)(dev.bar[i] & ~0x3u);
+            break;
+        }
+    }
+
+    /* Locally administered fallback if the device has no MAC */
+    static const uint8_t default_mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x57 };
+    memcpy(vn_mac, default_mac, 6);
+
+    int ok;
+    if (vn_parse_caps(&dev)) {
+        vn_modern = 1;
+        ok = vn_init_modern();
+    } else if (vn_iobase) {
+        vn_modern = 0;
+        ok = vn_init_legacy();
+    } else {
+        DBG("[virtio-net] No usable BAR");
+        return -1;
+    }
+    if (!ok || !vn_fill_rings())
+        return -1;
+
+    /* Receive interrupts stay off until the network layer enables them */
+    vn_q[VN_RXQ].avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+
+    if (vn_modern)
+        vn_common->device_status = VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER
+                                 | VIRTIO_STATUS_FEATURES_OK | VIRTIO_STATUS_DRIVER_OK;
+    else
+        outb(vn_iobase + VIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER
+                                   | VIRTIO_STATUS_DRIVER_OK);
+    vn_notify(VN_RXQ);
+
+    vn_irq = dev.interrupt_line;
+    vn_active = 1;
+    DBG("[virtio-net] %s, rxq=%u (%u posted), txq=%u (%u slots), csum=%d/%d, IRQ %d",
+        vn_modern ? "modern" : "legacy",
+        vn_q[VN_RXQ].size, vn_rx_count, vn_q[VN_TXQ].size, vn_tx_count,
+        (vn_features & VIRTIO_NET_F_CSUM) != 0,
+        (vn_features & VIRTIO_NET_F_GUEST_CSUM) != 0, vn_irq);
+    return 0;
+}
+
+int virtio_net_is_initialized(void) {
+    return vn_active;
+}
+
+void virtio_net_get_mac(uint8_t mac[6]) {
+    if (vn_active)
+        memcpy(mac, vn_mac, 6);
+}
+
+int virtio_net_has_csum_offload(void) {
+    return vn_active && (vn_features & VIRTIO_NET_F_CSUM) != 0;
+}
+
+/* ═══ Transmit ═════════════════════════════════════════════════ */
+
+int virtio_net_send_netbuf(netbuf_t *nb, int csum_start, int csum_offset) {
+    if (!vn_active || nb->len == 0 || nb->len > VNET_MAX_FRAME ||
+        netbuf_headroom(nb) < vn_hdr_len) {
+        netbuf_free(nb);
+        return -1;
+    }
+
+    uint32_t flags = irq_save();
+    if (vn_tx_nfree == 0) {
+        /* Let the device see what's been held back before giving up */
+        virtio_net_tx_flush();
+        vn_reap_tx();
+    }
+    if (vn_tx_nfree == 0) {
+        /* Ring full: the device is behind, drop like a full NIC FIFO */
+        irq_restore(flags);
+        netbuf_free(nb);
+        return -1;
+    }
+    uint16_t id = vn_tx_free[--vn_tx_nfree];
+
+    struct virtio_net_hdr_vn *hdr =
+        (struct virtio_net_hdr_vn *)netbuf_push(nb, vn_hdr_len);
+    memset(hdr, 0, vn_hdr_len);
+    if (csum_start >= 0 && (vn_features & VIRTIO_NET_F_CSUM)) {
+        hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr->csum_start = (uint16_t)csum_start;
+        hdr->csum_offset = (uint16_t)csum_offset;
+    }
+
+    vn_queue_t *q = &vn_q[VN_TXQ];
+    vn_tx_nb[id] = nb;
+    q->desc[id].addr = (uint32_t)nb->data;
+    q->desc[id].len = nb->len;
+    vn_post(q, id);
+    if (!vn_tx_held || ++vn_tx_unkicked >= VN_TX_KICK_BATCH) {
+        vn_tx_unkicked = 0;
+        vn_notify(VN_TXQ);
+    }
+
+    /* Opportunistically reclaim finished buffers */
+    vn_reap_tx();
+    irq_restore(flags);
+    return 0;
+}
+
+void virtio_net_tx_hold(int on) {
+    vn_tx_held = on;
+    if (!on)
+        virtio_net_tx_flush();
+}
+
+void virtio_net_tx_flush(void) {
+    if (vn_active && vn_tx_unkicked) {
+        vn_tx_unkicked = 0;
+        vn_notify(VN_TXQ);
+    }
+}
+
+int virtio_net_send_packet(const uint8_t *data, size_t len) {
+    netbuf_t *nb = netbuf_alloc();
+    if (!nb)
+        return -1;
+    uint8_t *p = netbuf_put(nb, len);
+    if (!p) {
+        netbuf_free(nb);
+        return -1;
+    }
+    memcpy(p, data, len);
+    return virtio_net_send_netbuf(nb, VNET_NO_CSUM, 0);
+}
+
+/* ═══ Receive ══════════════════════════════════════════════════ */
+
+netbuf_t *virtio_net_receive_netbuf(void) {
+    if (!vn_active)
+        return NULL;
+
+    vn_queue_t *q = &vn_q[VN_RXQ];
+    for (;;) {
+        if (q->used->idx == q->last_used) {
+            if (vn_rx_unkicked) {
+                vn_rx_unkicked = 0;
+                vn_notify(VN_RXQ);
+            }
+            return NULL;
+        }
+        __asm__ volatile("" ::: "memory");
+
+        struct vring_used_elem_vn *e = &q->used->ring[q->last_used % q->size];
+        uint32_t id = e->id;
+        uint32_t total = e->len;
+        q->last_used++;
+        if (id >= vn_rx_count)
+            continue;
+
+        /* Swap in a fresh buffer and pass the filled one up as is.  With
+         * the pool dry the frame is dropped and its buffer reposted. */
+        netbuf_t *nb = NULL;
+        if (total > vn_hdr_len && total <= NETBUF_SIZE) {
+            netbuf_t *fresh = netbuf_alloc();
+            if (fresh) {
+                nb = vn_rx_nb[id];
+                vn_rx_attach((uint16_t)id, fresh);
+            }
+        }
+
+        /* Hand the descriptor straight back; kick once per batch */
+        vn_post(q, (uint16_t)id);
+        if (++vn_rx_unkicked >= VN_RX_KICK_BATCH) {
+            vn_rx_unkicked = 0;
+            vn_notify(VN_RXQ);
+        }
+        if (!nb)
+            continue;
+
+        struct virtio_net_hdr_vn *hdr = (struct virtio_net_hdr_vn *)nb->head;
+        nb->data = nb->head + vn_hdr_len;
+        nb->len = total - vn_hdr_len;
+        if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+            vn_finish_csum(nb->data, nb->len, hdr->csum_start, hdr->csum_offset);
+        return nb;
+    }
+}
+
+/* ═══ Interrupts ═══════════════════════════════════════════════ */
+
+int virtio_net_get_irq(void) {
+    return vn_active ? vn_irq : -1;
+}
+
+int virtio_net_irq_ack(void) {
+    if (!vn_active) return 0;
+    /* Reading ISR acknowledges the interrupt */
+    uint8_t isr = vn_modern ? *vn_isr : inb(vn_iobase + VIO_ISR);
+    if (!(isr & 1))
+        return 0;   /* not ours (the line may be shared) */
+    vn_q[VN_RXQ].avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    return 1;
+}
+
+int virtio_net_irq_enable(int on) {
+    if (!vn_active) return 0;
+    vn_queue_t *q = &vn_q[VN_RXQ];
+    q->avail->flags = on ? 0 : VRING_AVAIL_F_NO_INTERRUPT;
+    __asm__ volatile("mfence" ::: "memory");
+    /* Frames that completed while suppressed raised no interrupt */
+    return on && q->used->idx != q->last_used;
+}
@@ -42,12 +42,12 @@ static void about_refresh_stats(void)
                  "CPU (%d%%)", cpu_pct);
     }
 
-    /* Memory: PMM frames (4KB each, 65536 total = 256MB) */
+    /* Memory: PMM frames (4KB each) */
     uint32_t free_frames = pmm_free_frame_count();
-    uint32_t total_frames = 65536; /* NUM_BLOCKS = 65536 frames */
+    uint32_t total_frames = pmm_total_frame_count();
     uint32_t used_frames = (free_frames < total_frames)
                            ? total_frames - free_frames : 0;
-    int mem_pct = (int)(used_frames * 100 / total_frames);
+    int mem_pct = total_frames ? (int)(used_frames * 100 / total_frames) : 0;
 
     w = ui_get_widget(about_win, mem_prog_idx);
     if (w) {
@@ -97,8 +97,10 @@ void app_about_open(void)
     y += 22;
 
     /* Subtitle */
-    ui_add_label(about_win, 12, y, cw, 16, "i386 | 256MB | 120Hz",
-                 ui_theme.text_dim);
+    char subtitle[48];
+    snprintf(subtitle, sizeof(subtitle), "i386 | %uMB | 120Hz",
+             pmm_total_frame_count() / 256);
+    ui_add_label(about_win, 12, y, cw, 16, subtitle, ui_theme.text_dim);
     y += 24;
 
     /* Separator */
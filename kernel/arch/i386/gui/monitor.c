@@ -99,9 +99,9 @@ static void mon_paint(void) {
     /* Memory */
     {
         uint32_t free_frames = pmm_free_frame_count();
-        uint32_t total_frames = 65536; /* 256MB / 4KB */
+        uint32_t total_frames = pmm_total_frame_count();
         uint32_t used_frames = total_frames - free_frames;
-        int pct = (int)(used_frames * 100 / total_frames);
+        int pct = total_frames ? (int)(used_frames * 100 / total_frames) : 0;
         uint32_t used_mb = (used_frames * 4) / 1024;
         uint32_t total_mb = (total_frames * 4) / 1024;
         char buf[32];
@@ -131,8 +131,9 @@ static void demo_paint(void)
 static void systray_mem_update(int idx, char *out, uint32_t *color) {
     (void)idx;
     uint32_t free_frames = pmm_free_frame_count();
-    uint32_t free_mb = free_frames * 4 / 1024;
-    uint32_t used_pct = (free_mb >= 256) ? 0 : 100 - (free_mb * 100 / 256);
+    uint32_t total_frames = pmm_total_frame_count();
+    uint32_t used_pct = (!total_frames || free_frames >= total_frames) ? 0
+                        : 100 - (uint32_t)((uint64_t)free_frames * 100 / total_frames);
     out[0] = '0' + (used_pct / 10) % 10;
     out[1] = '0' + used_pct % 10;
     out[2] = '\0';
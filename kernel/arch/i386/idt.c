@@ -280,11 +280,20 @@ void pit_get_cpu_stats(uint32_t *idle, uint32_t *busy) {
 /* ========== IRQ Handler Table ========== */
 
 #define NUM_IRQS 16
-static irq_handler_t irq_handlers[NUM_IRQS];
+#define IRQ_MAX_SHARED 4    /* PCI devices often share a line */
+static irq_handler_t irq_handlers[NUM_IRQS][IRQ_MAX_SHARED];
 
 void irq_register_handler(int irq, irq_handler_t handler) {
-    if (irq >= 0 && irq < NUM_IRQS)
-        irq_handlers[irq] = handler;
+    if (irq < 0 || irq >= NUM_IRQS)
+        return;
+    for (int i = 0; i < IRQ_MAX_SHARED; i++) {
+        if (irq_handlers[irq][i] == handler)
+            return;
+        if (!irq_handlers[irq][i]) {
+            irq_handlers[irq][i] = handler;
+            return;
+        }
+    }
 }
 
 /* PIT IRQ0 handler */
@@ -328,8 +337,8 @@ registers_t* isr_handler(registers_t* regs) {
         /* IRQ */
         int irq = int_no - 32;
 
-        if (irq_handlers[irq])
-            irq_handlers[irq](regs);
+        for (int i = 0; i < IRQ_MAX_SHARED && irq_handlers[irq][i]; i++)
+            irq_handlers[irq][i](regs);
 
         /* Send EOI */
         if (irq >= 8)
@@ -451,15 +460,18 @@ registers_t* isr_handler(registers_t* regs) {
                     }
 
                     if (vma) {
-                        uint32_t frame = pmm_alloc_frame();
+                        uint32_t frame = pmm_alloc_frame_high();
+                        if (frame && vmm_zero_frame(frame) != 0) {
+                            pmm_free_frame(frame);
+                            frame = 0;
+                        }
                         if (frame) {
-                            memset((void *)frame, 0, PAGE_SIZE);
                             uint32_t pflags = PTE_PRESENT | PTE_USER;
                             if (vma->vm_flags & VMA_WRITE) pflags |= PTE_WRITABLE;
                             vmm_map_user_page(t->page_dir, page_va, frame, pflags);
                             return regs;  /* fault handled — resume execution */
                         }
-                        /* OOM: fall through to SIGSEGV */
+                        /* OOM or no kmap slot: fall through to SIGSEGV */
                     }
                 }
 
@@ -476,13 +488,16 @@ registers_t* isr_handler(registers_t* regs) {
                             vmm_map_user_page(t->page_dir, page_va, old_frame, new_flags);
                         } else {
                             /* Copy the page, decrement old refcount */
-                            uint32_t new_frame = pmm_alloc_frame();
+                            uint32_t new_frame = pmm_alloc_frame_high();
+                            if (new_frame && vmm_copy_frame(new_frame, old_frame) != 0) {
+                                pmm_free_frame(new_frame);
+                                new_frame = 0;
+                            }
                             if (new_frame) {
-                                memcpy((void *)new_frame, (void *)old_frame, PAGE_SIZE);
                                 frame_ref_dec(old_frame);
                                 vmm_map_user_page(t->page_dir, page_va, new_frame, new_flags);
                             }
-                            /* OOM: fall through to SIGSEGV */
+                            /* OOM or no kmap slot: fall through to SIGSEGV */
                             else goto cow_done;
                         }
                         return regs;  /* COW resolved */
@@ -38,6 +38,8 @@ int arp_resolve(const uint8_t ip[4], uint8_t mac[6]) {
             DBG("arp: send_request failed");
             return -1;
         }
+        /* We may be inside a transmit batch (tcp_output()) */
+        net_tx_flush();
 
         /* Poll for reply: ~1 second per attempt */
         for (int poll = 0; poll < 200; poll++) {
@@ -67,8 +69,12 @@ int arp_send_request(const uint8_t target_ip[4]) {
     if (!config->link_up) {
         return -1;
     }
-    uint8_t packet[60];  /* Minimum Ethernet frame size */
-    memset(packet, 0, sizeof(packet));
+    netbuf_t* nb = netbuf_alloc();
+    if (!nb) {
+        return -1;
+    }
+    uint8_t* packet = netbuf_put(nb, 60);  /* Minimum Ethernet frame size */
+    memset(packet, 0, 60);
     
     /* Ethernet header */
     uint8_t broadcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -88,7 +94,7 @@ int arp_send_request(const uint8_t target_ip[4]) {
     memset(arp->target_mac, 0, 6);   /* Unknown */
     memcpy(arp->target_ip, target_ip, 4);
     
-    return net_send_packet(packet, sizeof(packet));
+    return net_send_netbuf(nb);
 }
 
 void arp_handle_packet(const uint8_t* data, size_t len) {
@@ -136,8 +142,12 @@ void arp_handle_packet(const uint8_t* data, size_t len) {
     if (opcode == ARP_REQUEST && 
         memcmp(arp->target_ip, config->ip, 4) == 0) {
         
-        uint8_t reply[60];
-        memset(reply, 0, sizeof(reply));
+        netbuf_t* nb = netbuf_alloc();
+        if (!nb) {
+            return;
+        }
+        uint8_t* reply = netbuf_put(nb, 60);
+        memset(reply, 0, 60);
         
         /* Ethernet header */
         memcpy(reply, arp->sender_mac, 6);        /* Destination MAC */
@@ -156,6 +166,6 @@ void arp_handle_packet(const uint8_t* data, size_t len) {
         memcpy(arp_reply->target_mac, arp->sender_mac, 6);
         memcpy(arp_reply->target_ip, arp->sender_ip, 4);
         
-        net_send_packet(reply, sizeof(reply));
+        net_send_netbuf(nb);
     }
 }
@@ -26,6 +26,8 @@ static const char *tls_cipher_name(uint16_t suite) {
         case 0xC027: return "ECDHE-RSA-AES128-CBC-SHA256";
         case 0x009C: return "RSA-AES128-GCM-SHA256";
         case 0x003C: return "RSA-AES128-CBC-SHA256";
+        case 0xCCA8: return "ECDHE-RSA-CHACHA20-POLY1305";
+        case 0xCCA9: return "ECDHE-ECDSA-CHACHA20-POLY1305";
         default:     return "unknown";
     }
 }
@@ -191,7 +193,7 @@ int http_get(const char *url, http_response_t *resp) {
                 rc = -5;
                 break;
             }
-            int tls_rc = tls_connect(tls, sock, host);
+            int tls_rc = tls_connect(tls, sock, host, port);
             if (tls_rc < 0) {
                 static const char *tls_step[] = {
                     "ClientHello send", "ServerHello/Cert recv",
@@ -209,6 +211,8 @@ int http_get(const char *url, http_response_t *resp) {
                 break;
             }
             VPRINT("* TLS 1.2, cipher: %s\n", tls_cipher_name(tls->cipher_suite));
+            if (tls->resumed)
+                VPRINT("* TLS session resumed\n");
             VPRINT("* TLS handshake complete\n");
         }
 
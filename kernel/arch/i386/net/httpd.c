@@ -1,166 +1,575 @@
+/*
+ * httpd.c — Built-in HTTP/1.1 server
+ *
+ * One kernel thread runs an event loop over up to HTTPD_MAX_CONNS
+ * connections with the TCP layer's non-blocking calls: accept what is
+ * queued, read what has arrived, answer complete requests in order
+ * (keep-alive and pipelining), and push as much of each response as the
+ * send buffer takes.  Between passes it sleeps until the receive path
+ * has handled more frames, which is also when ACKs free send space.
+ *
+ * Files up to HTTPD_CACHE_FILE_MAX are kept in memory as a ready-made
+ * response, headers included, and revalidated against the inode's size
+ * and mtime on each hit.  Larger files are streamed HTTPD_CHUNK bytes at
+ * a time.
+ */
+
 #include <kernel/httpd.h>
-#include <kernel/socket.h>
 #include <kernel/tcp.h>
 #include <kernel/fs.h>
 #include <kernel/net.h>
 #include <kernel/idt.h>
 #include <kernel/task.h>
+#include <kernel/sched.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#define HTTPD_PATH_MAX 64
+
+/* A cached file: header lines (no blank line) followed by the body */
+typedef struct {
+    int      valid;
+    int      refs;              /* responses still sending from it */
+    char     path[HTTPD_PATH_MAX];
+    uint32_t ino, size, mtime;
+    uint8_t *resp;
+    uint32_t hdr_len, resp_len;
+    uint32_t last_use;
+} httpd_cent_t;
+
+typedef struct {
+    const uint8_t *p;
+    uint32_t len;
+} httpd_iov_t;
 
-#define HTTP_PORT 80
-#define HTTP_MAX_REQUEST 2048
+typedef struct {
+    int      tcp;               /* TCP handle; -1 when the slot is free */
+    uint32_t last_active;
+    uint32_t served;            /* requests answered */
+    int      close_after;       /* close once the response is out */
+    uint32_t req_len;
+    char     req[HTTPD_MAX_REQUEST];
+
+    /* Response in progress: headers and in-memory body, then file data */
+    int      busy;
+    httpd_iov_t out[3];
+    int      nout, cur;
+    httpd_cent_t *cent;         /* pinned while out[] points into it */
+    uint32_t file_ino, file_off, file_end;
+    char     hdr[160];          /* headers of uncached responses */
+} httpd_conn_t;
 
 static int httpd_running = 0;
-static int listen_fd = -1;
-static int httpd_task_id = -1;
+static int listen_idx = -1;
+static int httpd_tid = -1;
+static httpd_conn_t *conns;
+static httpd_cent_t cache[HTTPD_CACHE_ENTRIES];
+static uint8_t httpd_chunk[HTTPD_CHUNK];
+static httpd_stats_t stats;
 
-static const char* http_200 = "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n";
-static const char* http_404 = "HTTP/1.0 404 Not Found\r\nContent-Type: text/html\r\n\r\n"
-                               "<html><body><h1>404 Not Found</h1></body></html>";
-static const char* http_index =
+static const char http_index[] =
     "<html><head><title>ImposOS</title></head><body>"
     "<h1>Welcome to ImposOS!</h1>"
     "<p>This page is being served by ImposOS's built-in HTTP server.</p>"
     "<p>Try requesting a file from the filesystem, e.g. <code>/etc/hostname</code></p>"
     "</body></html>";
+static const char http_404[] = "<html><body><h1>404 Not Found</h1></body></html>";
+static const char http_400[] = "<html><body><h1>400 Bad Request</h1></body></html>";
+static const char http_501[] = "<html><body><h1>501 Not Implemented</h1></body></html>";
 
 void httpd_initialize(void) {
     httpd_running = 0;
-    listen_fd = -1;
+    listen_idx = -1;
 }
 
-int httpd_start(void) {
-    if (httpd_running) {
-        printf("httpd: already running\n");
-        return -1;
-    }
-
-    listen_fd = socket_create(SOCK_STREAM);
-    if (listen_fd < 0) {
-        printf("httpd: failed to create socket\n");
-        return -1;
-    }
+/* ═══ Helpers ═════════════════════════════════════════════════ */
 
-    if (socket_bind(listen_fd, HTTP_PORT) != 0) {
-        printf("httpd: failed to bind port %d\n", HTTP_PORT);
-        socket_close(listen_fd);
-        listen_fd = -1;
-        return -1;
-    }
+static int lower(int c) {
+    return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+}
 
-    if (socket_listen(listen_fd, 1) != 0) {
-        printf("httpd: failed to listen\n");
-        socket_close(listen_fd);
-        listen_fd = -1;
-        return -1;
-    }
+static int prefix_nocase(const char *s, const char *prefix) {
+    for (; *prefix; s++, prefix++)
+        if (lower(*s) != *prefix) return 0;
+    return 1;
+}
 
-    httpd_running = 1;
-    httpd_task_id = task_register("httpd", 1, -1);
-    printf("httpd: listening on port %d\n", HTTP_PORT);
+/* Case-insensitive search for `word` in s[0..len) */
+static int contains_nocase(const char *s, uint32_t len, const char *word) {
+    uint32_t wl = strlen(word);
+    for (uint32_t i = 0; i + wl <= len; i++)
+        if (prefix_nocase(s + i, word)) return 1;
     return 0;
 }
 
-void httpd_stop(void) {
-    if (!httpd_running) return;
-    if (listen_fd >= 0) {
-        socket_close(listen_fd);
-        listen_fd = -1;
+static const char *content_type(const char *path) {
+    const char *dot = strrchr(path, '.');
+    if (!dot || strchr(dot, '/')) return "text/plain";
+    dot++;
+    if (!strcmp(dot, "html") || !strcmp(dot, "htm")) return "text/html";
+    if (!strcmp(dot, "txt") || !strcmp(dot, "conf")) return "text/plain";
+    if (!strcmp(dot, "css"))  return "text/css";
+    if (!strcmp(dot, "js"))   return "application/javascript";
+    if (!strcmp(dot, "json")) return "application/json";
+    if (!strcmp(dot, "png"))  return "image/png";
+    if (!strcmp(dot, "jpg") || !strcmp(dot, "jpeg")) return "image/jpeg";
+    if (!strcmp(dot, "gif"))  return "image/gif";
+    return "application/octet-stream";
+}
+
+/* Status line and entity headers, without the blank line */
+static int build_header(char *buf, size_t max, const char *status,
+                        const char *type, uint32_t length) {
+    return snprintf(buf, max,
+        "HTTP/1.1 %s\r\nServer: ImposOS\r\nContent-Type: %s\r\n"
+        "Content-Length: %u\r\n", status, type, (unsigned)length);
+}
+
+/* ═══ File cache ══════════════════════════════════════════════ */
+
+static void cache_free(httpd_cent_t *e) {
+    stats.cache_entries--;
+    stats.cache_bytes -= e->resp_len;
+    free(e->resp);
+    e->resp = NULL;
+    e->valid = 0;
+}
+
+static void cache_unpin(httpd_cent_t *e) {
+    if (--e->refs == 0 && !e->valid && e->resp)
+        cache_free(e);
+}
+
+/* Drop an entry; if a response is still sending from it, it goes when
+ * that finishes */
+static void cache_invalidate(httpd_cent_t *e) {
+    e->valid = 0;
+    if (e->refs == 0)
+        cache_free(e);
+}
+
+static httpd_cent_t *cache_lookup(const char *path) {
+    for (int i = 0; i < HTTPD_CACHE_ENTRIES; i++) {
+        httpd_cent_t *e = &cache[i];
+        if (!e->valid || strcmp(e->path, path) != 0)
+            continue;
+        inode_t node;
+        int r = fs_read_inode(e->ino, &node);
+        if (r < 0 || node.type != INODE_FILE || node.size != e->size ||
+            node.modified_at != e->mtime) {
+            cache_invalidate(e);
+            return NULL;
+        }
+        e->last_use = pit_get_ticks();
+        return e;
     }
-    if (httpd_task_id >= 0) {
-        task_unregister(httpd_task_id);
-        httpd_task_id = -1;
+    return NULL;
+}
+
+/* A free slot with room for `bytes` more, evicting the least recently
+ * used idle entries; NULL if the pinned ones leave no room */
+static httpd_cent_t *cache_make_room(uint32_t bytes) {
+    for (;;) {
+        httpd_cent_t *slot = NULL, *lru = NULL;
+        for (int i = 0; i < HTTPD_CACHE_ENTRIES; i++) {
+            httpd_cent_t *e = &cache[i];
+            if (!e->valid && !e->resp) {
+                if (!slot) slot = e;
+            } else if (e->valid && e->refs == 0 &&
+                       (!lru || (int32_t)(e->last_use - lru->last_use) < 0)) {
+                lru = e;
+            }
+        }
+        if (slot && stats.cache_bytes + bytes <= HTTPD_CACHE_BYTES)
+            return slot;
+        if (!lru)
+            return NULL;
+        cache_invalidate(lru);
     }
-    httpd_running = 0;
-    printf("httpd: stopped\n");
 }
 
-static void handle_request(int client_fd) {
-    char request[HTTP_MAX_REQUEST];
-    int n = socket_recv(client_fd, request, sizeof(request) - 1, 3000);
-    if (n <= 0) {
-        socket_close(client_fd);
-        return;
+/* Read a file into a new cache entry */
+static httpd_cent_t *cache_fill(const char *path, uint32_t ino,
+                                const inode_t *node) {
+    char hdr[128];
+    int hl = build_header(hdr, sizeof(hdr), "200 OK", content_type(path), node->size);
+    uint32_t total = (uint32_t)hl + node->size;
+    httpd_cent_t *e = cache_make_room(total);
+    if (!e) return NULL;
+    uint8_t *resp = malloc(total ? total : 1);
+    if (!resp) return NULL;
+
+    memcpy(resp, hdr, hl);
+    int n = node->size ? fs_read_at(ino, resp + hl, 0, node->size) : 0;
+    if (n != (int)node->size) {
+        free(resp);
+        return NULL;
     }
-    request[n] = '\0';
 
-    /* Parse GET line */
-    char* method = request;
-    char* path = NULL;
+    strcpy(e->path, path);
+    e->ino = ino;
+    e->size = node->size;
+    e->mtime = node->modified_at;
+    e->resp = resp;
+    e->hdr_len = hl;
+    e->resp_len = total;
+    e->last_use = pit_get_ticks();
+    e->refs = 0;
+    e->valid = 1;
+    stats.cache_entries++;
+    stats.cache_bytes += total;
+    return e;
+}
 
-    if (strncmp(method, "GET ", 4) == 0) {
-        path = method + 4;
-        char* end = strchr(path, ' ');
-        if (end) *end = '\0';
+/* ═══ Requests ════════════════════════════════════════════════ */
+
+static void respond(httpd_conn_t *c, const char *tail,
+                    const void *hdr, uint32_t hdr_len,
+                    const void *body, uint32_t body_len) {
+    c->out[0].p = (const uint8_t *)hdr;
+    c->out[0].len = hdr_len;
+    c->out[1].p = (const uint8_t *)tail;
+    c->out[1].len = strlen(tail);
+    c->out[2].p = (const uint8_t *)body;
+    c->out[2].len = body_len;
+    c->nout = 3;
+    c->cur = 0;
+    c->file_off = c->file_end = 0;
+    c->busy = 1;
+}
+
+static void respond_error(httpd_conn_t *c, const char *tail, int head_only,
+                          const char *status, const char *body) {
+    uint32_t bl = strlen(body);
+    int hl = build_header(c->hdr, sizeof(c->hdr), status, "text/html", bl);
+    respond(c, tail, c->hdr, hl, body, head_only ? 0 : bl);
+}
+
+/* Answer the request in c->req[0..len), whose headers end there */
+static void handle_request(httpd_conn_t *c, uint32_t len) {
+    char *line = c->req;
+    char *eol = memchr(line, '\r', len);
+    uint32_t line_len = eol ? (uint32_t)(eol - line) : len;
+
+    stats.requests++;
+    if (c->served++ > 0) stats.reused++;
+    if (c->served >= HTTPD_MAX_KEEPALIVE) c->close_after = 1;
+
+    /* Request line: METHOD SP target SP HTTP/1.x */
+    char *sp1 = memchr(line, ' ', line_len);
+    char *sp2 = sp1 ? memchr(sp1 + 1, ' ', line_len - (sp1 + 1 - line)) : NULL;
+    int http11 = sp2 && line_len - (sp2 + 1 - line) == 8 &&
+                 memcmp(sp2 + 1, "HTTP/1.1", 8) == 0;
+
+    /* 1.1 keeps the connection unless told otherwise, 1.0 only when
+     * asked to */
+    const char *hdrs = eol ? eol : line + len;
+    uint32_t hdrs_len = len - (uint32_t)(hdrs - line);
+    int keep = http11;
+    for (uint32_t i = 0; i + 11 < hdrs_len; i++) {
+        if (hdrs[i] != '\n' || !prefix_nocase(hdrs + i + 1, "connection:"))
+            continue;
+        const char *v = hdrs + i + 12;
+        const char *ve = memchr(v, '\r', hdrs_len - (uint32_t)(v - hdrs));
+        uint32_t vl = ve ? (uint32_t)(ve - v) : hdrs_len - (uint32_t)(v - hdrs);
+        if (contains_nocase(v, vl, "close")) keep = 0;
+        else if (contains_nocase(v, vl, "keep-alive")) keep = 1;
     }
+    if (!sp2) keep = 0;
+    if (!keep) c->close_after = 1;
+    const char *tail = c->close_after ? "Connection: close\r\n\r\n" :
+                       http11 ? "\r\n" : "Connection: keep-alive\r\n\r\n";
 
-    if (!path) {
-        socket_send(client_fd, http_404, strlen(http_404));
-        socket_close(client_fd);
+    if (!sp2) {
+        respond_error(c, tail, 0, "400 Bad Request", http_400);
         return;
     }
-
-    /* Serve / as index */
-    if (strcmp(path, "/") == 0) {
-        socket_send(client_fd, http_200, strlen(http_200));
-        socket_send(client_fd, http_index, strlen(http_index));
-        socket_close(client_fd);
+    int head_only = (sp1 - line == 4 && memcmp(line, "HEAD", 4) == 0);
+    if (!head_only && !(sp1 - line == 3 && memcmp(line, "GET", 3) == 0)) {
+        respond_error(c, tail, 0, "501 Not Implemented", http_501);
         return;
     }
 
-    /* Try to serve from filesystem — stream in 4KB chunks */
-    uint32_t parent;
-    char name[28];
-    int ino = fs_resolve_path(path, &parent, name);
-    if (ino < 0) {
-        socket_send(client_fd, http_404, strlen(http_404));
-        socket_close(client_fd);
+    char path[HTTPD_PATH_MAX];
+    uint32_t pl = (uint32_t)(sp2 - (sp1 + 1));
+    char *q = memchr(sp1 + 1, '?', pl);
+    if (q) pl = (uint32_t)(q - (sp1 + 1));
+    if (pl == 0 || pl >= sizeof(path) || sp1[1] != '/') {
+        respond_error(c, tail, head_only, "404 Not Found", http_404);
+        stats.not_found++;
         return;
     }
+    memcpy(path, sp1 + 1, pl);
+    path[pl] = '\0';
 
-    inode_t node;
-    if (fs_read_inode(ino, &node) < 0 || node.type != INODE_FILE) {
-        socket_send(client_fd, http_404, strlen(http_404));
-        socket_close(client_fd);
+    if (strcmp(path, "/") == 0) {
+        uint32_t bl = sizeof(http_index) - 1;
+        int hl = build_header(c->hdr, sizeof(c->hdr), "200 OK", "text/html", bl);
+        respond(c, tail, c->hdr, hl, http_index, head_only ? 0 : bl);
         return;
     }
 
-    socket_send(client_fd, http_200, strlen(http_200));
+    httpd_cent_t *e = cache_lookup(path);
+    if (e) {
+        stats.cache_hits++;
+    } else {
+        uint32_t parent;
+        char name[28];
+        inode_t node;
+        int ino = fs_resolve_path(path, &parent, name);
+        int ok = ino >= 0 && fs_read_inode(ino, &node) >= 0 &&
+                 node.type == INODE_FILE;
+        if (!ok) {
+            respond_error(c, tail, head_only, "404 Not Found", http_404);
+            stats.not_found++;
+            return;
+        }
+        if (node.size <= HTTPD_CACHE_FILE_MAX)
+            e = cache_fill(path, ino, &node);
+        if (e) {
+            stats.cache_misses++;
+        } else {
+            /* Too big for the cache (or no room): stream it */
+            int hl = build_header(c->hdr, sizeof(c->hdr), "200 OK",
+                                  content_type(path), node.size);
+            respond(c, tail, c->hdr, hl, NULL, 0);
+            if (!head_only) {
+                c->file_ino = ino;
+                c->file_off = 0;
+                c->file_end = node.size;
+            }
+            stats.streamed++;
+            return;
+        }
+    }
 
-    static uint8_t chunk[4096];
-    uint32_t offset = 0;
-    while (offset < node.size) {
-        uint32_t to_read = node.size - offset;
-        if (to_read > sizeof(chunk)) to_read = sizeof(chunk);
-        int n = fs_read_at(ino, chunk, offset, to_read);
-        if (n <= 0) break;
-        socket_send(client_fd, chunk, n);
-        offset += n;
+    e->refs++;
+    c->cent = e;
+    respond(c, tail, e->resp, e->hdr_len, e->resp + e->hdr_len,
+            head_only ? 0 : e->size);
+}
+
+/* ═══ Connections ═════════════════════════════════════════════ */
+
+static void conn_close(httpd_conn_t *c) {
+    if (c->cent) cache_unpin(c->cent);
+    tcp_close(c->tcp);
+    c->tcp = -1;
+    stats.active--;
+}
+
+/* Push the current response; 1 if it's all queued, 0 to come back
+ * later, -1 if the connection failed */
+static int conn_send(httpd_conn_t *c, int *progress) {
+    while (c->cur < c->nout) {
+        httpd_iov_t *v = &c->out[c->cur];
+        if (v->len == 0) {
+            c->cur++;
+            continue;
+        }
+        int n = tcp_send_nb(c->tcp, v->p, v->len);
+        if (n == -2) return 0;
+        if (n < 0) return -1;
+        *progress = 1;
+        v->p += n;
+        v->len -= n;
+    }
+
+    while (c->file_off < c->file_end) {
+        uint32_t want = c->file_end - c->file_off;
+        if (want > HTTPD_CHUNK) want = HTTPD_CHUNK;
+        int r = fs_read_at(c->file_ino, httpd_chunk, c->file_off, want);
+        if (r <= 0) return -1;      /* shrank under us: can't keep Content-Length */
+        int n = tcp_send_nb(c->tcp, httpd_chunk, r);
+        if (n == -2) return 0;
+        if (n < 0) return -1;
+        *progress = 1;
+        c->file_off += n;           /* what didn't fit is read again next time */
     }
 
-    socket_close(client_fd);
+    if (c->cent) {
+        cache_unpin(c->cent);
+        c->cent = NULL;
+    }
+    c->busy = 0;
+    return 1;
+}
+
+/* Index of the end of the first complete request header, or 0 */
+static uint32_t request_end(const httpd_conn_t *c) {
+    for (uint32_t i = 3; i < c->req_len; i++)
+        if (c->req[i] == '\n' && c->req[i - 1] == '\r' &&
+            c->req[i - 2] == '\n' && c->req[i - 3] == '\r')
+            return i + 1;
+    return 0;
 }
 
-void httpd_poll(void) {
-    if (!httpd_running || listen_fd < 0) return;
+static int conn_service(httpd_conn_t *c, uint32_t now) {
+    int progress = 0;
+    tcp_state_t st = tcp_get_state(c->tcp);
+    if (st != TCP_ESTABLISHED && st != TCP_CLOSE_WAIT) {
+        conn_close(c);
+        return 1;
+    }
 
-    /* Check if killed via task system */
-    if (httpd_task_id >= 0 && task_check_killed(httpd_task_id)) {
-        httpd_stop();
-        return;
+    if (c->req_len < sizeof(c->req)) {
+        int n = tcp_recv_nb(c->tcp, (uint8_t *)c->req + c->req_len,
+                            sizeof(c->req) - c->req_len);
+        if (n > 0) {
+            c->req_len += n;
+            c->last_active = now;
+            progress = 1;
+        }
+    }
+
+    for (;;) {
+        if (c->busy) {
+            int r = conn_send(c, &progress);
+            if (r < 0) {
+                conn_close(c);
+                return 1;
+            }
+            if (r == 0) break;
+            c->last_active = now;
+            if (c->close_after) {
+                conn_close(c);
+                return 1;
+            }
+        }
+
+        /* Next request, pipelined ones in arrival order */
+        uint32_t end = request_end(c);
+        if (end == 0) {
+            if (c->req_len == sizeof(c->req)) {
+                /* Headers too large to buffer */
+                c->close_after = 1;
+                respond_error(c, "Connection: close\r\n\r\n", 0,
+                              "400 Bad Request", http_400);
+                c->req_len = 0;
+                continue;
+            }
+            break;
+        }
+        handle_request(c, end);
+        memmove(c->req, c->req + end, c->req_len - end);
+        c->req_len -= end;
+        progress = 1;
+    }
+
+    /* Nothing left to answer: the peer hung up, or it went quiet */
+    if (!c->busy && ((st == TCP_CLOSE_WAIT && tcp_rx_available(c->tcp) == 0) ||
+                     now - c->last_active > HTTPD_IDLE_TICKS)) {
+        conn_close(c);
+        return 1;
+    }
+    return progress;
+}
+
+int httpd_poll(void) {
+    if (!httpd_running || listen_idx < 0) return 0;
+    int progress = 0, backlog = 1;
+    uint32_t now = pit_get_ticks();
+
+    /* Connections beyond HTTPD_MAX_CONNS wait in the accept queue */
+    for (int i = 0; i < HTTPD_MAX_CONNS; i++) {
+        httpd_conn_t *c = &conns[i];
+        if (c->tcp < 0) {
+            int idx = backlog ? tcp_accept(listen_idx, 0) : -1;
+            if (idx < 0) {
+                backlog = 0;
+                continue;
+            }
+            memset(c, 0, sizeof(*c));
+            c->tcp = idx;
+            c->last_active = now;
+            stats.accepted++;
+            stats.active++;
+            progress = 1;
+        }
+        progress |= conn_service(c, now);
+    }
+    return progress;
+}
+
+/* ═══ Thread ══════════════════════════════════════════════════ */
+
+static void httpd_thread(void) {
+    while (httpd_running) {
+        uint32_t seq = net_wait_seq();
+        if (httpd_poll())
+            continue;
+        /* Wake when the receive path has handled more frames (requests,
+         * ACKs that free send space) or to time out idle connections */
+        net_wait(seq, NET_TIMER_TICKS);
+        if (!net_rx_threaded())
+            pit_sleep_ms(10);       /* polled: net_wait() doesn't sleep */
     }
 
-    /* Non-blocking accept: check if a connection is waiting */
-    net_process_packets();
+    for (int i = 0; i < HTTPD_MAX_CONNS; i++)
+        if (conns[i].tcp >= 0) conn_close(&conns[i]);
+    tcp_close(listen_idx);
+    listen_idx = -1;
+    httpd_tid = -1;
+    task_exit();
+}
 
-    /* Try to accept - this will block briefly */
-    int client_fd = socket_accept(listen_fd);
-    if (client_fd >= 0) {
-        handle_request(client_fd);
+int httpd_start(void) {
+    if (httpd_running || httpd_tid >= 0) {
+        printf("httpd: already running\n");
+        return -1;
+    }
+    if (!sched_is_active()) {
+        printf("httpd: needs the scheduler\n");
+        return -1;
     }
+
+    if (!conns) {
+        conns = malloc(HTTPD_MAX_CONNS * sizeof(httpd_conn_t));
+        if (!conns) {
+            printf("httpd: out of memory\n");
+            return -1;
+        }
+    }
+    for (int i = 0; i < HTTPD_MAX_CONNS; i++)
+        conns[i].tcp = -1;
+
+    listen_idx = tcp_open(HTTPD_PORT, 1);
+    if (listen_idx < 0) {
+        printf("httpd: failed to listen on port %d\n", HTTPD_PORT);
+        return -1;
+    }
+    tcp_set_backlog(listen_idx, HTTPD_BACKLOG);
+
+    stats.active = 0;
+    httpd_running = 1;
+    httpd_tid = task_create_thread("httpd", httpd_thread, 0);
+    if (httpd_tid < 0) {
+        httpd_running = 0;
+        tcp_close(listen_idx);
+        listen_idx = -1;
+        printf("httpd: could not start thread\n");
+        return -1;
+    }
+    printf("httpd: listening on port %d\n", HTTPD_PORT);
+    return 0;
+}
+
+void httpd_stop(void) {
+    if (!httpd_running) return;
+    httpd_running = 0;
+    /* The thread closes everything on its way out */
+    while (httpd_tid >= 0)
+        task_yield();
+    for (int i = 0; i < HTTPD_CACHE_ENTRIES; i++)
+        if (cache[i].resp) cache_free(&cache[i]);
+    printf("httpd: stopped\n");
 }
 
 int httpd_is_running(void) {
     return httpd_running;
 }
+
+void httpd_get_stats(httpd_stats_t *st) {
+    *st = stats;
+}
@@ -2,6 +2,7 @@
 #include <kernel/arp.h>
 #include <kernel/net.h>
 #include <kernel/endian.h>
+#include <kernel/checksum.h>
 #include <kernel/udp.h>
 #include <kernel/tcp.h>
 #include <kernel/firewall.h>
@@ -14,36 +15,57 @@
 static uint16_t ip_id_counter = 0;
 
 uint16_t ip_checksum(const void* data, size_t len) {
-    const uint16_t* words = (const uint16_t*)data;
-    uint32_t sum = 0;
-    
-    while (len > 1) {
-        sum += *words++;
-        len -= 2;
-    }
-    
-    if (len == 1) {
-        sum += *(const uint8_t*)words;
-    }
-    
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-    
-    return ~sum;
+    return csum_finish(csum_partial(data, len, 0));
 }
 
 void ip_initialize(void) {
     ip_id_counter = 1;
 }
 
-int ip_send_packet(const uint8_t dst_ip[4], uint8_t protocol, const uint8_t* payload, size_t payload_len) {
+/* Prepend the IP header to the payload in `nb`; NULL if there's no room */
+static ip_header_t* ip_push_header(netbuf_t* nb, const uint8_t src_ip[4],
+                                   const uint8_t dst_ip[4], uint8_t protocol) {
+    size_t payload_len = nb->len;
+    ip_header_t* ip_hdr = (ip_header_t*)netbuf_push(nb, sizeof(ip_header_t));
+    if (!ip_hdr)
+        return NULL;
+
+    memset(ip_hdr, 0, sizeof(ip_header_t));
+    ip_hdr->version_ihl = 0x45;  /* Version 4, IHL 5 (20 bytes) */
+    ip_hdr->tos = 0;
+    ip_hdr->total_length = htons(sizeof(ip_header_t) + payload_len);
+    ip_hdr->identification = htons(ip_id_counter++);
+    ip_hdr->flags_fragment = 0;
+    ip_hdr->ttl = 64;
+    ip_hdr->protocol = protocol;
+    memcpy(ip_hdr->src_ip, src_ip, 4);
+    memcpy(ip_hdr->dst_ip, dst_ip, 4);
+    ip_hdr->checksum = 0;
+    return ip_hdr;
+}
+
+int ip_send_netbuf(const uint8_t dst_ip[4], uint8_t protocol, netbuf_t* nb) {
     net_config_t* config = net_get_config();
     DBG("ip: send to %d.%d.%d.%d proto=%d len=%u link_up=%d",
         dst_ip[0], dst_ip[1], dst_ip[2], dst_ip[3],
-        protocol, (unsigned)payload_len, config->link_up);
+        protocol, (unsigned)nb->len, config->link_up);
+
+    /* Local destinations take the loopback device, link or no link.
+     * 127.x traffic comes from the address it went to, so replies find
+     * the same connection. */
+    if (net_is_local(dst_ip)) {
+        const uint8_t* src_ip = dst_ip[0] == 127 ? dst_ip : config->ip;
+        if (nb->len + sizeof(ip_header_t) > 1500 ||
+            !ip_push_header(nb, src_ip, dst_ip, protocol)) {
+            netbuf_free(nb);
+            return -1;
+        }
+        return net_loopback_xmit(nb);
+    }
+
     if (!config->link_up) {
         DBG("ip: link down, aborting send");
+        netbuf_free(nb);
         return -1;
     }
     
@@ -74,41 +96,44 @@ int ip_send_packet(const uint8_t dst_ip[4], uint8_t protocol, const uint8_t* pay
         }
     }
     
-    /* Build packet: Ethernet + IP + Payload */
-    size_t total_len = 14 + sizeof(ip_header_t) + payload_len;
-    uint8_t packet[1500];
-    
-    if (total_len > sizeof(packet)) {
+    /* Prepend IP and Ethernet headers in the buffer's headroom */
+    size_t payload_len = nb->len;
+    if (14 + sizeof(ip_header_t) + payload_len > 1500) {
+        netbuf_free(nb);
         return -1;
     }
     
-    /* Ethernet header */
-    memcpy(packet, dst_mac, 6);
-    memcpy(packet + 6, config->mac, 6);
-    *(uint16_t*)(packet + 12) = htons(ETHERTYPE_IP);
-    
-    /* IP header */
-    ip_header_t* ip_hdr = (ip_header_t*)(packet + 14);
-    memset(ip_hdr, 0, sizeof(ip_header_t));
-    ip_hdr->version_ihl = 0x45;  /* Version 4, IHL 5 (20 bytes) */
-    ip_hdr->tos = 0;
-    ip_hdr->total_length = htons(sizeof(ip_header_t) + payload_len);
-    ip_hdr->identification = htons(ip_id_counter++);
-    ip_hdr->flags_fragment = 0;
-    ip_hdr->ttl = 64;
-    ip_hdr->protocol = protocol;
-    memcpy(ip_hdr->src_ip, config->ip, 4);
-    memcpy(ip_hdr->dst_ip, dst_ip, 4);
-    ip_hdr->checksum = 0;
+    ip_header_t* ip_hdr = ip_push_header(nb, config->ip, dst_ip, protocol);
+    uint8_t* eth = ip_hdr ? netbuf_push(nb, 14) : NULL;
+    if (!eth) {
+        netbuf_free(nb);
+        return -1;
+    }
     ip_hdr->checksum = ip_checksum(ip_hdr, sizeof(ip_header_t));
     
-    /* Payload */
-    memcpy(packet + 14 + sizeof(ip_header_t), payload, payload_len);
+    /* Ethernet header */
+    memcpy(eth, dst_mac, 6);
+    memcpy(eth + 6, config->mac, 6);
+    *(uint16_t*)(eth + 12) = htons(ETHERTYPE_IP);
     
-    return net_send_packet(packet, total_len);
+    return net_send_netbuf(nb);
 }
 
-void ip_handle_packet(const uint8_t* data, size_t len) {
+int ip_send_packet(const uint8_t dst_ip[4], uint8_t protocol, const uint8_t* payload, size_t payload_len) {
+    netbuf_t* nb = netbuf_alloc();
+    if (!nb) {
+        return -1;
+    }
+    uint8_t* p = netbuf_put(nb, payload_len);
+    if (!p) {
+        netbuf_free(nb);
+        return -1;
+    }
+    memcpy(p, payload, payload_len);
+    return ip_send_netbuf(dst_ip, protocol, nb);
+}
+
+static void ip_input(const uint8_t* data, size_t len, int local) {
     if (len < sizeof(ip_header_t)) {
         DBG("ip: recv too short len=%u", (unsigned)len);
         return;
@@ -125,7 +150,8 @@ void ip_handle_packet(const uint8_t* data, size_t len) {
     /* Check if packet is for us (or broadcast for DHCP) */
     uint8_t bcast[4] = {255, 255, 255, 255};
     uint8_t zero[4]  = {0, 0, 0, 0};
-    if (memcmp(ip_hdr->dst_ip, config->ip, 4) != 0 &&
+    if (!local &&
+        memcmp(ip_hdr->dst_ip, config->ip, 4) != 0 &&
         memcmp(ip_hdr->dst_ip, bcast, 4) != 0 &&
         memcmp(config->ip, zero, 4) != 0) {
         DBG("ip: not for us, dropping");
@@ -133,7 +159,7 @@ void ip_handle_packet(const uint8_t* data, size_t len) {
     }
 
     /* Verify checksum: sum of entire header (including checksum) should be 0 */
-    if (ip_checksum(ip_hdr, sizeof(ip_header_t)) != 0) {
+    if (!local && ip_checksum(ip_hdr, sizeof(ip_header_t)) != 0) {
         DBG("ip: bad checksum, dropping");
         return;  /* Bad checksum */
     }
@@ -164,6 +190,14 @@ void ip_handle_packet(const uint8_t* data, size_t len) {
     }
 }
 
+void ip_handle_packet(const uint8_t* data, size_t len) {
+    ip_input(data, len, 0);
+}
+
+void ip_handle_local(const uint8_t* data, size_t len) {
+    ip_input(data, len, 1);
+}
+
 void icmp_initialize(void) {
     /* Nothing to initialize */
 }
@@ -204,13 +238,20 @@ void icmp_handle_packet(const uint8_t* data, size_t len, const uint8_t src_ip[4]
         printf(": seq=%d\n", ntohs(icmp->sequence));
     } else if (icmp->type == ICMP_ECHO_REQUEST) {
         /* Send echo reply */
-        uint8_t reply[1500];
+        netbuf_t* nb = netbuf_alloc();
+        uint8_t* reply = nb ? netbuf_put(nb, len) : NULL;
+        if (!reply) {
+            netbuf_free(nb);
+            return;
+        }
         memcpy(reply, data, len);
         icmp_header_t* reply_icmp = (icmp_header_t*)reply;
+        /* Only the type changes: patch the checksum instead of redoing it */
+        uint16_t from = *(const uint16_t*)reply_icmp;
         reply_icmp->type = ICMP_ECHO_REPLY;
-        reply_icmp->checksum = 0;
-        reply_icmp->checksum = ip_checksum(reply, len);
+        reply_icmp->checksum = csum_update16(reply_icmp->checksum, from,
+                                             *(const uint16_t*)reply_icmp);
         
-        ip_send_packet(src_ip, IP_PROTOCOL_ICMP, reply, len);
+        ip_send_netbuf(src_ip, IP_PROTOCOL_ICMP, nb);
     }
 }
@@ -1,6 +1,7 @@
 #include <kernel/net.h>
 #include <kernel/rtl8139.h>
 #include <kernel/pcnet.h>
+#include <kernel/virtio_net.h>
 #include <kernel/arp.h>
 #include <kernel/ip.h>
 #include <kernel/udp.h>
@@ -10,15 +11,37 @@
 #include <kernel/dhcp.h>
 #include <kernel/httpd.h>
 #include <kernel/io.h>
+#include <kernel/idt.h>
+#include <kernel/task.h>
+#include <kernel/sched.h>
+#include <kernel/waitq.h>
+#include <kernel/checksum.h>
 #include <stdio.h>
 #include <string.h>
 
 static net_config_t net_config;
 static int net_initialized = 0;
-static int active_driver = 0;  /* 0=none, 1=rtl8139, 2=pcnet */
+static int active_driver = 0;  /* 0=none, 1=rtl8139, 2=pcnet, 3=virtio-net */
 static uint32_t net_tx_packets = 0, net_tx_bytes = 0;
 static uint32_t net_rx_packets = 0, net_rx_bytes = 0;
 
+/* Receive thread state (see "receive path" below) */
+static int netrx_tid = -1;
+static int net_irq = -1;
+static volatile int net_rx_pending = 0;
+static net_rx_stats_t rx_stats;
+static waitq_t net_rx_wq;       /* woken after every batch of frames */
+static uint32_t net_last_timer;
+
+/* Loopback device: IP packets sent to ourselves, delivered by net_poll() */
+static netbuf_t *lo_head, *lo_tail;
+static int lo_count;
+
+static int net_tx_depth;       /* open net_tx_begin() calls */
+
+static void net_start_rx_thread(void);
+static void net_run_timers(void);
+
 void net_initialize(void) {
     if (net_initialized) {
         return;
@@ -54,6 +77,9 @@ void net_initialize(void) {
     
     net_config.link_up = 0;
     
+    /* Packet buffers first: the drivers post them to their receive rings */
+    netbuf_init();
+    
     /* Initialize protocol layers */
     arp_initialize();
     ip_initialize();
@@ -65,17 +91,31 @@ void net_initialize(void) {
     dhcp_initialize();
     httpd_initialize();
     
-    /* Try to initialize NIC drivers: RTL8139 first, then PCnet */
-    DBG("net: trying RTL8139...");
-    if (rtl8139_initialize() == 0) {
-        rtl8139_get_mac(net_config.mac);
+    /* Try to initialize NIC drivers: virtio-net, RTL8139, then PCnet */
+    DBG("net: trying virtio-net...");
+    if (virtio_net_initialize() == 0) {
+        virtio_net_get_mac(net_config.mac);
         net_config.link_up = 1;
-        active_driver = 1;
-        DBG("net: RTL8139 OK, MAC=%x:%x:%x:%x:%x:%x",
+        active_driver = 3;
+        DBG("net: virtio-net OK, MAC=%x:%x:%x:%x:%x:%x",
             net_config.mac[0], net_config.mac[1], net_config.mac[2],
             net_config.mac[3], net_config.mac[4], net_config.mac[5]);
-        DBG("Network: RTL8139 initialized");
-    } else {
+    }
+
+    if (!active_driver) {
+        DBG("net: trying RTL8139...");
+        if (rtl8139_initialize() == 0) {
+            rtl8139_get_mac(net_config.mac);
+            net_config.link_up = 1;
+            active_driver = 1;
+            DBG("net: RTL8139 OK, MAC=%x:%x:%x:%x:%x:%x",
+                net_config.mac[0], net_config.mac[1], net_config.mac[2],
+                net_config.mac[3], net_config.mac[4], net_config.mac[5]);
+            DBG("Network: RTL8139 initialized");
+        }
+    }
+
+    if (!active_driver) {
         DBG("net: RTL8139 not found, trying PCnet...");
         if (pcnet_initialize() == 0) {
             pcnet_get_mac(net_config.mac);
@@ -92,6 +132,7 @@ void net_initialize(void) {
     }
 
     net_initialized = 1;
+    net_start_rx_thread();
     DBG("net: init done, driver=%d link_up=%d", active_driver, net_config.link_up);
 }
 
@@ -106,20 +147,104 @@ void net_set_ip(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
     net_config.ip[3] = d;
 }
 
-int net_send_packet(const uint8_t* data, size_t len) {
+/* Finish a checksum TCP/UDP left partial (see netbuf_csum_partial()):
+ * the field already holds the pseudo-header sum */
+static void net_csum_complete(netbuf_t* nb, uint32_t start) {
+    if (start + nb->csum_offset + 2 > nb->len) return;
+    uint8_t* l4 = nb->data + start;
+    uint16_t csum = csum_finish(csum_partial(l4, nb->len - start, 0));
+    /* 0 would mean "no checksum" to UDP; 0xFFFF is the same sum */
+    if (csum == 0) csum = 0xFFFF;
+    memcpy(l4 + nb->csum_offset, &csum, 2);
+}
+
+int net_send_netbuf(netbuf_t* nb) {
+    size_t len = nb->len;
     DBG("net: send_packet len=%u driver=%d", (unsigned)len, active_driver);
     int ret = -1;
-    if (active_driver == 1) ret = rtl8139_send_packet(data, len);
-    else if (active_driver == 2) ret = pcnet_send_packet(data, len);
+    /* The receive thread transmits too (ACKs, ARP replies) */
+    uint32_t flags = irq_save();
+    int csum_start = VNET_NO_CSUM;
+    if (nb->csum_start) {
+        uint32_t start = (uint32_t)(nb->head + nb->csum_start - nb->data);
+        if (active_driver == 3 && virtio_net_has_csum_offload()) {
+            csum_start = (int)start;
+            rx_stats.csum_hw++;
+        } else {
+            net_csum_complete(nb, start);
+            rx_stats.csum_sw++;
+        }
+    }
+    if (active_driver == 1) ret = rtl8139_send_netbuf(nb);
+    else if (active_driver == 2) ret = pcnet_send_netbuf(nb);
+    else if (active_driver == 3)
+        ret = virtio_net_send_netbuf(nb, csum_start, nb->csum_offset);
+    else netbuf_free(nb);
+    irq_restore(flags);
     if (ret == 0) { net_tx_packets++; net_tx_bytes += (uint32_t)len; }
     DBG("net: send_packet ret=%d", ret);
     return ret;
 }
 
+/* Only virtio-net has a doorbell worth saving; the RTL8139 and PCnet
+ * are told about each frame by the register write that queues it */
+void net_tx_begin(void) {
+    uint32_t flags = irq_save();
+    if (net_tx_depth++ == 0) {
+        rx_stats.tx_batches++;
+        if (active_driver == 3) virtio_net_tx_hold(1);
+    }
+    irq_restore(flags);
+}
+
+void net_tx_end(void) {
+    uint32_t flags = irq_save();
+    if (net_tx_depth > 0 && --net_tx_depth == 0 && active_driver == 3)
+        virtio_net_tx_hold(0);
+    irq_restore(flags);
+}
+
+void net_tx_flush(void) {
+    uint32_t flags = irq_save();
+    if (active_driver == 3) virtio_net_tx_flush();
+    irq_restore(flags);
+}
+
+int net_send_packet(const uint8_t* data, size_t len) {
+    netbuf_t* nb = netbuf_alloc();
+    if (!nb) {
+        return -1;
+    }
+    uint8_t* p = netbuf_put(nb, len);
+    if (!p) {
+        netbuf_free(nb);
+        return -1;
+    }
+    memcpy(p, data, len);
+    return net_send_netbuf(nb);
+}
+
+netbuf_t* net_receive_netbuf(void) {
+    netbuf_t* nb = NULL;
+    uint32_t flags = irq_save();
+    if (active_driver == 1) nb = rtl8139_receive_netbuf();
+    else if (active_driver == 2) nb = pcnet_receive_netbuf();
+    else if (active_driver == 3) nb = virtio_net_receive_netbuf();
+    irq_restore(flags);
+    return nb;
+}
+
 int net_receive_packet(uint8_t* buffer, size_t* len) {
-    if (active_driver == 1) return rtl8139_receive_packet(buffer, len);
-    if (active_driver == 2) return pcnet_receive_packet(buffer, len);
-    return -1;
+    netbuf_t* nb = net_receive_netbuf();
+    if (!nb) {
+        return -1;
+    }
+    if (nb->len < *len) {
+        *len = nb->len;
+    }
+    memcpy(buffer, nb->data, *len);
+    netbuf_free(nb);
+    return 0;
 }
 
 void net_print_mac(const uint8_t mac[6]) {
@@ -136,35 +261,273 @@ void net_print_ip(const uint8_t ip[4]) {
     printf("%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
 }
 
+/* ---- receive path ----
+ *
+ * NIC interrupts don't process anything themselves: the handler acks
+ * and masks the device, then wakes the "netrx" thread.  The thread
+ * drains the ring NET_RX_BUDGET frames at a time, yielding between
+ * batches so a flood can't starve other tasks, and unmasks the device
+ * once the ring is empty.  It also wakes every NET_TIMER_TICKS to run
+ * the TCP timers, so retransmits and TIME_WAIT expiry happen whether
+ * or not anyone is blocked in the stack, and earlier when a delayed
+ * ACK falls due.  Blocked callers sleep on a
+ * wait queue and are woken after each batch.
+ *
+ * Each frame is handled with interrupts disabled, which serialises the
+ * protocol layers against callers on other threads.  Without a
+ * scheduler (or before the thread starts) callers poll as before.
+ */
+
+/* Returns 1 if the device has frames that raised no interrupt */
+static int net_irq_enable(int on) {
+    if (active_driver == 1) rtl8139_irq_enable(on);
+    else if (active_driver == 2) pcnet_irq_enable(on);
+    else if (active_driver == 3) return virtio_net_irq_enable(on);
+    return 0;
+}
+
+static void net_irq_handler(registers_t *regs) {
+    (void)regs;
+    int ours = 0;
+    if (active_driver == 1) ours = rtl8139_irq_ack();
+    else if (active_driver == 2) ours = pcnet_irq_ack();
+    else if (active_driver == 3) ours = virtio_net_irq_ack();
+    if (!ours)
+        return;
+    rx_stats.irqs++;
+    net_rx_pending = 1;
+    if (netrx_tid >= 0)
+        task_unblock(netrx_tid);
+}
+
+/* ---- loopback ----
+ *
+ * Packets for 127.0.0.0/8 or our own address are queued here by
+ * ip_send_netbuf() instead of going to the NIC, and handed to the IP
+ * layer by the next net_poll(), exactly like received frames.  Queuing
+ * rather than delivering on the spot keeps the protocol layers from
+ * re-entering themselves mid-send.  There is no Ethernet header and no
+ * checksum to compute or verify, so local traffic costs one copy into
+ * the buffer and nothing else.
+ */
+
+int net_is_local(const uint8_t ip[4]) {
+    static const uint8_t zero[4];
+    if (ip[0] == 127)
+        return 1;
+    return memcmp(ip, net_config.ip, 4) == 0 && memcmp(ip, zero, 4) != 0;
+}
+
+int net_loopback_xmit(netbuf_t* nb) {
+    uint32_t flags = irq_save();
+    if (lo_count >= NET_LOOPBACK_QUEUE) {
+        rx_stats.lo_drops++;
+        irq_restore(flags);
+        netbuf_free(nb);
+        return -1;
+    }
+    nb->next = NULL;
+    if (lo_tail) lo_tail->next = nb;
+    else lo_head = nb;
+    lo_tail = nb;
+    lo_count++;
+    rx_stats.lo_packets++;
+    rx_stats.lo_bytes += nb->len;
+
+    /* Have the receive thread pick it up */
+    net_rx_pending = 1;
+    if (netrx_tid >= 0 && task_get_current() != netrx_tid)
+        task_unblock(netrx_tid);
+    irq_restore(flags);
+    return 0;
+}
+
+static int net_loopback_poll(int budget) {
+    int done = 0;
+    while (done < budget) {
+        uint32_t flags = irq_save();
+        netbuf_t *nb = lo_head;
+        if (nb) {
+            lo_head = nb->next;
+            if (!lo_head) lo_tail = NULL;
+            lo_count--;
+            ip_handle_local(nb->data, nb->len);
+            netbuf_free(nb);
+        }
+        irq_restore(flags);
+        if (!nb)
+            break;
+        done++;
+    }
+    return done;
+}
+
+/* Handle one received frame; runs with interrupts disabled */
+static void net_dispatch(const uint8_t *frame, size_t len) {
+    net_rx_packets++;
+    net_rx_bytes += (uint32_t)len;
+
+    /* Check Ethernet frame type */
+    if (len < 14)
+        return;
+
+    uint16_t ethertype = (frame[12] << 8) | frame[13];
+    DBG("net: rx pkt len=%u ethertype=0x%x", (unsigned)len, ethertype);
+
+    if (ethertype == 0x0806) {  /* ARP */
+        arp_handle_packet(frame + 14, len - 14);
+    } else if (ethertype == 0x0800) {  /* IPv4 */
+        ip_handle_packet(frame + 14, len - 14);
+    }
+}
+
+int net_poll(int budget) {
+    int done = net_loopback_poll(budget);
+
+    while (active_driver != 0 && done < budget) {
+        uint32_t flags = irq_save();
+        netbuf_t *nb = net_receive_netbuf();
+        if (nb) {
+            net_dispatch(nb->data, nb->len);
+            netbuf_free(nb);
+        }
+        irq_restore(flags);
+        if (!nb)
+            break;
+        done++;
+    }
+
+    rx_stats.polls++;
+    if (done == budget)
+        rx_stats.budget_hits++;
+    if (done > 0)
+        waitq_wake(&net_rx_wq);
+    return done;
+}
+
 void net_process_packets(void) {
-    if (active_driver == 0) {
+    uint32_t flags = irq_save();
+    irq_restore(flags);
+
+    /* The receive thread owns the ring; give it a chance to run.  Code
+     * running on the thread itself (ARP resolution while replying) or
+     * with interrupts off still has to poll. */
+    if (netrx_tid >= 0 && (flags & 0x200) &&
+        task_get_current() != netrx_tid) {
+        if (waitq_can_block())
+            task_yield();
         return;
     }
+    while (net_poll(NET_RX_BUDGET) == NET_RX_BUDGET)
+        ;
+    net_run_timers();
+}
 
-    uint8_t buffer[1500];
-    size_t len = sizeof(buffer);
+/* Run the TCP timers every NET_TIMER_TICKS, or sooner for a delayed ACK */
+static void net_run_timers(void) {
+    uint32_t now = pit_get_ticks(), due;
+    int periodic = now - net_last_timer >= NET_TIMER_TICKS;
+    if (!periodic && !(tcp_delack_due(&due) && (int32_t)(now - due) >= 0))
+        return;
+    if (periodic) net_last_timer = now;
+    uint32_t flags = irq_save();
+    tcp_timer_tick();
+    irq_restore(flags);
+}
 
-    while (net_receive_packet(buffer, &len) == 0) {
-        net_rx_packets++;
-        net_rx_bytes += (uint32_t)len;
+static void net_rx_thread(void) {
+    for (;;) {
+        net_rx_pending = 0;
+        int n = net_poll(NET_RX_BUDGET);
+        net_run_timers();
 
-        /* Check Ethernet frame type */
-        if (len < 14) {
-            len = sizeof(buffer);
+        if (n == NET_RX_BUDGET) {
+            task_yield();           /* more queued: let others run first */
             continue;
         }
 
-        uint16_t ethertype = (buffer[12] << 8) | buffer[13];
-        DBG("net: rx pkt len=%u ethertype=0x%x", (unsigned)len, ethertype);
-
-        if (ethertype == 0x0806) {  /* ARP */
-            arp_handle_packet(buffer + 14, len - 14);
-        } else if (ethertype == 0x0800) {  /* IPv4 */
-            ip_handle_packet(buffer + 14, len - 14);
+        /* Ring empty: unmask and sleep until the next interrupt or timer.
+         * A frame landing after the poll raises the interrupt as soon as
+         * the device is unmasked, which wakes us straight back up. */
+        uint32_t flags = irq_save();
+        if (net_irq_enable(1))
+            net_rx_pending = 1;
+        if (!net_rx_pending) {
+            task_info_t *t = task_get(netrx_tid);
+            uint32_t wake = pit_get_ticks() + NET_TIMER_TICKS, due;
+            if (tcp_delack_due(&due) && (int32_t)(due - wake) < 0)
+                wake = due;
+            t->sleep_until = wake;
+            t->state = TASK_STATE_SLEEPING;
+            irq_restore(flags);
+            task_yield();
+            rx_stats.wakeups++;
+        } else {
+            irq_restore(flags);
         }
+    }
+}
+
+static void unmask_irq(int irq) {
+    if (irq < 8) {
+        outb(0x21, inb(0x21) & ~(1 << irq));
+    } else {
+        outb(0xA1, inb(0xA1) & ~(1 << (irq - 8)));
+        outb(0x21, inb(0x21) & ~(1 << 2));     /* cascade */
+    }
+}
+
+static void net_start_rx_thread(void) {
+    waitq_init(&net_rx_wq);
+    if (active_driver == 0 || netrx_tid >= 0 || !sched_is_active())
+        return;
+
+    if (active_driver == 1) net_irq = rtl8139_get_irq();
+    else if (active_driver == 2) net_irq = pcnet_get_irq();
+    else net_irq = virtio_net_get_irq();
+    if (net_irq <= 0 || net_irq >= 16) {
+        DBG("net: no usable IRQ line, staying in polled mode");
+        net_irq = -1;
+        return;
+    }
+
+    netrx_tid = task_create_thread("netrx", net_rx_thread, 0);
+    if (netrx_tid < 0) {
+        DBG("net: could not start receive thread, staying in polled mode");
+        return;
+    }
+    irq_register_handler(net_irq, net_irq_handler);
+    unmask_irq(net_irq);
+    net_irq_enable(1);
+    DBG("net: receive thread %d on IRQ %d", netrx_tid, net_irq);
+}
+
+int net_rx_threaded(void) {
+    return netrx_tid >= 0;
+}
+
+int net_can_sleep(void) {
+    uint32_t flags = irq_save();
+    irq_restore(flags);
+    return netrx_tid >= 0 && (flags & 0x200) && task_get_current() != netrx_tid;
+}
 
-        len = sizeof(buffer);
+void net_wait(uint32_t seq, uint32_t ticks) {
+    if (!net_can_sleep()) {
+        net_process_packets();
+        return;
     }
+    waitq_sleep(&net_rx_wq, seq, ticks);
+}
+
+uint32_t net_wait_seq(void) {
+    return waitq_seq(&net_rx_wq);
+}
+
+void net_get_rx_stats(net_rx_stats_t *out) {
+    *out = rx_stats;
+    out->threaded = netrx_tid >= 0;
+    out->irq = net_irq;
 }
 
 void net_get_stats(uint32_t *tx_pkts, uint32_t *tx_bytes, uint32_t *rx_pkts, uint32_t *rx_bytes) {
@@ -0,0 +1,71 @@
+/*
+ * netbuf.c — Network packet buffer pool
+ *
+ * Every frame that goes through the stack lives in one of these
+ * preallocated buffers, from the NIC's receive ring up to the protocol
+ * handlers and from the socket layer down to the NIC's transmit ring.
+ * Buffers start with NETBUF_HEADROOM bytes free so TCP/UDP, IP and
+ * Ethernet can each prepend their header in place.  The free list is
+ * touched from the receive interrupt path, so it's guarded by irq_save().
+ */
+
+#include <kernel/netbuf.h>
+#include <kernel/io.h>
+
+static uint8_t nb_mem[NETBUF_COUNT][NETBUF_SIZE] __attribute__((aligned(16)));
+static netbuf_t nb_pool[NETBUF_COUNT];
+static netbuf_t *nb_free_list;
+static netbuf_stats_t nb_stats;
+static int nb_ready;
+
+void netbuf_init(void) {
+    if (nb_ready)
+        return;
+    nb_free_list = NULL;
+    for (int i = NETBUF_COUNT - 1; i >= 0; i--) {
+        nb_pool[i].head = nb_mem[i];
+        nb_pool[i].next = nb_free_list;
+        nb_free_list = &nb_pool[i];
+    }
+    nb_stats.total = NETBUF_COUNT;
+    nb_stats.free = NETBUF_COUNT;
+    nb_stats.min_free = NETBUF_COUNT;
+    nb_ready = 1;
+}
+
+netbuf_t *netbuf_alloc(void) {
+    uint32_t flags = irq_save();
+    netbuf_t *nb = nb_free_list;
+    if (!nb) {
+        nb_stats.fails++;
+        irq_restore(flags);
+        return NULL;
+    }
+    nb_free_list = nb->next;
+    nb_stats.allocs++;
+    if (--nb_stats.free < nb_stats.min_free)
+        nb_stats.min_free = nb_stats.free;
+    irq_restore(flags);
+
+    nb->next = NULL;
+    nb->data = nb->head + NETBUF_HEADROOM;
+    nb->len = 0;
+    nb->csum_start = 0;
+    return nb;
+}
+
+void netbuf_free(netbuf_t *nb) {
+    if (!nb)
+        return;
+    uint32_t flags = irq_save();
+    nb->next = nb_free_list;
+    nb_free_list = nb;
+    nb_stats.free++;
+    irq_restore(flags);
+}
+
+void netbuf_get_stats(netbuf_stats_t *st) {
+    uint32_t flags = irq_save();
+    *st = nb_stats;
+    irq_restore(flags);
+}
@@ -11,6 +11,7 @@ typedef struct {
     uint16_t port;      /* bound port */
     int nonblock;       /* O_NONBLOCK flag */
     int listening;      /* 1 if listen() called */
+    int nodelay;        /* TCP_NODELAY, applied once there is a TCB */
     uint8_t remote_ip[4];
     uint16_t remote_port;
 } socket_t;
@@ -46,12 +47,13 @@ int socket_bind(int fd, uint16_t port) {
 }
 
 int socket_listen(int fd, int backlog) {
-    (void)backlog;
     if (fd < 0 || fd >= MAX_SOCKETS || !sockets[fd].active) return -1;
     socket_t* s = &sockets[fd];
     if (s->type != SOCK_STREAM) return -1;
     int idx = tcp_open(s->port, 1);
     if (idx < 0) return -1;
+    if (backlog > 0)
+        tcp_set_backlog(idx, backlog);
     s->proto_idx = idx;
     s->listening = 1;
     return 0;
@@ -72,6 +74,8 @@ int socket_accept(int fd) {
         return -1;
     }
     sockets[new_fd].proto_idx = conn_idx;
+    /* Accepted connections inherit TCP_NODELAY from the listener */
+    if (s->nodelay) socket_set_nodelay(new_fd, 1);
     return new_fd;
 }
 
@@ -90,6 +94,8 @@ int socket_accept_nb(int fd) {
         return -1;
     }
     sockets[new_fd].proto_idx = conn_idx;
+    /* Accepted connections inherit TCP_NODELAY from the listener */
+    if (s->nodelay) socket_set_nodelay(new_fd, 1);
     return new_fd;
 }
 
@@ -101,6 +107,7 @@ int socket_connect(int fd, const uint8_t ip[4], uint16_t port) {
     int idx = tcp_open(s->port, 0);
     if (idx < 0) return -1;
     s->proto_idx = idx;
+    if (s->nodelay) tcp_set_nodelay(idx, 1);
 
     memcpy(s->remote_ip, ip, 4);
     s->remote_port = port;
@@ -162,6 +169,16 @@ int socket_get_nonblock(int fd) {
     return sockets[fd].nonblock;
 }
 
+int socket_set_nodelay(int fd, int on) {
+    if (fd < 0 || fd >= MAX_SOCKETS || !sockets[fd].active) return -1;
+    socket_t* s = &sockets[fd];
+    if (s->type != SOCK_STREAM) return -1;
+    s->nodelay = on != 0;
+    if (s->proto_idx >= 0 && !s->listening)
+        tcp_set_nodelay(s->proto_idx, s->nodelay);
+    return 0;
+}
+
 int socket_is_listening(int fd) {
     if (fd < 0 || fd >= MAX_SOCKETS || !sockets[fd].active) return 0;
     return sockets[fd].listening;
@@ -1,305 +1,1537 @@
 #include <kernel/tcp.h>
 #include <kernel/ip.h>
+#include <kernel/netbuf.h>
 #include <kernel/net.h>
 #include <kernel/idt.h>
 #include <kernel/task.h>
 #include <kernel/endian.h>
+#include <kernel/checksum.h>
+#include <kernel/io.h>
+#include <kernel/crypto.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-static tcb_t tcbs[TCP_MAX_CONNECTIONS];
+static tcb_t *tcb_handles[TCP_MAX_CONNECTIONS];  /* API index -> TCB */
+static tcb_t *tcb_hash[TCP_HASH_SIZE];            /* connections by 4-tuple */
+static tcb_t *listen_hash[TCP_LISTEN_HASH];       /* listeners by port */
+static int next_handle;
+static tcp_stats_t tcp_stats;
 static uint16_t next_ephemeral_port = 49152;
 
-/* Ring buffer helpers */
-static int ring_write(tcp_ring_t* r, const uint8_t* data, size_t len) {
-    size_t written = 0;
-    while (written < len && r->count < TCP_BUFFER_SIZE) {
-        r->buf[r->head] = data[written++];
-        r->head = (r->head + 1) % TCP_BUFFER_SIZE;
-        r->count++;
+/* Sequence number comparisons, modulo 2^32 */
+#define SEQ_LT(a, b)  ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b)  ((int32_t)((a) - (b)) > 0)
+#define SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+
+_Static_assert((65535u << TCP_WSCALE) >= TCP_BUF_MAX,
+               "the scaled window must cover the largest buffer");
+
+/* Ring buffer helpers: at most two memcpy()s per call.  Callers hold
+ * interrupts off and allocate the ring with ring_alloc() first. */
+static int ring_alloc(tcp_ring_t* r) {
+    if (!r->buf) {
+        r->buf = malloc(r->size);
+        r->head = r->tail = r->count = 0;
+        r->last_use = pit_get_ticks();
     }
-    return written;
+    return r->buf != NULL;
 }
 
-static int ring_read(tcp_ring_t* r, uint8_t* buf, size_t len) {
-    size_t nread = 0;
-    while (nread < len && r->count > 0) {
-        buf[nread++] = r->buf[r->tail];
-        r->tail = (r->tail + 1) % TCP_BUFFER_SIZE;
-        r->count--;
+static void ring_release(tcp_ring_t* r) {
+    free(r->buf);
+    r->buf = NULL;
+    r->head = r->tail = r->count = 0;
+}
+
+/* Store `len` bytes `off` bytes past the end of the data, leaving count
+ * alone (out-of-order data); the caller checks that they fit */
+static void ring_store(tcp_ring_t* r, size_t off, const uint8_t* data, size_t len) {
+    size_t start = (r->head + off) % r->size;
+    size_t first = r->size - start;
+    if (first > len) first = len;
+    memcpy(r->buf + start, data, first);
+    memcpy(r->buf, data + first, len - first);
+    r->last_use = pit_get_ticks();
+}
+
+/* Make `len` bytes stored past the end part of the data */
+static void ring_commit(tcp_ring_t* r, size_t len) {
+    r->head = (r->head + len) % r->size;
+    r->count += len;
+}
+
+static size_t ring_write(tcp_ring_t* r, const uint8_t* data, size_t len) {
+    size_t space = r->size - r->count;
+    if (len > space) len = space;
+    ring_store(r, 0, data, len);
+    ring_commit(r, len);
+    return len;
+}
+
+/* Copy `len` bytes starting `off` bytes past the tail, without consuming */
+static size_t ring_peek(const tcp_ring_t* r, size_t off, uint8_t* buf, size_t len) {
+    if (off >= r->count) return 0;
+    if (len > r->count - off) len = r->count - off;
+    size_t start = (r->tail + off) % r->size;
+    size_t first = r->size - start;
+    if (first > len) first = len;
+    memcpy(buf, r->buf + start, first);
+    memcpy(buf + first, r->buf, len - first);
+    return len;
+}
+
+static void ring_drop(tcp_ring_t* r, size_t len) {
+    if (len > r->count) len = r->count;
+    r->tail = (r->tail + len) % r->size;
+    r->count -= len;
+    r->last_use = pit_get_ticks();
+}
+
+static size_t ring_read(tcp_ring_t* r, uint8_t* buf, size_t len) {
+    len = ring_peek(r, 0, buf, len);
+    ring_drop(r, len);
+    return len;
+}
+
+/* Double the capacity, up to `max`, keeping the first `keep` bytes from
+ * the tail (the data plus any out-of-order bytes stored after it).
+ * Returns 0 if the ring is at `max` or the heap is exhausted. */
+static int ring_grow(tcp_ring_t* r, uint32_t max, uint32_t keep) {
+    uint32_t size = r->size * 2;
+    if (size > max) size = max;
+    if (size <= r->size) return 0;
+    if (!r->buf) {
+        r->size = size;
+        return 1;
     }
-    return nread;
+
+    uint8_t* buf = malloc(size);
+    if (!buf) return 0;
+    size_t first = r->size - r->tail;
+    if (first > keep) first = keep;
+    memcpy(buf, r->buf + r->tail, first);
+    memcpy(buf + first, r->buf, keep - first);
+    free(r->buf);
+    r->buf = buf;
+    r->size = size;
+    r->tail = 0;
+    r->head = r->count;
+    return 1;
 }
 
-/* Backlog queue helpers */
-static int backlog_push(tcb_t *ltcb, int conn_idx) {
-    if (ltcb->backlog_count >= TCP_BACKLOG_MAX) return -1;
-    ltcb->backlog_queue[ltcb->backlog_head] = conn_idx;
-    ltcb->backlog_head = (ltcb->backlog_head + 1) % TCP_BACKLOG_MAX;
-    ltcb->backlog_count++;
-    return 0;
+/* Add [start, end) to a SACK list, merging the blocks it overlaps or
+ * touches.  The result goes first, since RFC 2018 wants the most recent
+ * block reported first; when the list is full the oldest is forgotten. */
+static void sack_insert(tcp_sack_t* list, int* n, uint32_t start, uint32_t end) {
+    for (int i = 0; i < *n; ) {
+        if (SEQ_LEQ(list[i].start, end) && SEQ_GEQ(list[i].end, start)) {
+            if (SEQ_LT(list[i].start, start)) start = list[i].start;
+            if (SEQ_GT(list[i].end, end)) end = list[i].end;
+            memmove(&list[i], &list[i + 1], (*n - i - 1) * sizeof(*list));
+            (*n)--;
+        } else {
+            i++;
+        }
+    }
+    if (*n == TCP_SACK_BLOCKS) (*n)--;
+    memmove(&list[1], &list[0], *n * sizeof(*list));
+    list[0].start = start;
+    list[0].end = end;
+    (*n)++;
 }
 
-static int backlog_pop(tcb_t *ltcb) {
-    if (ltcb->backlog_count <= 0) return -1;
-    int idx = ltcb->backlog_queue[ltcb->backlog_tail];
-    ltcb->backlog_tail = (ltcb->backlog_tail + 1) % TCP_BACKLOG_MAX;
-    ltcb->backlog_count--;
-    return idx;
+/* Wait for something to happen on a connection.  Take waitq_seq(&tcb->wq)
+ * before testing the condition.  Sleeps on the connection's queue when
+ * the receive thread can wake us, otherwise (no thread, or interrupts
+ * off inside a system call) polls the NIC once. */
+static void tcp_wait(tcb_t *tcb, uint32_t seq, uint32_t ticks) {
+    if (net_can_sleep())
+        waitq_sleep(&tcb->wq, seq, ticks);
+    else
+        net_process_packets();
 }
 
-/* TCP checksum with pseudo-header */
-static uint16_t tcp_checksum(const uint8_t src_ip[4], const uint8_t dst_ip[4],
-                              const uint8_t* tcp_pkt, size_t tcp_len) {
-    uint32_t sum = 0;
+/* ---- options ---- */
+
+typedef struct {
+    uint16_t mss;         /* 0 if absent */
+    int      wscale;      /* -1 if absent */
+    int      sack_ok;
+    int      ts;          /* timestamps present */
+    uint32_t tsval, tsecr;
+    int      nsack;
+    tcp_sack_t sack[TCP_SACK_BLOCKS];
+} tcp_opts_t;
+
+static uint32_t get_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
 
-    /* Build pseudo-header as raw bytes in network order */
-    uint8_t pseudo[12];
-    memcpy(pseudo, src_ip, 4);
-    memcpy(pseudo + 4, dst_ip, 4);
-    pseudo[8] = 0;
-    pseudo[9] = 6; /* TCP protocol */
-    pseudo[10] = (tcp_len >> 8) & 0xFF;
-    pseudo[11] = tcp_len & 0xFF;
+static void put_be32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
 
-    const uint16_t* pw = (const uint16_t*)pseudo;
-    for (int i = 0; i < 6; i++) sum += pw[i];
+static void tcp_parse_options(const uint8_t* p, size_t len, tcp_opts_t* o) {
+    memset(o, 0, sizeof(*o));
+    o->wscale = -1;
+
+    size_t i = 0;
+    while (i < len) {
+        uint8_t kind = p[i];
+        if (kind == TCPOPT_EOL) break;
+        if (kind == TCPOPT_NOP) { i++; continue; }
+        if (i + 1 >= len) break;
+        uint8_t olen = p[i + 1];
+        if (olen < 2 || i + olen > len) break;
+        const uint8_t* v = p + i + 2;
+
+        switch (kind) {
+        case TCPOPT_MSS:
+            if (olen == 4) o->mss = (v[0] << 8) | v[1];
+            break;
+        case TCPOPT_WSCALE:
+            if (olen == 3) o->wscale = v[0] > 14 ? 14 : v[0];
+            break;
+        case TCPOPT_SACK_PERM:
+            if (olen == 2) o->sack_ok = 1;
+            break;
+        case TCPOPT_SACK:
+            for (size_t j = 0; j + 8 <= (size_t)olen - 2 && o->nsack < TCP_SACK_BLOCKS; j += 8) {
+                o->sack[o->nsack].start = get_be32(v + j);
+                o->sack[o->nsack].end = get_be32(v + j + 4);
+                o->nsack++;
+            }
+            break;
+        case TCPOPT_TS:
+            if (olen == 10) {
+                o->ts = 1;
+                o->tsval = get_be32(v);
+                o->tsecr = get_be32(v + 4);
+            }
+            break;
+        }
+        i += olen;
+    }
+}
 
-    const uint16_t* words = (const uint16_t*)tcp_pkt;
-    size_t remaining = tcp_len;
-    while (remaining > 1) {
-        sum += *words++;
-        remaining -= 2;
+/* Write the options for an outgoing segment (at most 40 bytes) and
+ * return their length, a multiple of 4.  A SYN offers everything the
+ * connection still allows: all of it on an active open, what the peer
+ * offered on a SYN-ACK.  SACK blocks only go on segments without data,
+ * so a segment never grows past the peer's MSS. */
+static size_t tcp_write_options(const tcb_t* tcb, uint8_t flags, size_t data_len, uint8_t* p) {
+    size_t n = 0;
+
+    if (flags & TCP_SYN) {
+        p[n++] = TCPOPT_MSS;
+        p[n++] = 4;
+        p[n++] = TCP_MSS >> 8;
+        p[n++] = TCP_MSS & 0xFF;
+        if (tcb->sack_ok) {
+            p[n++] = TCPOPT_NOP;
+            p[n++] = TCPOPT_NOP;
+            p[n++] = TCPOPT_SACK_PERM;
+            p[n++] = 2;
+        }
+        if (tcb->ws_ok) {
+            p[n++] = TCPOPT_NOP;
+            p[n++] = TCPOPT_WSCALE;
+            p[n++] = 3;
+            p[n++] = tcb->rcv_wscale;
+        }
     }
-    if (remaining == 1)
-        sum += *(const uint8_t*)words;
 
-    while (sum >> 16)
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    if (tcb->ts_ok) {
+        p[n++] = TCPOPT_NOP;
+        p[n++] = TCPOPT_NOP;
+        p[n++] = TCPOPT_TS;
+        p[n++] = 10;
+        put_be32(p + n, pit_get_ticks());
+        put_be32(p + n + 4, tcb->ts_recent);
+        n += 8;
+    }
 
-    uint16_t result = ~sum;
-    return result == 0 ? 0xFFFF : result;
+    if (!(flags & TCP_SYN) && tcb->sack_ok && tcb->rcv_sack_n > 0 && data_len == 0) {
+        int blocks = tcb->rcv_sack_n;
+        if (tcb->ts_ok && blocks > 3) blocks = 3;
+        p[n++] = TCPOPT_NOP;
+        p[n++] = TCPOPT_NOP;
+        p[n++] = TCPOPT_SACK;
+        p[n++] = 2 + 8 * blocks;
+        for (int i = 0; i < blocks; i++) {
+            put_be32(p + n, tcb->rcv_sack[i].start);
+            put_be32(p + n + 4, tcb->rcv_sack[i].end);
+            n += 8;
+        }
+    }
+    return n;
 }
 
-/* Send a TCP segment */
-static int tcp_send_segment(tcb_t* tcb, uint8_t flags, const uint8_t* data, size_t data_len) {
-    uint8_t packet[sizeof(tcp_header_t) + TCP_MSS];
-    tcp_header_t* hdr = (tcp_header_t*)packet;
-    size_t total = sizeof(tcp_header_t) + data_len;
+/* Put a header with sequence number `seq` in front of the payload
+ * already in `nb` and send it.  Consumes `nb`. */
+static int tcp_emit(tcb_t* tcb, netbuf_t* nb, uint32_t seq, uint8_t flags) {
+    uint8_t opts[40];
+    size_t opt_len = tcp_write_options(tcb, flags, nb->len, opts);
+    size_t hdr_len = sizeof(tcp_header_t) + opt_len;
 
+    tcp_header_t* hdr = (tcp_header_t*)netbuf_push(nb, hdr_len);
     memset(hdr, 0, sizeof(tcp_header_t));
+    memcpy((uint8_t*)hdr + sizeof(tcp_header_t), opts, opt_len);
+
+    /* Windows in SYNs are never scaled */
+    uint32_t space = tcb->rx_ring.size - tcb->rx_ring.count;
+    uint8_t shift = (flags & TCP_SYN) ? 0 : tcb->rcv_wscale;
+    uint32_t wnd = space >> shift;
+    if (wnd > 0xFFFF) wnd = 0xFFFF;
+
     hdr->src_port    = htons(tcb->local_port);
     hdr->dst_port    = htons(tcb->remote_port);
-    hdr->seq_num     = htonl(tcb->snd_nxt);
+    hdr->seq_num     = htonl(seq);
     hdr->ack_num     = htonl(tcb->rcv_nxt);
-    hdr->data_offset = (sizeof(tcp_header_t) / 4) << 4;
+    hdr->data_offset = (hdr_len / 4) << 4;
     hdr->flags       = flags;
-    hdr->window      = htons(TCP_BUFFER_SIZE - tcb->rx_ring.count);
+    hdr->window      = htons(wnd);
     hdr->checksum    = 0;
     hdr->urgent_ptr  = 0;
+    tcb->rcv_adv = tcb->rcv_nxt + (wnd << shift);
+    if (flags & TCP_ACK) {
+        /* Whatever this carries, it settles the ACK we owed */
+        if (flags == TCP_ACK && nb->len == hdr_len) tcp_stats.pure_acks++;
+        tcb->ack_pending = 0;
+        tcb->rcv_acked = tcb->rcv_nxt;
+    }
+    tcp_stats.segs_out++;
+    tcb->segs_out++;
 
-    if (data_len > 0)
-        memcpy(packet + sizeof(tcp_header_t), data, data_len);
-
+    /* Loopback packets never reach a wire: no checksum needed.  Others
+     * carry the pseudo-header sum; the NIC or net_send_netbuf() adds
+     * the segment itself. */
     net_config_t* cfg = net_get_config();
-    hdr->checksum = tcp_checksum(cfg->ip, tcb->remote_ip, packet, total);
+    if (!net_is_local(tcb->remote_ip)) {
+        hdr->checksum = csum_fold(csum_pseudo(cfg->ip, tcb->remote_ip,
+                                              IP_PROTOCOL_TCP, (uint16_t)nb->len));
+        netbuf_csum_partial(nb, (uint8_t*)hdr, offsetof(tcp_header_t, checksum));
+    }
 
     tcb->last_send_tick = pit_get_ticks();
 
-    return ip_send_packet(tcb->remote_ip, IP_PROTOCOL_TCP, packet, total);
+    return ip_send_netbuf(tcb->remote_ip, IP_PROTOCOL_TCP, nb);
 }
 
-void tcp_initialize(void) {
-    memset(tcbs, 0, sizeof(tcbs));
-    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
-        tcbs[i].state = TCP_CLOSED;
-        tcbs[i].backlog_head = 0;
-        tcbs[i].backlog_tail = 0;
-        tcbs[i].backlog_count = 0;
+/* Send a TCP segment, built in place in a network buffer */
+static int tcp_send_segment(tcb_t* tcb, uint8_t flags, const uint8_t* data, size_t data_len) {
+    if (data_len > TCP_MSS) return -1;
+
+    netbuf_t* nb = netbuf_alloc();
+    if (!nb) return -1;
+
+    if (data_len > 0)
+        memcpy(netbuf_put(nb, data_len), data, data_len);
+    return tcp_emit(tcb, nb, tcb->snd_nxt, flags);
+}
+
+/* Send `len` bytes of the send buffer starting at sequence `seq`,
+ * copied once from the ring into the outgoing buffer */
+static int tcp_send_range(tcb_t* tcb, uint32_t seq, size_t len, uint8_t flags) {
+    netbuf_t* nb = netbuf_alloc();
+    if (!nb) return -1;
+
+    if (len > 0)
+        ring_peek(&tcb->tx_ring, seq - tcb->snd_una, netbuf_put(nb, len), len);
+    if (SEQ_LT(seq, tcb->snd_max))
+        tcb->retrans++;
+    return tcp_emit(tcb, nb, seq, flags);
+}
+
+/* ---- sending and congestion control ----
+ *
+ * tx_ring holds everything from snd_una on: bytes in flight first, then
+ * bytes not sent yet.  tcp_output() sends as much of the rest as the
+ * smaller of the peer's window and the congestion window allows, one
+ * MSS per segment, followed by the FIN once the application has closed.
+ * Lost segments are found by three duplicate ACKs (fast retransmit,
+ * NewReno recovery) or by the retransmit timer, whose timeout follows
+ * the measured round-trip time.  When the peer sends SACK blocks,
+ * recovery resends the holes between them instead of one segment per
+ * round trip.
+ */
+
+/* Reset the per-connection sending state for a new connection */
+static void tcp_init_sender(tcb_t* tcb) {
+    tcb->cwnd = TCP_INIT_CWND;
+    tcb->ssthresh = 0xFFFFFFFF;
+    tcb->rto_ticks = TCP_RTO_INIT;
+    tcb->snd_max = tcb->snd_nxt;
+    tcb->mss = TCP_MSS;
+    tcb->rx_ring.size = TCP_BUF_INIT;
+    tcb->tx_ring.size = TCP_BUF_INIT;
+}
+
+/* Segment size once the handshake is done: the smaller of ours and the
+ * peer's, less the room timestamps take in every segment */
+static void tcp_set_mss(tcb_t* tcb, uint16_t peer_mss) {
+    uint32_t mss = peer_mss ? peer_mss : TCP_MSS_DEFAULT;
+    if (mss > TCP_MSS) mss = TCP_MSS;
+    if (mss < 64) mss = 64;
+    if (tcb->ts_ok) mss -= 12;
+    tcb->mss = mss;
+}
+
+/* Adopt the options of the peer's SYN (or SYN-ACK, answering ours) */
+static void tcp_negotiate(tcb_t* tcb, const tcp_opts_t* o) {
+    tcb->ts_ok = o->ts;
+    tcb->sack_ok = o->sack_ok;
+    tcb->ws_ok = o->wscale >= 0;
+    tcb->snd_wscale = tcb->ws_ok ? o->wscale : 0;
+    tcb->rcv_wscale = tcb->ws_ok ? TCP_WSCALE : 0;
+    if (o->ts) tcb->ts_recent = o->tsval;
+    tcp_set_mss(tcb, o->mss);
+}
+
+static uint32_t tcp_rto_from_rtt(const tcb_t* tcb) {
+    uint32_t rto = (tcb->srtt >> 3) + (tcb->rttvar ? tcb->rttvar : 1);
+    if (rto < TCP_RTO_MIN) rto = TCP_RTO_MIN;
+    if (rto > TCP_RTO_MAX) rto = TCP_RTO_MAX;
+    return rto;
+}
+
+/* Fold a round-trip measurement (in ticks) into SRTT/RTTVAR */
+static void tcp_rtt_sample(tcb_t* tcb, uint32_t m) {
+    if (m == 0) m = 1;
+    if (tcb->srtt == 0) {
+        tcb->srtt = m << 3;
+        tcb->rttvar = m << 1;
+    } else {
+        int32_t delta = (int32_t)m - (int32_t)(tcb->srtt >> 3);
+        tcb->srtt += delta;
+        if (delta < 0) delta = -delta;
+        tcb->rttvar += delta - (tcb->rttvar >> 2);
     }
+    tcb->rto_ticks = tcp_rto_from_rtt(tcb);
 }
 
-int tcp_open(uint16_t local_port, int listen) {
-    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
-        if (tcbs[i].state == TCP_CLOSED) {
-            memset(&tcbs[i], 0, sizeof(tcb_t));
-            tcbs[i].local_port = local_port;
-            tcbs[i].state = listen ? TCP_LISTEN : TCP_CLOSED;
-            tcbs[i].is_listen = listen;
-            tcbs[i].backlog_head = 0;
-            tcbs[i].backlog_tail = 0;
-            tcbs[i].backlog_count = 0;
-            tcbs[i].rto_ticks = TCP_RTO_INIT;
-            tcbs[i].rcv_wnd = TCP_BUFFER_SIZE;
-            tcbs[i].snd_wnd = TCP_BUFFER_SIZE;
-            /* Simple ISN based on tick counter */
-            tcbs[i].snd_nxt = pit_get_ticks() * 64;
-            tcbs[i].snd_una = tcbs[i].snd_nxt;
+static int tcp_can_send(const tcb_t* tcb) {
+    return tcb->state == TCP_ESTABLISHED || tcb->state == TCP_CLOSE_WAIT ||
+           tcb->state == TCP_FIN_WAIT_1 || tcb->state == TCP_CLOSING ||
+           tcb->state == TCP_LAST_ACK;
+}
+
+static uint32_t tcp_send_window(const tcb_t* tcb) {
+    return tcb->snd_wnd < tcb->cwnd ? tcb->snd_wnd : tcb->cwnd;
+}
+
+static void tcp_output_burst(tcb_t* tcb) {
+    for (;;) {
+        uint32_t sent = tcb->snd_nxt - tcb->snd_una;
+        uint32_t queued = tcb->tx_ring.count;
+        uint32_t now = pit_get_ticks();
+
+        if (sent >= queued) {
+            /* All data is out: the FIN follows, needing no window */
+            if (tcb->fin_queued && sent == queued) {
+                if (tcb->snd_nxt == tcb->snd_una) tcb->rtx_tick = now;
+                if (tcp_send_segment(tcb, TCP_FIN | TCP_ACK, NULL, 0) < 0)
+                    return;
+                tcb->snd_nxt++;
+                if (SEQ_GT(tcb->snd_nxt, tcb->snd_max))
+                    tcb->snd_max = tcb->snd_nxt;
+            }
+            return;
+        }
+
+        uint32_t wnd = tcp_send_window(tcb);
+        if (sent >= wnd) return;
+
+        uint32_t len = queued - sent;
+        if (len > wnd - sent) len = wnd - sent;
+        if (len > tcb->mss) len = tcb->mss;
+
+        /* Nagle: while data is unacknowledged, hold back the last
+         * partial segment until it fills up or the ACK comes back */
+        if (queued - sent < tcb->mss && !tcb->nodelay && !tcb->fin_queued &&
+            tcb->snd_nxt != tcb->snd_una)
+            return;
+        uint8_t flags = TCP_ACK;
+        if (sent + len == queued) flags |= TCP_PSH;
+
+        if (tcb->snd_nxt == tcb->snd_una) tcb->rtx_tick = now;
+        if (tcp_send_range(tcb, tcb->snd_nxt, len, flags) < 0)
+            return;
+
+        /* Without timestamps, time one new (never retransmitted)
+         * segment per round trip */
+        if (!tcb->ts_ok && !tcb->rtt_active && tcb->snd_nxt == tcb->snd_max) {
+            tcb->rtt_active = 1;
+            tcb->rtt_seq = tcb->snd_nxt + len;
+            tcb->rtt_start = now;
+        }
+        tcb->snd_nxt += len;
+        if (SEQ_GT(tcb->snd_nxt, tcb->snd_max))
+            tcb->snd_max = tcb->snd_nxt;
+    }
+}
+
+/* Send whatever the windows allow, as one transmit batch so the NIC
+ * is notified once per burst.  Called with interrupts disabled. */
+static void tcp_output(tcb_t* tcb) {
+    if (!tcp_can_send(tcb)) return;
+    net_tx_begin();
+    tcp_output_burst(tcb);
+    net_tx_end();
+}
+
+/* Resend the oldest unacknowledged segment (or the FIN) */
+static void tcp_retransmit_first(tcb_t* tcb) {
+    if (tcb->tx_ring.count > 0) {
+        uint32_t len = tcb->tx_ring.count < tcb->mss ? tcb->tx_ring.count : tcb->mss;
+        tcp_send_range(tcb, tcb->snd_una, len, TCP_ACK | TCP_PSH);
+        tcb->rtx_high = tcb->snd_una + len;
+    } else if (tcb->fin_queued) {
+        netbuf_t* nb = netbuf_alloc();
+        if (nb) tcp_emit(tcb, nb, tcb->snd_una, TCP_FIN | TCP_ACK);
+    }
+    tcb->rtx_tick = pit_get_ticks();
+}
+
+/* Resend the first segment the peer's SACK blocks say is missing,
+ * past what this recovery has resent already.  Returns 0 when there is
+ * no such hole below the highest SACKed byte. */
+static int tcp_retransmit_hole(tcb_t* tcb) {
+    if (tcb->snd_sack_n == 0) return 0;
+
+    uint32_t seq = SEQ_GT(tcb->rtx_high, tcb->snd_una) ? tcb->rtx_high : tcb->snd_una;
+    uint32_t top = tcb->snd_una;
+    for (int i = 0; i < tcb->snd_sack_n; i++)
+        if (SEQ_GT(tcb->snd_sack[i].end, top)) top = tcb->snd_sack[i].end;
+
+    /* Step over SACKed ranges */
+    for (int i = 0; i < tcb->snd_sack_n; i++) {
+        if (SEQ_GEQ(seq, tcb->snd_sack[i].start) && SEQ_LT(seq, tcb->snd_sack[i].end)) {
+            seq = tcb->snd_sack[i].end;
+            i = -1;
+        }
+    }
+    if (SEQ_GEQ(seq, top)) return 0;
+
+    /* The hole ends where the next SACKed range starts */
+    uint32_t end = top;
+    for (int i = 0; i < tcb->snd_sack_n; i++)
+        if (SEQ_GT(tcb->snd_sack[i].start, seq) && SEQ_LT(tcb->snd_sack[i].start, end))
+            end = tcb->snd_sack[i].start;
+    uint32_t avail = tcb->snd_una + tcb->tx_ring.count - seq;
+    uint32_t len = end - seq;
+    if (len > tcb->mss) len = tcb->mss;
+    if ((int32_t)avail <= 0) return 0;
+    if (len > avail) len = avail;
+
+    tcp_send_range(tcb, seq, len, TCP_ACK);
+    tcb->rtx_high = seq + len;
+    tcb->rtx_tick = pit_get_ticks();
+    return 1;
+}
+
+/* Record the peer's SACK blocks that cover data in flight */
+static void tcp_sack_update(tcb_t* tcb, const tcp_opts_t* o) {
+    for (int i = 0; i < o->nsack; i++) {
+        uint32_t start = o->sack[i].start, end = o->sack[i].end;
+        if (!SEQ_LT(start, end) || SEQ_LEQ(end, tcb->snd_una) ||
+            SEQ_GT(end, tcb->snd_max))
+            continue;
+        if (SEQ_LT(start, tcb->snd_una)) start = tcb->snd_una;
+        sack_insert(tcb->snd_sack, &tcb->snd_sack_n, start, end);
+    }
+}
+
+/* Forget SACKed ranges the cumulative ACK has passed */
+static void tcp_sack_prune(tcb_t* tcb) {
+    for (int i = 0; i < tcb->snd_sack_n; ) {
+        tcp_sack_t* b = &tcb->snd_sack[i];
+        if (SEQ_LEQ(b->end, tcb->snd_una)) {
+            memmove(b, b + 1, (tcb->snd_sack_n - i - 1) * sizeof(*b));
+            tcb->snd_sack_n--;
+            continue;
+        }
+        if (SEQ_LT(b->start, tcb->snd_una)) b->start = tcb->snd_una;
+        i++;
+    }
+}
+
+/* Process the acknowledgment fields of an incoming segment */
+static void tcp_ack(tcb_t* tcb, uint32_t ack, uint32_t window, int dup_candidate,
+                    const tcp_opts_t* o) {
+    uint32_t old_wnd = tcb->snd_wnd;
+    uint32_t mss = tcb->mss;
+
+    if (SEQ_GT(ack, tcb->snd_max))
+        return;     /* acks something never sent */
+    tcb->snd_wnd = window;
+    if (tcb->sack_ok)
+        tcp_sack_update(tcb, o);
+
+    if (SEQ_GT(ack, tcb->snd_una)) {
+        uint32_t acked = ack - tcb->snd_una;
+        uint32_t flight = tcb->snd_max - tcb->snd_una;
+        uint32_t data = acked < tcb->tx_ring.count ? acked : tcb->tx_ring.count;
+        ring_drop(&tcb->tx_ring, data);
+        if (acked > data && tcb->fin_queued)
+            tcb->fin_acked = 1;
+        tcb->snd_una = ack;
+        if (SEQ_LT(tcb->snd_nxt, ack))
+            tcb->snd_nxt = ack;
+        tcp_sack_prune(tcb);
+
+        /* Timestamps give a sample per ACK, retransmissions included */
+        if (tcb->ts_ok && o->ts && o->tsecr) {
+            tcp_rtt_sample(tcb, pit_get_ticks() - o->tsecr);
+        } else if (tcb->rtt_active && SEQ_GEQ(ack, tcb->rtt_seq)) {
+            tcb->rtt_active = 0;
+            tcp_rtt_sample(tcb, pit_get_ticks() - tcb->rtt_start);
+        } else if (tcb->srtt) {
+            tcb->rto_ticks = tcp_rto_from_rtt(tcb);   /* undo backoff */
+        }
+        tcb->retries = 0;
+        tcb->rtx_tick = pit_get_ticks();
+
+        if (tcb->in_recovery) {
+            if (SEQ_GEQ(ack, tcb->recover)) {
+                tcb->in_recovery = 0;
+                tcb->cwnd = tcb->ssthresh;
+            } else {
+                /* Partial ACK: the next hole is lost too */
+                if (!tcp_retransmit_hole(tcb))
+                    tcp_retransmit_first(tcb);
+                tcb->cwnd = tcb->cwnd > acked ? tcb->cwnd - acked + mss : mss;
+            }
+        } else if (flight + mss >= tcb->cwnd) {
+            /* Only grow the window while it is what limits us */
+            if (tcb->cwnd < tcb->ssthresh) {
+                /* Byte counting (RFC 3465), so delayed ACKs covering two
+                 * segments open the window as fast as two ACKs would */
+                tcb->cwnd += acked < 2 * mss ? acked : 2 * mss;
+            } else {
+                /* One MSS per window's worth of bytes ACKed */
+                uint32_t inc = (mss * acked) / tcb->cwnd;
+                tcb->cwnd += inc ? inc : 1;
+            }
+        }
+        tcb->dupacks = 0;
+        return;
+    }
+
+    /* Duplicate ACK: nothing new, no data, same window, data outstanding */
+    if (ack != tcb->snd_una || !dup_candidate || window != old_wnd ||
+        tcb->snd_max == tcb->snd_una)
+        return;
+
+    tcb->dupacks++;
+    if (tcb->dupacks == TCP_DUPACK_THRESH && !tcb->in_recovery) {
+        uint32_t flight = tcb->snd_max - tcb->snd_una;
+        tcb->ssthresh = flight / 2 > 2 * mss ? flight / 2 : 2 * mss;
+        tcb->recover = tcb->snd_max;
+        tcb->in_recovery = 1;
+        tcb->rtt_active = 0;
+        tcb->rtx_high = tcb->snd_una;
+        tcp_retransmit_first(tcb);
+        tcb->cwnd = tcb->ssthresh + TCP_DUPACK_THRESH * mss;
+        tcb->fast_rtx++;
+    } else if (tcb->dupacks > TCP_DUPACK_THRESH && tcb->in_recovery) {
+        /* Each dup ACK means a segment left the network: fill the next
+         * known hole with it, or let new data go out */
+        if (!tcp_retransmit_hole(tcb))
+            tcb->cwnd += mss;
+    }
+}
+
+/* ---- receiving ----
+ *
+ * In-order data is appended to rx_ring.  Data beyond a gap is stored in
+ * the ring where it will belong once the gap fills, and remembered as a
+ * SACK block; when the missing segment arrives, everything contiguous
+ * with it becomes readable at once.  The receive buffer starts at
+ * TCP_BUF_INIT and doubles whenever the application reads half of it or
+ * more within one round trip, which means the window, not the reader,
+ * is what limits the transfer.
+ */
+
+/* Bytes of rx_ring in use, counting out-of-order data */
+static uint32_t tcp_rcv_extent(const tcb_t* tcb) {
+    uint32_t ext = 0;
+    for (int i = 0; i < tcb->rcv_sack_n; i++) {
+        uint32_t e = tcb->rcv_sack[i].end - tcb->rcv_nxt;
+        if (e > ext) ext = e;
+    }
+    return tcb->rx_ring.count + ext;
+}
+
+/* Move held out-of-order data that the receive point has reached into
+ * the readable part of the ring */
+static void tcp_rcv_reassemble(tcb_t* tcb) {
+    for (int i = 0; i < tcb->rcv_sack_n; ) {
+        tcp_sack_t* b = &tcb->rcv_sack[i];
+        if (SEQ_GT(b->start, tcb->rcv_nxt)) {
+            i++;
+            continue;
+        }
+        if (SEQ_GT(b->end, tcb->rcv_nxt)) {
+            ring_commit(&tcb->rx_ring, b->end - tcb->rcv_nxt);
+            tcb->rcv_nxt = b->end;
+        }
+        memmove(b, b + 1, (tcb->rcv_sack_n - i - 1) * sizeof(*b));
+        tcb->rcv_sack_n--;
+        i = 0;
+    }
+}
+
+/* Earliest delayed ACK, so the receive thread can wake up for it
+ * rather than at its next 100 ms timer run */
+static int      delack_armed;
+static uint32_t delack_due;
+
+static void tcp_delack_arm(uint32_t due) {
+    if (!delack_armed || SEQ_LT(due, delack_due)) {
+        delack_due = due;
+        delack_armed = 1;
+    }
+}
+
+int tcp_delack_due(uint32_t *due) {
+    if (!delack_armed) return 0;
+    *due = delack_due;
+    return 1;
+}
+
+#define RCV_ACK_NOW    1
+#define RCV_ACK_DELAY  2    /* in-order data: the ACK may wait */
+
+/* Take payload that fits the window; returns whether and how soon the
+ * segment must be ACKed */
+static int tcp_rcv_data(tcb_t* tcb, uint32_t seq, const uint8_t* payload, size_t len) {
+    if (len == 0) return 0;
+
+    /* Trim anything already received (retransmissions) */
+    if (SEQ_LT(seq, tcb->rcv_nxt)) {
+        uint32_t skip = tcb->rcv_nxt - seq;
+        if (skip >= len) return RCV_ACK_NOW;
+        payload += skip;
+        len -= skip;
+        seq = tcb->rcv_nxt;
+    }
+
+    /* ...and anything past the window */
+    uint32_t off = seq - tcb->rcv_nxt;
+    uint32_t space = tcb->rx_ring.size - tcb->rx_ring.count;
+    if (off >= space) return RCV_ACK_NOW;
+    if (len > space - off) len = space - off;
+
+    /* Out of memory: drop it, the peer will send it again */
+    if (!ring_alloc(&tcb->rx_ring)) return RCV_ACK_NOW;
+
+    ring_store(&tcb->rx_ring, off, payload, len);
+    if (off > 0) {
+        /* Out of order: the ACK carries a SACK block for it */
+        sack_insert(tcb->rcv_sack, &tcb->rcv_sack_n, seq, seq + len);
+        tcb->quickack = TCP_QUICKACKS;
+        return RCV_ACK_NOW;
+    }
+
+    ring_commit(&tcb->rx_ring, len);
+    tcb->rcv_nxt += len;
+    tcp_rcv_reassemble(tcb);
+
+    /* Filling a gap is ACKed at once so the sender learns quickly, and
+     * so are the segments after it while its window is still small */
+    if (tcb->quickack > 0) {
+        tcb->quickack--;
+        return RCV_ACK_NOW;
+    }
+    return RCV_ACK_DELAY;
+}
+
+/* Receiver round-trip time, for buffer tuning */
+static uint32_t tcp_rcv_rtt(const tcb_t* tcb) {
+    if (tcb->rcv_rtt) return tcb->rcv_rtt;
+    if (tcb->srtt) return tcb->srtt >> 3;
+    return TCP_RTO_INIT;
+}
+
+/* Account for `n` bytes read by the application and grow the receive
+ * buffer if it was drained quickly */
+static void tcp_rcv_autotune(tcb_t* tcb, uint32_t n) {
+    uint32_t now = pit_get_ticks();
+    uint32_t rtt = tcp_rcv_rtt(tcb);
+    uint32_t elapsed = now - tcb->rcv_space_tick;
+
+    tcb->rcv_space += n;
+    if (elapsed < rtt) return;
+
+    uint32_t per_rtt = tcb->rcv_space / (elapsed / rtt);
+    if (per_rtt * 2 >= tcb->rx_ring.size) {
+        uint32_t max = TCP_BUF_MAX;
+        if (max > (0xFFFFu << tcb->rcv_wscale)) max = 0xFFFFu << tcb->rcv_wscale;
+        ring_grow(&tcb->rx_ring, max, tcp_rcv_extent(tcb));
+    }
+    tcb->rcv_space = 0;
+    tcb->rcv_space_tick = now;
+}
+
+/* Grow a full send buffer when the windows would let more than it holds
+ * be in flight, i.e. the buffer is what limits the sender */
+static int tcp_snd_autotune(tcb_t* tcb) {
+    if (tcp_send_window(tcb) + tcb->mss < tcb->tx_ring.size) return 0;
+    return ring_grow(&tcb->tx_ring, TCP_BUF_MAX, tcb->tx_ring.count);
+}
+
+/* Give back buffer memory that has sat empty for a while */
+static void tcp_release_idle(tcb_t* tcb, uint32_t now) {
+    if (tcb->tx_ring.buf && tcb->tx_ring.count == 0 &&
+        now - tcb->tx_ring.last_use >= TCP_BUF_IDLE)
+        ring_release(&tcb->tx_ring);
+    if (tcb->rx_ring.buf && tcb->rx_ring.count == 0 && tcb->rcv_sack_n == 0 &&
+        now - tcb->rx_ring.last_use >= TCP_BUF_IDLE)
+        ring_release(&tcb->rx_ring);
+}
+
+static void tcp_release_buffers(tcb_t* tcb) {
+    ring_release(&tcb->tx_ring);
+    ring_release(&tcb->rx_ring);
+    tcb->rcv_sack_n = 0;
+}
+
+/* ---- connection table ----
+ *
+ * TCBs are allocated per connection.  Established and connecting ones
+ * are found by 4-tuple in tcb_hash, listeners by port in listen_hash;
+ * the application refers to them by index into tcb_handles.  A SYN
+ * creates a child TCB that waits on its listener's accept queue once
+ * the handshake completes.  Past TCP_SYN_BACKLOG half-open children
+ * (or when memory runs out) the listener answers with SYN cookies and
+ * keeps no state until the final ACK proves the peer is real.
+ *
+ * tcp_close() hands the connection to the stack as an orphan that
+ * finishes sending and closing on its own; an orphan reaching TIME_WAIT
+ * is replaced by a small tcp_tw_t.
+ */
+
+/* What's left of a connection in TIME_WAIT: enough to re-ACK a
+ * retransmitted FIN and to swallow stray segments */
+typedef struct tcp_tw {
+    struct tcp_tw *hnext;     /* hash chain */
+    struct tcp_tw *fifo_next; /* expiry order */
+    uint8_t  remote_ip[4];
+    uint16_t local_port, remote_port;
+    uint32_t snd_nxt, rcv_nxt;
+    uint32_t expire;
+} tcp_tw_t;
+
+static tcp_tw_t *tw_hash[TCP_HASH_SIZE];
+static tcp_tw_t *tw_oldest, *tw_newest;
+
+static uint32_t tcp_hashfn(const uint8_t ip[4], uint16_t rport, uint16_t lport) {
+    uint32_t h = get_be32(ip) ^ ((uint32_t)rport << 16 | lport);
+    h ^= h >> 16;
+    h *= 0x45D9F3B;
+    h ^= h >> 16;
+    return h & (TCP_HASH_SIZE - 1);
+}
+
+static tcb_t* tcb_get(int idx) {
+    if (idx < 0 || idx >= TCP_MAX_CONNECTIONS) return NULL;
+    return tcb_handles[idx];
+}
+
+static tcb_t* tcb_alloc(void) {
+    tcb_t* tcb = malloc(sizeof(tcb_t));
+    if (!tcb) return NULL;
+    memset(tcb, 0, sizeof(tcb_t));
+    tcb->state = TCP_CLOSED;
+    tcb->handle = -1;
+    tcb->rcv_wnd = TCP_BUF_INIT;
+    tcb->snd_wnd = TCP_BUF_INIT;
+    tcb->quickack = TCP_QUICKACKS;   /* slow start is ACK-clocked */
+    /* Simple ISN based on tick counter */
+    tcb->snd_nxt = pit_get_ticks() * 64;
+    tcb->snd_una = tcb->snd_nxt;
+    tcp_init_sender(tcb);
+    tcp_stats.tcbs++;
+    return tcb;
+}
+
+static void tcb_free(tcb_t* tcb) {
+    tcp_release_buffers(tcb);
+    free(tcb);
+    tcp_stats.tcbs--;
+}
+
+static int handle_alloc(tcb_t* tcb) {
+    for (int n = 0; n < TCP_MAX_CONNECTIONS; n++) {
+        int i = (next_handle + n) % TCP_MAX_CONNECTIONS;
+        if (!tcb_handles[i]) {
+            tcb_handles[i] = tcb;
+            tcb->handle = i;
+            next_handle = i + 1;
             return i;
         }
     }
     return -1;
 }
 
+static void tcb_hash_insert(tcb_t* tcb) {
+    uint32_t b = tcp_hashfn(tcb->remote_ip, tcb->remote_port, tcb->local_port);
+    tcb->hnext = tcb_hash[b];
+    tcb_hash[b] = tcb;
+    tcb->hashed = 1;
+}
+
+static void tcb_hash_remove(tcb_t* tcb) {
+    if (!tcb->hashed) return;
+    tcb_t** pp = &tcb_hash[tcp_hashfn(tcb->remote_ip, tcb->remote_port, tcb->local_port)];
+    while (*pp && *pp != tcb)
+        pp = &(*pp)->hnext;
+    if (*pp) *pp = tcb->hnext;
+    tcb->hashed = 0;
+}
+
+static tcb_t* tcb_lookup(const uint8_t ip[4], uint16_t rport, uint16_t lport) {
+    for (tcb_t* t = tcb_hash[tcp_hashfn(ip, rport, lport)]; t; t = t->hnext)
+        if (t->local_port == lport && t->remote_port == rport &&
+            memcmp(t->remote_ip, ip, 4) == 0)
+            return t;
+    return NULL;
+}
+
+static tcb_t* listen_lookup(uint16_t port) {
+    for (tcb_t* t = listen_hash[port & (TCP_LISTEN_HASH - 1)]; t; t = t->hnext)
+        if (t->local_port == port)
+            return t;
+    return NULL;
+}
+
+static void listen_remove(tcb_t* ltcb) {
+    tcb_t** pp = &listen_hash[ltcb->local_port & (TCP_LISTEN_HASH - 1)];
+    while (*pp && *pp != ltcb)
+        pp = &(*pp)->hnext;
+    if (*pp) *pp = ltcb->hnext;
+}
+
+static tcp_tw_t* tw_lookup(const uint8_t ip[4], uint16_t rport, uint16_t lport) {
+    for (tcp_tw_t* tw = tw_hash[tcp_hashfn(ip, rport, lport)]; tw; tw = tw->hnext)
+        if (tw->local_port == lport && tw->remote_port == rport &&
+            memcmp(tw->remote_ip, ip, 4) == 0)
+            return tw;
+    return NULL;
+}
+
+/* Free TIME_WAIT entries whose time is up; they expire in the order
+ * they were created */
+static void tw_expire(uint32_t now) {
+    while (tw_oldest && (int32_t)(now - tw_oldest->expire) >= 0) {
+        tcp_tw_t* tw = tw_oldest;
+        tcp_tw_t** pp = &tw_hash[tcp_hashfn(tw->remote_ip, tw->remote_port, tw->local_port)];
+        while (*pp && *pp != tw)
+            pp = &(*pp)->hnext;
+        if (*pp) *pp = tw->hnext;
+        tw_oldest = tw->fifo_next;
+        if (!tw_oldest) tw_newest = NULL;
+        free(tw);
+        tcp_stats.time_wait--;
+    }
+}
+
+/* Send a segment for a connection without a TCB (TIME_WAIT, SYN cookies) */
+static void tcp_send_stateless(const uint8_t ip[4], uint16_t rport, uint16_t lport,
+                               uint32_t seq, uint32_t ack, uint8_t flags) {
+    static tcb_t t;
+    memset(&t, 0, sizeof(t));
+    memcpy(t.remote_ip, ip, 4);
+    t.remote_port = rport;
+    t.local_port = lport;
+    t.rcv_nxt = ack;
+    t.rx_ring.size = TCP_BUF_INIT;
+    netbuf_t* nb = netbuf_alloc();
+    if (nb) tcp_emit(&t, nb, seq, flags);
+}
+
+/* ---- SYN cookies ----
+ *
+ * The ISN of a cookie SYN-ACK is [t:5][mss:2][hash:25]: a 64-second
+ * time slot, an index into cookie_mss[] and a keyed hash of the 4-tuple,
+ * the peer's ISN and the slot.  The ACK completing the handshake brings
+ * it back as ack - 1 and is accepted for two slots.  Window scaling,
+ * SACK and timestamps can't be remembered this way and are not used.
+ */
+
+#define TCP_COOKIE_PERIOD (64 * 120)
+
+static const uint16_t cookie_mss[4] = { TCP_MSS_DEFAULT, 1200, 1360, TCP_MSS };
+static uint8_t cookie_secret[16];
+static int cookie_secret_ready;
+
+static uint32_t tcp_cookie_hash(const uint8_t ip[4], uint16_t rport, uint16_t lport,
+                                uint32_t peer_isn, uint32_t slot) {
+    if (!cookie_secret_ready) {
+        prng_random(cookie_secret, sizeof(cookie_secret));
+        cookie_secret_ready = 1;
+    }
+    uint8_t msg[16 + 4 + 4 + 4 + 4];
+    memcpy(msg, cookie_secret, 16);
+    memcpy(msg + 16, ip, 4);
+    put_be32(msg + 20, (uint32_t)rport << 16 | lport);
+    put_be32(msg + 24, peer_isn);
+    put_be32(msg + 28, slot);
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256(msg, sizeof(msg), digest);
+    return get_be32(digest);
+}
+
+static uint32_t tcp_cookie_make(const uint8_t ip[4], uint16_t rport, uint16_t lport,
+                                uint32_t peer_isn, uint16_t mss) {
+    uint32_t slot = (pit_get_ticks() / TCP_COOKIE_PERIOD) & 31;
+    uint32_t idx = 0;
+    while (idx < 3 && cookie_mss[idx + 1] <= mss)
+        idx++;
+    uint32_t h = tcp_cookie_hash(ip, rport, lport, peer_isn, slot);
+    return (slot << 27) | (idx << 25) | (h & 0x1FFFFFF);
+}
+
+/* MSS encoded in a returning cookie, or 0 if it isn't one of ours */
+static uint16_t tcp_cookie_check(const uint8_t ip[4], uint16_t rport, uint16_t lport,
+                                 uint32_t peer_isn, uint32_t cookie) {
+    uint32_t slot = cookie >> 27;
+    uint32_t now = (pit_get_ticks() / TCP_COOKIE_PERIOD) & 31;
+    if (((now - slot) & 31) > 1) return 0;
+    uint32_t h = tcp_cookie_hash(ip, rport, lport, peer_isn, slot);
+    if ((h & 0x1FFFFFF) != (cookie & 0x1FFFFFF)) return 0;
+    return cookie_mss[(cookie >> 25) & 3];
+}
+
+/* ---- connection lifetime ---- */
+
+/* The connection is over.  It's freed unless the application still has
+ * a handle, which keeps it readable until tcp_close(), or it sits on an
+ * accept queue, where tcp_accept() will find and free it. */
+static void tcp_set_closed(tcb_t* tcb) {
+    tcb->state = TCP_CLOSED;
+    tcb_hash_remove(tcb);
+    if (tcb->queued)
+        return;
+    if (tcb->parent) {
+        tcb->parent->syn_count--;
+        tcp_stats.syn_recv--;
+        tcb_free(tcb);
+    } else if (tcb->handle < 0) {
+        tcp_stats.orphans--;
+        tcb_free(tcb);
+    } else {
+        waitq_wake(&tcb->wq);
+    }
+}
+
+/* Trade an orphan's TCB for a TIME_WAIT entry */
+static void tcp_enter_time_wait(tcb_t* tcb) {
+    tcp_tw_t* tw = malloc(sizeof(tcp_tw_t));
+    if (!tw || tcb->handle >= 0) {
+        free(tw);
+        tcp_set_closed(tcb);
+        return;
+    }
+    memcpy(tw->remote_ip, tcb->remote_ip, 4);
+    tw->local_port = tcb->local_port;
+    tw->remote_port = tcb->remote_port;
+    tw->snd_nxt = tcb->snd_nxt;
+    tw->rcv_nxt = tcb->rcv_nxt;
+    tw->expire = pit_get_ticks() + TCP_TIME_WAIT_TICKS;
+
+    uint32_t b = tcp_hashfn(tw->remote_ip, tw->remote_port, tw->local_port);
+    tw->hnext = tw_hash[b];
+    tw_hash[b] = tw;
+    tw->fifo_next = NULL;
+    if (tw_newest) tw_newest->fifo_next = tw;
+    else tw_oldest = tw;
+    tw_newest = tw;
+    tcp_stats.time_wait++;
+
+    tcb_hash_remove(tcb);
+    tcp_stats.orphans--;
+    tcb_free(tcb);
+}
+
+/* Let go of a connection the application no longer holds: queue the
+ * FIN behind unsent data and leave the rest to the stack */
+static void tcp_orphan(tcb_t* tcb) {
+    tcb->handle = -1;
+    tcp_stats.orphans++;
+    switch (tcb->state) {
+    case TCP_ESTABLISHED:
+        tcb->state = TCP_FIN_WAIT_1;
+        tcb->fin_queued = 1;
+        tcp_output(tcb);
+        break;
+    case TCP_CLOSE_WAIT:
+        tcb->state = TCP_LAST_ACK;
+        tcb->fin_queued = 1;
+        tcp_output(tcb);
+        break;
+    case TCP_FIN_WAIT_1:
+    case TCP_FIN_WAIT_2:
+    case TCP_CLOSING:
+    case TCP_LAST_ACK:
+        break;
+    case TCP_TIME_WAIT:
+        tcp_enter_time_wait(tcb);
+        break;
+    default:
+        tcp_set_closed(tcb);
+        break;
+    }
+}
+
+static void tcp_accept_push(tcb_t* ltcb, tcb_t* tcb) {
+    tcb->queued = 1;
+    tcb->accept_next = NULL;
+    if (ltcb->accept_tail) ltcb->accept_tail->accept_next = tcb;
+    else ltcb->accept_head = tcb;
+    ltcb->accept_tail = tcb;
+    ltcb->accept_count++;
+    waitq_wake(&ltcb->wq);
+}
+
+static tcb_t* tcp_accept_pop(tcb_t* ltcb) {
+    tcb_t* tcb = ltcb->accept_head;
+    if (!tcb) return NULL;
+    ltcb->accept_head = tcb->accept_next;
+    if (!ltcb->accept_head) ltcb->accept_tail = NULL;
+    ltcb->accept_count--;
+    tcb->queued = 0;
+    tcb->parent = NULL;
+    return tcb;
+}
+
+/* Close a listener along with the connections it hasn't handed out */
+static void tcp_close_listener(tcb_t* ltcb) {
+    listen_remove(ltcb);
+
+    tcb_t* tcb;
+    while ((tcb = tcp_accept_pop(ltcb)))
+        tcp_orphan(tcb);
+
+    for (int b = 0; b < TCP_HASH_SIZE && ltcb->syn_count > 0; b++) {
+        tcb_t* next;
+        for (tcb = tcb_hash[b]; tcb; tcb = next) {
+            next = tcb->hnext;
+            if (tcb->parent == ltcb) {
+                tcb->parent = NULL;
+                ltcb->syn_count--;
+                tcp_stats.syn_recv--;
+                tcp_orphan(tcb);
+            }
+        }
+    }
+    tcb_free(ltcb);
+}
+
+/* Child connection for a SYN (or returning cookie) on listener `ltcb` */
+static tcb_t* tcp_spawn(tcb_t* ltcb, const uint8_t ip[4], uint16_t rport, uint32_t irs) {
+    tcb_t* tcb = tcb_alloc();
+    if (!tcb) return NULL;
+    tcb->local_port = ltcb->local_port;
+    tcb->remote_port = rport;
+    memcpy(tcb->remote_ip, ip, 4);
+    tcb->rcv_nxt = irs + 1;
+    tcb->parent = ltcb;
+    tcb_hash_insert(tcb);
+    return tcb;
+}
+
+/* Segment for a port with a listener and no connection: a SYN starts
+ * one, an ACK may carry back a SYN cookie.  Returns the new connection
+ * if the segment needs further processing. */
+static tcb_t* tcp_listen_input(tcb_t* ltcb, const uint8_t ip[4], uint16_t rport,
+                               uint32_t seq, uint32_t ack, uint8_t flags,
+                               uint16_t window, const tcp_opts_t* opts) {
+    if ((flags & (TCP_SYN | TCP_ACK | TCP_RST)) == TCP_SYN) {
+        if (ltcb->accept_count >= ltcb->backlog) {
+            tcp_stats.syn_dropped++;    /* the peer will retry */
+            return NULL;
+        }
+        tcb_t* tcb = NULL;
+        if (ltcb->syn_count < TCP_SYN_BACKLOG)
+            tcb = tcp_spawn(ltcb, ip, rport, seq);
+        if (!tcb) {
+            /* Flooded or out of memory: answer without keeping state */
+            uint32_t cookie = tcp_cookie_make(ip, rport, ltcb->local_port, seq,
+                                              opts->mss ? opts->mss : TCP_MSS_DEFAULT);
+            tcp_send_stateless(ip, rport, ltcb->local_port, cookie, seq + 1,
+                               TCP_SYN | TCP_ACK);
+            tcp_stats.cookies_sent++;
+            return NULL;
+        }
+
+        ltcb->syn_count++;
+        tcp_stats.syn_recv++;
+        tcb->snd_wnd = window;
+        tcp_negotiate(tcb, opts);
+        tcb->state = TCP_SYN_RECEIVED;
+        tcp_send_segment(tcb, TCP_SYN | TCP_ACK, NULL, 0);
+        tcb->snd_nxt++;
+        tcb->snd_max = tcb->snd_nxt;
+        return NULL;
+    }
+
+    if ((flags & (TCP_SYN | TCP_ACK | TCP_RST)) != TCP_ACK ||
+        ltcb->accept_count >= ltcb->backlog)
+        return NULL;
+
+    uint16_t mss = tcp_cookie_check(ip, rport, ltcb->local_port, seq - 1, ack - 1);
+    if (!mss) return NULL;
+    tcb_t* tcb = tcp_spawn(ltcb, ip, rport, seq - 1);
+    if (!tcb) return NULL;
+    tcb->snd_una = tcb->snd_nxt = tcb->snd_max = ack;
+    tcb->snd_wnd = window;
+    tcp_set_mss(tcb, mss);
+    tcb->state = TCP_ESTABLISHED;
+    tcp_accept_push(ltcb, tcb);
+    tcp_stats.cookies_ok++;
+    return tcb;
+}
+
+void tcp_initialize(void) {
+    memset(tcb_handles, 0, sizeof(tcb_handles));
+    memset(tcb_hash, 0, sizeof(tcb_hash));
+    memset(listen_hash, 0, sizeof(listen_hash));
+    memset(tw_hash, 0, sizeof(tw_hash));
+    tw_oldest = tw_newest = NULL;
+    memset(&tcp_stats, 0, sizeof(tcp_stats));
+}
+
+int tcp_open(uint16_t local_port, int listen) {
+    uint32_t flags = irq_save();
+    if (listen && listen_lookup(local_port)) {
+        irq_restore(flags);
+        return -1;      /* port already has a listener */
+    }
+    tcb_t* tcb = tcb_alloc();
+    int idx = tcb ? handle_alloc(tcb) : -1;
+    if (idx < 0) {
+        if (tcb) tcb_free(tcb);
+        irq_restore(flags);
+        return -1;
+    }
+
+    tcb->local_port = local_port;
+    if (listen) {
+        tcb->state = TCP_LISTEN;
+        tcb->is_listen = 1;
+        tcb->backlog = TCP_BACKLOG_MAX;
+        uint32_t b = local_port & (TCP_LISTEN_HASH - 1);
+        tcb->hnext = listen_hash[b];
+        listen_hash[b] = tcb;
+    }
+    irq_restore(flags);
+    return idx;
+}
+
+int tcp_set_nodelay(int idx, int on) {
+    tcb_t* tcb = tcb_get(idx);
+    if (!tcb) return -1;
+    uint32_t flags = irq_save();
+    tcb->nodelay = on != 0;
+    if (tcb->nodelay)
+        tcp_output(tcb);    /* release anything Nagle held back */
+    irq_restore(flags);
+    return 0;
+}
+
+int tcp_set_backlog(int idx, int backlog) {
+    tcb_t* tcb = tcb_get(idx);
+    if (!tcb || !tcb->is_listen) return -1;
+    if (backlog < 1) backlog = 1;
+    if (backlog > TCP_BACKLOG_MAX) backlog = TCP_BACKLOG_MAX;
+    tcb->backlog = backlog;
+    return 0;
+}
+
 int tcp_connect(int idx, const uint8_t dst_ip[4], uint16_t dst_port) {
-    if (idx < 0 || idx >= TCP_MAX_CONNECTIONS) return -1;
-    tcb_t* tcb = &tcbs[idx];
-    if (tcb->state != TCP_CLOSED) return -1;
+    tcb_t* tcb = tcb_get(idx);
+    if (!tcb || tcb->state != TCP_CLOSED || tcb->is_listen || tcb->hashed) return -1;
 
     memcpy(tcb->remote_ip, dst_ip, 4);
     tcb->remote_port = dst_port;
-    if (tcb->local_port == 0)
+    if (tcb->local_port == 0) {
         tcb->local_port = next_ephemeral_port++;
+        if (next_ephemeral_port == 0) next_ephemeral_port = 49152;
+    }
 
-    /* Send SYN */
+    /* Send SYN, offering every option.  Interrupts stay off until
+     * snd_nxt is final so the receive thread can't handle the SYN-ACK
+     * in between. */
+    uint32_t flags = irq_save();
+    tcb->ws_ok = tcb->ts_ok = tcb->sack_ok = 1;
+    tcb->rcv_wscale = TCP_WSCALE;
     tcb->state = TCP_SYN_SENT;
+    tcb_hash_insert(tcb);
     tcp_send_segment(tcb, TCP_SYN, NULL, 0);
     tcb->snd_nxt++; /* SYN consumes one seq */
+    tcb->snd_max = tcb->snd_nxt;
+    irq_restore(flags);
 
     /* Wait for SYN-ACK */
     uint32_t start = pit_get_ticks();
-    while (tcb->state == TCP_SYN_SENT) {
-        net_process_packets();
-        if (pit_get_ticks() - start > 500) /* 5 second timeout */
+    for (;;) {
+        uint32_t seq = waitq_seq(&tcb->wq);
+        if (tcb->state != TCP_SYN_SENT)
+            break;
+        uint32_t waited = pit_get_ticks() - start;
+        if (waited > 500) { /* 5 second timeout */
+            flags = irq_save();
+            if (tcb->state == TCP_SYN_SENT)
+                tcp_set_closed(tcb);
+            irq_restore(flags);
             return -1;
+        }
+        tcp_wait(tcb, seq, 500 - waited);
     }
 
     return tcb->state == TCP_ESTABLISHED ? 0 : -1;
 }
 
+/* Queue data behind whatever is still unacknowledged and push out as
+ * much as the windows allow; blocks while the send buffer is full and
+ * can't grow.  Returns once everything is queued, not when it has been
+ * acked. */
 int tcp_send(int idx, const uint8_t* data, size_t len) {
-    if (idx < 0 || idx >= TCP_MAX_CONNECTIONS) return -1;
-    tcb_t* tcb = &tcbs[idx];
+    tcb_t* tcb = tcb_get(idx);
+    if (!tcb) return -1;
     if (tcb->state != TCP_ESTABLISHED && tcb->state != TCP_CLOSE_WAIT)
         return -1;
 
     size_t sent = 0;
     while (sent < len) {
-        size_t chunk = len - sent;
-        if (chunk > TCP_MSS) chunk = TCP_MSS;
+        uint32_t seq = waitq_seq(&tcb->wq);
+        if (tcb->state != TCP_ESTABLISHED && tcb->state != TCP_CLOSE_WAIT)
+            return sent ? (int)sent : -1;
+
+        uint32_t flags = irq_save();
+        if (!ring_alloc(&tcb->tx_ring)) {
+            irq_restore(flags);
+            return sent ? (int)sent : -1;
+        }
+        size_t n = ring_write(&tcb->tx_ring, data + sent, len - sent);
+        if (sent + n < len && tcp_snd_autotune(tcb))
+            n += ring_write(&tcb->tx_ring, data + sent + n, len - sent - n);
+        tcp_output(tcb);
+        irq_restore(flags);
+        sent += n;
+
+        /* Buffer full: wait for ACKs to make room */
+        if (sent < len)
+            tcp_wait(tcb, seq, TCP_RTO_INIT);
+    }
+    return sent;
+}
 
-        tcp_send_segment(tcb, TCP_ACK | TCP_PSH, data + sent, chunk);
-        tcb->snd_nxt += chunk;
-        sent += chunk;
+int tcp_send_nb(int idx, const uint8_t* data, size_t len) {
+    tcb_t* tcb = tcb_get(idx);
+    if (!tcb) return -1;
+    if (tcb->state != TCP_ESTABLISHED && tcb->state != TCP_CLOSE_WAIT)
+        return -1;
 
-        /* Brief poll for ACKs between segments */
-        net_process_packets();
+    uint32_t flags = irq_save();
+    if (!ring_alloc(&tcb->tx_ring)) {
+        irq_restore(flags);
+        return -1;
     }
-    return sent;
+    size_t n = ring_write(&tcb->tx_ring, data, len);
+    if (n < len && tcp_snd_autotune(tcb))
+        n += ring_write(&tcb->tx_ring, data + n, len - n);
+    if (n > 0) tcp_output(tcb);
+    irq_restore(flags);
+    return n > 0 ? (int)n : -2;     /* EAGAIN: buffer full */
+}
+
+/* Copy out received data.  Once reading has moved the right edge of
+ * the window a full segment past what the peer was last told, send a
+ * window update rather than leave it waiting on a stale small window
+ * (receiver-side silly window avoidance, RFC 1122). */
+static int tcp_read(tcb_t* tcb, uint8_t* buf, size_t len) {
+    uint32_t flags = irq_save();
+    int n = ring_read(&tcb->rx_ring, buf, len);
+    tcp_rcv_autotune(tcb, n);
+    uint32_t edge = tcb->rcv_nxt + tcb->rx_ring.size - tcb->rx_ring.count;
+    if (n > 0 && SEQ_GEQ(edge, tcb->rcv_adv + tcb->mss) &&
+        (tcb->state == TCP_ESTABLISHED || tcb->state == TCP_FIN_WAIT_1 ||
+         tcb->state == TCP_FIN_WAIT_2))
+        tcp_send_segment(tcb, TCP_ACK, NULL, 0);
+    irq_restore(flags);
+    return n;
 }
 
 int tcp_recv(int idx, uint8_t* buf, size_t len, uint32_t timeout_ms) {
-    if (idx < 0 || idx >= TCP_MAX_CONNECTIONS) return -1;
-    tcb_t* tcb = &tcbs[idx];
+    tcb_t* tcb = tcb_get(idx);
+    if (!tcb) return -1;
 
     uint32_t start = pit_get_ticks();
     uint32_t timeout_ticks = timeout_ms * 120 / 1000;
 
     while (1) {
-        net_process_packets();
+        uint32_t seq = waitq_seq(&tcb->wq);
 
-        if (tcb->rx_ring.count > 0) {
-            return ring_read(&tcb->rx_ring, buf, len);
-        }
+        if (tcb->rx_ring.count > 0)
+            return tcp_read(tcb, buf, len);
 
         /* Connection closed by peer */
         if (tcb->state == TCP_CLOSE_WAIT || tcb->state == TCP_CLOSED ||
             tcb->state == TCP_TIME_WAIT)
             return 0;
 
-        if (pit_get_ticks() - start >= timeout_ticks)
+        uint32_t waited = pit_get_ticks() - start;
+        if (waited >= timeout_ticks)
             return -1; /* timeout */
+        tcp_wait(tcb, seq, timeout_ticks - waited);
+    }
+}
+
+/* Hand out the next connection on the accept queue, or -1.  Ones that
+ * died while queued are freed on the way. */
+static int tcp_accept_one(tcb_t *ltcb) {
+    uint32_t flags = irq_save();
+    tcb_t* tcb;
+    int idx = -1;
+    while (idx < 0 && (tcb = tcp_accept_pop(ltcb))) {
+        if (tcb->state == TCP_ESTABLISHED || tcb->state == TCP_CLOSE_WAIT)
+            idx = handle_alloc(tcb);
+        if (idx < 0)
+            tcp_orphan(tcb);
     }
+    irq_restore(flags);
+    return idx;
 }
 
 int tcp_accept(int listen_idx, uint32_t timeout_ms) {
-    if (listen_idx < 0 || listen_idx >= TCP_MAX_CONNECTIONS) return -1;
-    tcb_t* ltcb = &tcbs[listen_idx];
-    if (ltcb->state != TCP_LISTEN) return -1;
+    tcb_t* ltcb = tcb_get(listen_idx);
+    if (!ltcb || ltcb->state != TCP_LISTEN) return -1;
 
     /* Non-blocking: check once and return */
     if (timeout_ms == 0) {
-        net_process_packets();
-        int idx = backlog_pop(ltcb);
-        if (idx >= 0 && (tcbs[idx].state == TCP_ESTABLISHED ||
-                         tcbs[idx].state == TCP_SYN_RECEIVED))
-            return idx;
-        return -2; /* EAGAIN */
+        if (!net_rx_threaded())
+            net_process_packets();
+        int idx = tcp_accept_one(ltcb);
+        return idx >= 0 ? idx : -2; /* EAGAIN */
     }
 
-    /* Blocking with cooperative yield */
+    /* Blocking: sleep until a SYN lands in the backlog */
     uint32_t deadline = 0;
     if (timeout_ms != 0xFFFFFFFF)
         deadline = pit_get_ticks() + (timeout_ms * 120 + 999) / 1000;
 
     while (1) {
-        net_process_packets();
+        uint32_t seq = waitq_seq(&ltcb->wq);
 
-        int idx = backlog_pop(ltcb);
-        if (idx >= 0 && (tcbs[idx].state == TCP_ESTABLISHED ||
-                         tcbs[idx].state == TCP_SYN_RECEIVED))
+        int idx = tcp_accept_one(ltcb);
+        if (idx >= 0)
             return idx;
 
-        if (timeout_ms != 0xFFFFFFFF &&
-            (int32_t)(pit_get_ticks() - deadline) >= 0)
-            return -1; /* timeout */
-
-        task_yield();
-    }
-}
-
-void tcp_close(int idx) {
-    if (idx < 0 || idx >= TCP_MAX_CONNECTIONS) return;
-    tcb_t* tcb = &tcbs[idx];
-
-    if (tcb->state == TCP_ESTABLISHED) {
-        tcb->state = TCP_FIN_WAIT_1;
-        tcp_send_segment(tcb, TCP_FIN | TCP_ACK, NULL, 0);
-        tcb->snd_nxt++;
-
-        /* Wait briefly for FIN-ACK */
-        uint32_t start = pit_get_ticks();
-        while (tcb->state != TCP_CLOSED && tcb->state != TCP_TIME_WAIT) {
-            net_process_packets();
-            if (pit_get_ticks() - start > 300) break; /* 3 sec */
+        uint32_t ticks = WAITQ_FOREVER;
+        if (timeout_ms != 0xFFFFFFFF) {
+            int32_t left = (int32_t)(deadline - pit_get_ticks());
+            if (left <= 0)
+                return -1; /* timeout */
+            ticks = (uint32_t)left;
         }
-    } else if (tcb->state == TCP_CLOSE_WAIT) {
-        tcb->state = TCP_LAST_ACK;
-        tcp_send_segment(tcb, TCP_FIN | TCP_ACK, NULL, 0);
-        tcb->snd_nxt++;
 
-        uint32_t start = pit_get_ticks();
-        while (tcb->state != TCP_CLOSED) {
+        if (net_rx_threaded()) {
+            tcp_wait(ltcb, seq, ticks);
+        } else {
             net_process_packets();
-            if (pit_get_ticks() - start > 300) break;
+            task_yield();
         }
     }
+}
 
-    tcb->state = TCP_CLOSED;
+/* Give up the handle.  Unsent data still goes out, followed by the
+ * FIN; the connection finishes closing in the background. */
+void tcp_close(int idx) {
+    tcb_t* tcb = tcb_get(idx);
+    if (!tcb) return;
+
+    uint32_t flags = irq_save();
+    tcb_handles[idx] = NULL;
+    if (tcb->is_listen)
+        tcp_close_listener(tcb);
+    else
+        tcp_orphan(tcb);
+    irq_restore(flags);
 }
 
 tcp_state_t tcp_get_state(int idx) {
-    if (idx < 0 || idx >= TCP_MAX_CONNECTIONS) return TCP_CLOSED;
-    return tcbs[idx].state;
+    tcb_t *tcb = tcb_get(idx);
+    return tcb ? tcb->state : TCP_CLOSED;
 }
 
 int tcp_has_backlog(int idx) {
-    if (idx < 0 || idx >= TCP_MAX_CONNECTIONS) return 0;
-    return tcbs[idx].backlog_count > 0;
+    tcb_t *tcb = tcb_get(idx);
+    return tcb && tcb->accept_count > 0;
 }
 
 int tcp_rx_available(int idx) {
-    if (idx < 0 || idx >= TCP_MAX_CONNECTIONS) return 0;
-    return tcbs[idx].rx_ring.count;
+    tcb_t *tcb = tcb_get(idx);
+    return tcb ? (int)tcb->rx_ring.count : 0;
 }
 
 int tcp_recv_nb(int idx, uint8_t *buf, size_t len) {
-    if (idx < 0 || idx >= TCP_MAX_CONNECTIONS) return -1;
-    tcb_t *tcb = &tcbs[idx];
+    tcb_t *tcb = tcb_get(idx);
+    if (!tcb) return -1;
     if (tcb->state != TCP_ESTABLISHED && tcb->state != TCP_CLOSE_WAIT)
         return -1;
     if (tcb->rx_ring.count == 0) return -2; /* EAGAIN */
-    return ring_read(&tcb->rx_ring, buf, len);
+    return tcp_read(tcb, buf, len);
+}
+
+int tcp_get_info(int idx, tcp_info_t *out) {
+    uint32_t flags = irq_save();
+    tcb_t *tcb = tcb_get(idx);
+    if (!tcb) {
+        irq_restore(flags);
+        return -1;
+    }
+    out->state = tcb->state;
+    out->local_port = tcb->local_port;
+    out->remote_port = tcb->remote_port;
+    memcpy(out->remote_ip, tcb->remote_ip, 4);
+    out->snd_una = tcb->snd_una;
+    out->snd_nxt = tcb->snd_nxt;
+    out->rcv_nxt = tcb->rcv_nxt;
+    out->in_flight = tcb->snd_max - tcb->snd_una;
+    out->queued = tcb->tx_ring.count;
+    out->snd_wnd = tcb->snd_wnd;
+    out->cwnd = tcb->cwnd;
+    out->ssthresh = tcb->ssthresh;
+    out->srtt_ms = (tcb->srtt >> 3) * 1000 / 120;
+    out->rto_ms = tcb->rto_ticks * 1000 / 120;
+    out->timeouts = tcb->timeouts;
+    out->fast_rtx = tcb->fast_rtx;
+    out->segs_out = tcb->segs_out;
+    out->retrans = tcb->retrans;
+    out->snd_buf = tcb->tx_ring.buf ? tcb->tx_ring.size : 0;
+    out->rcv_buf = tcb->rx_ring.buf ? tcb->rx_ring.size : 0;
+    out->snd_wscale = tcb->snd_wscale;
+    out->rcv_wscale = tcb->rcv_wscale;
+    out->ws_ok = tcb->ws_ok;
+    out->ts_ok = tcb->ts_ok;
+    out->sack_ok = tcb->sack_ok;
+    irq_restore(flags);
+    return 0;
+}
+
+void tcp_get_stats(tcp_stats_t *st) {
+    uint32_t flags = irq_save();
+    *st = tcp_stats;
+    irq_restore(flags);
 }
 
 /* Handle incoming TCP packet */
@@ -314,187 +1546,231 @@ void tcp_handle_packet(const uint8_t* data, size_t len, const uint8_t src_ip[4])
     uint8_t  flags = hdr->flags;
     uint16_t window = ntohs(hdr->window);
     size_t hdr_len = ((hdr->data_offset >> 4) & 0xF) * 4;
+    if (hdr_len < sizeof(tcp_header_t) || hdr_len > len) return;
     const uint8_t* payload = data + hdr_len;
     size_t payload_len = len - hdr_len;
+    tcp_opts_t opts;
+    tcp_parse_options(data + sizeof(tcp_header_t), hdr_len - sizeof(tcp_header_t), &opts);
 
-    /* Find matching TCB */
-    tcb_t* tcb = NULL;
-    int tcb_idx = -1;
-    tcb_t* listen_tcb = NULL;
-
-    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
-        if (tcbs[i].state == TCP_CLOSED) continue;
-
-        if (tcbs[i].state == TCP_LISTEN && tcbs[i].local_port == dst_port) {
-            listen_tcb = &tcbs[i];
-            continue;
-        }
-
-        if (tcbs[i].local_port == dst_port &&
-            tcbs[i].remote_port == src_port &&
-            memcmp(tcbs[i].remote_ip, src_ip, 4) == 0) {
-            tcb = &tcbs[i];
-            tcb_idx = i;
-            break;
-        }
-    }
-
-    /* Handle SYN on listening socket */
-    if (!tcb && listen_tcb && (flags & TCP_SYN)) {
-        /* Find free TCB for new connection */
-        for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
-            if (tcbs[i].state == TCP_CLOSED) {
-                tcb = &tcbs[i];
-                tcb_idx = i;
-                memset(tcb, 0, sizeof(tcb_t));
-                tcb->local_port = dst_port;
-                tcb->remote_port = src_port;
-                memcpy(tcb->remote_ip, src_ip, 4);
-                tcb->rcv_nxt = seq + 1;
-                tcb->snd_nxt = pit_get_ticks() * 64;
-                tcb->snd_una = tcb->snd_nxt;
-                tcb->snd_wnd = window;
-                tcb->rcv_wnd = TCP_BUFFER_SIZE;
-                tcb->rto_ticks = TCP_RTO_INIT;
-                tcb->backlog_head = 0;
-                tcb->backlog_tail = 0;
-                tcb->backlog_count = 0;
-                tcb->state = TCP_SYN_RECEIVED;
-
-                /* Send SYN-ACK */
-                tcp_send_segment(tcb, TCP_SYN | TCP_ACK, NULL, 0);
-                tcb->snd_nxt++;
-
-                backlog_push(listen_tcb, tcb_idx);
-                return;
-            }
-        }
-        /* No free TCB - send RST */
-        return;
-    }
-
+    tcb_t* tcb = tcb_lookup(src_ip, src_port, dst_port);
     if (!tcb) {
+        tcp_tw_t* tw = tw_lookup(src_ip, src_port, dst_port);
+        if (tw) {
+            /* TIME_WAIT: ACK any late FINs, ignore everything else */
+            if (flags & TCP_FIN)
+                tcp_send_stateless(src_ip, src_port, dst_port, tw->snd_nxt,
+                                   tw->rcv_nxt, TCP_ACK);
+            return;
+        }
+        tcb_t* ltcb = listen_lookup(dst_port);
+        if (ltcb)
+            tcb = tcp_listen_input(ltcb, src_ip, src_port, seq, ack, flags,
+                                   window, &opts);
         /* No matching connection - could send RST but skip for simplicity */
-        return;
+        if (!tcb)
+            return;
     }
 
-    /* Update send window */
-    tcb->snd_wnd = window;
-
     switch (tcb->state) {
     case TCP_SYN_SENT:
         if ((flags & (TCP_SYN | TCP_ACK)) == (TCP_SYN | TCP_ACK)) {
             tcb->rcv_nxt = seq + 1;
             tcb->snd_una = ack;
+            tcb->snd_wnd = window;
+            tcp_negotiate(tcb, &opts);
             tcb->state = TCP_ESTABLISHED;
             tcp_send_segment(tcb, TCP_ACK, NULL, 0);
         }
-        break;
+        waitq_wake(&tcb->wq);
+        return;
 
     case TCP_SYN_RECEIVED:
-        if (flags & TCP_ACK) {
-            tcb->snd_una = ack;
-            tcb->state = TCP_ESTABLISHED;
+        if (!(flags & TCP_ACK))
+            return;
+        tcb->snd_una = ack;
+        tcb->state = TCP_ESTABLISHED;
+        if (tcb->parent) {
+            tcb->parent->syn_count--;
+            tcp_stats.syn_recv--;
+            tcp_accept_push(tcb->parent, tcb);
         }
         break;
 
-    case TCP_ESTABLISHED:
-        if (flags & TCP_ACK) {
-            tcb->snd_una = ack;
-        }
+    default:
+        break;
+    }
 
-        /* Receive data */
-        if (payload_len > 0 && seq == tcb->rcv_nxt) {
-            ring_write(&tcb->rx_ring, payload, payload_len);
-            tcb->rcv_nxt += payload_len;
+    if (tcb->ts_ok && opts.ts) {
+        /* PAWS (RFC 7323): a timestamp older than the last one seen is
+         * an old duplicate */
+        if ((int32_t)(opts.tsval - tcb->ts_recent) < 0) {
             tcp_send_segment(tcb, TCP_ACK, NULL, 0);
+            return;
+        }
+        if (SEQ_LEQ(seq, tcb->rcv_nxt))
+            tcb->ts_recent = opts.tsval;
+        /* New data echoing our timestamp times the receiver's round trip */
+        if (payload_len > 0 && seq == tcb->rcv_nxt && opts.tsecr) {
+            uint32_t m = pit_get_ticks() - opts.tsecr;
+            if (m == 0) m = 1;
+            tcb->rcv_rtt = tcb->rcv_rtt ? (7 * tcb->rcv_rtt + m) / 8 : m;
         }
+    }
 
-        if (flags & TCP_FIN) {
-            tcb->rcv_nxt++;
-            tcb->state = TCP_CLOSE_WAIT;
-            tcp_send_segment(tcb, TCP_ACK, NULL, 0);
+    if (flags & TCP_ACK)
+        tcp_ack(tcb, ack, (uint32_t)window << tcb->snd_wscale,
+                payload_len == 0 && !(flags & (TCP_SYN | TCP_FIN)), &opts);
+
+    /* Our FIN has been acknowledged */
+    if (tcb->fin_acked) {
+        if (tcb->state == TCP_FIN_WAIT_1) {
+            tcb->state = TCP_FIN_WAIT_2;
+        } else if (tcb->state == TCP_CLOSING) {
+            tcp_enter_time_wait(tcb);
+            return;
+        } else if (tcb->state == TCP_LAST_ACK) {
+            tcp_set_closed(tcb);
+            return;
         }
-        break;
+    }
 
-    case TCP_FIN_WAIT_1:
-        if (flags & TCP_ACK) {
-            tcb->snd_una = ack;
-            if (flags & TCP_FIN) {
-                tcb->rcv_nxt = seq + 1;
+    /* Receive data, also while our own FIN is outstanding */
+    int need_ack = 0;
+    int receiving = tcb->state == TCP_ESTABLISHED ||
+                    tcb->state == TCP_FIN_WAIT_1 || tcb->state == TCP_FIN_WAIT_2;
+    if (receiving)
+        need_ack = tcp_rcv_data(tcb, seq, payload, payload_len);
+
+    if (flags & TCP_FIN) {
+        if (receiving && seq + payload_len == tcb->rcv_nxt) {
+            tcb->rcv_nxt++;
+            if (tcb->state == TCP_ESTABLISHED)
+                tcb->state = TCP_CLOSE_WAIT;
+            else if (tcb->state == TCP_FIN_WAIT_1)
+                tcb->state = TCP_CLOSING;
+            else
                 tcb->state = TCP_TIME_WAIT;
-                tcp_send_segment(tcb, TCP_ACK, NULL, 0);
-            } else {
-                tcb->state = TCP_FIN_WAIT_2;
-            }
-        }
-        /* Receive data even in FIN_WAIT_1 */
-        if (payload_len > 0 && seq == tcb->rcv_nxt) {
-            ring_write(&tcb->rx_ring, payload, payload_len);
-            tcb->rcv_nxt += payload_len;
         }
-        break;
+        need_ack = RCV_ACK_NOW;   /* also re-ACKs retransmitted FINs */
+    }
 
-    case TCP_FIN_WAIT_2:
-        if (payload_len > 0 && seq == tcb->rcv_nxt) {
-            ring_write(&tcb->rx_ring, payload, payload_len);
-            tcb->rcv_nxt += payload_len;
-            tcp_send_segment(tcb, TCP_ACK, NULL, 0);
-        }
-        if (flags & TCP_FIN) {
-            tcb->rcv_nxt = seq + 1;
-            tcb->state = TCP_TIME_WAIT;
+    /* In-order data is ACKed for every second full segment, otherwise
+     * when the delayed-ACK timer fires or data goes the other way */
+    if (need_ack) {
+        if (!tcb->ack_pending) tcb->ack_tick = pit_get_ticks();
+        tcb->ack_pending = 1;
+        if (tcb->rcv_nxt - tcb->rcv_acked >= 2 * tcb->mss)
+            need_ack = RCV_ACK_NOW;
+    }
+
+    /* ACKs opened the window: send more.  The first segment out
+     * carries the ACK we owe. */
+    tcp_output(tcb);
+
+    if (tcb->ack_pending) {
+        if (need_ack == RCV_ACK_NOW)
             tcp_send_segment(tcb, TCP_ACK, NULL, 0);
-        }
-        break;
+        else
+            tcp_delack_arm(tcb->ack_tick + TCP_DELACK_TICKS);
+    }
 
-    case TCP_CLOSE_WAIT:
-        /* Waiting for application to close */
-        break;
+    if (tcb->state == TCP_TIME_WAIT) {
+        tcp_enter_time_wait(tcb);
+        return;
+    }
 
-    case TCP_LAST_ACK:
-        if (flags & TCP_ACK) {
-            tcb->state = TCP_CLOSED;
-        }
-        break;
+    waitq_wake(&tcb->wq);
+}
 
-    case TCP_TIME_WAIT:
-        /* ACK any late FINs */
-        if (flags & TCP_FIN) {
+/* Timers of one connection; may free it */
+static void tcp_timer_one(tcb_t* tcb, uint32_t now) {
+    tcp_release_idle(tcb, now);
+
+    if (tcb->ack_pending) {
+        if (now - tcb->ack_tick >= TCP_DELACK_TICKS)
             tcp_send_segment(tcb, TCP_ACK, NULL, 0);
+        else
+            tcp_delack_arm(tcb->ack_tick + TCP_DELACK_TICKS);
+    }
+
+    /* Retransmission for SYN_SENT, SYN_RECEIVED */
+    if (tcb->state == TCP_SYN_SENT || tcb->state == TCP_SYN_RECEIVED) {
+        if (now - tcb->last_send_tick > tcb->rto_ticks) {
+            if (tcb->retries >= TCP_MAX_RETRIES) {
+                tcp_set_closed(tcb);
+                return;
+            }
+            tcb->retries++;
+            tcb->rto_ticks *= 2; /* Exponential backoff */
+            /* Resend with the SYN's own sequence number */
+            tcb->snd_nxt--;
+            if (tcb->state == TCP_SYN_SENT)
+                tcp_send_segment(tcb, TCP_SYN, NULL, 0);
+            else
+                tcp_send_segment(tcb, TCP_SYN | TCP_ACK, NULL, 0);
+            tcb->snd_nxt++;
         }
-        break;
+        return;
+    }
 
-    default:
-        break;
+    /* An orphan whose peer never sends its FIN */
+    if (tcb->state == TCP_FIN_WAIT_2 && tcb->handle < 0) {
+        if (now - tcb->rtx_tick >= TCP_FIN_TIMEOUT)
+            tcp_set_closed(tcb);
+        return;
     }
-}
 
-void tcp_timer_tick(void) {
-    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
-        tcb_t* tcb = &tcbs[i];
+    if (!tcp_can_send(tcb))
+        return;
 
-        /* TIME_WAIT expiry (2 * MSL ≈ 6 seconds) */
-        if (tcb->state == TCP_TIME_WAIT) {
-            if (pit_get_ticks() - tcb->last_send_tick > 600) {
-                tcb->state = TCP_CLOSED;
-            }
+    /* Zero window: probe with an old sequence number so the peer
+     * answers with its current window */
+    if (tcb->snd_max == tcb->snd_una) {
+        if (tcb->snd_wnd == 0 && tcb->tx_ring.count > 0 &&
+            now - tcb->rtx_tick >= tcb->rto_ticks) {
+            netbuf_t* nb = netbuf_alloc();
+            if (nb) tcp_emit(tcb, nb, tcb->snd_una - 1, TCP_ACK);
+            tcb->rtx_tick = now;
+            tcb->rto_ticks *= 2;
+            if (tcb->rto_ticks > TCP_RTO_MAX) tcb->rto_ticks = TCP_RTO_MAX;
         }
+        return;
+    }
 
-        /* Retransmission for SYN_SENT, SYN_RECEIVED */
-        if (tcb->state == TCP_SYN_SENT || tcb->state == TCP_SYN_RECEIVED) {
-            if (pit_get_ticks() - tcb->last_send_tick > tcb->rto_ticks) {
-                if (tcb->retries >= TCP_MAX_RETRIES) {
-                    tcb->state = TCP_CLOSED;
-                    continue;
-                }
-                tcb->retries++;
-                tcb->rto_ticks *= 2; /* Exponential backoff */
-                if (tcb->state == TCP_SYN_SENT)
-                    tcp_send_segment(tcb, TCP_SYN, NULL, 0);
-                else
-                    tcp_send_segment(tcb, TCP_SYN | TCP_ACK, NULL, 0);
-            }
+    /* Retransmission timeout: back off, collapse the window to one
+     * segment and resend everything from snd_una (go-back-N) */
+    if (now - tcb->rtx_tick >= tcb->rto_ticks) {
+        if (tcb->retries >= TCP_MAX_RETRIES) {
+            tcp_set_closed(tcb);
+            return;
+        }
+        uint32_t flight = tcb->snd_max - tcb->snd_una;
+        tcb->retries++;
+        tcb->timeouts++;
+        tcb->ssthresh = flight / 2 > 2 * tcb->mss ? flight / 2 : 2 * tcb->mss;
+        tcb->cwnd = tcb->mss;
+        tcb->in_recovery = 0;
+        tcb->dupacks = 0;
+        tcb->snd_sack_n = 0;    /* the peer may have discarded SACKed data */
+        tcb->rtt_active = 0;    /* Karn: don't time retransmissions */
+        tcb->rto_ticks *= 2;
+        if (tcb->rto_ticks > TCP_RTO_MAX) tcb->rto_ticks = TCP_RTO_MAX;
+        tcb->snd_nxt = tcb->snd_una;
+        tcb->rtx_tick = now;
+        tcp_output(tcb);
+    }
+}
+
+void tcp_timer_tick(void) {
+    uint32_t now = pit_get_ticks();
+
+    delack_armed = 0;   /* re-armed by connections still holding an ACK */
+    tw_expire(now);
+    for (int b = 0; b < TCP_HASH_SIZE; b++) {
+        tcb_t* next;
+        for (tcb_t* tcb = tcb_hash[b]; tcb; tcb = next) {
+            next = tcb->hnext;
+            tcp_timer_one(tcb, now);
         }
     }
 }
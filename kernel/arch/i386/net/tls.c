@@ -8,6 +8,7 @@
 #include <kernel/endian.h>
 #include <kernel/task.h>
 #include <kernel/io.h>
+#include <kernel/idt.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,6 +40,209 @@ static uint32_t get_be24(const uint8_t *p) {
     return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
 }
 
+static uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | get_be24(p + 1);
+}
+
+static int suite_is_ecdhe(uint16_t suite) {
+    return suite == TLS_ECDHE_RSA_AES128_CBC_SHA256 ||
+           suite == TLS_ECDHE_ECDSA_AES128_GCM_SHA256 ||
+           suite == TLS_ECDHE_RSA_CHACHA20_POLY1305 ||
+           suite == TLS_ECDHE_ECDSA_CHACHA20_POLY1305;
+}
+
+/* RFC 7905 per-record nonce: the 64-bit sequence number, big-endian,
+ * xored into the last eight bytes of the 12-byte IV */
+static void tls_chacha_nonce(uint8_t nonce[12], const uint8_t iv[12],
+                             uint64_t seq) {
+    memcpy(nonce, iv, 12);
+    for (int i = 0; i < 8; i++)
+        nonce[11 - i] ^= (uint8_t)(seq >> (8 * i));
+}
+
+/* ── Session cache ───────────────────────────────────────────────
+ *
+ * The master secret of every finished handshake is kept per host and
+ * port with the server's session ID or ticket.  The next connection
+ * offers it in ClientHello; if the server agrees, both sides derive
+ * fresh keys from it and skip the certificate, the key exchange and a
+ * round trip.  Entries live TLS_SESSION_LIFETIME seconds at most. */
+
+typedef struct {
+    int      valid;
+    char     host[TLS_SESSION_HOST];
+    uint16_t port;
+    uint16_t cipher_suite;
+    uint8_t  master_secret[48];
+    uint8_t  session_id[32];
+    uint8_t  session_id_len;
+    uint8_t *ticket;         /* malloc'd, NULL if the server issued none */
+    uint16_t ticket_len;
+    uint32_t expires;        /* tick */
+    uint32_t last_used;
+} tls_session_t;
+
+static tls_session_t sessions[TLS_SESSION_CACHE];
+static tls_stats_t tls_stats;
+
+static void session_drop(tls_session_t *s) {
+    free(s->ticket);
+    memset(s, 0, sizeof(*s));
+}
+
+/* Call with interrupts off */
+static tls_session_t *session_find(const char *host, uint16_t port) {
+    uint32_t now = pit_get_ticks();
+    for (int i = 0; i < TLS_SESSION_CACHE; i++) {
+        tls_session_t *s = &sessions[i];
+        if (!s->valid)
+            continue;
+        if ((int32_t)(now - s->expires) >= 0) {
+            session_drop(s);
+            continue;
+        }
+        if (s->port == port && strcmp(s->host, host) == 0)
+            return s;
+    }
+    return NULL;
+}
+
+/* Copy the cached session for host:port into conn, to offer it */
+static void session_load(tls_conn_t *conn, const char *host, uint16_t port) {
+    uint32_t flags = irq_save();
+    tls_session_t *s = session_find(host, port);
+    if (s) {
+        memcpy(conn->master_secret, s->master_secret, 48);
+        conn->cipher_suite = s->cipher_suite;
+        memcpy(conn->session_id, s->session_id, s->session_id_len);
+        conn->session_id_len = s->session_id_len;
+        if (s->ticket) {
+            conn->ticket = malloc(s->ticket_len);
+            if (conn->ticket) {
+                memcpy(conn->ticket, s->ticket, s->ticket_len);
+                conn->ticket_len = s->ticket_len;
+            }
+        }
+        s->last_used = pit_get_ticks();
+        conn->resuming = (conn->session_id_len > 0 || conn->ticket);
+    }
+    irq_restore(flags);
+
+    /* With a ticket the session ID is ours to pick (RFC 5077 3.4); the
+     * server echoes it when it accepts the ticket */
+    if (conn->ticket) {
+        prng_random(conn->session_id, 32);
+        conn->session_id_len = 32;
+    }
+}
+
+static void session_forget(const char *host, uint16_t port) {
+    uint32_t flags = irq_save();
+    tls_session_t *s = session_find(host, port);
+    if (s) {
+        session_drop(s);
+        tls_stats.cached--;
+    }
+    irq_restore(flags);
+}
+
+/* Cache the session of a finished handshake; takes conn->ticket */
+static void session_store(tls_conn_t *conn, const char *host, uint16_t port) {
+    if (strlen(host) >= TLS_SESSION_HOST)
+        return;
+    if (conn->session_id_len == 0 && !conn->ticket) {
+        /* The server offers no way back */
+        session_forget(host, port);
+        return;
+    }
+
+    uint32_t now = pit_get_ticks();
+    uint32_t lifetime = TLS_SESSION_LIFETIME;
+    if (conn->ticket_lifetime && conn->ticket_lifetime < lifetime)
+        lifetime = conn->ticket_lifetime;
+
+    uint32_t flags = irq_save();
+    tls_session_t *s = session_find(host, port);
+    uint32_t expires = now + lifetime * 120;
+    if (s && conn->resumed && !conn->new_ticket)
+        expires = s->expires;   /* a resumed session keeps its age */
+
+    if (s) {
+        session_drop(s);
+    } else {
+        /* A free slot, else the least recently used */
+        s = &sessions[0];
+        for (int i = 0; i < TLS_SESSION_CACHE; i++) {
+            if (!sessions[i].valid) {
+                s = &sessions[i];
+                break;
+            }
+            if ((int32_t)(sessions[i].last_used - s->last_used) < 0)
+                s = &sessions[i];
+        }
+        if (s->valid)
+            session_drop(s);
+        else
+            tls_stats.cached++;
+    }
+
+    s->valid = 1;
+    strcpy(s->host, host);
+    s->port = port;
+    s->cipher_suite = conn->cipher_suite;
+    memcpy(s->master_secret, conn->master_secret, 48);
+    memcpy(s->session_id, conn->session_id, conn->session_id_len);
+    s->session_id_len = conn->session_id_len;
+    s->ticket = conn->ticket;
+    s->ticket_len = conn->ticket_len;
+    s->expires = expires;
+    s->last_used = now;
+    irq_restore(flags);
+
+    conn->ticket = NULL;
+    conn->ticket_len = 0;
+}
+
+void tls_session_flush(void) {
+    uint32_t flags = irq_save();
+    for (int i = 0; i < TLS_SESSION_CACHE; i++)
+        if (sessions[i].valid)
+            session_drop(&sessions[i]);
+    tls_stats.cached = 0;
+    irq_restore(flags);
+}
+
+void tls_get_stats(tls_stats_t *st) {
+    uint32_t flags = irq_save();
+    *st = tls_stats;
+    irq_restore(flags);
+}
+
+/* NewSessionTicket: lifetime_hint(4) + ticket_len(2) + ticket */
+static int tls_take_ticket(tls_conn_t *conn, const uint8_t *body, uint32_t len) {
+    if (len < 6) return -1;
+    uint16_t tlen = get_be16(body + 4);
+    if (6 + (uint32_t)tlen > len) return -1;
+
+    free(conn->ticket);
+    conn->ticket = NULL;
+    conn->ticket_len = 0;
+    conn->new_ticket = 1;
+    conn->ticket_lifetime = get_be32(body);
+    tls_stats.tickets++;
+
+    /* An empty ticket withdraws the old one */
+    if (tlen == 0 || tlen > TLS_MAX_TICKET)
+        return 0;
+    conn->ticket = malloc(tlen);
+    if (conn->ticket) {
+        memcpy(conn->ticket, body + 6, tlen);
+        conn->ticket_len = tlen;
+    }
+    DBG("tls: NewSessionTicket, %u bytes", tlen);
+    return 0;
+}
+
 /* ── Raw TCP I/O with timeout ────────────────────────────────── */
 
 /* Read exactly `len` bytes from socket, blocking with timeout */
@@ -68,6 +272,38 @@ static int tls_send_record(tls_conn_t *conn, uint8_t type,
         return 0;
     }
 
+    if (conn->is_chacha) {
+        /* ChaCha20-Poly1305 (RFC 7905): nonce = iv(12) ^ seq (big-endian,
+         * right-aligned), no explicit nonce on the wire.
+         * Record = ciphertext + tag(16), AAD as for GCM */
+        uint8_t nonce[12];
+        tls_chacha_nonce(nonce, conn->client_write_iv, conn->client_seq);
+
+        uint8_t aad[13];
+        put_be64(aad, conn->client_seq);
+        aad[8] = type;
+        put_be16(aad + 9, TLS_VERSION_1_2);
+        put_be16(aad + 11, (uint16_t)len);
+
+        uint8_t *cipher = malloc(len + 16);
+        if (!cipher) return -1;
+        chacha20_poly1305_encrypt(conn->client_write_key, nonce, aad, 13,
+                                  data, len, cipher, cipher + len);
+        conn->client_seq++;
+
+        uint8_t hdr[5];
+        hdr[0] = type;
+        put_be16(hdr + 1, TLS_VERSION_1_2);
+        put_be16(hdr + 3, (uint16_t)(len + 16));
+
+        int ret = 0;
+        if (socket_send(conn->sock_fd, hdr, 5) < 0) ret = -1;
+        if (ret == 0 && socket_send(conn->sock_fd, cipher, len + 16) < 0) ret = -1;
+
+        free(cipher);
+        return ret;
+    }
+
     if (conn->is_gcm) {
         /* GCM: nonce = implicit_iv(4) || explicit_nonce(8)
          * explicit_nonce = sequence number (big-endian)
@@ -213,6 +449,35 @@ static int tls_recv_record(tls_conn_t *conn, uint8_t *out_type,
         return 0;
     }
 
+    if (conn->is_chacha) {
+        /* ChaCha20-Poly1305: ciphertext + tag(16) */
+        if (rec_len < 16) { free(rec); return -1; }
+        size_t ct_len = rec_len - 16;
+        if (ct_len > buf_size) { free(rec); return -1; }
+
+        uint8_t nonce[12];
+        tls_chacha_nonce(nonce, conn->server_write_iv, conn->server_seq);
+
+        uint8_t aad[13];
+        put_be64(aad, conn->server_seq);
+        aad[8] = *out_type;
+        put_be16(aad + 9, TLS_VERSION_1_2);
+        put_be16(aad + 11, (uint16_t)ct_len);
+
+        int rc = chacha20_poly1305_decrypt(conn->server_write_key, nonce,
+                                           aad, 13, rec, ct_len, buf,
+                                           rec + ct_len);
+        free(rec);
+        if (rc < 0) {
+            DBG("tls: Poly1305 authentication failed!");
+            return -1;
+        }
+
+        conn->server_seq++;
+        *out_len = ct_len;
+        return 0;
+    }
+
     if (conn->is_gcm) {
         /* GCM: explicit_nonce(8) + ciphertext + tag(16) */
         if (rec_len < 8 + 16) { free(rec); return -1; }
@@ -363,6 +628,7 @@ static int tls_send_client_hello(tls_conn_t *conn, const char *hostname) {
      * 2. signature_algorithms
      * 3. supported_groups (for ECDHE)
      * 4. ec_point_formats (for ECDHE)
+     * 5. session_ticket: empty asks for a ticket, else the cached one
      */
 
     /* SNI extension: type(2) + len(2) + sni_list_len(2) + type(1) + name_len(2) + name */
@@ -397,13 +663,17 @@ static int tls_send_client_hello(tls_conn_t *conn, const char *hostname) {
         0x00,        /* uncompressed */
     };
 
+    size_t ticket_ext_len = 4 + conn->ticket_len;
     size_t extensions_len = sni_ext_len + sizeof(sig_algs) +
-                            sizeof(sup_groups) + sizeof(ec_formats);
+                            sizeof(sup_groups) + sizeof(ec_formats) +
+                            ticket_ext_len;
 
     /* Cipher suites: ECDHE-ECDSA first (for ECDSA servers like impin.fr),
-     * then ECDHE-RSA, then RSA-only GCM/CBC fallback. */
-    size_t cipher_len = 8; /* 4 cipher suites × 2 bytes */
-    size_t body_len = 2 + 32 + 1 + 2 + cipher_len + 1 + 1 + 2 + extensions_len;
+     * then ECDHE-RSA, then RSA-only GCM/CBC fallback.  ChaCha20-Poly1305
+     * leads unless AES-NI makes AES-GCM the faster AEAD. */
+    size_t cipher_len = 12; /* 6 cipher suites × 2 bytes */
+    size_t body_len = 2 + 32 + 1 + conn->session_id_len + 2 + cipher_len +
+                      1 + 1 + 2 + extensions_len;
     uint8_t *body = malloc(body_len);
     if (!body) return -1;
     uint8_t *p = body;
@@ -414,12 +684,21 @@ static int tls_send_client_hello(tls_conn_t *conn, const char *hostname) {
     /* Client random */
     memcpy(p, conn->client_random, 32); p += 32;
 
-    /* Session ID (empty) */
-    *p++ = 0;
+    /* Session ID: empty unless resuming */
+    *p++ = conn->session_id_len;
+    memcpy(p, conn->session_id, conn->session_id_len);
+    p += conn->session_id_len;
 
     /* Cipher suites */
     put_be16(p, (uint16_t)cipher_len); p += 2;
-    put_be16(p, TLS_ECDHE_ECDSA_AES128_GCM_SHA256); p += 2;
+    if (aes128_accel()) {
+        put_be16(p, TLS_ECDHE_ECDSA_AES128_GCM_SHA256); p += 2;
+        put_be16(p, TLS_ECDHE_ECDSA_CHACHA20_POLY1305); p += 2;
+    } else {
+        put_be16(p, TLS_ECDHE_ECDSA_CHACHA20_POLY1305); p += 2;
+        put_be16(p, TLS_ECDHE_ECDSA_AES128_GCM_SHA256); p += 2;
+    }
+    put_be16(p, TLS_ECDHE_RSA_CHACHA20_POLY1305);   p += 2;
     put_be16(p, TLS_ECDHE_RSA_AES128_CBC_SHA256);    p += 2;
     put_be16(p, TLS_RSA_AES128_GCM_SHA256);          p += 2;
     put_be16(p, TLS_RSA_AES128_CBC_SHA256);           p += 2;
@@ -448,18 +727,28 @@ static int tls_send_client_hello(tls_conn_t *conn, const char *hostname) {
     /* EC point formats extension */
     memcpy(p, ec_formats, sizeof(ec_formats)); p += sizeof(ec_formats);
 
+    /* Session ticket extension */
+    put_be16(p, TLS_EXT_SESSION_TICKET); p += 2;
+    put_be16(p, conn->ticket_len); p += 2;
+    if (conn->ticket_len) {
+        memcpy(p, conn->ticket, conn->ticket_len);
+        p += conn->ticket_len;
+    }
+
     int ret = tls_send_handshake(conn, TLS_HS_CLIENT_HELLO, body, body_len);
     free(body);
     return ret;
 }
 
-/* Process ServerHello, Certificate, [ServerKeyExchange], ServerHelloDone */
+/* Process ServerHello, Certificate, [ServerKeyExchange], ServerHelloDone.
+ * When the server resumes our session, ServerHello (and perhaps
+ * NewSessionTicket) is all there is. */
 static int tls_recv_server_hello(tls_conn_t *conn) {
     uint8_t *buf = malloc(TLS_RECV_BUF);
     if (!buf) return -1;
     int got_hello = 0, got_cert = 0, got_done = 0, got_ske = 0;
 
-    while (!got_done) {
+    while (!got_done && !conn->resumed) {
         uint8_t type;
         size_t len;
         if (tls_recv_record(conn, &type, buf, TLS_RECV_BUF, &len) < 0) {
@@ -498,21 +787,49 @@ static int tls_recv_server_hello(tls_conn_t *conn) {
                 memcpy(conn->server_random, hs_body + 2, 32);
                 uint8_t sid_len = hs_body[34];
                 size_t off = 35 + sid_len;
-                if (off + 3 > hs_len) { free(buf); return -1; }
+                if (sid_len > 32 || off + 3 > hs_len) { free(buf); return -1; }
                 uint16_t cipher = get_be16(hs_body + off);
+
+                /* Echoing the session ID we offered accepts resumption */
+                if (conn->resuming && sid_len == conn->session_id_len &&
+                    memcmp(hs_body + 35, conn->session_id, sid_len) == 0) {
+                    if (cipher != conn->cipher_suite) {
+                        DBG("tls: resumed with a different cipher 0x%x", cipher);
+                        free(buf);
+                        return -1;
+                    }
+                    conn->resumed = 1;
+                } else {
+                    /* Full handshake; remember the new ID, drop the
+                     * ticket the server declined */
+                    memcpy(conn->session_id, hs_body + 35, sid_len);
+                    conn->session_id_len = sid_len;
+                    free(conn->ticket);
+                    conn->ticket = NULL;
+                    conn->ticket_len = 0;
+                }
                 if (cipher != TLS_RSA_AES128_GCM_SHA256 &&
                     cipher != TLS_RSA_AES128_CBC_SHA256 &&
                     cipher != TLS_ECDHE_RSA_AES128_CBC_SHA256 &&
-                    cipher != TLS_ECDHE_ECDSA_AES128_GCM_SHA256) {
+                    cipher != TLS_ECDHE_ECDSA_AES128_GCM_SHA256 &&
+                    cipher != TLS_ECDHE_RSA_CHACHA20_POLY1305 &&
+                    cipher != TLS_ECDHE_ECDSA_CHACHA20_POLY1305) {
                     DBG("tls: server chose unsupported cipher 0x%x", cipher);
                     free(buf);
                     return -1;
                 }
                 conn->cipher_suite = cipher;
                 got_hello = 1;
-                DBG("tls: ServerHello OK, cipher=0x%x", cipher);
+                DBG("tls: ServerHello OK, cipher=0x%x%s", cipher,
+                    conn->resumed ? " (resumed)" : "");
                 break;
             }
+            case TLS_HS_NEW_SESSION_TICKET:
+                if (tls_take_ticket(conn, hs_body, hs_len) < 0) {
+                    free(buf);
+                    return -1;
+                }
+                break;
             case TLS_HS_CERTIFICATE: {
                 /* certificates_length(3) + [ cert_length(3) + cert_data ]* */
                 if (hs_len < 3) { free(buf); return -1; }
@@ -598,26 +915,112 @@ static int tls_recv_server_hello(tls_conn_t *conn) {
 
     free(buf);
 
+    if (conn->resumed)
+        return 0;
     if (!got_hello || !got_cert) {
         DBG("tls: missing ServerHello or Certificate");
         return -1;
     }
     /* ECDHE requires ServerKeyExchange */
-    int is_ecdhe = (conn->cipher_suite == TLS_ECDHE_RSA_AES128_CBC_SHA256 ||
-                    conn->cipher_suite == TLS_ECDHE_ECDSA_AES128_GCM_SHA256);
-    if (is_ecdhe && !got_ske) {
+    if (suite_is_ecdhe(conn->cipher_suite) && !got_ske) {
         DBG("tls: ECDHE cipher but no ServerKeyExchange");
         return -1;
     }
     return 0;
 }
 
+/* Derive the record keys from the master secret */
+static void tls_derive_keys(tls_conn_t *conn) {
+    /* Derive key_block = PRF(master_secret, "key expansion", server_random + client_random)
+     *
+     * CBC (0x003C): MAC_key(32)*2 + write_key(16)*2 = 96 bytes
+     * GCM (0x009C): write_key(16)*2 + implicit_iv(4)*2 = 40 bytes (no MAC)
+     * ChaCha20-Poly1305: write_key(32)*2 + iv(12)*2 = 88 bytes (no MAC) */
+    conn->is_gcm = (conn->cipher_suite == TLS_RSA_AES128_GCM_SHA256 ||
+                    conn->cipher_suite == TLS_ECDHE_ECDSA_AES128_GCM_SHA256);
+    conn->is_chacha = (conn->cipher_suite == TLS_ECDHE_RSA_CHACHA20_POLY1305 ||
+                       conn->cipher_suite == TLS_ECDHE_ECDSA_CHACHA20_POLY1305);
+
+    uint8_t ks_seed[64];
+    memcpy(ks_seed, conn->server_random, 32);
+    memcpy(ks_seed + 32, conn->client_random, 32);
+
+    if (conn->is_chacha) {
+        uint8_t key_block[88];
+        tls_prf(conn->master_secret, 48, "key expansion", ks_seed, 64,
+                key_block, 88);
+        memcpy(conn->client_write_key, key_block, 32);
+        memcpy(conn->server_write_key, key_block + 32, 32);
+        memcpy(conn->client_write_iv, key_block + 64, 12);
+        memcpy(conn->server_write_iv, key_block + 76, 12);
+        DBG("tls: keys derived (mode=ChaCha20-Poly1305)");
+        return;
+    }
+
+    if (conn->is_gcm) {
+        uint8_t key_block[40];
+        tls_prf(conn->master_secret, 48, "key expansion", ks_seed, 64,
+                key_block, 40);
+        memcpy(conn->client_write_key, key_block, 16);
+        memcpy(conn->server_write_key, key_block + 16, 16);
+        memcpy(conn->client_write_iv, key_block + 32, 4);
+        memcpy(conn->server_write_iv, key_block + 36, 4);
+    } else {
+        uint8_t key_block[96];
+        tls_prf(conn->master_secret, 48, "key expansion", ks_seed, 64,
+                key_block, 96);
+        memcpy(conn->client_write_mac_key, key_block, 32);
+        memcpy(conn->server_write_mac_key, key_block + 32, 32);
+        memcpy(conn->client_write_key, key_block + 64, 16);
+        memcpy(conn->server_write_key, key_block + 80, 16);
+    }
+
+    aes128_init(&conn->client_aes, conn->client_write_key);
+    aes128_init(&conn->server_aes, conn->server_write_key);
+
+    DBG("tls: keys derived (mode=%s)", conn->is_gcm ? "GCM" : "CBC");
+    DBG("tls: client_key[0..3]=%x %x %x %x",
+        conn->client_write_key[0], conn->client_write_key[1],
+        conn->client_write_key[2], conn->client_write_key[3]);
+}
+
+/* Send ChangeCipherSpec + Finished */
+static int tls_send_finished(tls_conn_t *conn) {
+    /* Send ChangeCipherSpec */
+    uint8_t ccs = 1;
+    if (tls_send_record(conn, TLS_CHANGE_CIPHER_SPEC, &ccs, 1) < 0)
+        return -1;
+
+    conn->client_encrypted = 1;
+    conn->client_seq = 0;
+
+    /* Compute verify_data for Finished message:
+     * verify_data = PRF(master_secret, "client finished", Hash(all_handshake_messages)) */
+    sha256_ctx_t hash_copy = conn->hs_hash;
+    uint8_t hs_digest[SHA256_DIGEST_SIZE];
+    sha256_final(&hash_copy, hs_digest);
+
+    uint8_t verify_data[12];
+    tls_prf(conn->master_secret, 48, "client finished",
+            hs_digest, SHA256_DIGEST_SIZE, verify_data, 12);
+
+    DBG("tls: verify[0..5]=%x %x %x %x %x %x",
+        verify_data[0], verify_data[1], verify_data[2],
+        verify_data[3], verify_data[4], verify_data[5]);
+
+    /* Send Finished (this goes encrypted now) */
+    if (tls_send_handshake(conn, TLS_HS_FINISHED, verify_data, 12) < 0)
+        return -1;
+
+    DBG("tls: client Finished sent");
+    return 0;
+}
+
 /* Send ClientKeyExchange + ChangeCipherSpec + Finished */
 static int tls_send_client_finish(tls_conn_t *conn) {
     uint8_t pms[48];
 
-    if (conn->cipher_suite == TLS_ECDHE_RSA_AES128_CBC_SHA256 ||
-        conn->cipher_suite == TLS_ECDHE_ECDSA_AES128_GCM_SHA256) {
+    if (suite_is_ecdhe(conn->cipher_suite)) {
         /* ECDHE key exchange */
         DBG("tls: ECDHE key exchange");
 
@@ -695,131 +1098,112 @@ static int tls_send_client_finish(tls_conn_t *conn) {
                 conn->master_secret, 48);
     }
 
-    /* Derive key_block = PRF(master_secret, "key expansion", server_random + client_random)
-     *
-     * CBC (0x003C): MAC_key(32)*2 + write_key(16)*2 = 96 bytes
-     * GCM (0x009C): write_key(16)*2 + implicit_iv(4)*2 = 40 bytes (no MAC) */
-    conn->is_gcm = (conn->cipher_suite == TLS_RSA_AES128_GCM_SHA256 ||
-                    conn->cipher_suite == TLS_ECDHE_ECDSA_AES128_GCM_SHA256);
-
-    uint8_t ks_seed[64];
-    memcpy(ks_seed, conn->server_random, 32);
-    memcpy(ks_seed + 32, conn->client_random, 32);
-
-    if (conn->is_gcm) {
-        uint8_t key_block[40];
-        tls_prf(conn->master_secret, 48, "key expansion", ks_seed, 64,
-                key_block, 40);
-        memcpy(conn->client_write_key, key_block, 16);
-        memcpy(conn->server_write_key, key_block + 16, 16);
-        memcpy(conn->client_write_iv, key_block + 32, 4);
-        memcpy(conn->server_write_iv, key_block + 36, 4);
-    } else {
-        uint8_t key_block[96];
-        tls_prf(conn->master_secret, 48, "key expansion", ks_seed, 64,
-                key_block, 96);
-        memcpy(conn->client_write_mac_key, key_block, 32);
-        memcpy(conn->server_write_mac_key, key_block + 32, 32);
-        memcpy(conn->client_write_key, key_block + 64, 16);
-        memcpy(conn->server_write_key, key_block + 80, 16);
-    }
-
-    aes128_init(&conn->client_aes, conn->client_write_key);
-    aes128_init(&conn->server_aes, conn->server_write_key);
-
-    DBG("tls: keys derived (mode=%s)", conn->is_gcm ? "GCM" : "CBC");
-    DBG("tls: client_key[0..3]=%x %x %x %x",
-        conn->client_write_key[0], conn->client_write_key[1],
-        conn->client_write_key[2], conn->client_write_key[3]);
-
-    /* Send ChangeCipherSpec */
-    uint8_t ccs = 1;
-    if (tls_send_record(conn, TLS_CHANGE_CIPHER_SPEC, &ccs, 1) < 0)
-        return -1;
-
-    conn->client_encrypted = 1;
-    conn->client_seq = 0;
-
-    /* Compute verify_data for Finished message:
-     * verify_data = PRF(master_secret, "client finished", Hash(all_handshake_messages)) */
-    sha256_ctx_t hash_copy = conn->hs_hash;
-    uint8_t hs_digest[SHA256_DIGEST_SIZE];
-    sha256_final(&hash_copy, hs_digest);
-
-    uint8_t verify_data[12];
-    tls_prf(conn->master_secret, 48, "client finished",
-            hs_digest, SHA256_DIGEST_SIZE, verify_data, 12);
-
-    DBG("tls: verify[0..5]=%x %x %x %x %x %x",
-        verify_data[0], verify_data[1], verify_data[2],
-        verify_data[3], verify_data[4], verify_data[5]);
-
-    /* Send Finished (this goes encrypted now) */
-    if (tls_send_handshake(conn, TLS_HS_FINISHED, verify_data, 12) < 0)
-        return -1;
-
-    DBG("tls: client Finished sent");
-    return 0;
+    tls_derive_keys(conn);
+    return tls_send_finished(conn);
 }
 
-/* Receive server's ChangeCipherSpec + Finished */
+/* Receive [NewSessionTicket], the server's ChangeCipherSpec and
+ * Finished, and check its verify_data */
 static int tls_recv_server_finish(tls_conn_t *conn) {
-    uint8_t buf[256];
+    uint8_t *buf = malloc(TLS_RECV_BUF);
+    if (!buf) return -1;
     uint8_t type;
     size_t len;
+    int ret = -1;
+
+    /* A ticket comes before CCS, in the clear */
+    for (;;) {
+        if (tls_recv_record(conn, &type, buf, TLS_RECV_BUF, &len) < 0)
+            goto out;
+        if (type != TLS_HANDSHAKE || len < 4 ||
+            buf[0] != TLS_HS_NEW_SESSION_TICKET)
+            break;
+        uint32_t hs_len = get_be24(buf + 1);
+        if (4 + hs_len > len || tls_take_ticket(conn, buf + 4, hs_len) < 0)
+            goto out;
+        sha256_update(&conn->hs_hash, buf, 4 + hs_len);
+    }
 
     /* Expect ChangeCipherSpec */
-    if (tls_recv_record(conn, &type, buf, sizeof(buf), &len) < 0)
-        return -1;
     if (type == TLS_ALERT && len >= 2) {
         DBG("tls: server alert: level=%d desc=%d", buf[0], buf[1]);
-        return -1;
+        goto out;
     }
     if (type != TLS_CHANGE_CIPHER_SPEC) {
         DBG("tls: expected CCS, got type %d", type);
-        return -1;
+        goto out;
     }
 
     conn->server_encrypted = 1;
     conn->server_seq = 0;
 
     /* Expect Finished */
-    if (tls_recv_record(conn, &type, buf, sizeof(buf), &len) < 0)
-        return -1;
-    if (type != TLS_HANDSHAKE || len < 4) {
+    if (tls_recv_record(conn, &type, buf, TLS_RECV_BUF, &len) < 0)
+        goto out;
+    if (type != TLS_HANDSHAKE || len < 4 + 12) {
         DBG("tls: expected Finished, got type %d len %u", type, (unsigned)len);
-        return -1;
+        goto out;
     }
-    if (buf[0] != TLS_HS_FINISHED) {
+    if (buf[0] != TLS_HS_FINISHED || get_be24(buf + 1) != 12) {
         DBG("tls: expected Finished handshake, got %d", buf[0]);
-        return -1;
+        goto out;
     }
 
+    /* verify_data = PRF(master_secret, "server finished", Hash(handshake)).
+     * On resumption this is all that proves the server holds the
+     * session's master secret. */
+    sha256_ctx_t hash_copy = conn->hs_hash;
+    uint8_t hs_digest[SHA256_DIGEST_SIZE];
+    sha256_final(&hash_copy, hs_digest);
+    uint8_t verify_data[12];
+    tls_prf(conn->master_secret, 48, "server finished",
+            hs_digest, SHA256_DIGEST_SIZE, verify_data, 12);
+    if (memcmp(verify_data, buf + 4, 12) != 0) {
+        DBG("tls: server Finished does not verify");
+        goto out;
+    }
+
+    /* Our Finished follows the server's in an abbreviated handshake */
+    sha256_update(&conn->hs_hash, buf, 4 + 12);
+
     DBG("tls: handshake complete!");
-    return 0;
+    ret = 0;
+out:
+    free(buf);
+    return ret;
 }
 
 /* ── Public API ──────────────────────────────────────────────── */
 
-int tls_connect(tls_conn_t *conn, int sock_fd, const char *hostname) {
-    memset(conn, 0, sizeof(tls_conn_t));
-    conn->sock_fd = sock_fd;
-    sha256_init(&conn->hs_hash);
-
-    DBG("tls: starting handshake with %s", hostname);
-
+static int tls_handshake(tls_conn_t *conn, const char *hostname) {
     /* ClientHello */
     if (tls_send_client_hello(conn, hostname) < 0) {
         DBG("tls: FAILED at ClientHello send");
         return -1;
     }
 
-    /* ServerHello + Certificate + ServerHelloDone */
+    /* ServerHello + Certificate + ServerHelloDone, or just ServerHello
+     * when resuming */
     if (tls_recv_server_hello(conn) < 0) {
         DBG("tls: FAILED at ServerHello/Certificate");
         return -2;
     }
 
+    if (conn->resumed) {
+        /* Abbreviated: the server finishes first, keys come from the
+         * cached master secret and the fresh randoms */
+        tls_derive_keys(conn);
+        if (tls_recv_server_finish(conn) < 0) {
+            DBG("tls: FAILED at ServerFinish (resumed)");
+            return -4;
+        }
+        if (tls_send_finished(conn) < 0) {
+            DBG("tls: FAILED at ClientFinish (resumed)");
+            return -3;
+        }
+        return 0;
+    }
+
     /* ClientKeyExchange + CCS + Finished */
     if (tls_send_client_finish(conn) < 0) {
         DBG("tls: FAILED at ClientFinish");
@@ -831,11 +1215,39 @@ int tls_connect(tls_conn_t *conn, int sock_fd, const char *hostname) {
         DBG("tls: FAILED at ServerFinish");
         return -4;
     }
-
-    conn->established = 1;
     return 0;
 }
 
+int tls_connect(tls_conn_t *conn, int sock_fd, const char *hostname, uint16_t port) {
+    memset(conn, 0, sizeof(tls_conn_t));
+    conn->sock_fd = sock_fd;
+    sha256_init(&conn->hs_hash);
+
+    DBG("tls: starting handshake with %s:%u", hostname, port);
+
+    session_load(conn, hostname, port);
+    int rc = tls_handshake(conn, hostname);
+
+    if (rc == 0) {
+        if (conn->resumed)
+            tls_stats.resumed++;
+        else
+            tls_stats.full++;
+        if (conn->resuming && !conn->resumed)
+            tls_stats.rejected++;
+        session_store(conn, hostname, port);
+        conn->established = 1;
+    } else if (conn->resuming) {
+        /* Don't offer a session that ended in a failed handshake */
+        session_forget(hostname, port);
+    }
+
+    free(conn->ticket);
+    conn->ticket = NULL;
+    conn->ticket_len = 0;
+    return rc;
+}
+
 int tls_send(tls_conn_t *conn, const uint8_t *data, size_t len) {
     if (!conn->established) return -1;
     return tls_send_record(conn, TLS_APPLICATION_DATA, data, len);
@@ -927,13 +1339,14 @@ int https_get(const char *host, uint16_t port, const char *path,
     }
 
     printf("TLS handshake...\n");
-    if (tls_connect(tls, sock, host) < 0) {
+    if (tls_connect(tls, sock, host, port) < 0) {
         printf("TLS handshake failed\n");
         free(tls);
         socket_close(sock);
         return -1;
     }
-    printf("TLS established\n");
+    printf(tls->resumed ? "TLS established (session resumed)\n"
+                        : "TLS established\n");
 
     /* Send HTTP/1.0 GET request */
     char req[512];
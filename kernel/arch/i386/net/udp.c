@@ -1,8 +1,11 @@
 #include <kernel/udp.h>
 #include <kernel/ip.h>
+#include <kernel/netbuf.h>
 #include <kernel/net.h>
 #include <kernel/idt.h>
 #include <kernel/endian.h>
+#include <kernel/checksum.h>
+#include <kernel/io.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -53,58 +56,33 @@ void udp_unbind(uint16_t port) {
     }
 }
 
-static uint16_t udp_checksum(const uint8_t src_ip[4], const uint8_t dst_ip[4],
-                              const uint8_t* udp_pkt, size_t udp_len) {
-    uint32_t sum = 0;
-
-    /* Build pseudo-header as raw bytes in network order, then sum as uint16_t
-     * to stay consistent with how the packet data is summed */
-    uint8_t pseudo[12];
-    memcpy(pseudo, src_ip, 4);
-    memcpy(pseudo + 4, dst_ip, 4);
-    pseudo[8] = 0;
-    pseudo[9] = 17; /* protocol UDP */
-    pseudo[10] = (udp_len >> 8) & 0xFF;
-    pseudo[11] = udp_len & 0xFF;
-
-    const uint16_t* pw = (const uint16_t*)pseudo;
-    for (int i = 0; i < 6; i++) sum += pw[i];
-
-    /* UDP header + data */
-    const uint16_t* words = (const uint16_t*)udp_pkt;
-    size_t remaining = udp_len;
-    while (remaining > 1) {
-        sum += *words++;
-        remaining -= 2;
-    }
-    if (remaining == 1)
-        sum += *(const uint8_t*)words;
-
-    while (sum >> 16)
-        sum = (sum & 0xFFFF) + (sum >> 16);
-
-    uint16_t result = ~sum;
-    return result == 0 ? 0xFFFF : result;
-}
-
 int udp_send(const uint8_t dst_ip[4], uint16_t dst_port, uint16_t src_port,
              const uint8_t* data, size_t len) {
     if (len > UDP_MAX_PAYLOAD) return -1;
 
-    uint8_t packet[sizeof(udp_header_t) + UDP_MAX_PAYLOAD];
-    udp_header_t* hdr = (udp_header_t*)packet;
-    size_t total = sizeof(udp_header_t) + len;
+    netbuf_t* nb = netbuf_alloc();
+    if (!nb) return -1;
+
+    /* Payload first, then the header in front of it */
+    if (len > 0)
+        memcpy(netbuf_put(nb, len), data, len);
+    udp_header_t* hdr = (udp_header_t*)netbuf_push(nb, sizeof(udp_header_t));
 
     hdr->src_port = htons(src_port);
     hdr->dst_port = htons(dst_port);
-    hdr->length   = htons(total);
+    hdr->length   = htons(nb->len);
     hdr->checksum = 0;
-    memcpy(packet + sizeof(udp_header_t), data, len);
 
+    /* Loopback packets never reach a wire; 0 means "no checksum".  The
+     * rest is finished by the NIC or net_send_netbuf(). */
     net_config_t* cfg = net_get_config();
-    hdr->checksum = udp_checksum(cfg->ip, dst_ip, packet, total);
+    if (!net_is_local(dst_ip)) {
+        hdr->checksum = csum_fold(csum_pseudo(cfg->ip, dst_ip, IP_PROTOCOL_UDP,
+                                              (uint16_t)nb->len));
+        netbuf_csum_partial(nb, (uint8_t*)hdr, offsetof(udp_header_t, checksum));
+    }
 
-    return ip_send_packet(dst_ip, IP_PROTOCOL_UDP, packet, total);
+    return ip_send_netbuf(dst_ip, IP_PROTOCOL_UDP, nb);
 }
 
 int udp_recv(uint16_t port, uint8_t* buf, size_t* len,
@@ -122,8 +100,7 @@ int udp_recv(uint16_t port, uint8_t* buf, size_t* len,
     uint32_t timeout_ticks = timeout_ms * 120 / 1000;
 
     while (1) {
-        /* Process incoming packets */
-        net_process_packets();
+        uint32_t seq = net_wait_seq();
 
         if (b->count > 0) {
             udp_packet_t* pkt = &b->ring[b->tail];
@@ -133,13 +110,17 @@ int udp_recv(uint16_t port, uint8_t* buf, size_t* len,
             *len = copy;
             if (src_ip) memcpy(src_ip, pkt->src_ip, 4);
             if (src_port) *src_port = pkt->src_port;
+            uint32_t flags = irq_save();
             b->tail = (b->tail + 1) % UDP_RING_SIZE;
             b->count--;
+            irq_restore(flags);
             return 0;
         }
 
-        if (pit_get_ticks() - start >= timeout_ticks)
+        uint32_t waited = pit_get_ticks() - start;
+        if (waited >= timeout_ticks)
             return -1; /* timeout */
+        net_wait(seq, timeout_ticks - waited);
     }
 }
 
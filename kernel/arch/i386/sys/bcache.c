@@ -0,0 +1,450 @@
+/*
+ * bcache.c — Block cache for imposfs
+ *
+ * Data blocks are no longer mirrored in RAM at mount.  Instead a bounded
+ * set of 4KB buffers caches the blocks in use: a hash maps block number to
+ * buffer, misses are read from the ATA disk, and when the cache is at its
+ * limit a CLOCK sweep picks an unpinned victim, writing it back first if
+ * it is dirty.
+ *
+ * Buffers are pinned between bcache_read()/bcache_zero() and
+ * bcache_release(), so pointers into block data stay valid while a caller
+ * walks extent blocks or directory blocks.
+ *
+ * With no disk the filesystem lives only in RAM: dirty blocks have nowhere
+ * to go, so they are never evicted and the cache simply grows.
+ *
+ * bcache_flush() writes dirty blocks in block order and merges runs of
+ * adjacent blocks into one multi-sector request through a staging buffer.
+ * bcache_prefetch() does the same for reads of a file's contiguous extents.
+ */
+
+#include <kernel/bcache.h>
+#include <kernel/fs.h>
+#include <kernel/ata.h>
+#include <kernel/virtio_blk.h>
+#include <kernel/pmm.h>
+#include <kernel/io.h>
+#include <string.h>
+
+#define BC_NONE 0xFFFFFFFFu
+
+static bcache_buf_t bufs[BCACHE_MAX_BUFS];
+static uint32_t hash_head[BCACHE_HASH_SIZE];
+static uint32_t free_list = BC_NONE;    /* entries with a buffer, not hashed */
+static uint32_t nr_bufs;                /* entries [0, nr_bufs) own a buffer */
+static uint32_t clock_hand;
+static uint32_t limit = BCACHE_DEFAULT_PAGES;
+static bcache_stats_t stats;
+
+static inline uint32_t hash_of(uint32_t block) {
+    return (block * 2654435761u) >> (32 - BCACHE_HASH_BITS);
+}
+
+/* ── Hash table ───────────────────────────────────────────────── */
+
+static uint32_t lookup(uint32_t block) {
+    uint32_t i = hash_head[hash_of(block)];
+    while (i != BC_NONE && bufs[i].block != block)
+        i = bufs[i].hash_next;
+    return i;
+}
+
+static void hash_insert(uint32_t i) {
+    uint32_t h = hash_of(bufs[i].block);
+    bufs[i].hash_next = hash_head[h];
+    hash_head[h] = i;
+    bufs[i].flags |= BC_HASHED;
+    stats.cached++;
+}
+
+static void hash_remove(uint32_t i) {
+    uint32_t *link = &hash_head[hash_of(bufs[i].block)];
+    while (*link != i)
+        link = &bufs[*link].hash_next;
+    *link = bufs[i].hash_next;
+    bufs[i].hash_next = BC_NONE;
+    if (bufs[i].flags & BC_DIRTY)
+        stats.dirty--;
+    bufs[i].flags = 0;
+    stats.cached--;
+}
+
+static void free_push(uint32_t i) {
+    bufs[i].hash_next = free_list;
+    free_list = i;
+}
+
+static void pin(bcache_buf_t *b) {
+    b->refcnt++;
+}
+
+/* ── Disk I/O ─────────────────────────────────────────────────── */
+
+static int writeback(uint32_t i) {
+    if (ata_write_sectors(bufs[i].block * SECTORS_PER_BLOCK,
+                          SECTORS_PER_BLOCK, bufs[i].data) != 0) {
+        stats.io_errors++;
+        return -1;
+    }
+    bufs[i].flags &= ~BC_DIRTY;
+    stats.dirty--;
+    stats.writebacks++;
+    stats.write_ops++;
+    return 0;
+}
+
+/* ── Buffer allocation ────────────────────────────────────────── */
+
+/* CLOCK sweep: skip pinned buffers, give referenced ones a second chance,
+ * write back dirty ones when there is a disk to write them to. */
+static uint32_t evict(void) {
+    if (nr_bufs == 0)
+        return BC_NONE;
+    int can_write = ata_is_available();
+
+    for (uint32_t n = 0; n < 2 * nr_bufs; n++) {
+        uint32_t i = clock_hand;
+        clock_hand = (clock_hand + 1) % nr_bufs;
+
+        bcache_buf_t *b = &bufs[i];
+        if (!(b->flags & BC_HASHED) || b->refcnt)
+            continue;
+        if (b->flags & BC_REF) {
+            b->flags &= ~BC_REF;
+            continue;
+        }
+        if (b->flags & BC_DIRTY) {
+            if (!can_write || writeback(i) != 0)
+                continue;
+        }
+        hash_remove(i);
+        stats.evictions++;
+        return i;
+    }
+    return BC_NONE;
+}
+
+static uint32_t new_buf(void) {
+    if (nr_bufs >= BCACHE_MAX_BUFS)
+        return BC_NONE;
+    uint32_t phys = pmm_alloc_frame();
+    if (!phys)
+        return BC_NONE;
+    bufs[nr_bufs].data = (uint8_t *)phys;
+    return nr_bufs++;
+}
+
+/* Find or allocate the entry for `block`.  The entry is hashed on return
+ * but its data is only valid if BC_VALID is set. */
+static bcache_buf_t *get_entry(uint32_t block) {
+    uint32_t i = lookup(block);
+    if (i != BC_NONE) {
+        stats.hits++;
+        return &bufs[i];
+    }
+    stats.misses++;
+
+    if (free_list != BC_NONE) {
+        i = free_list;
+        free_list = bufs[i].hash_next;
+    } else if (stats.cached < limit) {
+        i = new_buf();
+        if (i == BC_NONE)
+            i = evict();
+    } else {
+        i = evict();
+        if (i == BC_NONE)
+            i = new_buf();  /* everything pinned or unwritable: grow */
+    }
+    if (i == BC_NONE) {
+        DBG("[BCACHE] no buffer for block %u (%u cached)", block, stats.cached);
+        return NULL;
+    }
+
+    bufs[i].block = block;
+    bufs[i].refcnt = 0;
+    bufs[i].flags = 0;
+    hash_insert(i);
+    return &bufs[i];
+}
+
+/* ── Public API ───────────────────────────────────────────────── */
+
+void bcache_init(uint32_t max_pages) {
+    for (uint32_t h = 0; h < BCACHE_HASH_SIZE; h++)
+        hash_head[h] = BC_NONE;
+    free_list = BC_NONE;
+    for (uint32_t i = nr_bufs; i-- > 0; ) {
+        bufs[i].flags = 0;
+        bufs[i].refcnt = 0;
+        free_push(i);
+    }
+    clock_hand = 0;
+    memset(&stats, 0, sizeof(stats));
+    bcache_set_limit(max_pages);
+}
+
+void bcache_set_limit(uint32_t max_pages) {
+    if (max_pages == 0)
+        max_pages = 1;
+    if (max_pages > BCACHE_MAX_BUFS)
+        max_pages = BCACHE_MAX_BUFS;
+    limit = max_pages;
+}
+
+bcache_buf_t *bcache_read(uint32_t block) {
+    bcache_buf_t *b = get_entry(block);
+    if (!b)
+        return NULL;
+    if (!(b->flags & BC_VALID)) {
+        if (ata_is_available()) {
+            if (ata_read_sectors(block * SECTORS_PER_BLOCK,
+                                 SECTORS_PER_BLOCK, b->data) != 0) {
+                stats.io_errors++;
+                uint32_t i = (uint32_t)(b - bufs);
+                hash_remove(i);
+                free_push(i);
+                return NULL;
+            }
+            stats.read_ops++;
+        } else {
+            memset(b->data, 0, BLOCK_SIZE);
+        }
+        b->flags |= BC_VALID;
+    }
+    pin(b);
+    b->flags |= BC_REF;
+    return b;
+}
+
+bcache_buf_t *bcache_zero(uint32_t block) {
+    bcache_buf_t *b = bcache_getblk(block);
+    if (!b)
+        return NULL;
+    memset(b->data, 0, BLOCK_SIZE);
+    bcache_dirty(b);
+    return b;
+}
+
+bcache_buf_t *bcache_getblk(uint32_t block) {
+    bcache_buf_t *b = get_entry(block);
+    if (!b)
+        return NULL;
+    b->flags |= BC_VALID | BC_REF;
+    pin(b);
+    return b;
+}
+
+void bcache_dirty(bcache_buf_t *b) {
+    if (!(b->flags & BC_DIRTY)) {
+        b->flags |= BC_DIRTY;
+        stats.dirty++;
+    }
+}
+
+void bcache_release(bcache_buf_t *b) {
+    if (!b || b->refcnt == 0)
+        return;
+    if (--b->refcnt == 0 && !(b->flags & BC_HASHED))
+        free_push((uint32_t)(b - bufs));  /* forgotten while pinned */
+}
+
+void bcache_forget(uint32_t block) {
+    uint32_t i = lookup(block);
+    if (i == BC_NONE)
+        return;
+    hash_remove(i);
+    /* A pinned buffer goes back to the free list on its last release */
+    if (bufs[i].refcnt == 0)
+        free_push(i);
+}
+
+/* ── Coalesced writeback ──────────────────────────────────────── */
+
+/* A run of adjacent dirty blocks written with one request */
+typedef struct {
+    uint32_t block;         /* first block of the run */
+    uint32_t count;
+    uint32_t idx[BCACHE_RUN_MAX];
+    int      id;            /* virtio request id, -1 when written synchronously */
+} bc_run_t;
+
+static uint32_t flush_map[NUM_BLOCKS / 32];    /* dirty blocks, by number */
+static uint8_t *stage[BCACHE_FLUSH_DEPTH];     /* BCACHE_RUN_MAX blocks each */
+static int stage_tried;
+
+static void stage_init(void) {
+    if (stage_tried)
+        return;
+    stage_tried = 1;
+    for (int s = 0; s < BCACHE_FLUSH_DEPTH; s++) {
+        uint32_t phys = pmm_alloc_contiguous(BCACHE_RUN_MAX);
+        if (!phys)
+            break;
+        stage[s] = (uint8_t *)phys;
+    }
+}
+
+/* Start writing a run.  The buffers are marked clean and pinned first, so
+ * a block dirtied again while the write is in flight is simply written
+ * again by the next flush. */
+static int run_submit(bc_run_t *r, uint8_t *stage_buf) {
+    uint8_t *src = bufs[r->idx[0]].data;
+    for (uint32_t k = 0; k < r->count; k++) {
+        bcache_buf_t *b = &bufs[r->idx[k]];
+        b->flags &= ~BC_DIRTY;
+        stats.dirty--;
+        pin(b);
+        if (r->count > 1)
+            memcpy(stage_buf + k * BLOCK_SIZE, b->data, BLOCK_SIZE);
+    }
+    if (r->count > 1)
+        src = stage_buf;
+
+    uint32_t lba = r->block * SECTORS_PER_BLOCK;
+    uint32_t sectors = r->count * SECTORS_PER_BLOCK;
+    stats.write_ops++;
+    if (virtio_blk_active()) {
+        r->id = virtio_blk_submit(lba, sectors, src, 1);
+        return r->id < 0 ? -1 : 0;
+    }
+    r->id = -1;
+    return ata_write_sectors(lba, sectors, src);
+}
+
+static void run_complete(bc_run_t *r, int ok) {
+    for (uint32_t k = 0; k < r->count; k++) {
+        bcache_buf_t *b = &bufs[r->idx[k]];
+        if (ok)
+            stats.writebacks++;
+        else if (b->flags & BC_HASHED)
+            bcache_dirty(b);        /* keep it for the next flush */
+        bcache_release(b);
+    }
+    if (!ok)
+        stats.io_errors++;
+}
+
+static int runs_wait(bc_run_t *runs, int n) {
+    int rc = 0;
+    for (int k = 0; k < n; k++) {
+        int ok = virtio_blk_wait(runs[k].id) == 0;
+        run_complete(&runs[k], ok);
+        if (!ok)
+            rc = -1;
+    }
+    return rc;
+}
+
+int bcache_flush(void) {
+    if (!ata_is_available())
+        return -1;
+    if (stats.dirty == 0)
+        return 0;
+    stage_init();
+
+    /* Index dirty buffers by block number so they come out in disk order */
+    memset(flush_map, 0, sizeof(flush_map));
+    for (uint32_t i = 0; i < nr_bufs; i++) {
+        if ((bufs[i].flags & (BC_HASHED | BC_DIRTY)) == (BC_HASHED | BC_DIRTY))
+            flush_map[bufs[i].block / 32] |= 1u << (bufs[i].block % 32);
+    }
+
+    bc_run_t runs[BCACHE_FLUSH_DEPTH];
+    int inflight = 0;
+    int rc = 0;
+
+    for (uint32_t w = 0; w < NUM_BLOCKS / 32; w++) {
+        while (flush_map[w]) {
+            uint32_t block = w * 32 + (uint32_t)__builtin_ctz(flush_map[w]);
+            if (inflight == BCACHE_FLUSH_DEPTH) {
+                rc |= runs_wait(runs, inflight);
+                inflight = 0;
+            }
+
+            /* Extend the run while the next block is dirty too */
+            bc_run_t *r = &runs[inflight];
+            uint32_t max = stage[inflight] ? BCACHE_RUN_MAX : 1;
+            r->block = block;
+            r->count = 0;
+            while (r->count < max && block < NUM_BLOCKS &&
+                   (flush_map[block / 32] & (1u << (block % 32)))) {
+                flush_map[block / 32] &= ~(1u << (block % 32));
+                r->idx[r->count++] = lookup(block);
+                block++;
+            }
+
+            if (run_submit(r, stage[inflight]) != 0) {
+                run_complete(r, 0);
+                rc = -1;
+            } else if (r->id < 0) {
+                run_complete(r, 1);
+            } else {
+                inflight++;
+            }
+        }
+    }
+    rc |= runs_wait(runs, inflight);
+    return rc;
+}
+
+/* ── Read-ahead ───────────────────────────────────────────────── */
+
+static uint8_t *ra_stage;       /* BCACHE_RUN_MAX blocks */
+static int ra_tried;
+
+/* Read the uncached blocks among [block, block+count) with one request per
+ * run of adjacent misses.  The blocks go in without a CLOCK reference, so
+ * ones that are never used are the first to be evicted again. */
+uint32_t bcache_prefetch(uint32_t block, uint32_t count) {
+    if (!ata_is_available() || count < 2)
+        return 0;
+    if (!ra_tried) {
+        ra_tried = 1;
+        uint32_t phys = pmm_alloc_contiguous(BCACHE_RUN_MAX);
+        ra_stage = phys ? (uint8_t *)phys : NULL;
+    }
+    if (!ra_stage)
+        return 0;
+    if (block + count > NUM_BLOCKS)
+        count = block < NUM_BLOCKS ? NUM_BLOCKS - block : 0;
+
+    uint32_t end = block + count, done = 0;
+    while (block < end) {
+        if (lookup(block) != BC_NONE) {
+            block++;
+            continue;
+        }
+        uint32_t n = 1;
+        while (n < BCACHE_RUN_MAX && block + n < end &&
+               lookup(block + n) == BC_NONE)
+            n++;
+
+        if (ata_read_sectors(block * SECTORS_PER_BLOCK,
+                             n * SECTORS_PER_BLOCK, ra_stage) != 0) {
+            stats.io_errors++;
+            break;
+        }
+        stats.read_ops++;
+        for (uint32_t k = 0; k < n; k++) {
+            /* get_entry counts a miss; the later bcache_read is the hit */
+            bcache_buf_t *b = get_entry(block + k);
+            if (!b)
+                break;
+            if (!(b->flags & BC_VALID)) {
+                memcpy(b->data, ra_stage + k * BLOCK_SIZE, BLOCK_SIZE);
+                b->flags |= BC_VALID;
+                stats.prefetched++;
+                done++;
+            }
+        }
+        block += n;
+    }
+    return done;
+}
+
+void bcache_get_stats(bcache_stats_t *out) {
+    *out = stats;
+    out->limit = limit;
+}
@@ -0,0 +1,185 @@
+/*
+ * dcache.c — Directory entry cache for imposfs
+ *
+ * Path resolution looks every component up in its parent directory.  The
+ * results are kept here, keyed by (parent inode, name), so hot paths like
+ * /bin or /lib resolve with hash lookups instead of directory block scans.
+ * Misses are cached too, as negative entries, since programs probe for
+ * files that don't exist (search paths, config fallbacks).
+ *
+ * fs.c keeps the cache coherent: adding a directory entry replaces any
+ * negative entry for the name, removing or renaming one invalidates it,
+ * and removing a directory purges everything looked up inside it so a
+ * reused inode number can't inherit stale names.  When the table is full
+ * a CLOCK sweep picks the victim.
+ */
+
+#include <kernel/dcache.h>
+#include <kernel/fs.h>
+#include <string.h>
+
+#define DC_NONE 0xFFFFu
+
+typedef struct {
+    uint32_t parent;
+    uint32_t ino;           /* DCACHE_NEGATIVE for a cached miss */
+    uint32_t hash;
+    uint16_t next;          /* bucket chain / free list link */
+    uint8_t  used;
+    uint8_t  ref;           /* CLOCK reference bit */
+    char     name[MAX_NAME_LEN];
+} dentry_t;
+
+static dentry_t dents[DCACHE_ENTRIES];
+static uint16_t hash_head[DCACHE_HASH_SIZE];
+static uint16_t free_list = DC_NONE;
+static uint32_t clock_hand;
+static dcache_stats_t stats;
+
+/* FNV-1a over the name, seeded with the parent inode */
+static uint32_t hash_of(uint32_t parent, const char *name) {
+    uint32_t h = 2166136261u ^ (parent * 2654435761u);
+    for (int i = 0; i < MAX_NAME_LEN && name[i]; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int name_eq(const char *a, const char *b) {
+    return strncmp(a, b, MAX_NAME_LEN) == 0;
+}
+
+/* ── Hash table ───────────────────────────────────────────────── */
+
+static uint16_t find(uint32_t parent, const char *name, uint32_t h) {
+    uint16_t i = hash_head[h & (DCACHE_HASH_SIZE - 1)];
+    while (i != DC_NONE) {
+        dentry_t *d = &dents[i];
+        if (d->hash == h && d->parent == parent && name_eq(d->name, name))
+            return i;
+        i = d->next;
+    }
+    return DC_NONE;
+}
+
+static void unhash(uint16_t i) {
+    dentry_t *d = &dents[i];
+    uint16_t *link = &hash_head[d->hash & (DCACHE_HASH_SIZE - 1)];
+    while (*link != DC_NONE && *link != i)
+        link = &dents[*link].next;
+    if (*link == i)
+        *link = d->next;
+
+    if (d->ino == DCACHE_NEGATIVE)
+        stats.negative--;
+    stats.entries--;
+    d->used = 0;
+    d->next = free_list;
+    free_list = i;
+}
+
+/* CLOCK sweep: referenced entries get a second chance */
+static uint16_t evict(void) {
+    for (uint32_t n = 0; n < 2 * DCACHE_ENTRIES; n++) {
+        uint16_t i = (uint16_t)clock_hand;
+        clock_hand = (clock_hand + 1) % DCACHE_ENTRIES;
+        if (!dents[i].used)
+            continue;
+        if (dents[i].ref) {
+            dents[i].ref = 0;
+            continue;
+        }
+        unhash(i);
+        stats.evictions++;
+        return i;
+    }
+    return DC_NONE;
+}
+
+/* ── Public API ───────────────────────────────────────────────── */
+
+void dcache_init(void) {
+    for (uint32_t h = 0; h < DCACHE_HASH_SIZE; h++)
+        hash_head[h] = DC_NONE;
+    free_list = DC_NONE;
+    for (uint32_t i = DCACHE_ENTRIES; i-- > 0; ) {
+        dents[i].used = 0;
+        dents[i].next = free_list;
+        free_list = (uint16_t)i;
+    }
+    clock_hand = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+int dcache_lookup(uint32_t parent, const char *name, uint32_t *ino) {
+    stats.lookups++;
+    uint16_t i = find(parent, name, hash_of(parent, name));
+    if (i == DC_NONE) {
+        stats.misses++;
+        return 0;
+    }
+    dents[i].ref = 1;
+    *ino = dents[i].ino;
+    if (dents[i].ino == DCACHE_NEGATIVE)
+        stats.neg_hits++;
+    else
+        stats.hits++;
+    return 1;
+}
+
+void dcache_insert(uint32_t parent, const char *name, uint32_t ino) {
+    if (name[0] == '\0')
+        return;
+    uint32_t h = hash_of(parent, name);
+    uint16_t i = find(parent, name, h);
+    if (i != DC_NONE)
+        unhash(i);
+
+    if (free_list != DC_NONE) {
+        i = free_list;
+        free_list = dents[i].next;
+    } else {
+        i = evict();
+        if (i == DC_NONE)
+            return;
+        free_list = dents[i].next;
+    }
+
+    dentry_t *d = &dents[i];
+    d->parent = parent;
+    d->ino = ino;
+    d->hash = h;
+    d->used = 1;
+    d->ref = 0;
+    strncpy(d->name, name, MAX_NAME_LEN - 1);
+    d->name[MAX_NAME_LEN - 1] = '\0';
+
+    uint16_t *head = &hash_head[h & (DCACHE_HASH_SIZE - 1)];
+    d->next = *head;
+    *head = i;
+    stats.entries++;
+    if (ino == DCACHE_NEGATIVE)
+        stats.negative++;
+}
+
+void dcache_invalidate(uint32_t parent, const char *name) {
+    uint16_t i = find(parent, name, hash_of(parent, name));
+    if (i != DC_NONE) {
+        unhash(i);
+        stats.invalidations++;
+    }
+}
+
+void dcache_purge_dir(uint32_t dir) {
+    for (uint16_t i = 0; i < DCACHE_ENTRIES; i++) {
+        if (dents[i].used && (dents[i].parent == dir || dents[i].ino == dir)) {
+            unhash(i);
+            stats.invalidations++;
+        }
+    }
+}
+
+void dcache_get_stats(dcache_stats_t *out) {
+    *out = stats;
+}
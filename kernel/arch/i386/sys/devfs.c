@@ -232,8 +232,8 @@ static int devfs_stat(void *priv, const char *path, inode_t *out)
     if (dev) {
         out->type = INODE_CHARDEV;
         out->mode = 0666;
-        out->blocks[0] = dev->major;
-        out->blocks[1] = dev->minor;
+        out->dev.major = dev->major;
+        out->dev.minor = dev->minor;
         return 0;
     }
 
@@ -31,6 +31,15 @@ static int elf_track_frame(task_info_t *t, uint32_t frame) {
     return 0;
 }
 
+/* Copy segment data into a (possibly highmem) user frame */
+static void elf_copy_to_frame(uint32_t frame, uint32_t off,
+                              const void *src, uint32_t len) {
+    uint8_t *page = kmap(frame);
+    if (!page) return;
+    memcpy(page + off, src, len);
+    kunmap(page);
+}
+
 /* ── ELF Detection ───────────────────────────────────────────── */
 
 int elf_detect(const uint8_t *data, size_t size) {
@@ -99,13 +108,17 @@ uint32_t elf_load_interp(uint32_t pd, const char *path, uint32_t base,
             uint32_t existing = vmm_get_pte(pd, va);
             if (existing & PTE_PRESENT) continue;
 
-            uint32_t frame = pmm_alloc_frame();
+            uint32_t frame = pmm_alloc_frame_high();
             if (!frame) {
                 printf("elf_load_interp: OOM at 0x%x\n", va);
                 free(file_data);
                 return 0;
             }
-            memset((void *)frame, 0, PAGE_SIZE);
+            if (vmm_zero_frame(frame) != 0) {
+                pmm_free_frame(frame);
+                free(file_data);
+                return 0;
+            }
 
             uint32_t pte_flags = PTE_PRESENT | PTE_USER;
             if (phdr[i].p_flags & PF_W)
@@ -139,7 +152,7 @@ uint32_t elf_load_interp(uint32_t pd, const char *path, uint32_t base,
             if (copy_len > 0) {
                 uint32_t src_off = (va < vaddr) ? offset : offset + (va - vaddr);
                 if (src_off + copy_len <= file_size)
-                    memcpy((void *)(frame + copy_start), file_data + src_off, copy_len);
+                    elf_copy_to_frame(frame, copy_start, file_data + src_off, copy_len);
             }
         }
 
@@ -271,12 +284,15 @@ int elf_run_argv(const char *filename, int argc, const char **argv) {
 
         /* Allocate and map pages for this segment */
         for (uint32_t va = seg_start; va < seg_end; va += PAGE_SIZE) {
-            uint32_t frame = pmm_alloc_frame();
+            uint32_t frame = pmm_alloc_frame_high();
             if (!frame) {
                 printf("elf: out of physical memory\n");
                 goto fail;
             }
-            memset((void *)frame, 0, PAGE_SIZE);
+            if (vmm_zero_frame(frame) != 0) {
+                pmm_free_frame(frame);
+                goto fail;
+            }
 
             uint32_t pte_flags = PTE_PRESENT | PTE_USER;
             if (phdr[i].p_flags & PF_W)
@@ -319,7 +335,7 @@ int elf_run_argv(const char *filename, int argc, const char **argv) {
                     src_off = offset + (va - vaddr);
 
                 if (src_off + copy_len <= file_size)
-                    memcpy((void *)(frame + copy_start), file_data + src_off, copy_len);
+                    elf_copy_to_frame(frame, copy_start, file_data + src_off, copy_len);
             }
         }
 
@@ -791,9 +807,12 @@ int elf_exec(int tid, const char *filename, int argc, const char **argv) {
         uint32_t seg_end = align_up(vaddr + memsz, PAGE_SIZE);
 
         for (uint32_t va = seg_start; va < seg_end; va += PAGE_SIZE) {
-            uint32_t frame = pmm_alloc_frame();
+            uint32_t frame = pmm_alloc_frame_high();
             if (!frame) goto exec_fail;
-            memset((void *)frame, 0, PAGE_SIZE);
+            if (vmm_zero_frame(frame) != 0) {
+                pmm_free_frame(frame);
+                goto exec_fail;
+            }
 
             uint32_t pte_flags = PTE_PRESENT | PTE_USER;
             if (phdr[i].p_flags & PF_W) pte_flags |= PTE_WRITABLE;
@@ -823,7 +842,7 @@ int elf_exec(int tid, const char *filename, int argc, const char **argv) {
             if (copy_len > 0) {
                 uint32_t src_off = (va < vaddr) ? offset : offset + (va - vaddr);
                 if (src_off + copy_len <= file_size)
-                    memcpy((void *)(frame + copy_start), file_data + src_off, copy_len);
+                    elf_copy_to_frame(frame, copy_start, file_data + src_off, copy_len);
             }
         }
 
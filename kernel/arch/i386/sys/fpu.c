@@ -0,0 +1,41 @@
+/*
+ * fpu.c — CPU feature query and FPU/SSE use from kernel code
+ *
+ * The kernel is built without SSE and the scheduler doesn't save XMM
+ * state, so vector code (AES-NI, the ChaCha20 SSE2 path) runs with
+ * interrupts off and the interrupted context's registers parked in a
+ * single fxsave area.  Callers keep each stretch short.
+ */
+
+#include <kernel/fpu.h>
+#include <kernel/io.h>
+
+static uint64_t features;
+static int features_ready;
+
+int cpu_has(uint64_t mask) {
+    if (!features_ready) {
+        uint32_t a = 1, b, c = 0, d;
+        __asm__ volatile("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+        features = (uint64_t)c << 32 | d;
+        features_ready = 1;
+    }
+    return (features & mask) == mask;
+}
+
+static uint8_t fpu_save[512] __attribute__((aligned(16)));
+
+uint32_t kernel_fpu_begin(void) {
+    uint32_t flags = irq_save();
+    __asm__ volatile("fxsave %0" : "=m"(fpu_save));
+    return flags;
+}
+
+/* target("sse2") lets the clobber list name the XMM registers */
+__attribute__((target("sse2")))
+void kernel_fpu_end(uint32_t flags) {
+    __asm__ volatile("fxrstor %0" : : "m"(fpu_save)
+                     : "xmm0", "xmm1", "xmm2", "xmm3",
+                       "xmm4", "xmm5", "xmm6", "xmm7");
+    irq_restore(flags);
+}
@@ -1,17 +1,16 @@
 /*
  * frame_ref.c — Physical frame reference counting for COW fork
  *
- * One byte per frame (65536 frames = 256MB / 4KB). Saturates at 255 to
+ * One byte per frame (PMM_MAX_FRAMES = 4GB / 4KB). Saturates at 255 to
  * prevent overflow — a saturated frame is never freed (minor leak is safer
  * than use-after-free).
  */
 
 #include <kernel/frame_ref.h>
 #include <kernel/vmm.h>
+#include <kernel/pmm.h>
 #include <string.h>
 
-#define PMM_MAX_FRAMES  65536
-
 static uint8_t refcounts[PMM_MAX_FRAMES];
 
 void frame_ref_init(void) {
@@ -7,30 +7,68 @@ extern void procfs_init(void);
 extern void devfs_init(void);
 extern void tmpfs_init(void);
 #include <kernel/ata.h>
+#include <kernel/bcache.h>
+#include <kernel/dcache.h>
 #include <kernel/user.h>
 #include <kernel/group.h>
 #include <kernel/rtc.h>
 #include <kernel/crypto.h>
 #include <kernel/io.h>
+#include <kernel/idt.h>
+#include <kernel/task.h>
+#include <kernel/sched.h>
+#include <kernel/waitq.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 
 static superblock_t sb;
 static inode_t inodes[NUM_INODES];
-static uint8_t *data_blocks = NULL;
-#define BLOCK_PTR(i) (data_blocks + (size_t)(i) * BLOCK_SIZE)
+
+/* Data blocks live in the block cache (bcache.c): pin with bcache_read(),
+ * bcache_zero() or bcache_getblk(), unpin with bcache_release(). */
 
 static int fs_dirty = 0;
 
 /* Bitmaps are standalone arrays (too large for superblock in FS v4) */
 static uint8_t inode_bitmap[NUM_INODES / 8];     /* 512 bytes */
 static uint8_t block_bitmap[NUM_BLOCKS / 8];     /* 8192 bytes */
-static uint8_t dirty_bitmap[NUM_BLOCKS / 8];     /* 8192 bytes */
 
 static uint32_t fs_rd_ops = 0, fs_rd_bytes = 0;
 static uint32_t fs_wr_ops = 0, fs_wr_bytes = 0;
 
+/* Metadata as last written to disk.  fs_sync() compares each block of the
+ * superblock, bitmaps and inode table against it and writes only the
+ * blocks that changed, merging neighbours into one request. */
+static superblock_t disk_sb;
+static inode_t disk_inodes[NUM_INODES];
+static uint8_t disk_inode_bitmap[NUM_INODES / 8];
+static uint8_t disk_block_bitmap[NUM_BLOCKS / 8];
+static int disk_meta_valid = 0;     /* 0: disk contents unknown, write all */
+static uint32_t fs_meta_writes = 0;
+static volatile uint32_t fs_clean_tick;    /* time of the last complete sync */
+
+/* Inodes, bitmaps, the superblock and the block cache are changed with
+ * interrupts enabled, so every public entry point holds the filesystem
+ * lock; fs_sync() holds it for the whole writeback.  It is recursive,
+ * so entry points may call each other. */
+static kmutex_t fs_lock = KMUTEX_INIT;
+
+static void fs_unlock_scope(int *locked) {
+    if (*locked == 0)
+        kmutex_unlock(&fs_lock);
+}
+
+/* Take the filesystem lock until the enclosing block is left.  System
+ * calls wait for it like everyone else; only kernel code that disabled
+ * interrupts itself finds it busy and returns `fail` instead. */
+#define FS_LOCKED(fail) \
+    int fs_locked_ __attribute__((cleanup(fs_unlock_scope))) = \
+        kmutex_lock(&fs_lock); \
+    if (fs_locked_ != 0) \
+        return fail
+
 
 static void local_strncpy(char* dst, const char* src, size_t n) {
     size_t i;
@@ -70,10 +108,6 @@ static int bitmap_test(const uint8_t* map, uint32_t bit) {
     return (map[bit / 8] >> (bit % 8)) & 1;
 }
 
-static void mark_dirty(uint32_t block) {
-    bitmap_set(dirty_bitmap, block);
-}
-
 /* ---- permission check ---- */
 
 static int check_permission(inode_t* node, int required) {
@@ -112,136 +146,599 @@ static int alloc_inode(void) {
     return -1;
 }
 
-static int alloc_block(void) {
-    /* Skip metadata blocks (0 through DISK_METADATA_BLOCKS-1) */
-    for (uint32_t i = DISK_METADATA_BLOCKS; i < NUM_BLOCKS; i++) {
-        if (!bitmap_test(block_bitmap, i)) {
-            bitmap_set(block_bitmap, i);
-            memset(BLOCK_PTR(i), 0, BLOCK_SIZE);
-            mark_dirty(i);
-            fs_dirty = 1;
-            return (int)i;
+static void free_inode(int idx) {
+    if (inodes[idx].type == INODE_DIR)
+        dcache_purge_dir((uint32_t)idx);
+    bitmap_clear(inode_bitmap, idx);
+    inodes[idx].type = INODE_FREE;
+    fs_dirty = 1;
+}
+
+/* ---- free-extent index ----
+ *
+ * block_bitmap remains the on-disk record of which blocks are in use.  In
+ * memory, free space is also kept as an array of free extents sorted by
+ * start block, so an allocation finds a run at or after its goal with a
+ * binary search instead of scanning the bitmap. */
+
+typedef struct {
+    uint32_t start;
+    uint32_t len;
+} free_extent_t;
+
+#define FREE_EXT_MAX   (NUM_BLOCKS / 2 + 1)  /* worst case: every other block free */
+#define ALLOC_SCAN     16   /* extents examined for one that fits a request */
+#define ALLOC_SLACK    16   /* blocks left free after another file's data */
+
+static free_extent_t free_ext[FREE_EXT_MAX];
+static uint32_t free_ext_count;
+static uint32_t free_block_total;
+
+/* Index of the last free extent starting at or before `block`, or -1 */
+static int fx_find(uint32_t block) {
+    int lo = 0, hi = (int)free_ext_count - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (free_ext[mid].start <= block) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
         }
     }
-    return -1;
+    return found;
 }
 
-static void free_inode(int idx) {
-    bitmap_clear(inode_bitmap, idx);
-    inodes[idx].type = INODE_FREE;
+static void fx_insert(uint32_t i, uint32_t start, uint32_t len) {
+    memmove(&free_ext[i + 1], &free_ext[i],
+            (free_ext_count - i) * sizeof(free_extent_t));
+    free_ext[i].start = start;
+    free_ext[i].len = len;
+    free_ext_count++;
+}
+
+static void fx_remove(uint32_t i) {
+    memmove(&free_ext[i], &free_ext[i + 1],
+            (free_ext_count - i - 1) * sizeof(free_extent_t));
+    free_ext_count--;
+}
+
+/* Rebuild the index from block_bitmap after mount or format */
+static void fx_build(void) {
+    free_ext_count = 0;
+    free_block_total = 0;
+    uint32_t b = DISK_METADATA_BLOCKS;
+    while (b < NUM_BLOCKS) {
+        if (b % 8 == 0 && block_bitmap[b / 8] == 0xFF) { b += 8; continue; }
+        if (bitmap_test(block_bitmap, b)) { b++; continue; }
+        uint32_t start = b;
+        while (b < NUM_BLOCKS) {
+            if (b % 8 == 0 && b + 8 <= NUM_BLOCKS && block_bitmap[b / 8] == 0) { b += 8; continue; }
+            if (bitmap_test(block_bitmap, b)) break;
+            b++;
+        }
+        free_ext[free_ext_count].start = start;
+        free_ext[free_ext_count].len = b - start;
+        free_ext_count++;
+        free_block_total += b - start;
+    }
+}
+
+/* Remove [start, start+len) from free extent i, which contains it */
+static void fx_take(uint32_t i, uint32_t start, uint32_t len) {
+    free_extent_t *e = &free_ext[i];
+    uint32_t end = e->start + e->len;
+    if (start == e->start) {
+        e->start += len;
+        e->len -= len;
+        if (e->len == 0)
+            fx_remove(i);
+    } else if (start + len == end) {
+        e->len -= len;
+    } else {
+        e->len = start - e->start;
+        fx_insert(i + 1, start + len, end - (start + len));
+    }
+    free_block_total -= len;
+}
+
+/* Return [start, start+len) to the index, merging with its neighbours */
+static void fx_release(uint32_t start, uint32_t len) {
+    int prev = fx_find(start);
+    uint32_t next = (uint32_t)(prev + 1);
+    int join_prev = prev >= 0 && free_ext[prev].start + free_ext[prev].len == start;
+    int join_next = next < free_ext_count && free_ext[next].start == start + len;
+
+    if (join_prev && join_next) {
+        free_ext[prev].len += len + free_ext[next].len;
+        fx_remove(next);
+    } else if (join_prev) {
+        free_ext[prev].len += len;
+    } else if (join_next) {
+        free_ext[next].start = start;
+        free_ext[next].len += len;
+    } else {
+        fx_insert(next, start, len);
+    }
+    free_block_total += len;
+}
+
+/* Allocate up to `want` contiguous blocks at or after `goal`.  When the
+ * goal is taken, the first of the next ALLOC_SCAN free extents big enough
+ * for the whole request wins, starting ALLOC_SLACK blocks in when it is
+ * roomy so the file that ends just before it can still grow in place.
+ * The blocks still hold whatever was on disk; the caller zeroes or
+ * overwrites them.  Returns the first block and sets *got, or -1 when
+ * the disk is full. */
+static int alloc_blocks(uint32_t goal, uint32_t want, uint32_t *got) {
+    if (free_ext_count == 0 || want == 0)
+        return -1;
+    if (want > EXTENT_MAX_LEN)
+        want = EXTENT_MAX_LEN;
+    if (goal < DISK_METADATA_BLOCKS || goal >= NUM_BLOCKS)
+        goal = DISK_METADATA_BLOCKS;
+
+    int f = fx_find(goal);
+    uint32_t i, start;
+    if (f >= 0 && goal < free_ext[f].start + free_ext[f].len) {
+        i = (uint32_t)f;
+        start = goal;
+    } else {
+        uint32_t first = (uint32_t)(f + 1) < free_ext_count ? (uint32_t)(f + 1) : 0;
+        i = first;
+        for (uint32_t k = 0, j = first; k < ALLOC_SCAN && k < free_ext_count; k++) {
+            if (free_ext[j].len >= want) {
+                i = j;
+                break;
+            }
+            if (++j == free_ext_count)
+                j = 0;
+        }
+        start = free_ext[i].start;
+        if (free_ext[i].len >= want + 2 * ALLOC_SLACK)
+            start += ALLOC_SLACK;
+    }
+
+    uint32_t n = free_ext[i].start + free_ext[i].len - start;
+    if (n > want)
+        n = want;
+    for (uint32_t k = 0; k < n; k++)
+        bitmap_set(block_bitmap, start + k);
+    fx_take(i, start, n);
     fs_dirty = 1;
+    *got = n;
+    return (int)start;
 }
 
-static void free_block(int idx) {
-    if (idx < (int)DISK_METADATA_BLOCKS) return; /* never free metadata blocks */
-    bitmap_clear(block_bitmap, idx);
+/* Free a run of blocks.  Blocks that are already free are skipped so a
+ * bad pointer cannot corrupt the index. */
+static void free_blocks(uint32_t start, uint32_t len) {
+    uint32_t run = 0, b;
+    for (b = start; b < start + len && b < NUM_BLOCKS; b++) {
+        if (b < DISK_METADATA_BLOCKS || !bitmap_test(block_bitmap, b)) {
+            if (run) fx_release(b - run, run);
+            run = 0;
+            continue;
+        }
+        bitmap_clear(block_bitmap, b);
+        bcache_forget(b);
+        run++;
+    }
+    if (run)
+        fx_release(b - run, run);
     fs_dirty = 1;
 }
 
-/* ---- block addressing helpers (direct / single-indirect / double-indirect) ---- */
-
-/* Get the physical block number for a logical file block index.
- * Returns 0 if the block is a hole (not allocated). */
-static uint32_t get_block_at(inode_t *node, uint32_t logical_block) {
-    /* Direct blocks */
-    if (logical_block < DIRECT_BLOCKS) {
-        if (logical_block >= node->num_blocks) return 0;
-        return node->blocks[logical_block];
-    }
-
-    /* Single-indirect */
-    uint32_t ind_offset = logical_block - DIRECT_BLOCKS;
-    if (ind_offset < INDIRECT_PTRS) {
-        if (node->indirect_block == 0) return 0;
-        uint32_t *ptrs = (uint32_t *)BLOCK_PTR(node->indirect_block);
-        return ptrs[ind_offset];
-    }
-
-    /* Double-indirect */
-    uint32_t dbl_offset = ind_offset - INDIRECT_PTRS;
-    if (node->double_indirect == 0) return 0;
-    uint32_t *l1 = (uint32_t *)BLOCK_PTR(node->double_indirect);
-    uint32_t l1_idx = dbl_offset / INDIRECT_PTRS;
-    uint32_t l2_idx = dbl_offset % INDIRECT_PTRS;
-    if (l1_idx >= INDIRECT_PTRS) return 0;
-    if (l1[l1_idx] == 0) return 0;
-    uint32_t *l2 = (uint32_t *)BLOCK_PTR(l1[l1_idx]);
-    return l2[l2_idx];
-}
-
-/* Allocate (if needed) the physical block for a logical file block index.
- * Returns physical block number, or -1 on failure.
- * Creates indirect chain blocks as needed. */
-static int alloc_block_at(inode_t *node, uint32_t logical_block) {
-    /* Direct blocks */
-    if (logical_block < DIRECT_BLOCKS) {
-        if (logical_block < node->num_blocks && node->blocks[logical_block] != 0) {
-            return (int)node->blocks[logical_block];
+static void free_block(uint32_t blk) {
+    free_blocks(blk, 1);
+}
+
+/* Allocate a single block, zeroed and dirty in the cache */
+static int alloc_block(uint32_t goal) {
+    uint32_t got;
+    int blk = alloc_blocks(goal, 1, &got);
+    if (blk < 0)
+        return -1;
+    bcache_buf_t *b = bcache_zero((uint32_t)blk);
+    if (!b) {
+        free_block((uint32_t)blk);
+        return -1;
+    }
+    bcache_release(b);
+    return blk;
+}
+
+/* ---- block I/O helpers ---- */
+
+/* Copy `len` bytes at `off` out of / into a data block through the cache.
+ * A NULL `src` zeroes the range.  Both return 0 or -1 on I/O error. */
+static int block_read_bytes(uint32_t blk, uint32_t off, void *dst, uint32_t len) {
+    bcache_buf_t *b = bcache_read(blk);
+    if (!b) return -1;
+    memcpy(dst, b->data + off, len);
+    bcache_release(b);
+    return 0;
+}
+
+static int block_write_bytes(uint32_t blk, uint32_t off, const void *src, uint32_t len) {
+    /* A whole-block overwrite has no use for the old contents */
+    bcache_buf_t *b = (src && off == 0 && len == BLOCK_SIZE) ? bcache_getblk(blk)
+                                                             : bcache_read(blk);
+    if (!b) return -1;
+    if (src)
+        memcpy(b->data + off, src, len);
+    else
+        memset(b->data + off, 0, len);
+    bcache_dirty(b);
+    bcache_release(b);
+    return 0;
+}
+
+/* Write into a block that was just allocated: nothing is read from disk
+ * and the bytes outside [off, off+len) are zeroed. */
+static int block_fill_bytes(uint32_t blk, uint32_t off, const void *src, uint32_t len) {
+    if (off == 0 && len == BLOCK_SIZE)
+        return block_write_bytes(blk, 0, src, len);
+    bcache_buf_t *b = bcache_zero(blk);
+    if (!b) return -1;
+    memcpy(b->data + off, src, len);
+    bcache_release(b);
+    return 0;
+}
+
+/* ---- extent mapping ---- */
+
+/* Where a file with no blocks yet starts looking for space: inodes are
+ * spread evenly over the data area so neighbouring files have room to
+ * grow without interleaving. */
+static uint32_t inode_goal(const inode_t *node) {
+    uint32_t ino = (uint32_t)(node - inodes);
+    if (ino >= NUM_INODES) return DISK_METADATA_BLOCKS;
+    return DISK_METADATA_BLOCKS +
+           ino * ((NUM_BLOCKS - DISK_METADATA_BLOCKS) / NUM_INODES);
+}
+
+_Static_assert(EXTENT_NEXT_OFF + sizeof(uint32_t) <= BLOCK_SIZE,
+               "extent block has room for the chain link");
+
+/* Extent blocks needed for a file with `n` extents */
+static uint32_t ext_chain_len(uint32_t n) {
+    if (n <= INODE_EXTENTS) return 0;
+    return (n - INODE_EXTENTS + EXTENTS_PER_BLOCK - 1) / EXTENTS_PER_BLOCK;
+}
+
+/* The extent block holding extent `i` (i >= INODE_EXTENTS), found by
+ * following the chain from the inode.  Returns 0 if it is broken. */
+static uint32_t ext_chain_block(const inode_t *node, uint32_t i) {
+    uint32_t blk = node->extent_block;
+    for (uint32_t k = (i - INODE_EXTENTS) / EXTENTS_PER_BLOCK; k > 0 && blk; k--) {
+        uint32_t next;
+        if (block_read_bytes(blk, EXTENT_NEXT_OFF, &next, sizeof(next)) != 0)
+            return 0;
+        blk = next;
+    }
+    return blk < NUM_BLOCKS ? blk : 0;
+}
+
+/* Extent `i` of a file: the first INODE_EXTENTS are inline, the rest are
+ * in the extent block chain.  Return 0 or -1 on I/O error. */
+static int ext_get(const inode_t *node, uint32_t i, fs_extent_t *out) {
+    if (i < INODE_EXTENTS) {
+        *out = node->extents[i];
+        return 0;
+    }
+    uint32_t blk = ext_chain_block(node, i);
+    if (blk == 0) return -1;
+    return block_read_bytes(blk,
+                            (i - INODE_EXTENTS) % EXTENTS_PER_BLOCK * sizeof(fs_extent_t),
+                            out, sizeof(fs_extent_t));
+}
+
+static int ext_set(inode_t *node, uint32_t i, const fs_extent_t *e) {
+    if (i < INODE_EXTENTS) {
+        node->extents[i] = *e;
+        return 0;
+    }
+    uint32_t blk = ext_chain_block(node, i);
+    if (blk == 0) return -1;
+    return block_write_bytes(blk,
+                             (i - INODE_EXTENTS) % EXTENTS_PER_BLOCK * sizeof(fs_extent_t),
+                             e, sizeof(fs_extent_t));
+}
+
+/* Append an empty extent block to the chain, to hold the extents from
+ * node->num_extents on.  Returns 0, -ENOSPC or -EIO. */
+static int ext_chain_extend(inode_t *node) {
+    /* Index blocks go low on the disk, out of the data's way */
+    int xb = alloc_block(DISK_METADATA_BLOCKS);
+    if (xb < 0) return -ENOSPC;     /* arrives zeroed from the cache */
+
+    if (node->num_extents == INODE_EXTENTS) {
+        node->extent_block = (uint32_t)xb;
+        return 0;
+    }
+    uint32_t prev = ext_chain_block(node, node->num_extents - 1u);
+    uint32_t next = (uint32_t)xb;
+    if (prev == 0 ||
+        block_write_bytes(prev, EXTENT_NEXT_OFF, &next, sizeof(next)) != 0) {
+        free_block((uint32_t)xb);
+        return -EIO;
+    }
+    return 0;
+}
+
+/* Free the extent blocks a file no longer needs after shrinking from
+ * `had` chain blocks.  Only links inside the old chain are followed. */
+static void ext_chain_trim(inode_t *node, uint32_t had) {
+    uint32_t keep = ext_chain_len(node->num_extents);
+    if (keep >= had)
+        return;
+    uint32_t blk = node->extent_block;
+    for (uint32_t k = 0; k < had && blk != 0 && blk < NUM_BLOCKS; k++) {
+        uint32_t next = 0;
+        if (k + 1 < had &&
+            block_read_bytes(blk, EXTENT_NEXT_OFF, &next, sizeof(next)) != 0)
+            next = 0;
+        if (k + 1 == keep) {
+            uint32_t end = 0;
+            block_write_bytes(blk, EXTENT_NEXT_OFF, &end, sizeof(end));
+        } else if (k >= keep) {
+            free_block(blk);
         }
-        int blk = alloc_block();
-        if (blk < 0) return -1;
-        node->blocks[logical_block] = blk;
-        if (logical_block >= node->num_blocks)
-            node->num_blocks = logical_block + 1;
-        return blk;
-    }
-
-    /* Single-indirect */
-    uint32_t ind_offset = logical_block - DIRECT_BLOCKS;
-    if (ind_offset < INDIRECT_PTRS) {
-        /* Ensure all direct blocks are accounted for */
-        if (node->num_blocks < DIRECT_BLOCKS)
-            node->num_blocks = DIRECT_BLOCKS;
-        /* Ensure indirect block exists */
-        if (node->indirect_block == 0) {
-            int ind_blk = alloc_block();
-            if (ind_blk < 0) return -1;
-            node->indirect_block = ind_blk;
+        blk = next;
+    }
+    if (keep == 0)
+        node->extent_block = 0;
+}
+
+/* Walk a file's extents in order; each extent block is pinned once rather
+ * than looked up per extent.  `fn` returns non-zero to stop. */
+static void ext_walk(const inode_t *node,
+                     int (*fn)(const fs_extent_t *e, uint32_t logical, void *ctx),
+                     void *ctx) {
+    bcache_buf_t *xb = NULL;
+    uint32_t logical = 0;
+
+    for (uint32_t i = 0; i < node->num_extents; i++) {
+        const fs_extent_t *e;
+        if (i < INODE_EXTENTS) {
+            e = &node->extents[i];
+        } else {
+            uint32_t j = (i - INODE_EXTENTS) % EXTENTS_PER_BLOCK;
+            if (!xb || j == 0) {
+                uint32_t blk = xb ? *(const uint32_t *)(xb->data + EXTENT_NEXT_OFF)
+                                  : node->extent_block;
+                bcache_release(xb);
+                xb = NULL;
+                if (blk == 0 || blk >= NUM_BLOCKS) break;
+                xb = bcache_read(blk);
+                if (!xb) break;
+            }
+            e = &((const fs_extent_t *)xb->data)[j];
         }
-        uint32_t *ptrs = (uint32_t *)BLOCK_PTR(node->indirect_block);
-        if (ptrs[ind_offset] != 0) return (int)ptrs[ind_offset];
-        int blk = alloc_block();
-        if (blk < 0) return -1;
-        ptrs[ind_offset] = blk;
-        mark_dirty(node->indirect_block);
-        return blk;
-    }
-
-    /* Double-indirect */
-    uint32_t dbl_offset = ind_offset - INDIRECT_PTRS;
-    uint32_t l1_idx = dbl_offset / INDIRECT_PTRS;
-    uint32_t l2_idx = dbl_offset % INDIRECT_PTRS;
-    if (l1_idx >= INDIRECT_PTRS) return -1; /* exceeds maximum */
-
-    /* Ensure double-indirect L1 block exists */
-    if (node->double_indirect == 0) {
-        int dbl_blk = alloc_block();
-        if (dbl_blk < 0) return -1;
-        node->double_indirect = dbl_blk;
-    }
-    uint32_t *l1 = (uint32_t *)BLOCK_PTR(node->double_indirect);
-
-    /* Ensure L2 block exists */
-    if (l1[l1_idx] == 0) {
-        int l2_blk = alloc_block();
-        if (l2_blk < 0) return -1;
-        l1[l1_idx] = l2_blk;
-        mark_dirty(node->double_indirect);
-    }
-    uint32_t *l2 = (uint32_t *)BLOCK_PTR(l1[l1_idx]);
-
-    if (l2[l2_idx] != 0) return (int)l2[l2_idx];
-    int blk = alloc_block();
-    if (blk < 0) return -1;
-    l2[l2_idx] = blk;
-    mark_dirty(l1[l1_idx]);
-    return blk;
+        if (fn(e, logical, ctx))
+            break;
+        logical += e->len;
+    }
+    bcache_release(xb);
+}
+
+static int count_cb(const fs_extent_t *e, uint32_t logical, void *ctx) {
+    (void)logical;
+    *(uint32_t *)ctx += e->len;
+    return 0;
+}
+
+/* Number of data blocks allocated to a file */
+static uint32_t inode_nblocks(const inode_t *node) {
+    uint32_t n = 0;
+    ext_walk(node, count_cb, &n);
+    return n;
+}
+
+/* Position in a file's extent list, kept across the lookups of a
+ * sequential loop so each one carries on from the extent the last one
+ * found instead of walking the list from the start.  Zero-initialise. */
+typedef struct {
+    uint32_t    i;          /* index of `e` */
+    uint32_t    logical;    /* first logical block of `e` */
+    uint32_t    xblk;       /* extent block holding `e`, if chained */
+    fs_extent_t e;
+    uint8_t     valid;
+} map_cursor_t;
+
+/* Load extent c->i, following one chain link when it starts a new extent
+ * block.  Returns 0 or -1 if there is none or on I/O error. */
+static int map_cursor_load(const inode_t *node, map_cursor_t *c) {
+    if (c->i >= node->num_extents) return -1;
+    if (c->i < INODE_EXTENTS) {
+        c->e = node->extents[c->i];
+        return 0;
+    }
+    uint32_t j = (c->i - INODE_EXTENTS) % EXTENTS_PER_BLOCK;
+    if (c->i == INODE_EXTENTS) {
+        c->xblk = node->extent_block;
+    } else if (j == 0) {
+        uint32_t next;
+        if (block_read_bytes(c->xblk, EXTENT_NEXT_OFF, &next, sizeof(next)) != 0)
+            return -1;
+        c->xblk = next;
+    }
+    if (c->xblk == 0 || c->xblk >= NUM_BLOCKS) return -1;
+    return block_read_bytes(c->xblk, j * sizeof(fs_extent_t), &c->e, sizeof(c->e));
+}
+
+/* map_block() from a cursor: moves forward from the extent it is on and
+ * only restarts from the first one when `logical` goes backwards. */
+static uint32_t map_block_at(const inode_t *node, map_cursor_t *c,
+                             uint32_t logical, uint32_t *run) {
+    if (run) *run = 0;
+    if (!c->valid || logical < c->logical) {
+        c->i = 0;
+        c->logical = 0;
+        c->xblk = 0;
+        if (map_cursor_load(node, c) != 0) return 0;
+        c->valid = 1;
+    }
+    while (logical >= c->logical + c->e.len) {
+        /* Past the allocation: stay on the last extent */
+        if (c->i + 1 >= node->num_extents) return 0;
+        c->logical += c->e.len;
+        c->i++;
+        if (map_cursor_load(node, c) != 0) {
+            c->valid = 0;
+            return 0;
+        }
+    }
+    if (run) *run = c->e.len - (logical - c->logical);
+    return c->e.start + (logical - c->logical);
+}
+
+/* Physical block behind logical block `logical`, or 0 past the end of the
+ * allocation.  If `run` is non-NULL it receives how many blocks from here
+ * on are contiguous on disk. */
+static uint32_t map_block(const inode_t *node, uint32_t logical, uint32_t *run) {
+    map_cursor_t c = { 0 };
+    return map_block_at(node, &c, logical, run);
+}
+
+/* Prefetch up to `want` blocks of the contiguous run starting at `phys`.
+ * Returns how many logical blocks that covers (at least 1). */
+static uint32_t read_ahead(uint32_t phys, uint32_t run, uint32_t want) {
+    uint32_t n = run < want ? run : want;
+    if (n > FS_READAHEAD_BLOCKS) n = FS_READAHEAD_BLOCKS;
+    if (n > 1)
+        bcache_prefetch(phys, n);
+    return n ? n : 1;
+}
+
+/* Grow a file's allocation to `nblocks`, asking for the whole remainder
+ * right after its last extent so that it stays contiguous.  The new
+ * blocks are not zeroed: the caller must write every one of them.
+ * Returns 0, -ENOSPC when the disk or the extent table is full, or -EIO
+ * when an extent block can't be updated; blocks allocated before the
+ * failure stay with the file. */
+static int inode_extend(inode_t *node, uint32_t nblocks) {
+    uint32_t have = inode_nblocks(node);
+    fs_extent_t last = { 0, 0 };
+    if (node->num_extents > 0 &&
+        ext_get(node, node->num_extents - 1u, &last) != 0)
+        return -EIO;
+
+    while (have < nblocks) {
+        uint32_t goal = last.len ? last.start + last.len : inode_goal(node);
+        uint32_t got;
+        int start = alloc_blocks(goal, nblocks - have, &got);
+        if (start < 0) return -ENOSPC;
+
+        if (last.len && (uint32_t)start == last.start + last.len &&
+            last.len + got <= EXTENT_MAX_LEN) {
+            fs_extent_t grown = { last.start, (uint16_t)(last.len + got) };
+            if (ext_set(node, node->num_extents - 1u, &grown) != 0) {
+                free_blocks((uint32_t)start, got);
+                return -EIO;
+            }
+            last = grown;
+        } else {
+            if (node->num_extents >= FS_MAX_EXTENTS) {
+                free_blocks((uint32_t)start, got);
+                return -ENOSPC;
+            }
+            if (node->num_extents >= INODE_EXTENTS &&
+                (node->num_extents - INODE_EXTENTS) % EXTENTS_PER_BLOCK == 0) {
+                int rc = ext_chain_extend(node);
+                if (rc != 0) {
+                    free_blocks((uint32_t)start, got);
+                    return rc;
+                }
+            }
+            fs_extent_t e = { (uint32_t)start, (uint16_t)got };
+            if (ext_set(node, node->num_extents, &e) != 0) {
+                free_blocks((uint32_t)start, got);
+                return -EIO;
+            }
+            node->num_extents++;
+            last = e;
+        }
+        have += got;
+    }
+    return 0;
+}
+
+/* Zero logical blocks [from, to) of a file, a run at a time */
+static int inode_zero(const inode_t *node, uint32_t from, uint32_t to) {
+    map_cursor_t cur = { 0 };
+    while (from < to) {
+        uint32_t run;
+        uint32_t phys = map_block_at(node, &cur, from, &run);
+        if (phys == 0) return -EIO;
+        for (; run > 0 && from < to; run--, from++, phys++) {
+            bcache_buf_t *b = bcache_zero(phys);
+            if (!b) return -EIO;
+            bcache_release(b);
+        }
+    }
+    return 0;
+}
+
+/* inode_extend() for blocks that are not about to be overwritten: the
+ * new ones come out zeroed (directory and symlink blocks). */
+static int inode_grow(inode_t *node, uint32_t nblocks) {
+    uint32_t have = inode_nblocks(node);
+    int rc = inode_extend(node, nblocks);
+    int zrc = inode_zero(node, have, inode_nblocks(node));
+    return rc ? rc : zrc;
+}
+
+/* Release every block from logical block `keep` onwards */
+static void inode_shrink(inode_t *node, uint32_t keep) {
+    uint32_t end = inode_nblocks(node);
+    uint32_t had = ext_chain_len(node->num_extents);
+
+    while (node->num_extents > 0 && end > keep) {
+        fs_extent_t e;
+        if (ext_get(node, node->num_extents - 1u, &e) != 0) break;
+        uint32_t base = end - e.len;
+        if (base >= keep) {
+            free_blocks(e.start, e.len);
+            node->num_extents--;
+            end = base;
+            continue;
+        }
+        uint32_t drop = end - keep;
+        free_blocks(e.start + e.len - drop, drop);
+        e.len = (uint16_t)(e.len - drop);
+        ext_set(node, node->num_extents - 1u, &e);
+        end = keep;
+    }
+
+    ext_chain_trim(node, had);
+    fs_dirty = 1;
+}
+
+/* Pin block `b` of a directory, or NULL */
+static bcache_buf_t *dir_block(const inode_t *dir, uint32_t b) {
+    uint32_t phys = map_block(dir, b, NULL);
+    return phys ? bcache_read(phys) : NULL;
+}
+
+static int prefetch_cb(const fs_extent_t *e, uint32_t logical, void *ctx) {
+    (void)logical;
+    (void)ctx;
+    read_ahead(e->start, e->len, e->len);
+    return 0;
+}
+
+/* Start reading a whole directory before walking it block by block */
+static void dir_prefetch(const inode_t *dir) {
+    if (dir->num_extents > 0)
+        ext_walk(dir, prefetch_cb, NULL);
 }
 
 /* ---- device node I/O ---- */
 
 static int dev_read(inode_t* node, uint8_t* buffer, size_t* size) {
-    uint8_t major = (uint8_t)node->blocks[0];
+    uint8_t major = (uint8_t)node->dev.major;
     size_t requested = *size;
     /* Cap infinite sources to 256 bytes per read */
     if (requested > 256) requested = 256;
@@ -274,7 +771,7 @@ static int dev_read(inode_t* node, uint8_t* buffer, size_t* size) {
 }
 
 static int dev_write(inode_t* node, const uint8_t* data, size_t size) {
-    uint8_t major = (uint8_t)node->blocks[0];
+    uint8_t major = (uint8_t)node->dev.major;
 
     switch (major) {
     case DEV_MAJOR_NULL:
@@ -296,49 +793,356 @@ static int dev_write(inode_t* node, const uint8_t* data, size_t size) {
 
 /* ---- directory operations ---- */
 
-static int dir_lookup(uint32_t dir_inode, const char* name) {
+#define DIR_ENTRIES_PER_BLOCK  (BLOCK_SIZE / sizeof(dir_entry_t))   /* 128 */
+
+static int dir_is_dot(const char *name) {
+    return local_strncmp(name, ".", MAX_NAME_LEN) == 0 ||
+           local_strncmp(name, "..", MAX_NAME_LEN) == 0;
+}
+
+/* ---- hashed directory index ----
+ *
+ * A directory starts out as a single linear block.  When it needs a
+ * second one it is rebuilt as an index: block 0 keeps "." and ".." in its
+ * first two slots, followed by a table of (hash, leaf) pairs sorted by
+ * hash; every other block is a leaf holding the entries whose name hash
+ * falls in its range.  Lookup and insert read the root and one leaf, and
+ * a full leaf is split in two at its median hash.  Directories without
+ * INODE_FL_INDEX are still scanned block by block. */
+
+#define DX_MAGIC  0x58444E49    /* "INDX" */
+
+typedef struct {
+    uint32_t hash;              /* lowest name hash in the leaf */
+    uint32_t block;             /* logical block of the leaf */
+} dx_entry_t;
+
+typedef struct {
+    dir_entry_t dot, dotdot;
+    uint32_t magic;
+    uint16_t count;
+    uint16_t limit;
+    dx_entry_t ent[];
+} dx_root_t;
+
+#define DX_LIMIT  ((BLOCK_SIZE - sizeof(dx_root_t)) / sizeof(dx_entry_t))  /* 503 */
+
+/* FNV-1a over the name */
+static uint32_t dx_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < MAX_NAME_LEN && name[i]; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Pin the root of an indexed directory, or NULL if it is unreadable */
+static bcache_buf_t *dx_root(const inode_t *dir) {
+    bcache_buf_t *buf = dir_block(dir, 0);
+    if (buf && ((dx_root_t *)buf->data)->magic != DX_MAGIC) {
+        DBG("[FS] bad directory index root");
+        bcache_release(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/* Index slot of the leaf covering `hash`: the last one whose hash is <= it */
+static uint32_t dx_find(const dx_root_t *root, uint32_t hash) {
+    uint32_t lo = 1, hi = root->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (root->ent[mid].hash <= hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+/* Pin the leaf that holds (or would hold) `name` */
+static bcache_buf_t *dx_leaf(const inode_t *dir, const dx_root_t *root,
+                             uint32_t hash, uint32_t *slot) {
+    uint32_t i = dx_find(root, hash);
+    if (slot) *slot = i;
+    return dir_block(dir, root->ent[i].block);
+}
+
+static int dx_lookup(const inode_t *dir, const char *name) {
+    bcache_buf_t *rb = dx_root(dir);
+    if (!rb) return -1;
+    dx_root_t *root = (dx_root_t *)rb->data;
+    int ino = -1;
+
+    if (local_strncmp(name, ".", MAX_NAME_LEN) == 0)
+        ino = (int)root->dot.inode;
+    else if (local_strncmp(name, "..", MAX_NAME_LEN) == 0)
+        ino = (int)root->dotdot.inode;
+    else {
+        bcache_buf_t *lb = dx_leaf(dir, root, dx_hash(name), NULL);
+        if (lb) {
+            dir_entry_t *entries = (dir_entry_t *)lb->data;
+            for (uint32_t e = 0; e < DIR_ENTRIES_PER_BLOCK; e++) {
+                if (entries[e].name[0] != '\0' &&
+                    local_strncmp(entries[e].name, name, MAX_NAME_LEN) == 0) {
+                    ino = (int)entries[e].inode;
+                    break;
+                }
+            }
+            bcache_release(lb);
+        }
+    }
+    bcache_release(rb);
+    return ino;
+}
+
+static int leaf_put(bcache_buf_t *lb, const char *name, uint32_t child) {
+    dir_entry_t *entries = (dir_entry_t *)lb->data;
+    for (uint32_t e = 0; e < DIR_ENTRIES_PER_BLOCK; e++) {
+        if (entries[e].name[0] == '\0') {
+            entries[e].inode = child;
+            local_strncpy(entries[e].name, name, MAX_NAME_LEN);
+            bcache_dirty(lb);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Split the full leaf in index slot `i` at its median hash, moving the
+ * upper half to a new leaf.  Returns the hash the new leaf starts at, or
+ * 0 when it can't split (index full, disk full, or every name in the
+ * leaf has the same hash). */
+static uint32_t dx_split(inode_t *dir, bcache_buf_t *rb, bcache_buf_t *lb, uint32_t i,
+                         bcache_buf_t **out) {
+    dx_root_t *root = (dx_root_t *)rb->data;
+    dir_entry_t *entries = (dir_entry_t *)lb->data;
+    if (root->count >= DX_LIMIT) return 0;
+
+    uint32_t sorted[DIR_ENTRIES_PER_BLOCK];
+    for (uint32_t e = 0; e < DIR_ENTRIES_PER_BLOCK; e++) {
+        uint32_t h = dx_hash(entries[e].name), k = e;
+        for (; k > 0 && sorted[k - 1] > h; k--)
+            sorted[k] = sorted[k - 1];
+        sorted[k] = h;
+    }
+
+    /* Nearest hash boundary to the middle, so equal hashes stay together */
+    uint32_t mid = DIR_ENTRIES_PER_BLOCK / 2, split = 0;
+    for (uint32_t d = 0; d < mid && !split; d++) {
+        if (sorted[mid + d] != sorted[mid + d - 1])
+            split = sorted[mid + d];
+        else if (sorted[mid - d] != sorted[mid - d - 1])
+            split = sorted[mid - d];
+    }
+    if (!split) return 0;
+
+    uint32_t nb = inode_nblocks(dir);
+    if (inode_grow(dir, nb + 1) != 0) return 0;
+    bcache_buf_t *nbuf = dir_block(dir, nb);
+    if (!nbuf) {
+        inode_shrink(dir, nb);
+        return 0;
+    }
+
+    dir_entry_t *moved = (dir_entry_t *)nbuf->data;
+    uint32_t n = 0;
+    for (uint32_t e = 0; e < DIR_ENTRIES_PER_BLOCK; e++) {
+        if (dx_hash(entries[e].name) >= split) {
+            moved[n++] = entries[e];
+            memset(&entries[e], 0, sizeof(dir_entry_t));
+        }
+    }
+
+    memmove(&root->ent[i + 2], &root->ent[i + 1],
+            (root->count - i - 1) * sizeof(dx_entry_t));
+    root->ent[i + 1].hash = split;
+    root->ent[i + 1].block = nb;
+    root->count++;
+
+    bcache_dirty(lb);
+    bcache_dirty(nbuf);
+    bcache_dirty(rb);
+    *out = nbuf;
+    return split;
+}
+
+static int dx_add(inode_t *dir, const char *name, uint32_t child) {
+    bcache_buf_t *rb = dx_root(dir);
+    if (!rb) return -1;
+    uint32_t hash = dx_hash(name), i;
+    bcache_buf_t *lb = dx_leaf(dir, (dx_root_t *)rb->data, hash, &i);
+    int rc = -1;
+
+    if (lb && leaf_put(lb, name, child) != 0) {
+        bcache_buf_t *nbuf = NULL;
+        uint32_t split = dx_split(dir, rb, lb, i, &nbuf);
+        if (split)
+            rc = leaf_put(hash >= split ? nbuf : lb, name, child);
+        bcache_release(nbuf);
+    } else if (lb) {
+        rc = 0;
+    }
+    bcache_release(lb);
+    bcache_release(rb);
+    return rc;
+}
+
+static int dx_remove(const inode_t *dir, const char *name) {
+    bcache_buf_t *rb = dx_root(dir);
+    if (!rb) return -1;
+    bcache_buf_t *lb = dx_leaf(dir, (dx_root_t *)rb->data, dx_hash(name), NULL);
+    bcache_release(rb);
+    if (!lb) return -1;
+
+    dir_entry_t *entries = (dir_entry_t *)lb->data;
+    for (uint32_t e = 0; e < DIR_ENTRIES_PER_BLOCK; e++) {
+        if (entries[e].name[0] != '\0' &&
+            local_strncmp(entries[e].name, name, MAX_NAME_LEN) == 0) {
+            memset(&entries[e], 0, sizeof(dir_entry_t));
+            bcache_dirty(lb);
+            bcache_release(lb);
+            return 0;
+        }
+    }
+    bcache_release(lb);
+    return -1;
+}
+
+/* Rebuild a full linear directory as an index.  The new blocks are built
+ * on a scratch inode and only swapped in once every entry has been
+ * placed, so a full disk leaves the directory as it was. */
+static int dx_convert(inode_t *dir) {
+    inode_t tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.type = INODE_DIR;
+
+    /* Start the new blocks near the old ones */
+    int b0 = alloc_block(map_block(dir, 0, NULL));
+    if (b0 < 0) return -1;
+    tmp.extents[0].start = (uint32_t)b0;
+    tmp.extents[0].len = 1;
+    tmp.num_extents = 1;
+    if (inode_grow(&tmp, 2) != 0) {
+        inode_shrink(&tmp, 0);
+        return -1;
+    }
+
+    bcache_buf_t *rb = dir_block(&tmp, 0);
+    if (!rb) {
+        inode_shrink(&tmp, 0);
+        return -1;
+    }
+    dx_root_t *root = (dx_root_t *)rb->data;
+    root->magic = DX_MAGIC;
+    root->limit = DX_LIMIT;
+    root->count = 1;
+    root->ent[0].hash = 0;
+    root->ent[0].block = 1;
+
+    int ok = 1;
+    uint32_t nb = inode_nblocks(dir);
+    for (uint32_t b = 0; b < nb && ok; b++) {
+        bcache_buf_t *buf = dir_block(dir, b);
+        if (!buf) { ok = 0; break; }
+        dir_entry_t *entries = (dir_entry_t *)buf->data;
+        for (uint32_t e = 0; e < DIR_ENTRIES_PER_BLOCK && ok; e++) {
+            if (entries[e].name[0] == '\0') continue;
+            if (local_strncmp(entries[e].name, ".", MAX_NAME_LEN) == 0)
+                root->dot = entries[e];
+            else if (local_strncmp(entries[e].name, "..", MAX_NAME_LEN) == 0)
+                root->dotdot = entries[e];
+            else if (dx_add(&tmp, entries[e].name, entries[e].inode) != 0)
+                ok = 0;
+        }
+        bcache_release(buf);
+    }
+    bcache_dirty(rb);
+    bcache_release(rb);
+
+    if (!ok) {
+        inode_shrink(&tmp, 0);
+        return -1;
+    }
+
+    inode_shrink(dir, 0);
+    dir->num_extents = tmp.num_extents;
+    dir->extent_block = tmp.extent_block;
+    memcpy(dir->extents, tmp.extents, sizeof(dir->extents));
+    dir->flags |= INODE_FL_INDEX;
+    fs_dirty = 1;
+    return 0;
+}
+
+/* Directory entry slots in block `b` (see fs_dir_slots) */
+static uint32_t dir_slots(const inode_t *dir, uint32_t b) {
+    return (b == 0 && (dir->flags & INODE_FL_INDEX)) ? 2 : DIR_ENTRIES_PER_BLOCK;
+}
+
+uint32_t fs_dir_slots(const inode_t *dir, uint32_t block) {
+    FS_LOCKED(0);
+    return dir_slots(dir, block);
+}
+
+/* Find `name` in a directory's blocks, bypassing the dentry cache */
+static int dir_scan(uint32_t dir_inode, const char* name) {
     inode_t* dir = &inodes[dir_inode];
-    for (uint8_t b = 0; b < dir->num_blocks; b++) {
-        dir_entry_t* entries = (dir_entry_t*)BLOCK_PTR(dir->blocks[b]);
+    if (dir->flags & INODE_FL_INDEX)
+        return dx_lookup(dir, name);
+
+    uint32_t nb = inode_nblocks(dir);
+    for (uint32_t b = 0; b < nb; b++) {
+        bcache_buf_t *buf = dir_block(dir, b);
+        if (!buf) continue;
+        dir_entry_t* entries = (dir_entry_t*)buf->data;
         int entries_per_block = BLOCK_SIZE / sizeof(dir_entry_t);
         for (int e = 0; e < entries_per_block; e++) {
             if (entries[e].name[0] != '\0' &&
                 local_strncmp(entries[e].name, name, MAX_NAME_LEN) == 0) {
-                return (int)entries[e].inode;
+                int ino = (int)entries[e].inode;
+                bcache_release(buf);
+                return ino;
             }
         }
+        bcache_release(buf);
     }
     return -1;
 }
 
+static int dir_lookup(uint32_t dir_inode, const char* name) {
+    uint32_t ino;
+    if (dcache_lookup(dir_inode, name, &ino))
+        return ino == DCACHE_NEGATIVE ? -1 : (int)ino;
+    int found = dir_scan(dir_inode, name);
+    dcache_insert(dir_inode, name, found < 0 ? DCACHE_NEGATIVE : (uint32_t)found);
+    return found;
+}
+
 static int dir_add_entry(uint32_t dir_inode, const char* name, uint32_t child_inode) {
     inode_t* dir = &inodes[dir_inode];
-
-    /* try to find a free slot in existing blocks */
-    for (uint8_t b = 0; b < dir->num_blocks; b++) {
-        dir_entry_t* entries = (dir_entry_t*)BLOCK_PTR(dir->blocks[b]);
-        int entries_per_block = BLOCK_SIZE / sizeof(dir_entry_t);
-        for (int e = 0; e < entries_per_block; e++) {
-            if (entries[e].name[0] == '\0') {
-                entries[e].inode = child_inode;
-                local_strncpy(entries[e].name, name, MAX_NAME_LEN);
+    dcache_invalidate(dir_inode, name);     /* drop a cached miss */
+
+    if (!(dir->flags & INODE_FL_INDEX)) {
+        /* try to find a free slot in existing blocks */
+        uint32_t nb = inode_nblocks(dir);
+        for (uint32_t b = 0; b < nb; b++) {
+            bcache_buf_t *buf = dir_block(dir, b);
+            if (!buf) continue;
+            int rc = leaf_put(buf, name, child_inode);
+            bcache_release(buf);
+            if (rc == 0) {
                 dir->size += sizeof(dir_entry_t);
-                mark_dirty(dir->blocks[b]);
                 fs_dirty = 1;
                 return 0;
             }
         }
-    }
 
-    /* allocate a new block for the directory */
-    if (dir->num_blocks >= DIRECT_BLOCKS) return -1;
-    int blk = alloc_block();
-    if (blk < 0) return -1;
-    dir->blocks[dir->num_blocks++] = blk;
+        /* full: switch to a hashed index instead of adding a block */
+        if (dx_convert(dir) != 0) return -1;
+    }
 
-    dir_entry_t* entries = (dir_entry_t*)BLOCK_PTR(blk);
-    entries[0].inode = child_inode;
-    local_strncpy(entries[0].name, name, MAX_NAME_LEN);
+    if (dx_add(dir, name, child_inode) != 0) return -1;
     dir->size += sizeof(dir_entry_t);
     fs_dirty = 1;
     return 0;
@@ -346,19 +1150,32 @@ static int dir_add_entry(uint32_t dir_inode, const char* name, uint32_t child_in
 
 static int dir_remove_entry(uint32_t dir_inode, const char* name) {
     inode_t* dir = &inodes[dir_inode];
-    for (uint8_t b = 0; b < dir->num_blocks; b++) {
-        dir_entry_t* entries = (dir_entry_t*)BLOCK_PTR(dir->blocks[b]);
+    dcache_invalidate(dir_inode, name);
+    if (dir->flags & INODE_FL_INDEX) {
+        if (dir_is_dot(name) || dx_remove(dir, name) != 0) return -1;
+        dir->size -= sizeof(dir_entry_t);
+        fs_dirty = 1;
+        return 0;
+    }
+
+    uint32_t nb = inode_nblocks(dir);
+    for (uint32_t b = 0; b < nb; b++) {
+        bcache_buf_t *buf = dir_block(dir, b);
+        if (!buf) continue;
+        dir_entry_t* entries = (dir_entry_t*)buf->data;
         int entries_per_block = BLOCK_SIZE / sizeof(dir_entry_t);
         for (int e = 0; e < entries_per_block; e++) {
             if (entries[e].name[0] != '\0' &&
                 local_strncmp(entries[e].name, name, MAX_NAME_LEN) == 0) {
                 memset(&entries[e], 0, sizeof(dir_entry_t));
                 dir->size -= sizeof(dir_entry_t);
-                mark_dirty(dir->blocks[b]);
+                bcache_dirty(buf);
+                bcache_release(buf);
                 fs_dirty = 1;
                 return 0;
             }
         }
+        bcache_release(buf);
     }
     return -1;
 }
@@ -412,9 +1229,10 @@ static int resolve_path_depth(const char* path, uint32_t* out_parent, char* out_
             /* Follow symlinks in intermediate components */
             if (inodes[child].type == INODE_SYMLINK) {
                 char target[256];
-                if (inodes[child].num_blocks == 0) return -1;
+                if (inodes[child].num_extents == 0) return -1;
                 size_t tlen = inodes[child].size < 255 ? inodes[child].size : 255;
-                memcpy(target, BLOCK_PTR(inodes[child].blocks[0]), tlen);
+                if (block_read_bytes(inodes[child].extents[0].start, 0, target, tlen) != 0)
+                    return -1;
                 target[tlen] = '\0';
                 child = resolve_path_depth(target, NULL, NULL, depth + 1);
                 if (child < 0) return -1;
@@ -442,20 +1260,20 @@ static int init_dir_inode(int inode_idx, uint32_t parent_inode) {
     inode_t* inode = &inodes[inode_idx];
     inode->type = INODE_DIR;
     inode->size = 0;
-    inode->num_blocks = 0;
-    inode->indirect_block = 0;
-    inode->double_indirect = 0;
+    inode->num_extents = 0;
+    inode->extent_block = 0;
 
-    int blk = alloc_block();
-    if (blk < 0) return -1;
-    inode->blocks[0] = blk;
-    inode->num_blocks = 1;
+    if (inode_grow(inode, 1) != 0) return -1;
+    bcache_buf_t *buf = dir_block(inode, 0);
+    if (!buf) { inode_shrink(inode, 0); return -1; }
 
-    dir_entry_t* entries = (dir_entry_t*)BLOCK_PTR(blk);
+    dir_entry_t* entries = (dir_entry_t*)buf->data;
     entries[0].inode = inode_idx;
     local_strncpy(entries[0].name, ".", MAX_NAME_LEN);
     entries[1].inode = parent_inode;
     local_strncpy(entries[1].name, "..", MAX_NAME_LEN);
+    bcache_dirty(buf);
+    bcache_release(buf);
     inode->size = 2 * sizeof(dir_entry_t);
     return 0;
 }
@@ -467,6 +1285,7 @@ uint32_t fs_get_cwd_inode(void) {
 }
 
 int fs_read_inode(uint32_t inode_num, inode_t* out_inode) {
+    FS_LOCKED(-1);
     if (inode_num >= NUM_INODES) {
         return -1;
     }
@@ -475,16 +1294,17 @@ int fs_read_inode(uint32_t inode_num, inode_t* out_inode) {
 }
 
 int fs_read_block(uint32_t block_num, uint8_t* out_data) {
+    FS_LOCKED(-1);
     if (block_num >= NUM_BLOCKS) {
         return -1;
     }
-    memcpy(out_data, BLOCK_PTR(block_num), BLOCK_SIZE);
-    return 0;
+    return block_read_bytes(block_num, 0, out_data, BLOCK_SIZE);
 }
 
-/* ---- block-level partial read (uses get_block_at for all levels) ---- */
+/* ---- block-level partial read ---- */
 
 int fs_read_at(uint32_t inode_num, uint8_t *buffer, uint32_t offset, uint32_t count) {
+    FS_LOCKED(-1);
     if (inode_num >= NUM_INODES) return -1;
     inode_t *node = &inodes[inode_num];
 
@@ -497,6 +1317,9 @@ int fs_read_at(uint32_t inode_num, uint8_t *buffer, uint32_t offset, uint32_t co
     if (count == 0) return 0;
 
     uint32_t bytes_read = 0;
+    uint32_t last_block = (offset + count - 1) / BLOCK_SIZE;
+    uint32_t ra_next = 0;
+    map_cursor_t cur = { 0 };
 
     while (bytes_read < count) {
         uint32_t pos = offset + bytes_read;
@@ -506,12 +1329,16 @@ int fs_read_at(uint32_t inode_num, uint8_t *buffer, uint32_t offset, uint32_t co
         if (chunk > count - bytes_read)
             chunk = count - bytes_read;
 
-        uint32_t phys_block = get_block_at(node, block_index);
+        uint32_t run;
+        uint32_t phys_block = map_block_at(node, &cur, block_index, &run);
+        if (phys_block != 0 && block_index >= ra_next)
+            ra_next = block_index + read_ahead(phys_block, run, last_block - block_index + 1);
         if (phys_block == 0) {
             /* Hole — fill with zeros */
             memset(buffer + bytes_read, 0, chunk);
-        } else {
-            memcpy(buffer + bytes_read, BLOCK_PTR(phys_block) + block_offset, chunk);
+        } else if (block_read_bytes(phys_block, block_offset,
+                                    buffer + bytes_read, chunk) != 0) {
+            break; /* I/O error: return what we have */
         }
         bytes_read += chunk;
     }
@@ -525,15 +1352,26 @@ int fs_read_at(uint32_t inode_num, uint8_t *buffer, uint32_t offset, uint32_t co
 /* ---- block-level partial write ---- */
 
 int fs_write_at(uint32_t inode_num, const uint8_t *data, uint32_t offset, uint32_t count) {
+    FS_LOCKED(-1);
     if (inode_num >= NUM_INODES) return -1;
     inode_t *node = &inodes[inode_num];
 
     if (node->type != INODE_FILE) return -1;
     if (count == 0) return 0;
 
+    /* Allocate every block the write reaches in one go, so they come out
+     * as a single extent; on a full disk write what fits.  Only the new
+     * blocks the write skips over (holes) are zeroed here; the rest are
+     * zeroed or filled block by block as the data goes in. */
+    uint32_t had = inode_nblocks(node);
+    uint32_t first = offset / BLOCK_SIZE;
+    inode_extend(node, (offset + count + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    int ok = first <= had || inode_zero(node, had, first) == 0;
+
     uint32_t bytes_written = 0;
+    map_cursor_t cur = { 0 };
 
-    while (bytes_written < count) {
+    while (ok && bytes_written < count) {
         uint32_t pos = offset + bytes_written;
         uint32_t block_index = pos / BLOCK_SIZE;
         uint32_t block_offset = pos % BLOCK_SIZE;
@@ -541,11 +1379,14 @@ int fs_write_at(uint32_t inode_num, const uint8_t *data, uint32_t offset, uint32
         if (chunk > count - bytes_written)
             chunk = count - bytes_written;
 
-        int phys_block = alloc_block_at(node, block_index);
-        if (phys_block < 0) break; /* out of blocks */
+        uint32_t phys_block = map_block_at(node, &cur, block_index, NULL);
+        if (phys_block == 0) break; /* out of blocks */
 
-        memcpy(BLOCK_PTR(phys_block) + block_offset, data + bytes_written, chunk);
-        mark_dirty(phys_block);
+        int rc = block_index >= had
+            ? block_fill_bytes(phys_block, block_offset, data + bytes_written, chunk)
+            : block_write_bytes(phys_block, block_offset, data + bytes_written, chunk);
+        if (rc != 0)
+            break;
         bytes_written += chunk;
     }
 
@@ -553,6 +1394,14 @@ int fs_write_at(uint32_t inode_num, const uint8_t *data, uint32_t offset, uint32
     if (offset + bytes_written > node->size)
         node->size = offset + bytes_written;
 
+    /* New blocks the write never reached hold stale disk data: give them
+     * back rather than leave them allocated */
+    if (bytes_written < count) {
+        uint32_t keep = bytes_written ? (offset + bytes_written + BLOCK_SIZE - 1) / BLOCK_SIZE
+                                      : (ok ? first : had);
+        inode_shrink(node, keep > had ? keep : had);
+    }
+
     node->modified_at = rtc_get_epoch();
     fs_dirty = 1;
 
@@ -564,116 +1413,144 @@ int fs_write_at(uint32_t inode_num, const uint8_t *data, uint32_t offset, uint32
 /* ---- public wrappers for internal functions ---- */
 
 int fs_resolve_path(const char *path, uint32_t *out_parent, char *out_name) {
+    FS_LOCKED(-1);
     return resolve_path(path, out_parent, out_name);
 }
 
 int fs_dir_lookup(uint32_t dir_inode_num, const char *name) {
+    FS_LOCKED(-1);
     return dir_lookup(dir_inode_num, name);
 }
 
-/* ---- helper: free all blocks of an inode (direct + indirect + double-indirect) ---- */
+/* ---- helper: free all blocks of an inode ---- */
 
 static void free_inode_blocks(inode_t *node) {
-    /* Free direct blocks */
-    for (uint8_t b = 0; b < node->num_blocks; b++) {
-        if (node->blocks[b] != 0)
-            free_block(node->blocks[b]);
-    }
-
-    /* Free single-indirect chain */
-    if (node->indirect_block != 0) {
-        uint32_t *ptrs = (uint32_t *)BLOCK_PTR(node->indirect_block);
-        for (uint32_t i = 0; i < INDIRECT_PTRS; i++) {
-            if (ptrs[i] != 0)
-                free_block(ptrs[i]);
-        }
-        free_block(node->indirect_block);
-        node->indirect_block = 0;
-    }
-
-    /* Free double-indirect chain: walk L1 -> each L2 -> free data -> free L2 -> free L1 */
-    if (node->double_indirect != 0) {
-        uint32_t *l1 = (uint32_t *)BLOCK_PTR(node->double_indirect);
-        for (uint32_t i = 0; i < INDIRECT_PTRS; i++) {
-            if (l1[i] == 0) continue;
-            uint32_t *l2 = (uint32_t *)BLOCK_PTR(l1[i]);
-            for (uint32_t j = 0; j < INDIRECT_PTRS; j++) {
-                if (l2[j] != 0)
-                    free_block(l2[j]);
-            }
-            free_block(l1[i]);
-        }
-        free_block(node->double_indirect);
-        node->double_indirect = 0;
-    }
+    inode_shrink(node, 0);
 }
 
 /* ---- disk persistence ---- */
 
+/* Write the blocks of `mem` that differ from `shadow`, one request per
+ * run of adjacent changed blocks, then bring the shadow up to date. */
+static int sync_region(uint32_t disk_blk, void *mem, void *shadow, uint32_t nblocks) {
+    uint8_t *m = mem, *d = shadow;
+    uint32_t b = 0;
+
+    while (b < nblocks) {
+        if (disk_meta_valid &&
+            memcmp(m + b * BLOCK_SIZE, d + b * BLOCK_SIZE, BLOCK_SIZE) == 0) {
+            b++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (b + run < nblocks &&
+               (!disk_meta_valid ||
+                memcmp(m + (b + run) * BLOCK_SIZE, d + (b + run) * BLOCK_SIZE,
+                       BLOCK_SIZE) != 0))
+            run++;
+
+        if (ata_write_sectors((disk_blk + b) * SECTORS_PER_BLOCK,
+                              run * SECTORS_PER_BLOCK, m + b * BLOCK_SIZE) != 0)
+            return -1;
+        memcpy(d + b * BLOCK_SIZE, m + b * BLOCK_SIZE, run * BLOCK_SIZE);
+        fs_meta_writes++;
+        b += run;
+    }
+    return 0;
+}
+
 int fs_sync(void) {
+    FS_LOCKED(-1);
     if (!ata_is_available()) {
         return -1;
     }
 
-    if (!fs_dirty) {
+    bcache_stats_t bc;
+    bcache_get_stats(&bc);
+    if (!fs_dirty && bc.dirty == 0) {
         return 0;
     }
 
-    /* Write superblock (block 0) — clear dirty flag on clean sync */
-    sb.magic = FS_MAGIC;
-    sb.version = FS_VERSION;
-    sb.block_size = BLOCK_SIZE;
-    sb.flags &= ~FS_FLAG_DIRTY;
-    if (ata_write_sectors(DISK_BLK_SUPERBLOCK * SECTORS_PER_BLOCK,
-                          SECTORS_PER_BLOCK, (uint8_t*)&sb) != 0) {
+    /* Data blocks first, so metadata never points at unwritten data */
+    if (bcache_flush() != 0)
         return -1;
-    }
 
-    /* Write inode bitmap (block 1) */
-    /* Pad to full block: inode_bitmap is 512 bytes, pad rest with zeros */
-    {
-        uint8_t bmp_block[BLOCK_SIZE];
+    /* Inode bitmap (block 1): 512 bytes padded to a full block */
+    if (!disk_meta_valid ||
+        memcmp(inode_bitmap, disk_inode_bitmap, sizeof(inode_bitmap)) != 0) {
+        static uint8_t bmp_block[BLOCK_SIZE];
         memset(bmp_block, 0, BLOCK_SIZE);
         memcpy(bmp_block, inode_bitmap, sizeof(inode_bitmap));
         if (ata_write_sectors(DISK_BLK_INODE_BITMAP * SECTORS_PER_BLOCK,
                               SECTORS_PER_BLOCK, bmp_block) != 0)
             return -1;
+        memcpy(disk_inode_bitmap, inode_bitmap, sizeof(inode_bitmap));
+        fs_meta_writes++;
     }
 
-    /* Write block bitmap (blocks 2-3, exactly 8192 bytes = 2 blocks) */
-    if (ata_write_sectors(DISK_BLK_BLOCK_BITMAP * SECTORS_PER_BLOCK,
-                          DISK_BLK_BLOCK_BITMAP_COUNT * SECTORS_PER_BLOCK,
-                          block_bitmap) != 0)
+    /* Block bitmap (blocks 2-3) and inode table (blocks 4-67) */
+    if (sync_region(DISK_BLK_BLOCK_BITMAP, block_bitmap, disk_block_bitmap,
+                    DISK_BLK_BLOCK_BITMAP_COUNT) != 0)
+        return -1;
+    if (sync_region(DISK_BLK_INODE_TABLE, inodes, disk_inodes,
+                    DISK_BLK_INODE_TABLE_COUNT) != 0)
         return -1;
 
-    /* Write inode table (blocks 4-67, one block at a time) */
-    for (int i = 0; i < DISK_BLK_INODE_TABLE_COUNT; i++) {
-        uint32_t lba = (DISK_BLK_INODE_TABLE + i) * SECTORS_PER_BLOCK;
-        uint8_t *ptr = (uint8_t*)inodes + (size_t)i * BLOCK_SIZE;
-        if (ata_write_sectors(lba, SECTORS_PER_BLOCK, ptr) != 0)
-            return -1;
-    }
-
-    /* Write dirty + allocated data blocks */
-    for (uint32_t i = DISK_METADATA_BLOCKS; i < NUM_BLOCKS; i++) {
-        if (bitmap_test(dirty_bitmap, i) && bitmap_test(block_bitmap, i)) {
-            uint32_t lba = i * SECTORS_PER_BLOCK;
-            if (ata_write_sectors(lba, SECTORS_PER_BLOCK, BLOCK_PTR(i)) != 0) {
-                return -1;
-            }
-        }
-    }
+    /* Superblock (block 0) last — clear dirty flag on clean sync */
+    sb.magic = FS_MAGIC;
+    sb.version = FS_VERSION;
+    sb.block_size = BLOCK_SIZE;
+    sb.flags &= ~FS_FLAG_DIRTY;
+    if (sync_region(DISK_BLK_SUPERBLOCK, &sb, &disk_sb, 1) != 0)
+        return -1;
 
     /* Flush disk cache */
     if (ata_flush() != 0) {
         return -1;
     }
 
-    memset(dirty_bitmap, 0, sizeof(dirty_bitmap));
+    disk_meta_valid = 1;
     fs_dirty = 0;
+    fs_clean_tick = pit_get_ticks();
     return 0;
 }
 
+/* ── Background writeback ─────────────────────────────────────── */
+
+/* Writes modified data and metadata once it has been dirty for
+ * FS_DIRTY_EXPIRE_MS, or sooner when too many cache blocks are dirty.
+ * fs_sync() takes the filesystem lock, so it waits for an operation in
+ * progress to finish and holds off new ones until the writeback is done;
+ * interrupts stay on and the disk drivers sleep on their completions. */
+static void fs_flusher_thread(void) {
+    uint32_t dirty_since = 0;
+    int was_dirty = 0;
+
+    for (;;) {
+        pit_sleep_ms(FS_FLUSH_INTERVAL_MS);
+
+        bcache_stats_t bc;
+        bcache_get_stats(&bc);
+        if (!fs_dirty && bc.dirty == 0) {
+            was_dirty = 0;
+            continue;
+        }
+
+        /* Age counts from the first wakeup that found the filesystem
+         * dirty after the last sync, whoever did it */
+        uint32_t now = pit_get_ticks();
+        if (!was_dirty || (int32_t)(fs_clean_tick - dirty_since) >= 0) {
+            was_dirty = 1;
+            dirty_since = now;
+        }
+        if (now - dirty_since < FS_DIRTY_EXPIRE_MS * 120 / 1000 &&
+            bc.dirty < FS_DIRTY_MAX_BLOCKS)
+            continue;
+
+        fs_sync();
+    }
+}
+
 int fs_load(void) {
     if (!ata_is_available()) {
         return -1;
@@ -725,23 +1602,13 @@ int fs_load(void) {
                          block_bitmap) != 0)
         return -1;
 
-    /* Read inode table (blocks 4-67) */
-    for (int i = 0; i < DISK_BLK_INODE_TABLE_COUNT; i++) {
-        uint32_t lba = (DISK_BLK_INODE_TABLE + i) * SECTORS_PER_BLOCK;
-        uint8_t *ptr = (uint8_t*)inodes + (size_t)i * BLOCK_SIZE;
-        if (ata_read_sectors(lba, SECTORS_PER_BLOCK, ptr) != 0)
-            return -1;
-    }
+    /* Read inode table (blocks 4-67) in one request */
+    if (ata_read_sectors(DISK_BLK_INODE_TABLE * SECTORS_PER_BLOCK,
+                         DISK_BLK_INODE_TABLE_COUNT * SECTORS_PER_BLOCK,
+                         (uint8_t*)inodes) != 0)
+        return -1;
 
-    /* Read allocated data blocks */
-    for (uint32_t i = DISK_METADATA_BLOCKS; i < NUM_BLOCKS; i++) {
-        if (bitmap_test(block_bitmap, i)) {
-            uint32_t lba = i * SECTORS_PER_BLOCK;
-            if (ata_read_sectors(lba, SECTORS_PER_BLOCK, BLOCK_PTR(i)) != 0) {
-                return -1;
-            }
-        }
-    }
+    /* Data blocks are read on demand through the block cache */
 
     /* Validate active inodes */
     for (uint32_t i = 0; i < NUM_INODES; i++) {
@@ -751,19 +1618,20 @@ int fs_load(void) {
         if (node->type > INODE_CHARDEV) {
             return -1;
         }
-        if (node->num_blocks > DIRECT_BLOCKS) {
+        if (node->type == INODE_CHARDEV)
+            continue;
+        if (node->num_extents > INODE_EXTENTS && node->extent_block == 0) {
             return -1;
         }
-        for (uint8_t b = 0; b < node->num_blocks; b++) {
-            if (node->blocks[b] >= NUM_BLOCKS) {
-                return -1;
-            }
-        }
-        if (node->indirect_block != 0 && node->indirect_block >= NUM_BLOCKS) {
+        if (node->extent_block >= NUM_BLOCKS) {
             return -1;
         }
-        if (node->double_indirect != 0 && node->double_indirect >= NUM_BLOCKS) {
-            return -1;
+        uint32_t inl = node->num_extents < INODE_EXTENTS ?
+                       node->num_extents : INODE_EXTENTS;
+        for (uint32_t e = 0; e < inl; e++) {
+            if (node->extents[e].start + node->extents[e].len > NUM_BLOCKS) {
+                return -1;
+            }
         }
     }
 
@@ -774,32 +1642,43 @@ int fs_load(void) {
         sb.cwd_inode = ROOT_INODE;
     }
 
-    memset(dirty_bitmap, 0, sizeof(dirty_bitmap));
+    memcpy(&disk_sb, &sb, sizeof(sb));
+    memcpy(disk_inode_bitmap, inode_bitmap, sizeof(inode_bitmap));
+    memcpy(disk_block_bitmap, block_bitmap, sizeof(block_bitmap));
+    memcpy(disk_inodes, inodes, sizeof(inodes));
+    disk_meta_valid = 1;
     fs_dirty = 0;
+    fx_build();
     return 0;
 }
 
+static void fs_start_flusher(void) {
+    static int flusher_tid = -1;
+    if (flusher_tid >= 0 || !sched_is_active())
+        return;
+    flusher_tid = task_create_thread("fsflush", fs_flusher_thread, 0);
+    if (flusher_tid < 0)
+        DBG("[FS] could not start flusher thread; writes wait for sync");
+}
+
+uint32_t fs_get_meta_writes(void) {
+    return fs_meta_writes;
+}
+
 /* ---- public API ---- */
 
 void fs_initialize(void) {
     /* Initialize VFS mount table */
     vfs_init();
 
-    /* Allocate data blocks memory (256MB) */
-    if (!data_blocks) {
-        data_blocks = (uint8_t *)malloc((size_t)NUM_BLOCKS * BLOCK_SIZE);
-        if (!data_blocks) {
-            DBG("[FS] FATAL: cannot allocate %u MB for data blocks",
-                (NUM_BLOCKS * BLOCK_SIZE) / (1024 * 1024));
-            return;
-        }
-    }
-    memset(data_blocks, 0, (size_t)NUM_BLOCKS * BLOCK_SIZE);
+    /* Data blocks are cached on demand instead of mirrored in RAM */
+    bcache_init(BCACHE_DEFAULT_PAGES);
+    dcache_init();
     memset(inode_bitmap, 0, sizeof(inode_bitmap));
     memset(block_bitmap, 0, sizeof(block_bitmap));
-    memset(dirty_bitmap, 0, sizeof(dirty_bitmap));
 
     /* Try to load from disk first */
+    disk_meta_valid = 0;
     if (ata_is_available() && fs_load() == 0) {
         DBG("[FS] Loaded v%u filesystem: %u inodes, %u blocks (%u KB each)",
             sb.version, sb.num_inodes, sb.num_blocks, BLOCK_SIZE / 1024);
@@ -808,16 +1687,16 @@ void fs_initialize(void) {
         ata_write_sectors(DISK_BLK_SUPERBLOCK * SECTORS_PER_BLOCK,
                           SECTORS_PER_BLOCK, (uint8_t*)&sb);
         ata_flush();
+        memcpy(&disk_sb, &sb, sizeof(sb));
         /* Initialize journal */
         journal_init();
     } else {
         /* Otherwise initialize new filesystem in memory */
         memset(&sb, 0, sizeof(sb));
         memset(inodes, 0, sizeof(inodes));
-        memset(data_blocks, 0, (size_t)NUM_BLOCKS * BLOCK_SIZE);
+        bcache_init(BCACHE_DEFAULT_PAGES);  /* drop anything a failed load cached */
         memset(inode_bitmap, 0, sizeof(inode_bitmap));
         memset(block_bitmap, 0, sizeof(block_bitmap));
-        memset(dirty_bitmap, 0, sizeof(dirty_bitmap));
 
         sb.magic = FS_MAGIC;
         sb.version = FS_VERSION;
@@ -830,6 +1709,7 @@ void fs_initialize(void) {
         for (uint32_t i = 0; i < DISK_METADATA_BLOCKS; i++) {
             bitmap_set(block_bitmap, i);
         }
+        fx_build();
 
         /* allocate root inode */
         bitmap_set(inode_bitmap, ROOT_INODE);
@@ -838,8 +1718,6 @@ void fs_initialize(void) {
         inodes[ROOT_INODE].mode = 0755;
         inodes[ROOT_INODE].owner_uid = 0;
         inodes[ROOT_INODE].owner_gid = 0;
-        inodes[ROOT_INODE].indirect_block = 0;
-        inodes[ROOT_INODE].double_indirect = 0;
 
         /* create default directory hierarchy */
         fs_create_file("/home", 1);
@@ -877,6 +1755,9 @@ void fs_initialize(void) {
         }
     }
 
+    if (ata_is_available())
+        fs_start_flusher();
+
     /* Mount special virtual filesystems via VFS */
     procfs_init();
     devfs_init();
@@ -884,6 +1765,7 @@ void fs_initialize(void) {
 }
 
 int fs_create_file(const char* filename, uint8_t is_directory) {
+    FS_LOCKED(-1);
     /* VFS dispatch */
     const char *rel;
     vfs_mount_t *mnt = vfs_resolve(filename, &rel);
@@ -917,9 +1799,8 @@ int fs_create_file(const char* filename, uint8_t is_directory) {
     } else {
         inodes[idx].type = INODE_FILE;
         inodes[idx].size = 0;
-        inodes[idx].num_blocks = 0;
-        inodes[idx].indirect_block = 0;
-        inodes[idx].double_indirect = 0;
+        inodes[idx].num_extents = 0;
+        inodes[idx].extent_block = 0;
         inodes[idx].mode = 0644;
     }
     inodes[idx].owner_uid = user_get_current_uid();
@@ -936,8 +1817,7 @@ int fs_create_file(const char* filename, uint8_t is_directory) {
 
     if (dir_add_entry(parent, name, idx) < 0) {
         /* clean up allocated blocks */
-        for (uint8_t b = 0; b < inodes[idx].num_blocks; b++)
-            free_block(inodes[idx].blocks[b]);
+        free_inode_blocks(&inodes[idx]);
         free_inode(idx);
         journal_commit();
         return -1;
@@ -947,15 +1827,11 @@ int fs_create_file(const char* filename, uint8_t is_directory) {
     journal_log_inode_update(parent);
     journal_commit();
 
-    /* Auto-sync if disk available */
-    if (ata_is_available()) {
-        fs_sync();
-    }
-
     return 0;
 }
 
 int fs_create_device(const char* path, uint8_t major, uint8_t minor) {
+    FS_LOCKED(-1);
     uint32_t parent;
     char name[MAX_NAME_LEN];
 
@@ -971,11 +1847,10 @@ int fs_create_device(const char* path, uint8_t major, uint8_t minor) {
     inodes[idx].type = INODE_CHARDEV;
     inodes[idx].mode = 0666;
     inodes[idx].size = 0;
-    inodes[idx].num_blocks = 0;
-    inodes[idx].indirect_block = 0;
-    inodes[idx].double_indirect = 0;
-    inodes[idx].blocks[0] = major;  /* major device number */
-    inodes[idx].blocks[1] = minor;  /* minor device number */
+    inodes[idx].num_extents = 0;
+    inodes[idx].extent_block = 0;
+    inodes[idx].dev.major = major;
+    inodes[idx].dev.minor = minor;
     inodes[idx].owner_uid = 0;
     inodes[idx].owner_gid = 0;
 
@@ -991,13 +1866,11 @@ int fs_create_device(const char* path, uint8_t major, uint8_t minor) {
     }
 
     fs_dirty = 1;
-    if (ata_is_available()) {
-        fs_sync();
-    }
     return 0;
 }
 
 int fs_write_file(const char* filename, const uint8_t* data, size_t size) {
+    FS_LOCKED(-1);
     /* VFS dispatch */
     const char *rel;
     vfs_mount_t *mnt = vfs_resolve(filename, &rel);
@@ -1022,43 +1895,51 @@ int fs_write_file(const char* filename, const uint8_t* data, size_t size) {
 
     /* Free all existing blocks */
     free_inode_blocks(inode);
-    inode->num_blocks = 0;
     inode->size = 0;
-    inode->indirect_block = 0;
-    inode->double_indirect = 0;
 
-    /* Write data using alloc_block_at */
+    /* Allocate the whole file up front so it lands in as few extents as
+     * the free space allows, then fill it run by run */
+    if (inode_extend(inode, (uint32_t)((size + BLOCK_SIZE - 1) / BLOCK_SIZE)) != 0) {
+        free_inode_blocks(inode);
+        return -1;
+    }
+
     size_t remaining = size;
     size_t offset = 0;
     uint32_t block_index = 0;
+    map_cursor_t cur = { 0 };
 
     while (remaining > 0) {
-        int phys_blk = alloc_block_at(inode, block_index);
-        if (phys_blk < 0) return -1;
+        uint32_t run;
+        uint32_t phys_blk = map_block_at(inode, &cur, block_index, &run);
+        if (phys_blk == 0) {
+            free_inode_blocks(inode);
+            return -1;
+        }
 
-        size_t chunk = remaining > BLOCK_SIZE ? BLOCK_SIZE : remaining;
-        memcpy(BLOCK_PTR(phys_blk), data + offset, chunk);
-        mark_dirty(phys_blk);
-        offset += chunk;
-        remaining -= chunk;
-        block_index++;
+        for (; run > 0 && remaining > 0; run--, phys_blk++) {
+            size_t chunk = remaining > BLOCK_SIZE ? BLOCK_SIZE : remaining;
+            if (block_fill_bytes(phys_blk, 0, data + offset, chunk) != 0) {
+                free_inode_blocks(inode);
+                return -1;
+            }
+            offset += chunk;
+            remaining -= chunk;
+            block_index++;
+        }
     }
 
     inode->size = size;
     inode->modified_at = rtc_get_epoch();
     fs_dirty = 1;
 
-    /* Auto-sync if disk available */
-    if (ata_is_available()) {
-        fs_sync();
-    }
-
     fs_wr_ops++;
     fs_wr_bytes += (uint32_t)size;
     return 0;
 }
 
 int fs_read_file(const char* filename, uint8_t* buffer, size_t* size) {
+    FS_LOCKED(-1);
     /* VFS dispatch */
     const char *rel;
     vfs_mount_t *mnt = vfs_resolve(filename, &rel);
@@ -1076,9 +1957,9 @@ int fs_read_file(const char* filename, uint8_t* buffer, size_t* size) {
     /* Follow symlinks */
     if (inode->type == INODE_SYMLINK) {
         char target[256];
-        if (inode->num_blocks == 0) return -1;
+        if (inode->num_extents == 0) return -1;
         size_t tlen = inode->size < 255 ? inode->size : 255;
-        memcpy(target, BLOCK_PTR(inode->blocks[0]), tlen);
+        if (block_read_bytes(inode->extents[0].start, 0, target, tlen) != 0) return -1;
         target[tlen] = '\0';
         return fs_read_file(target, buffer, size);
     }
@@ -1091,24 +1972,37 @@ int fs_read_file(const char* filename, uint8_t* buffer, size_t* size) {
     if (inode->type != INODE_FILE) return -1;
     if (!check_permission(inode, PERM_R)) return -1;
 
-    /* Read using get_block_at for all block levels */
+    /* Read extent by extent, fetching each run from disk in one go */
     uint32_t remaining = inode->size;
     uint32_t offset = 0;
     uint32_t block_index = 0;
+    map_cursor_t cur = { 0 };
 
     while (remaining > 0) {
-        uint32_t chunk = remaining > BLOCK_SIZE ? BLOCK_SIZE : remaining;
-        uint32_t phys_block = get_block_at(inode, block_index);
+        uint32_t run;
+        uint32_t phys_block = map_block_at(inode, &cur, block_index, &run);
 
         if (phys_block == 0) {
-            /* Hole — fill with zeros */
+            /* Past the allocation — fill with zeros */
+            uint32_t chunk = remaining > BLOCK_SIZE ? BLOCK_SIZE : remaining;
             memset(buffer + offset, 0, chunk);
-        } else {
-            memcpy(buffer + offset, BLOCK_PTR(phys_block), chunk);
+            offset += chunk;
+            remaining -= chunk;
+            block_index++;
+            continue;
+        }
+
+        uint32_t want = (remaining + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (run > want) run = want;
+        read_ahead(phys_block, run, run);
+        for (; run > 0; run--, phys_block++) {
+            uint32_t chunk = remaining > BLOCK_SIZE ? BLOCK_SIZE : remaining;
+            if (block_read_bytes(phys_block, 0, buffer + offset, chunk) != 0)
+                return -1;
+            offset += chunk;
+            remaining -= chunk;
+            block_index++;
         }
-        offset += chunk;
-        remaining -= chunk;
-        block_index++;
     }
 
     *size = inode->size;
@@ -1119,6 +2013,7 @@ int fs_read_file(const char* filename, uint8_t* buffer, size_t* size) {
 }
 
 int fs_delete_file(const char* filename) {
+    FS_LOCKED(-1);
     /* VFS dispatch */
     const char *rel;
     vfs_mount_t *mnt = vfs_resolve(filename, &rel);
@@ -1140,16 +2035,21 @@ int fs_delete_file(const char* filename) {
 
     /* if directory, check it's empty (only . and ..) */
     if (inode->type == INODE_DIR) {
-        for (uint8_t b = 0; b < inode->num_blocks; b++) {
-            dir_entry_t* entries = (dir_entry_t*)BLOCK_PTR(inode->blocks[b]);
-            int entries_per_block = BLOCK_SIZE / sizeof(dir_entry_t);
+        uint32_t nb = inode_nblocks(inode);
+        for (uint32_t b = 0; b < nb; b++) {
+            bcache_buf_t *buf = dir_block(inode, b);
+            if (!buf) return -1;
+            dir_entry_t* entries = (dir_entry_t*)buf->data;
+            int entries_per_block = (int)dir_slots(inode, b);
             for (int e = 0; e < entries_per_block; e++) {
                 if (entries[e].name[0] != '\0' &&
                     local_strncmp(entries[e].name, ".", MAX_NAME_LEN) != 0 &&
                     local_strncmp(entries[e].name, "..", MAX_NAME_LEN) != 0) {
+                    bcache_release(buf);
                     return -1;  /* not empty */
                 }
             }
+            bcache_release(buf);
         }
     }
 
@@ -1160,8 +2060,9 @@ int fs_delete_file(const char* filename) {
     journal_log_dir_remove(parent, inode_idx, name);
     journal_log_inode_update(parent);
 
-    /* Decrement link count; only free inode+blocks when nlink reaches 0 */
-    if (inode->nlink > 1) {
+    /* Decrement link count; only free inode+blocks when nlink reaches 0.
+     * Directories can't be hard-linked, so an empty one always goes. */
+    if (inode->type != INODE_DIR && inode->nlink > 1) {
         inode->nlink--;
         inode->modified_at = rtc_get_epoch();
         journal_log_inode_update(inode_idx);
@@ -1176,17 +2077,13 @@ int fs_delete_file(const char* filename) {
         journal_commit();
     }
 
-    /* Auto-sync if disk available */
-    if (ata_is_available()) {
-        fs_sync();
-    }
-
     return 0;
 }
 
 /* ---- truncate ---- */
 
 int fs_truncate(const char *path, uint32_t new_size) {
+    FS_LOCKED(-1);
     /* VFS dispatch */
     const char *rel;
     vfs_mount_t *mnt = vfs_resolve(path, &rel);
@@ -1211,84 +2108,29 @@ int fs_truncate(const char *path, uint32_t new_size) {
             /* The last block has data up to tail_off; zero from there to block end
              * (or to new_size if still within same block) */
             uint32_t last_logical = (old_size - 1) / BLOCK_SIZE;
-            uint32_t phys = get_block_at(node, last_logical);
+            uint32_t phys = map_block(node, last_logical, NULL);
             if (phys != 0) {
                 uint32_t zero_end = BLOCK_SIZE;
                 uint32_t new_in_block = new_size - (last_logical * BLOCK_SIZE);
                 if (new_in_block < BLOCK_SIZE) zero_end = new_in_block;
-                if (zero_end > tail_off) {
-                    memset(BLOCK_PTR(phys) + tail_off, 0, zero_end - tail_off);
-                    mark_dirty(phys);
-                }
+                if (zero_end > tail_off)
+                    block_write_bytes(phys, tail_off, NULL, zero_end - tail_off);
             }
         }
         node->size = new_size;
     } else {
         /* Shrinking — free blocks beyond new_size */
-        uint32_t new_last_block = (new_size > 0) ? (new_size - 1) / BLOCK_SIZE : 0;
-        uint32_t old_last_block = (node->size > 0) ? (node->size - 1) / BLOCK_SIZE : 0;
-
-        /* Free blocks from new_last_block+1 onwards */
-        for (uint32_t b = (new_size == 0 ? 0 : new_last_block + 1); b <= old_last_block; b++) {
-            uint32_t phys = get_block_at(node, b);
-            if (phys != 0) {
-                free_block(phys);
-                /* Zero out the pointer — we'd need set_block_at for full cleanup,
-                 * but free_block prevents reallocation conflicts. For direct blocks
-                 * we can clear directly. */
-                if (b < DIRECT_BLOCKS) {
-                    node->blocks[b] = 0;
-                    if (b < node->num_blocks && b == node->num_blocks - 1) {
-                        /* Trim num_blocks */
-                        while (node->num_blocks > 0 && node->blocks[node->num_blocks - 1] == 0)
-                            node->num_blocks--;
-                    }
-                }
-                /* Indirect/double-indirect pointer cleanup happens
-                 * when the entire chain is freed below */
-            }
-        }
-
-        /* If no indirect blocks needed anymore, free them */
-        if (new_size <= MAX_DIRECT_SIZE) {
-            if (node->indirect_block != 0) {
-                uint32_t *ptrs = (uint32_t *)BLOCK_PTR(node->indirect_block);
-                for (uint32_t i = 0; i < INDIRECT_PTRS; i++) {
-                    if (ptrs[i] != 0) free_block(ptrs[i]);
-                }
-                free_block(node->indirect_block);
-                node->indirect_block = 0;
-            }
-            if (node->double_indirect != 0) {
-                uint32_t *l1 = (uint32_t *)BLOCK_PTR(node->double_indirect);
-                for (uint32_t i = 0; i < INDIRECT_PTRS; i++) {
-                    if (l1[i] == 0) continue;
-                    uint32_t *l2 = (uint32_t *)BLOCK_PTR(l1[i]);
-                    for (uint32_t j = 0; j < INDIRECT_PTRS; j++) {
-                        if (l2[j] != 0) free_block(l2[j]);
-                    }
-                    free_block(l1[i]);
-                }
-                free_block(node->double_indirect);
-                node->double_indirect = 0;
-            }
-        }
-
-        /* Recalculate num_blocks for direct region */
-        while (node->num_blocks > 0 && node->blocks[node->num_blocks - 1] == 0)
-            node->num_blocks--;
-
+        inode_shrink(node, (new_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
         node->size = new_size;
     }
 
     node->modified_at = rtc_get_epoch();
     fs_dirty = 1;
-
-    if (ata_is_available()) fs_sync();
     return 0;
 }
 
 int fs_truncate_inode(uint32_t inode_num, uint32_t new_size) {
+    FS_LOCKED(-1);
     if (inode_num >= NUM_INODES) return -1;
     inode_t *node = &inodes[inode_num];
     if (node->type != INODE_FILE) return -1;
@@ -1296,44 +2138,7 @@ int fs_truncate_inode(uint32_t inode_num, uint32_t new_size) {
     if (new_size >= node->size) {
         node->size = new_size;
     } else {
-        uint32_t new_last_block = (new_size > 0) ? (new_size - 1) / BLOCK_SIZE : 0;
-        uint32_t old_last_block = (node->size > 0) ? (node->size - 1) / BLOCK_SIZE : 0;
-
-        for (uint32_t b = (new_size == 0 ? 0 : new_last_block + 1); b <= old_last_block; b++) {
-            uint32_t phys = get_block_at(node, b);
-            if (phys != 0) {
-                free_block(phys);
-                if (b < DIRECT_BLOCKS) node->blocks[b] = 0;
-            }
-        }
-
-        if (new_size <= MAX_DIRECT_SIZE) {
-            if (node->indirect_block != 0) {
-                uint32_t *ptrs = (uint32_t *)BLOCK_PTR(node->indirect_block);
-                for (uint32_t i = 0; i < INDIRECT_PTRS; i++) {
-                    if (ptrs[i] != 0) free_block(ptrs[i]);
-                }
-                free_block(node->indirect_block);
-                node->indirect_block = 0;
-            }
-            if (node->double_indirect != 0) {
-                uint32_t *l1 = (uint32_t *)BLOCK_PTR(node->double_indirect);
-                for (uint32_t i = 0; i < INDIRECT_PTRS; i++) {
-                    if (l1[i] == 0) continue;
-                    uint32_t *l2 = (uint32_t *)BLOCK_PTR(l1[i]);
-                    for (uint32_t j = 0; j < INDIRECT_PTRS; j++) {
-                        if (l2[j] != 0) free_block(l2[j]);
-                    }
-                    free_block(l1[i]);
-                }
-                free_block(node->double_indirect);
-                node->double_indirect = 0;
-            }
-        }
-
-        while (node->num_blocks > 0 && node->blocks[node->num_blocks - 1] == 0)
-            node->num_blocks--;
-
+        inode_shrink(node, (new_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
         node->size = new_size;
     }
 
@@ -1378,17 +2183,17 @@ static void print_long_entry(const char* name, uint32_t ino) {
     if (node->type == INODE_CHARDEV) {
         printf("%s  %s  %u, %u  %s  %s",
                perm, owner,
-               (unsigned)node->blocks[0], (unsigned)node->blocks[1],
+               (unsigned)node->dev.major, (unsigned)node->dev.minor,
                timebuf, name);
     } else {
         printf("%s  %s  %5d  %s  %s", perm, owner, (int)node->size, timebuf, name);
     }
 
     /* Print symlink target */
-    if (node->type == INODE_SYMLINK && node->num_blocks > 0) {
+    if (node->type == INODE_SYMLINK && node->num_extents > 0) {
         char target[256];
         size_t tlen = node->size < 255 ? node->size : 255;
-        memcpy(target, BLOCK_PTR(node->blocks[0]), tlen);
+        if (block_read_bytes(node->extents[0].start, 0, target, tlen) != 0) tlen = 0;
         target[tlen] = '\0';
         printf(" -> %s", target);
     }
@@ -1397,6 +2202,7 @@ static void print_long_entry(const char* name, uint32_t ino) {
 }
 
 void fs_list_directory(int flags) {
+    FS_LOCKED();
     int show_all = flags & LS_ALL;
     int long_fmt = flags & LS_LONG;
 
@@ -1435,9 +2241,13 @@ void fs_list_directory(int flags) {
     inode_t* dir = &inodes[sb.cwd_inode];
     int col = 0;
 
-    for (uint8_t b = 0; b < dir->num_blocks; b++) {
-        dir_entry_t* entries = (dir_entry_t*)BLOCK_PTR(dir->blocks[b]);
-        int entries_per_block = BLOCK_SIZE / sizeof(dir_entry_t);
+    dir_prefetch(dir);
+    uint32_t nb = inode_nblocks(dir);
+    for (uint32_t b = 0; b < nb; b++) {
+        bcache_buf_t *buf = dir_block(dir, b);
+        if (!buf) continue;
+        dir_entry_t* entries = (dir_entry_t*)buf->data;
+        int entries_per_block = (int)dir_slots(dir, b);
         for (int e = 0; e < entries_per_block; e++) {
             if (entries[e].name[0] == '\0') continue;
             int is_dot = (local_strncmp(entries[e].name, ".", MAX_NAME_LEN) == 0 ||
@@ -1452,11 +2262,13 @@ void fs_list_directory(int flags) {
                 col++;
             }
         }
+        bcache_release(buf);
     }
     if (!long_fmt && col > 0) printf("\n");
 }
 
 int fs_enumerate_directory(fs_dir_entry_info_t *out, int max, int show_dot) {
+    FS_LOCKED(-1);
     /* VFS dispatch: check if CWD is under a virtual mount */
     const char *cwd = fs_get_cwd();
     const char *rel;
@@ -1467,9 +2279,13 @@ int fs_enumerate_directory(fs_dir_entry_info_t *out, int max, int show_dot) {
     inode_t* dir = &inodes[sb.cwd_inode];
     int count = 0;
 
-    for (uint8_t b = 0; b < dir->num_blocks && count < max; b++) {
-        dir_entry_t* entries = (dir_entry_t*)BLOCK_PTR(dir->blocks[b]);
-        int entries_per_block = BLOCK_SIZE / sizeof(dir_entry_t);
+    dir_prefetch(dir);
+    uint32_t nb = inode_nblocks(dir);
+    for (uint32_t b = 0; b < nb && count < max; b++) {
+        bcache_buf_t *buf = dir_block(dir, b);
+        if (!buf) continue;
+        dir_entry_t* entries = (dir_entry_t*)buf->data;
+        int entries_per_block = (int)dir_slots(dir, b);
         for (int e = 0; e < entries_per_block && count < max; e++) {
             if (entries[e].name[0] == '\0') continue;
             int is_dot = (local_strncmp(entries[e].name, ".", MAX_NAME_LEN) == 0 ||
@@ -1490,11 +2306,13 @@ int fs_enumerate_directory(fs_dir_entry_info_t *out, int max, int show_dot) {
             }
             count++;
         }
+        bcache_release(buf);
     }
     return count;
 }
 
 int fs_change_directory(const char* dirname) {
+    FS_LOCKED(-1);
     uint32_t parent;
     char name[MAX_NAME_LEN];
     int inode_idx = resolve_path(dirname, &parent, name);
@@ -1513,6 +2331,7 @@ int fs_change_directory(const char* dirname) {
 }
 
 int fs_change_directory_by_inode(uint32_t inode_num) {
+    FS_LOCKED(-1);
     if (inode_num >= NUM_INODES) return -1;
     if (inodes[inode_num].type != INODE_DIR) return -1;
     sb.cwd_inode = inode_num;
@@ -1521,6 +2340,7 @@ int fs_change_directory_by_inode(uint32_t inode_num) {
 
 const char* fs_get_cwd(void) {
     static char path[512];
+    FS_LOCKED(path);    /* last path built */
 
     if (sb.cwd_inode == ROOT_INODE) {
         path[0] = '/';
@@ -1541,9 +2361,12 @@ const char* fs_get_cwd(void) {
         /* find cur's name in parent */
         inode_t* pdir = &inodes[parent_inode];
         int found = 0;
-        for (uint8_t b = 0; b < pdir->num_blocks && !found; b++) {
-            dir_entry_t* entries = (dir_entry_t*)BLOCK_PTR(pdir->blocks[b]);
-            int entries_per_block = BLOCK_SIZE / sizeof(dir_entry_t);
+        uint32_t nb = inode_nblocks(pdir);
+        for (uint32_t b = 0; b < nb && !found; b++) {
+            bcache_buf_t *buf = dir_block(pdir, b);
+            if (!buf) continue;
+            dir_entry_t* entries = (dir_entry_t*)buf->data;
+            int entries_per_block = (int)dir_slots(pdir, b);
             for (int e = 0; e < entries_per_block; e++) {
                 if (entries[e].inode == cur && entries[e].name[0] != '\0' &&
                     local_strncmp(entries[e].name, ".", MAX_NAME_LEN) != 0 &&
@@ -1553,6 +2376,7 @@ const char* fs_get_cwd(void) {
                     break;
                 }
             }
+            bcache_release(buf);
         }
         if (!found) break;
         depth++;
@@ -1579,6 +2403,7 @@ inode_t *fs_get_inode_ptr(uint32_t ino) {
 }
 
 int fs_chmod(const char* path, uint16_t mode) {
+    FS_LOCKED(-1);
     /* VFS dispatch */
     const char *rel;
     vfs_mount_t *mnt = vfs_resolve(path, &rel);
@@ -1599,12 +2424,11 @@ int fs_chmod(const char* path, uint16_t mode) {
 
     node->mode = mode & 0777;
     fs_dirty = 1;
-
-    if (ata_is_available()) fs_sync();
     return 0;
 }
 
 int fs_chown(const char* path, uint16_t uid, uint16_t gid) {
+    FS_LOCKED(-1);
     /* VFS dispatch */
     const char *rel;
     vfs_mount_t *mnt = vfs_resolve(path, &rel);
@@ -1623,12 +2447,11 @@ int fs_chown(const char* path, uint16_t uid, uint16_t gid) {
     inodes[inode_idx].owner_uid = uid;
     inodes[inode_idx].owner_gid = gid;
     fs_dirty = 1;
-
-    if (ata_is_available()) fs_sync();
     return 0;
 }
 
 int fs_link(const char* oldpath, const char* newpath) {
+    FS_LOCKED(-1);
     uint32_t old_parent;
     char old_name[MAX_NAME_LEN];
     int old_inode = resolve_path(oldpath, &old_parent, old_name);
@@ -1655,12 +2478,11 @@ int fs_link(const char* oldpath, const char* newpath) {
     inodes[old_inode].nlink++;
     inodes[old_inode].modified_at = rtc_get_epoch();
     fs_dirty = 1;
-
-    if (ata_is_available()) fs_sync();
     return 0;
 }
 
 int fs_create_symlink(const char* target, const char* linkname) {
+    FS_LOCKED(-1);
     /* VFS dispatch (on the linkname, not target) */
     const char *rel;
     vfs_mount_t *mnt = vfs_resolve(linkname, &rel);
@@ -1683,8 +2505,6 @@ int fs_create_symlink(const char* target, const char* linkname) {
     inodes[idx].type = INODE_SYMLINK;
     inodes[idx].mode = 0777;
     inodes[idx].nlink = 1;
-    inodes[idx].indirect_block = 0;
-    inodes[idx].double_indirect = 0;
     inodes[idx].owner_uid = user_get_current_uid();
     inodes[idx].owner_gid = user_get_current_gid();
 
@@ -1695,29 +2515,31 @@ int fs_create_symlink(const char* target, const char* linkname) {
         return -1;
     }
 
-    int blk = alloc_block();
-    if (blk < 0) {
+    if (inode_grow(&inodes[idx], 1) != 0) {
+        free_inode_blocks(&inodes[idx]);
         free_inode(idx);
         return -1;
     }
 
-    memcpy(BLOCK_PTR(blk), target, tlen);
-    inodes[idx].blocks[0] = blk;
-    inodes[idx].num_blocks = 1;
+    if (block_write_bytes(inodes[idx].extents[0].start, 0, target, tlen) != 0) {
+        free_inode_blocks(&inodes[idx]);
+        free_inode(idx);
+        return -1;
+    }
     inodes[idx].size = tlen;
 
     if (dir_add_entry(parent, name, idx) < 0) {
-        free_block(blk);
+        free_inode_blocks(&inodes[idx]);
         free_inode(idx);
         return -1;
     }
 
     fs_dirty = 1;
-    if (ata_is_available()) fs_sync();
     return 0;
 }
 
 int fs_readlink(const char* path, char* buf, size_t bufsize) {
+    FS_LOCKED(-1);
     /* VFS dispatch */
     const char *rel;
     vfs_mount_t *mnt = vfs_resolve(path, &rel);
@@ -1732,17 +2554,18 @@ int fs_readlink(const char* path, char* buf, size_t bufsize) {
 
     inode_t* node = &inodes[inode_idx];
     if (node->type != INODE_SYMLINK) return -1;
-    if (node->num_blocks == 0) return -1;
+    if (node->num_extents == 0) return -1;
 
     size_t tlen = node->size;
     if (tlen >= bufsize) tlen = bufsize - 1;
 
-    memcpy(buf, BLOCK_PTR(node->blocks[0]), tlen);
+    if (block_read_bytes(node->extents[0].start, 0, buf, tlen) != 0) return -1;
     buf[tlen] = '\0';
     return 0;
 }
 
 int fs_rename(const char* old_name, const char* new_name) {
+    FS_LOCKED(-1);
     if (!old_name || !new_name || new_name[0] == '\0') return -1;
     if (local_strncmp(old_name, ".", MAX_NAME_LEN) == 0 ||
         local_strncmp(old_name, "..", MAX_NAME_LEN) == 0) return -1;
@@ -1750,21 +2573,40 @@ int fs_rename(const char* old_name, const char* new_name) {
     /* Check new name doesn't already exist */
     if (dir_lookup(sb.cwd_inode, new_name) >= 0) return -1;
 
-    /* Find and rename the directory entry in-place */
     inode_t *dir = &inodes[sb.cwd_inode];
-    for (uint8_t b = 0; b < dir->num_blocks; b++) {
-        dir_entry_t *entries = (dir_entry_t *)BLOCK_PTR(dir->blocks[b]);
+
+    /* A hashed directory files the entry under its new name's hash */
+    if (dir->flags & INODE_FL_INDEX) {
+        int ino = dir_lookup(sb.cwd_inode, old_name);
+        if (ino < 0) return -1;
+        if (dir_remove_entry(sb.cwd_inode, old_name) != 0) return -1;
+        if (dir_add_entry(sb.cwd_inode, new_name, (uint32_t)ino) != 0) {
+            dir_add_entry(sb.cwd_inode, old_name, (uint32_t)ino);
+            return -1;
+        }
+        return 0;
+    }
+
+    /* Find and rename the directory entry in-place */
+    dcache_invalidate(sb.cwd_inode, old_name);
+    dcache_invalidate(sb.cwd_inode, new_name);
+    uint32_t nb = inode_nblocks(dir);
+    for (uint32_t b = 0; b < nb; b++) {
+        bcache_buf_t *buf = dir_block(dir, b);
+        if (!buf) continue;
+        dir_entry_t *entries = (dir_entry_t *)buf->data;
         int entries_per_block = BLOCK_SIZE / sizeof(dir_entry_t);
         for (int e = 0; e < entries_per_block; e++) {
             if (entries[e].name[0] != '\0' &&
                 local_strncmp(entries[e].name, old_name, MAX_NAME_LEN) == 0) {
                 local_strncpy(entries[e].name, new_name, MAX_NAME_LEN);
-                mark_dirty(dir->blocks[b]);
+                bcache_dirty(buf);
+                bcache_release(buf);
                 fs_dirty = 1;
-                if (ata_is_available()) fs_sync();
                 return 0;
             }
         }
+        bcache_release(buf);
     }
     return -1;
 }
@@ -1772,6 +2614,7 @@ int fs_rename(const char* old_name, const char* new_name) {
 /* ---- initrd mounting ---- */
 
 int fs_mount_initrd(const uint8_t* data, uint32_t size) {
+    FS_LOCKED(-1);
     if (!data || size < 512) return -1;
 
     /* Parse tar headers and materialize files into the real FS */
@@ -1878,17 +2721,26 @@ void fs_get_io_stats(uint32_t *rd_ops, uint32_t *rd_bytes, uint32_t *wr_ops, uin
 }
 
 uint32_t fs_count_free_blocks(void) {
-    uint32_t count = 0;
-    for (uint32_t i = DISK_METADATA_BLOCKS; i < NUM_BLOCKS; i++) {
-        uint32_t byte = i / 8;
-        uint32_t bit = i % 8;
-        if (!(block_bitmap[byte] & (1 << bit)))
-            count++;
-    }
-    return count;
+    return free_block_total;
+}
+
+uint32_t fs_count_free_extents(void) {
+    FS_LOCKED(0);
+    return free_ext_count;
+}
+
+uint32_t fs_inode_blocks(const inode_t *node) {
+    FS_LOCKED(0);
+    return inode_nblocks(node);
+}
+
+uint32_t fs_inode_block_at(const inode_t *node, uint32_t logical) {
+    FS_LOCKED(0);
+    return map_block(node, logical, NULL);
 }
 
 uint32_t fs_count_free_inodes(void) {
+    FS_LOCKED(0);
     uint32_t count = 0;
     for (uint32_t i = 1; i < NUM_INODES; i++) {  /* skip root inode 0 */
         uint32_t byte = i / 8;
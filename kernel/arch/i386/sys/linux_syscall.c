@@ -10,6 +10,7 @@
 #include <kernel/signal.h>
 #include <kernel/shm.h>
 #include <kernel/fs.h>
+#include <kernel/ata.h>
 #include <kernel/user.h>
 #include <kernel/hostname.h>
 #include <kernel/drm.h>
@@ -54,7 +55,7 @@ static void fill_stat64(struct linux_stat64 *st, uint32_t ino, inode_t *node) {
             break;
         case INODE_CHARDEV:
             st->st_mode = LINUX_S_IFCHR | (node->mode & 0777);
-            st->st_rdev = ((uint64_t)node->blocks[0] << 8) | node->blocks[1];
+            st->st_rdev = ((uint64_t)node->dev.major << 8) | node->dev.minor;
             break;
         default:
             st->st_mode = node->mode & 0777;
@@ -122,7 +123,7 @@ static int32_t linux_sys_open(const char *path, uint32_t flags, uint32_t mode) {
         case INODE_FILE:    fd_type = FD_FILE; break;
         case INODE_DIR:     fd_type = FD_DIR;  break;
         case INODE_CHARDEV:
-            fd_type = ((uint8_t)node.blocks[0] == DEV_MAJOR_DRM) ? FD_DRM : FD_DEV;
+            fd_type = ((uint8_t)node.dev.major == DEV_MAJOR_DRM) ? FD_DRM : FD_DEV;
             break;
         case INODE_SYMLINK: {
             /* Follow symlink: re-resolve using readlink target */
@@ -219,7 +220,7 @@ static int32_t linux_sys_read(uint32_t fd, char *buf, uint32_t count) {
             if (fs_read_inode(fde->inode, &node) < 0) return -LINUX_EIO;
             if (node.type != INODE_CHARDEV) return -LINUX_EIO;
 
-            uint8_t major = (uint8_t)node.blocks[0];
+            uint8_t major = (uint8_t)node.dev.major;
             switch (major) {
                 case 1: /* /dev/null */
                     return 0;
@@ -287,7 +288,7 @@ static int32_t linux_sys_write(uint32_t fd, const char *buf, uint32_t count) {
             if (fs_read_inode(fde->inode, &node) < 0) return -LINUX_EIO;
             if (node.type != INODE_CHARDEV) return -LINUX_EIO;
 
-            uint8_t major = (uint8_t)node.blocks[0];
+            uint8_t major = (uint8_t)node.dev.major;
             switch (major) {
                 case 1: /* /dev/null */
                 case 2: /* /dev/zero */
@@ -354,6 +355,20 @@ static int32_t linux_sys_ftruncate(uint32_t fd, uint32_t length) {
     return 0;
 }
 
+/* ── Linux fsync(fd) / sync() ───────────────────────────────────── */
+
+/* Writeback is global, so fsync flushes everything */
+static int32_t linux_sys_fsync(uint32_t fd) {
+    int tid = task_get_current();
+    task_info_t *t = task_get(tid);
+    if (!t || fd >= (uint32_t)t->fd_count) return -LINUX_EBADF;
+    if (t->fds[fd].type != FD_FILE) return -LINUX_EINVAL;
+
+    if (ata_is_available() && fs_sync() != 0)
+        return -LINUX_EIO;
+    return 0;
+}
+
 /* ── Linux lseek(fd, offset, whence) ────────────────────────────── */
 
 static int32_t linux_sys_lseek(uint32_t fd, int32_t offset, uint32_t whence) {
@@ -513,12 +528,13 @@ static int32_t linux_sys_getdents64(uint32_t fd, void *dirp, uint32_t count) {
     uint32_t bytes_written = 0;
     uint32_t entry_index = 0;  /* linear entry counter */
 
-    for (uint8_t b = 0; b < node.num_blocks; b++) {
-        if (fs_read_block(node.blocks[b], block_buf) < 0)
+    uint32_t nb = fs_inode_blocks(&node);
+    for (uint32_t b = 0; b < nb; b++) {
+        if (fs_read_block(fs_inode_block_at(&node, b), block_buf) < 0)
             continue;
 
         dir_entry_t *entries = (dir_entry_t *)block_buf;
-        int entries_per_block = BLOCK_SIZE / sizeof(dir_entry_t);
+        int entries_per_block = (int)fs_dir_slots(&node, b);
 
         for (int e = 0; e < entries_per_block; e++) {
             if (entries[e].name[0] == '\0') {
@@ -751,10 +767,13 @@ static uint32_t linux_sys_brk(uint32_t new_brk) {
         uint32_t new_page = (new_brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
 
         for (uint32_t va = old_page; va < new_page; va += PAGE_SIZE) {
-            uint32_t frame = pmm_alloc_frame();
+            uint32_t frame = pmm_alloc_frame_high();
             if (!frame)
                 return t->brk_current;
-            memset((void *)frame, 0, PAGE_SIZE);
+            if (vmm_zero_frame(frame) != 0) {
+                pmm_free_frame(frame);
+                return t->brk_current;
+            }
 
             if (!vmm_map_user_page(t->page_dir, va, frame,
                                     PTE_PRESENT | PTE_WRITABLE | PTE_USER)) {
@@ -868,13 +887,19 @@ static uint32_t linux_sys_mmap2(uint32_t addr, uint32_t len, uint32_t prot,
         /* Eagerly allocate frames, read file data into them */
         uint32_t file_offset = pgoff * PAGE_SIZE;  /* mmap2 offset is in pages */
         for (uint32_t i = 0; i < num_pages; i++) {
-            uint32_t frame = pmm_alloc_frame();
+            uint32_t frame = pmm_alloc_frame_high();
             if (!frame) return (uint32_t)-LINUX_ENOMEM;
-            memset((void *)frame, 0, PAGE_SIZE);
 
             /* Read file data into this frame */
+            uint8_t *page = kmap(frame);
+            if (!page) {
+                pmm_free_frame(frame);
+                return (uint32_t)-LINUX_ENOMEM;
+            }
+            memset(page, 0, PAGE_SIZE);
             uint32_t off = file_offset + i * PAGE_SIZE;
-            fs_read_at(inode, (uint8_t *)frame, off, PAGE_SIZE);
+            fs_read_at(inode, page, off, PAGE_SIZE);
+            kunmap(page);
 
             uint32_t pte_flags = PTE_PRESENT | PTE_USER;
             if (prot & LINUX_PROT_WRITE) pte_flags |= PTE_WRITABLE;
@@ -901,10 +926,13 @@ static uint32_t linux_sys_mmap2(uint32_t addr, uint32_t len, uint32_t prot,
     } else {
         /* Legacy path (no VMA table): eager allocation */
         for (uint32_t i = 0; i < num_pages; i++) {
-            uint32_t frame = pmm_alloc_frame();
+            uint32_t frame = pmm_alloc_frame_high();
             if (!frame)
                 return (uint32_t)-LINUX_ENOMEM;
-            memset((void *)frame, 0, PAGE_SIZE);
+            if (vmm_zero_frame(frame) != 0) {
+                pmm_free_frame(frame);
+                return (uint32_t)-LINUX_ENOMEM;
+            }
 
             uint32_t va = va_start + i * PAGE_SIZE;
             if (!vmm_map_user_page(t->page_dir, va, frame,
@@ -1477,8 +1505,17 @@ static int32_t linux_sys_socketcall(uint32_t call, uint32_t *args, int tid) {
         }
         return (int32_t)recv_len;
     }
+    case SYS_SETSOCKOPT: {
+        /* args: sockfd, level, optname, optval*, optlen
+         * Only TCP_NODELAY (IPPROTO_TCP 6, option 1) does anything */
+        int fd = (int)args[0];
+        if (fd < 0 || fd >= t->fd_count || t->fds[fd].type != FD_SOCKET)
+            return -LINUX_ENOTSOCK;
+        if (args[1] == 6 && args[2] == 1 && args[3] && args[4] >= 4)
+            socket_set_nodelay(t->fds[fd].pipe_id, *(const int *)args[3] != 0);
+        return 0;
+    }
     case SYS_SHUTDOWN:
-    case SYS_SETSOCKOPT:
     case SYS_GETSOCKOPT:
     case SYS_GETSOCKNAME:
     case SYS_GETPEERNAME:
@@ -1739,6 +1776,16 @@ registers_t* linux_syscall_handler(registers_t* regs) {
             regs->eax = (uint32_t)linux_sys_ftruncate(regs->ebx, regs->ecx);
             return regs;
 
+        case LINUX_SYS_fsync:
+        case LINUX_SYS_fdatasync:
+            regs->eax = (uint32_t)linux_sys_fsync(regs->ebx);
+            return regs;
+
+        case LINUX_SYS_sync:
+            fs_sync();
+            regs->eax = 0;
+            return regs;
+
         case LINUX_SYS_uname:
             regs->eax = (uint32_t)linux_sys_uname(
                 (struct linux_utsname *)regs->ebx);
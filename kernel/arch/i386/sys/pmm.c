@@ -4,14 +4,67 @@
 #include <kernel/io.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-/* Bitmap: 1 bit per 4KB frame. 65536 frames = 256MB max. */
-#define PMM_MAX_FRAMES  65536
-#define PMM_BITMAP_SIZE (PMM_MAX_FRAMES / 32)  /* 2048 uint32_t = 8KB */
+/*
+ * Physical memory manager: binary buddy allocator.
+ *
+ * Free memory is kept as power-of-two blocks of frames on per-order free
+ * lists.  Allocation pops the smallest non-empty order >= the request and
+ * splits it; freeing merges a block with its buddy (block ^ size) while the
+ * buddy is also free.  Both are O(MAX_ORDER).
+ *
+ * The bitmap stays the ground truth for "is this frame in use" so double
+ * frees and frees of reserved frames are caught, and reservations can be
+ * carved out of free blocks after init.
+ *
+ * Memory is split into two zones with separate free lists.  ZONE_NORMAL
+ * (below PMM_LOWMEM_FRAMES) is identity-mapped through 4KB page tables in
+ * every address space, so its frames can be dereferenced directly; all of
+ * the classic pmm_alloc_* calls come from here.  ZONE_HIGH is everything
+ * above, up to the top of RAM reported by the multiboot map; those frames
+ * are handed out by pmm_alloc_frame_high() and must be accessed via kmap().
+ *
+ * ZONE_NORMAL hands out its highest frames first, so the lowmem right
+ * above the kernel heap's break stays free for pmm_claim_heap() for as
+ * long as possible without being set aside for it.
+ */
+
+/* Bitmap: 1 bit per 4KB frame. */
+#define PMM_BITMAP_SIZE (PMM_MAX_FRAMES / 32)  /* 32768 uint32_t = 128KB */
 #define FRAME_SIZE      4096
 
+#define FRAME_NONE      0xFFFFFFFFu
+#define ORDER_NONE      0xFF
+
 static uint32_t bitmap[PMM_BITMAP_SIZE];
 static uint32_t total_frames;
+static uint32_t heap_frame_end;     /* kernel image + heap own [256, this) */
+
+/* Per-zone buddy free lists, linked through per-frame arrays.
+ * free_order[f] is the order of the free block headed by frame f,
+ * or ORDER_NONE. */
+typedef struct {
+    const char *name;
+    uint32_t start, end;                /* frame range [start, end) */
+    uint32_t present;                   /* usable frames in the range */
+    uint32_t free_frames;
+    int      top_down;                  /* allocate from the top of the zone */
+    uint32_t free_head[PMM_MAX_ORDER + 1];
+    uint32_t free_tail[PMM_MAX_ORDER + 1];
+    uint32_t nr_free[PMM_MAX_ORDER + 1];
+    uint32_t order_bitmap;              /* bit o set = free_head[o] non-empty */
+} pmm_zone_t;
+
+static pmm_zone_t zones[PMM_NR_ZONES] = {
+    [PMM_ZONE_NORMAL] = { .name = "Normal", .top_down = 1 },
+    [PMM_ZONE_HIGH]   = { .name = "HighMem" },
+};
+
+/* Sized by the top of RAM and carved out of lowmem by pmm_init() */
+static uint32_t *link_next;
+static uint32_t *link_prev;
+static uint8_t  *free_order;
 
 /* Linker symbols */
 extern char _heap_start[];
@@ -28,14 +81,215 @@ static inline int frame_test(uint32_t frame) {
     return (bitmap[frame / 32] >> (frame % 32)) & 1;
 }
 
+static inline pmm_zone_t *zone_of(uint32_t frame) {
+    return &zones[frame < PMM_LOWMEM_FRAMES ? PMM_ZONE_NORMAL : PMM_ZONE_HIGH];
+}
+
+/* ── Buddy free lists ──────────────────────────────────────────────── */
+
+/* Blocks are taken from the head.  In a top-down zone a block below the
+ * current head goes on the tail instead, which keeps the low blocks
+ * near the back of the list without sorting it. */
+static void buddy_push(pmm_zone_t *z, uint32_t frame, uint32_t order) {
+    uint32_t head = z->free_head[order];
+    if (z->top_down && head != FRAME_NONE && frame < head) {
+        uint32_t tail = z->free_tail[order];
+        link_prev[frame] = tail;
+        link_next[frame] = FRAME_NONE;
+        link_next[tail] = frame;
+        z->free_tail[order] = frame;
+    } else {
+        link_prev[frame] = FRAME_NONE;
+        link_next[frame] = head;
+        if (head != FRAME_NONE)
+            link_prev[head] = frame;
+        else
+            z->free_tail[order] = frame;
+        z->free_head[order] = frame;
+    }
+    free_order[frame] = (uint8_t)order;
+    z->nr_free[order]++;
+    z->order_bitmap |= 1U << order;
+}
+
+static void buddy_unlink(pmm_zone_t *z, uint32_t frame, uint32_t order) {
+    uint32_t next = link_next[frame];
+    uint32_t prev = link_prev[frame];
+    if (prev != FRAME_NONE)
+        link_next[prev] = next;
+    else
+        z->free_head[order] = next;
+    if (next != FRAME_NONE)
+        link_prev[next] = prev;
+    else
+        z->free_tail[order] = prev;
+    free_order[frame] = ORDER_NONE;
+    if (--z->nr_free[order] == 0)
+        z->order_bitmap &= ~(1U << order);
+}
+
+/* Return a block to the free lists, merging with free buddies.
+ * Zone boundaries are aligned to the largest order, so merging never
+ * crosses into the other zone. */
+static void buddy_release(pmm_zone_t *z, uint32_t frame, uint32_t order) {
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1U << order);
+        if (buddy < z->start || buddy + (1U << order) > z->end ||
+            free_order[buddy] != order)
+            break;
+        buddy_unlink(z, buddy, order);
+        frame &= ~(1U << order);
+        order++;
+    }
+    buddy_push(z, frame, order);
+}
+
+/* Pop a block of exactly `order`, splitting a larger one if needed; a
+ * top-down zone keeps the upper half of each split.  Returns FRAME_NONE
+ * when no block is big enough. */
+static uint32_t buddy_take(pmm_zone_t *z, uint32_t order) {
+    uint32_t avail = z->order_bitmap & (~0U << order);
+    if (!avail)
+        return FRAME_NONE;
+    uint32_t o = __builtin_ctz(avail);
+    uint32_t frame = z->free_head[o];
+    buddy_unlink(z, frame, o);
+    while (o > order) {
+        o--;
+        if (z->top_down) {
+            buddy_push(z, frame, o);
+            frame += 1U << o;
+        } else {
+            buddy_push(z, frame + (1U << o), o);
+        }
+    }
+    return frame;
+}
+
+/* Remove a single frame from whichever free block contains it. */
+static void buddy_take_frame(uint32_t frame) {
+    pmm_zone_t *z = zone_of(frame);
+    for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++) {
+        uint32_t head = frame & ~((1U << o) - 1);
+        if (free_order[head] != o)
+            continue;
+        buddy_unlink(z, head, o);
+        /* Split down, keeping the halves that don't contain frame */
+        while (o > 0) {
+            o--;
+            uint32_t half = 1U << o;
+            if (frame & half) {
+                buddy_push(z, head, o);
+                head += half;
+            } else {
+                buddy_push(z, head + half, o);
+            }
+        }
+        return;
+    }
+}
+
+/* Free the range [start, end) as maximal aligned blocks. */
+static void buddy_release_range(pmm_zone_t *z, uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t order = start ? __builtin_ctz(start) : PMM_MAX_ORDER;
+        if (order > PMM_MAX_ORDER)
+            order = PMM_MAX_ORDER;
+        while (start + (1U << order) > end)
+            order--;
+        buddy_release(z, start, order);
+        start += 1U << order;
+    }
+}
+
+static void mark_used(pmm_zone_t *z, uint32_t frame, uint32_t count) {
+    for (uint32_t i = frame; i < frame + count; i++) {
+        frame_set(i);
+        frame_ref_set1(i * FRAME_SIZE);
+    }
+    z->free_frames -= count;
+}
+
+static inline uint32_t order_for(uint32_t n_frames) {
+    return n_frames <= 1 ? 0 : 32 - __builtin_clz(n_frames - 1);
+}
+
+/* ── Init ──────────────────────────────────────────────────────────── */
+
+/* Build the free lists from the bitmap: every maximal run of free frames
+ * within a zone is split into the largest naturally aligned blocks that
+ * fit.  Frames free at this point are the zone's present pages. */
+static void buddy_build(void) {
+    if (free_order)
+        memset(free_order, ORDER_NONE, total_frames);
+
+    zones[PMM_ZONE_NORMAL].start = 0;
+    zones[PMM_ZONE_NORMAL].end = total_frames < PMM_LOWMEM_FRAMES
+                                 ? total_frames : PMM_LOWMEM_FRAMES;
+    zones[PMM_ZONE_HIGH].start = zones[PMM_ZONE_NORMAL].end;
+    zones[PMM_ZONE_HIGH].end = total_frames;
+
+    for (int zi = 0; zi < PMM_NR_ZONES; zi++) {
+        pmm_zone_t *z = &zones[zi];
+        for (uint32_t o = 0; o <= PMM_MAX_ORDER; o++) {
+            z->free_head[o] = z->free_tail[o] = FRAME_NONE;
+            z->nr_free[o] = 0;
+        }
+        z->order_bitmap = 0;
+        z->free_frames = 0;
+
+        uint32_t f = z->start;
+        while (f < z->end) {
+            if (frame_test(f)) {
+                f++;
+                continue;
+            }
+            uint32_t run_end = f;
+            while (run_end < z->end && !frame_test(run_end))
+                run_end++;
+            buddy_release_range(z, f, run_end);
+            z->free_frames += run_end - f;
+            f = run_end;
+        }
+        z->present = z->free_frames;
+    }
+}
+
+/* Place the free-list arrays in the highest free run of lowmem big
+ * enough for them (paging is still off, and lowmem stays identity-mapped
+ * once it is on).  Returns -1 if there is no such run. */
+static int carve_links(void) {
+    uint32_t bytes = total_frames * (2 * sizeof(uint32_t) + sizeof(uint8_t));
+    uint32_t need = (bytes + FRAME_SIZE - 1) / FRAME_SIZE;
+    uint32_t low_top = total_frames < PMM_LOWMEM_FRAMES ? total_frames : PMM_LOWMEM_FRAMES;
+    uint32_t run = 0;
+
+    for (uint32_t f = low_top; f-- > heap_frame_end; ) {
+        if (frame_test(f)) {
+            run = 0;
+            continue;
+        }
+        if (++run < need)
+            continue;
+        for (uint32_t i = f; i < f + need; i++)
+            frame_set(i);
+        link_next = (uint32_t *)(f * FRAME_SIZE);
+        link_prev = link_next + total_frames;
+        free_order = (uint8_t *)(link_prev + total_frames);
+        return 0;
+    }
+    return -1;
+}
+
 void pmm_init(multiboot_info_t *mbi) {
     /* Start with all frames marked as used */
     memset(bitmap, 0xFF, sizeof(bitmap));
-    total_frames = PMM_MAX_FRAMES;
+    total_frames = 0;
 
     /* Parse multiboot memory map to find available regions */
     if (!(mbi->flags & (1 << 6))) {
         DBG("[PMM] No memory map from bootloader!");
+        buddy_build();
         return;
     }
 
@@ -51,7 +305,7 @@ void pmm_init(multiboot_info_t *mbi) {
             uint64_t len  = entry->len;
             uint64_t end  = base + len;
 
-            /* Clamp to our 256MB limit */
+            /* Clamp to the 32-bit physical address space */
             if (base >= (uint64_t)PMM_MAX_FRAMES * FRAME_SIZE)
                 goto next;
             if (end > (uint64_t)PMM_MAX_FRAMES * FRAME_SIZE)
@@ -63,6 +317,8 @@ void pmm_init(multiboot_info_t *mbi) {
 
             for (uint32_t f = frame_start; f < frame_end; f++)
                 frame_clear(f);
+            if (frame_end > total_frames)
+                total_frames = frame_end;
         }
 
 next:
@@ -75,96 +331,212 @@ next:
 
     /* Re-reserve kernel image + heap area.
      * Kernel starts at 1MB (frame 256). _heap_start marks end of BSS.
-     * Reserve up to _heap_start + 16MB for heap growth room. */
-    uint32_t kernel_end_addr = (uint32_t)_heap_start + (16 * 1024 * 1024);
+     * Reserve up to _heap_start + 16MB for heap growth room, or the current
+     * break if early boot already pushed it further (multiboot modules). */
+    heap_stats_t hs;
+    heap_get_stats(&hs);
+    uint32_t heap_room = hs.heap_bytes > (16 * 1024 * 1024)
+                         ? (uint32_t)hs.heap_bytes : (16 * 1024 * 1024);
+    uint32_t kernel_end_addr = (uint32_t)_heap_start + heap_room;
     uint32_t kernel_end_frame = kernel_end_addr / FRAME_SIZE;
     if (kernel_end_frame > PMM_MAX_FRAMES)
         kernel_end_frame = PMM_MAX_FRAMES;
     for (uint32_t f = 256; f < kernel_end_frame; f++)
         frame_set(f);
+    heap_frame_end = kernel_end_frame;
+
+    /* Without room for the free lists of every frame, give up highmem */
+    if (carve_links() != 0 && total_frames > PMM_LOWMEM_FRAMES) {
+        DBG("[PMM] No room for highmem free lists, using lowmem only");
+        total_frames = PMM_LOWMEM_FRAMES;
+        carve_links();
+    }
+    if (!free_order) {
+        DBG("[PMM] No room for the free lists!");
+        total_frames = 0;
+    }
+
+    buddy_build();
 
-    DBG("[PMM] Initialized: %u free frames (%u MB free)",
+    DBG("[PMM] Initialized: %u free frames (%u MB free, %u MB highmem)",
         pmm_free_frame_count(),
-        pmm_free_frame_count() * 4 / 1024);
+        pmm_free_frame_count() * 4 / 1024,
+        zones[PMM_ZONE_HIGH].free_frames * 4 / 1024);
+}
+
+/* ── Allocation ────────────────────────────────────────────────────── */
+
+static uint32_t zone_alloc(pmm_zone_t *z, uint32_t order) {
+    uint32_t flags = irq_save();
+    uint32_t frame = buddy_take(z, order);
+    if (frame != FRAME_NONE)
+        mark_used(z, frame, 1U << order);
+    irq_restore(flags);
+    return frame == FRAME_NONE ? 0 : frame * FRAME_SIZE;
 }
 
 uint32_t pmm_alloc_frame(void) {
-    for (uint32_t i = 0; i < PMM_BITMAP_SIZE; i++) {
-        if (bitmap[i] == 0xFFFFFFFF)
-            continue;  /* All 32 frames used */
-        for (uint32_t bit = 0; bit < 32; bit++) {
-            if (!(bitmap[i] & (1U << bit))) {
-                uint32_t frame = i * 32 + bit;
-                if (frame >= total_frames)
-                    return 0;
-                frame_set(frame);
-                frame_ref_set1(frame * FRAME_SIZE);
-                return frame * FRAME_SIZE;
-            }
-        }
-    }
-    return 0;  /* Out of memory */
+    return zone_alloc(&zones[PMM_ZONE_NORMAL], 0);
 }
 
-uint32_t pmm_alloc_contiguous(uint32_t n_frames) {
-    if (n_frames == 0) return 0;
-    if (n_frames == 1) return pmm_alloc_frame();
+uint32_t pmm_alloc_frame_high(void) {
+    uint32_t phys = zone_alloc(&zones[PMM_ZONE_HIGH], 0);
+    return phys ? phys : zone_alloc(&zones[PMM_ZONE_NORMAL], 0);
+}
 
-    uint32_t start = 0;
+uint32_t pmm_alloc_order(uint32_t order) {
+    if (order > PMM_MAX_ORDER) return 0;
+    return zone_alloc(&zones[PMM_ZONE_NORMAL], order);
+}
+
+/* Linear search for a run of n free frames that straddles buddy block
+ * boundaries.  Only used when no single block is large enough. */
+static uint32_t contiguous_scan(pmm_zone_t *z, uint32_t n_frames) {
+    uint32_t start = z->start;
     uint32_t count = 0;
 
-    for (uint32_t f = 0; f < total_frames; f++) {
+    for (uint32_t f = z->start; f < z->end; f++) {
         if (frame_test(f)) {
             count = 0;
             start = f + 1;
-        } else {
-            count++;
-            if (count >= n_frames) {
-                for (uint32_t i = start; i < start + n_frames; i++) {
-                    frame_set(i);
-                    frame_ref_set1(i * FRAME_SIZE);
-                }
-                return start * FRAME_SIZE;
-            }
+        } else if (++count >= n_frames) {
+            for (uint32_t i = start; i < start + n_frames; i++)
+                buddy_take_frame(i);
+            return start;
         }
     }
-    return 0;
+    return FRAME_NONE;
+}
+
+uint32_t pmm_alloc_contiguous(uint32_t n_frames) {
+    if (n_frames == 0) return 0;
+    if (n_frames == 1) return pmm_alloc_frame();
+
+    pmm_zone_t *z = &zones[PMM_ZONE_NORMAL];
+    uint32_t order = order_for(n_frames);
+    uint32_t flags = irq_save();
+    uint32_t frame = FRAME_NONE;
+
+    if (order <= PMM_MAX_ORDER) {
+        frame = buddy_take(z, order);
+        /* Hand back the unused tail of the power-of-two block */
+        if (frame != FRAME_NONE)
+            buddy_release_range(z, frame + n_frames, frame + (1U << order));
+    }
+    if (frame == FRAME_NONE)
+        frame = contiguous_scan(z, n_frames);
+    if (frame != FRAME_NONE)
+        mark_used(z, frame, n_frames);
+
+    irq_restore(flags);
+    return frame == FRAME_NONE ? 0 : frame * FRAME_SIZE;
+}
+
+/* ── Free / reserve ────────────────────────────────────────────────── */
+
+static void free_one(uint32_t frame) {
+    if (frame >= total_frames || !frame_test(frame))
+        return;
+    pmm_zone_t *z = zone_of(frame);
+    frame_clear(frame);
+    z->free_frames++;
+    buddy_release(z, frame, 0);
 }
 
 void pmm_free_frame(uint32_t phys_addr) {
-    uint32_t frame = phys_addr / FRAME_SIZE;
-    if (frame < total_frames)
-        frame_clear(frame);
+    uint32_t flags = irq_save();
+    free_one(phys_addr / FRAME_SIZE);
+    irq_restore(flags);
 }
 
 void pmm_free_contiguous(uint32_t phys_addr, uint32_t n_frames) {
     uint32_t frame = phys_addr / FRAME_SIZE;
+    uint32_t flags = irq_save();
     for (uint32_t i = 0; i < n_frames && (frame + i) < total_frames; i++)
-        frame_clear(frame + i);
+        free_one(frame + i);
+    irq_restore(flags);
 }
 
 void pmm_reserve_range(uint32_t phys_start, uint32_t phys_end) {
     uint32_t frame_start = phys_start / FRAME_SIZE;
     uint32_t frame_end = (phys_end + FRAME_SIZE - 1) / FRAME_SIZE;
-    if (frame_end > PMM_MAX_FRAMES) frame_end = PMM_MAX_FRAMES;
-    for (uint32_t f = frame_start; f < frame_end; f++)
+    if (frame_end > total_frames) frame_end = total_frames;
+
+    uint32_t flags = irq_save();
+    for (uint32_t f = frame_start; f < frame_end; f++) {
+        if (frame_test(f))
+            continue;
+        buddy_take_frame(f);
         frame_set(f);
+        zone_of(f)->free_frames--;
+    }
+    irq_restore(flags);
 }
 
-uint32_t pmm_free_frame_count(void) {
-    uint32_t count = 0;
-    for (uint32_t i = 0; i < PMM_BITMAP_SIZE; i++) {
-        if (bitmap[i] == 0)
-            count += 32;
-        else if (bitmap[i] != 0xFFFFFFFF) {
-            uint32_t val = bitmap[i];
-            /* Count zero bits */
-            val = ~val;
-            while (val) {
-                count++;
-                val &= val - 1;
-            }
+int pmm_claim_heap(uint32_t phys_end) {
+    if (!heap_frame_end)
+        return 0;       /* before pmm_init, which reserves the break itself */
+    uint32_t frame_end = (phys_end + FRAME_SIZE - 1) / FRAME_SIZE;
+    if (frame_end <= heap_frame_end)
+        return 0;
+    if (frame_end > PMM_LOWMEM_FRAMES || frame_end > total_frames)
+        return -1;
+
+    /* Take the frames past the high-water mark from the buddy lists if
+     * they are all still free */
+    uint32_t flags = irq_save();
+    uint32_t from = heap_frame_end;
+    for (uint32_t f = from; f < frame_end; f++) {
+        if (frame_test(f)) {
+            irq_restore(flags);
+            return -1;
         }
     }
-    return count;
+    for (uint32_t f = from; f < frame_end; f++) {
+        buddy_take_frame(f);
+        frame_set(f);
+        zone_of(f)->free_frames--;
+    }
+    heap_frame_end = frame_end;
+    irq_restore(flags);
+    return 0;
+}
+
+uint32_t pmm_free_frame_count(void) {
+    return zones[PMM_ZONE_NORMAL].free_frames + zones[PMM_ZONE_HIGH].free_frames;
+}
+
+uint32_t pmm_total_frame_count(void) {
+    return zones[PMM_ZONE_NORMAL].present + zones[PMM_ZONE_HIGH].present;
+}
+
+void pmm_zone_counts(int zone, uint32_t *present, uint32_t *free) {
+    if (zone < 0 || zone >= PMM_NR_ZONES) {
+        *present = *free = 0;
+        return;
+    }
+    *present = zones[zone].present;
+    *free = zones[zone].free_frames;
+}
+
+uint32_t pmm_free_blocks(uint32_t order) {
+    return order <= PMM_MAX_ORDER ? zones[PMM_ZONE_NORMAL].nr_free[order] : 0;
+}
+
+int pmm_buddyinfo(char *buf, size_t max) {
+    int n = 0;
+    for (int zi = 0; zi < PMM_NR_ZONES && (size_t)n < max; zi++) {
+        pmm_zone_t *z = &zones[zi];
+        if (z->present == 0)
+            continue;
+        n += snprintf(buf + n, max - n, "Node 0, zone %8s ", z->name);
+        for (uint32_t o = 0; o <= PMM_MAX_ORDER && (size_t)n < max; o++)
+            n += snprintf(buf + n, max - n, "%6u ", z->nr_free[o]);
+        if ((size_t)n < max)
+            n += snprintf(buf + n, max - n, "\n");
+    }
+    /* snprintf reports what it wanted to write, not what fit */
+    if ((size_t)n >= max)
+        n = max ? (int)max - 1 : 0;
+    return n;
 }
@@ -8,6 +8,13 @@
  *   /proc/uptime    — system uptime in seconds
  *   /proc/meminfo   — physical memory statistics
  *   /proc/version   — OS version string
+ *   /proc/heapinfo  — kernel heap allocator counters
+ *   /proc/buddyinfo — free physical blocks per buddy order
+ *   /proc/bcache    — filesystem block cache counters
+ *   /proc/dcache    — dentry cache counters
+ *   /proc/netrx     — network receive path counters
+ *   /proc/netbuf    — network packet buffer pool
+ *   /proc/tcp       — open TCP connections and their send state
  *   /proc/<pid>/status — per-process status
  *   /proc/<pid>/maps   — memory maps (simplified)
  */
@@ -18,6 +25,12 @@
 #include <kernel/vma.h>
 #include <kernel/idt.h>
 #include <kernel/pmm.h>
+#include <kernel/bcache.h>
+#include <kernel/dcache.h>
+#include <kernel/net.h>
+#include <kernel/netbuf.h>
+#include <kernel/tcp.h>
+#include <kernel/httpd.h>
 #include <kernel/rtc.h>
 #include <kernel/io.h>
 #include <string.h>
@@ -64,18 +77,29 @@ static int gen_uptime(char *buf, size_t max) {
 
 static int gen_meminfo(char *buf, size_t max) {
     uint32_t free_frames = pmm_free_frame_count();
-    uint32_t total_frames = 65536;  /* PMM_MAX_FRAMES */
+    uint32_t total_frames = pmm_total_frame_count();
     uint32_t used_frames = total_frames - free_frames;
+    uint32_t low_total, low_free, high_total, high_free;
+    pmm_zone_counts(PMM_ZONE_NORMAL, &low_total, &low_free);
+    pmm_zone_counts(PMM_ZONE_HIGH, &high_total, &high_free);
+    bcache_stats_t bc;
+    bcache_get_stats(&bc);
 
     return snprintf(buf, max,
-        "MemTotal:    %6u kB\n"
-        "MemFree:     %6u kB\n"
-        "MemUsed:     %6u kB\n"
-        "Buffers:     %6u kB\n",
+        "MemTotal:    %8u kB\n"
+        "MemFree:     %8u kB\n"
+        "MemUsed:     %8u kB\n"
+        "Buffers:     %8u kB\n"
+        "LowTotal:    %8u kB\n"
+        "LowFree:     %8u kB\n"
+        "HighTotal:   %8u kB\n"
+        "HighFree:    %8u kB\n",
         total_frames * 4,
         free_frames * 4,
         used_frames * 4,
-        0);
+        bc.cached * 4,
+        low_total * 4, low_free * 4,
+        high_total * 4, high_free * 4);
 }
 
 static int gen_version(char *buf, size_t max) {
@@ -85,6 +109,194 @@ static int gen_version(char *buf, size_t max) {
         FS_VERSION);
 }
 
+static int gen_heapinfo(char *buf, size_t max) {
+    heap_stats_t st;
+    heap_get_stats(&st);
+
+    return snprintf(buf, max,
+        "HeapBreak:   %8u kB\n"
+        "Arena:       %8u kB\n"
+        "LargeRuns:   %8u kB\n"
+        "InUse:       %8u kB\n"
+        "Peak:        %8u kB\n"
+        "FreeLists:   %8u kB\n"
+        "Allocs:      %8lu\n"
+        "Frees:       %8lu\n"
+        "LargeAllocs: %8lu\n"
+        "Splits:      %8lu\n"
+        "Coalesces:   %8lu\n"
+        "ArenaGrows:  %8lu\n"
+        "Failures:    %8lu\n",
+        (unsigned)(st.heap_bytes / 1024),
+        (unsigned)(st.arena_bytes / 1024),
+        (unsigned)(st.large_bytes / 1024),
+        (unsigned)(st.in_use_bytes / 1024),
+        (unsigned)(st.peak_bytes / 1024),
+        (unsigned)(st.free_bytes / 1024),
+        st.n_malloc, st.n_free, st.n_large, st.n_split,
+        st.n_coalesce, st.n_grow, st.n_fail);
+}
+
+static int gen_bcache(char *buf, size_t max) {
+    bcache_stats_t st;
+    bcache_get_stats(&st);
+
+    return snprintf(buf, max,
+        "Limit:       %8u kB\n"
+        "Cached:      %8u kB\n"
+        "Dirty:       %8u kB\n"
+        "Hits:        %8u\n"
+        "Misses:      %8u\n"
+        "Evictions:   %8u\n"
+        "Writebacks:  %8u\n"
+        "WriteOps:    %8u\n"
+        "ReadOps:     %8u\n"
+        "Prefetched:  %8u\n"
+        "IOErrors:    %8u\n",
+        st.limit * 4, st.cached * 4, st.dirty * 4,
+        st.hits, st.misses, st.evictions, st.writebacks, st.write_ops,
+        st.read_ops, st.prefetched, st.io_errors);
+}
+
+static int gen_dcache(char *buf, size_t max) {
+    dcache_stats_t st;
+    dcache_get_stats(&st);
+
+    return snprintf(buf, max,
+        "Entries:     %8u / %u\n"
+        "Negative:    %8u\n"
+        "Lookups:     %8u\n"
+        "Hits:        %8u\n"
+        "NegHits:     %8u\n"
+        "Misses:      %8u\n"
+        "Evictions:   %8u\n"
+        "Invalidated: %8u\n",
+        st.entries, DCACHE_ENTRIES, st.negative, st.lookups,
+        st.hits, st.neg_hits, st.misses, st.evictions, st.invalidations);
+}
+
+static int gen_netrx(char *buf, size_t max) {
+    net_rx_stats_t st;
+    net_get_rx_stats(&st);
+    uint32_t rx_pkts, rx_bytes;
+    net_get_stats(NULL, NULL, &rx_pkts, &rx_bytes);
+
+    return snprintf(buf, max,
+        "Mode:        %8s\n"
+        "IRQ:         %8d\n"
+        "Budget:      %8u\n"
+        "Packets:     %8u\n"
+        "Interrupts:  %8u\n"
+        "Polls:       %8u\n"
+        "BudgetHits:  %8u\n"
+        "Wakeups:     %8u\n"
+        "Loopback:    %8u\n"
+        "LoBytes:     %8u\n"
+        "LoDrops:     %8u\n"
+        "CsumHW:      %8u\n"
+        "CsumSW:      %8u\n"
+        "TxBatches:   %8u\n",
+        st.threaded ? "irq" : "polled", st.irq, NET_RX_BUDGET, rx_pkts,
+        st.irqs, st.polls, st.budget_hits, st.wakeups,
+        st.lo_packets, st.lo_bytes, st.lo_drops,
+        st.csum_hw, st.csum_sw, st.tx_batches);
+}
+
+static int gen_httpd(char *buf, size_t max) {
+    httpd_stats_t st;
+    httpd_get_stats(&st);
+
+    return snprintf(buf, max,
+        "Running:     %8s\n"
+        "Active:      %8u\n"
+        "Accepted:    %8u\n"
+        "Requests:    %8u\n"
+        "Reused:      %8u\n"
+        "NotFound:    %8u\n"
+        "CacheHits:   %8u\n"
+        "CacheMisses: %8u\n"
+        "CacheFiles:  %8u\n"
+        "CacheBytes:  %8u\n"
+        "Streamed:    %8u\n",
+        httpd_is_running() ? "yes" : "no", st.active, st.accepted,
+        st.requests, st.reused, st.not_found, st.cache_hits,
+        st.cache_misses, st.cache_entries, st.cache_bytes, st.streamed);
+}
+
+static int gen_netbuf(char *buf, size_t max) {
+    netbuf_stats_t st;
+    netbuf_get_stats(&st);
+
+    return snprintf(buf, max,
+        "Buffers:     %8u\n"
+        "Free:        %8u\n"
+        "MinFree:     %8u\n"
+        "Allocs:      %8u\n"
+        "Failures:    %8u\n",
+        st.total, st.free, st.min_free, st.allocs, st.fails);
+}
+
+static int gen_tcp(char *buf, size_t max) {
+    tcp_stats_t st;
+    tcp_get_stats(&st);
+    int n = snprintf(buf, max,
+        "TCBs: %u  orphans: %u  syn_recv: %u  time_wait: %u  "
+        "cookies: %u sent, %u ok  syn_dropped: %u\n"
+        "Segments out: %u  pure ACKs: %u\n",
+        st.tcbs, st.orphans, st.syn_recv, st.time_wait,
+        st.cookies_sent, st.cookies_ok, st.syn_dropped,
+        st.segs_out, st.pure_acks);
+    n += snprintf(buf + n, max - n,
+        "  Id State Local Flight   Cwnd  Ssthresh    Wnd  Srtt   Rto  Rtx Fast  SndBuf  RcvBuf Opts     Remote\n");
+    for (int i = 0; i < TCP_MAX_CONNECTIONS && (size_t)n < max - 140; i++) {
+        tcp_info_t ti;
+        if (tcp_get_info(i, &ti) != 0 || ti.state == TCP_CLOSED)
+            continue;
+        /* w<snd>/<rcv> window scaling, t timestamps, s SACK */
+        char opts[16] = "-";
+        int o = 0;
+        if (ti.ws_ok)
+            o += snprintf(opts, sizeof(opts), "w%u/%u", ti.snd_wscale, ti.rcv_wscale);
+        if (ti.ts_ok) opts[o++] = 't';
+        if (ti.sack_ok) opts[o++] = 's';
+        if (o) opts[o] = '\0';
+        n += snprintf(buf + n, max - n,
+            "%4d %5d %5u %6u %6u %9u %6u %5u %5u %4u %4u %7u %7u %-8s %d.%d.%d.%d:%u\n",
+            i, (int)ti.state, ti.local_port, ti.in_flight, ti.cwnd,
+            ti.ssthresh, ti.snd_wnd, ti.srtt_ms, ti.rto_ms,
+            ti.timeouts, ti.fast_rtx, ti.snd_buf, ti.rcv_buf, opts,
+            ti.remote_ip[0], ti.remote_ip[1], ti.remote_ip[2], ti.remote_ip[3],
+            ti.remote_port);
+    }
+    return n;
+}
+
+/* Top-level files: name -> generator */
+static const struct {
+    const char *name;
+    int (*gen)(char *buf, size_t max);
+} proc_files[] = {
+    { "uptime",    gen_uptime    },
+    { "meminfo",   gen_meminfo   },
+    { "version",   gen_version   },
+    { "heapinfo",  gen_heapinfo  },
+    { "buddyinfo", pmm_buddyinfo },
+    { "bcache",    gen_bcache    },
+    { "dcache",    gen_dcache    },
+    { "netrx",     gen_netrx     },
+    { "netbuf",    gen_netbuf    },
+    { "tcp",       gen_tcp       },
+    { "httpd",     gen_httpd     },
+};
+#define PROC_NFILES ((int)(sizeof(proc_files) / sizeof(proc_files[0])))
+
+static int proc_file_index(const char *name) {
+    for (int i = 0; i < PROC_NFILES; i++)
+        if (strcmp(name, proc_files[i].name) == 0)
+            return i;
+    return -1;
+}
+
 static int gen_pid_status(char *buf, size_t max, int pid) {
     int tid = task_find_by_pid(pid);
     if (tid < 0) return -1;
@@ -164,12 +376,9 @@ static int procfs_read_file(void *priv, const char *path,
     /* Skip leading slash */
     if (*path == '/') path++;
 
-    if (strcmp(path, "uptime") == 0) {
-        len = gen_uptime(tmp, sizeof(tmp));
-    } else if (strcmp(path, "meminfo") == 0) {
-        len = gen_meminfo(tmp, sizeof(tmp));
-    } else if (strcmp(path, "version") == 0) {
-        len = gen_version(tmp, sizeof(tmp));
+    int fi = proc_file_index(path);
+    if (fi >= 0) {
+        len = proc_files[fi].gen(tmp, sizeof(tmp));
     } else {
         /* Try /proc/<pid>/subfile */
         int pid = parse_pid(path);
@@ -202,10 +411,9 @@ static int procfs_readdir(void *priv, const char *path,
     /* Root of /proc */
     if (!path || *path == '\0' || strcmp(path, "/") == 0) {
         /* Static entries */
-        const char *statics[] = { "uptime", "meminfo", "version" };
-        for (int i = 0; i < 3 && count < max; i++) {
+        for (int i = 0; i < PROC_NFILES && count < max; i++) {
             memset(&out[count], 0, sizeof(out[count]));
-            strncpy(out[count].name, statics[i], MAX_NAME_LEN - 1);
+            strncpy(out[count].name, proc_files[i].name, MAX_NAME_LEN - 1);
             out[count].type = INODE_FILE;
             out[count].size = 0;
             out[count].inode = 0x8000 + i;
@@ -257,9 +465,7 @@ static int procfs_stat(void *priv, const char *path, inode_t *out)
 
     if (*path == '/') path++;
 
-    if (strcmp(path, "uptime") == 0 ||
-        strcmp(path, "meminfo") == 0 ||
-        strcmp(path, "version") == 0) {
+    if (proc_file_index(path) >= 0) {
         out->type = INODE_FILE;
         return 0;
     }
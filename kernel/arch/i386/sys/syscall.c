@@ -162,7 +162,7 @@ registers_t* syscall_handler(registers_t* regs) {
                 case INODE_FILE:    fd_type = FD_FILE; break;
                 case INODE_DIR:     fd_type = FD_DIR;  break;
                 case INODE_CHARDEV:
-                    fd_type = ((uint8_t)node.blocks[0] == DEV_MAJOR_DRM) ? FD_DRM : FD_DEV;
+                    fd_type = ((uint8_t)node.dev.major == DEV_MAJOR_DRM) ? FD_DRM : FD_DEV;
                     break;
                 default:
                     regs->eax = (uint32_t)-1;
@@ -2,7 +2,9 @@
  * tmpfs.c — RAM-backed Temporary Filesystem
  *
  * Mounted at /tmp.  All data lives in memory, lost on reboot.
- * Simplified inode/block system: 1024 inodes, 4096 blocks (16MB).
+ * Simplified inode/block system: 1024 inodes, up to 65536 blocks (256MB).
+ * Each block is a physical frame allocated on first use (preferring
+ * highmem) and accessed through kmap(), so an empty tmpfs costs nothing.
  * Supports files, directories, permissions, and timestamps.
  */
 
@@ -10,6 +12,8 @@
 #include <kernel/fs.h>
 #include <kernel/rtc.h>
 #include <kernel/io.h>
+#include <kernel/pmm.h>
+#include <kernel/vmm.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,7 +21,7 @@
 /* ── Geometry ──────────────────────────────────────────────────────── */
 
 #define TMPFS_NUM_INODES  1024
-#define TMPFS_NUM_BLOCKS  4096
+#define TMPFS_NUM_BLOCKS  65536
 #define TMPFS_BLOCK_SIZE  4096
 #define TMPFS_DIRECT      8
 #define TMPFS_MAX_NAME    28
@@ -44,11 +48,13 @@ typedef struct {
 /* ── State ─────────────────────────────────────────────────────────── */
 
 static tmpfs_inode_t  tmpfs_inodes[TMPFS_NUM_INODES];
-static uint8_t       *tmpfs_data = NULL;
+static uint32_t       tmpfs_block_phys[TMPFS_NUM_BLOCKS];  /* 0 = unallocated */
 static uint8_t        tmpfs_inode_bmp[TMPFS_NUM_INODES / 8];
 static uint8_t        tmpfs_block_bmp[TMPFS_NUM_BLOCKS / 8];
 
-#define TMPFS_BLK(i) (tmpfs_data + (size_t)(i) * TMPFS_BLOCK_SIZE)
+/* Map a block for access; pair every call with tmpfs_unmap(). */
+static void *tmpfs_map(uint32_t blk)  { return kmap(tmpfs_block_phys[blk]); }
+static void  tmpfs_unmap(void *p)     { kunmap(p); }
 
 static void tbmp_set(uint8_t *map, uint32_t bit)   { map[bit/8] |= (1 << (bit%8)); }
 static void tbmp_clear(uint8_t *map, uint32_t bit)  { map[bit/8] &= ~(1 << (bit%8)); }
@@ -74,8 +80,14 @@ static void tmpfs_free_inode(uint32_t ino) {
 static uint32_t tmpfs_alloc_block(void) {
     for (uint32_t i = 0; i < TMPFS_NUM_BLOCKS; i++) {
         if (!tbmp_test(tmpfs_block_bmp, i)) {
+            uint32_t phys = pmm_alloc_frame_high();
+            if (!phys) break;
+            if (vmm_zero_frame(phys) != 0) {
+                pmm_free_frame(phys);
+                break;
+            }
+            tmpfs_block_phys[i] = phys;
             tbmp_set(tmpfs_block_bmp, i);
-            memset(TMPFS_BLK(i), 0, TMPFS_BLOCK_SIZE);
             return i;
         }
     }
@@ -84,6 +96,10 @@ static uint32_t tmpfs_alloc_block(void) {
 
 static void tmpfs_free_block(uint32_t blk) {
     if (blk >= TMPFS_NUM_BLOCKS) return;
+    if (tmpfs_block_phys[blk]) {
+        pmm_free_frame(tmpfs_block_phys[blk]);
+        tmpfs_block_phys[blk] = 0;
+    }
     tbmp_clear(tmpfs_block_bmp, blk);
 }
 
@@ -94,13 +110,18 @@ static int tmpfs_dir_lookup(uint32_t dir_ino, const char *name) {
     if (dir->type != INODE_DIR) return -1;
 
     for (uint8_t b = 0; b < dir->num_blocks; b++) {
-        tmpfs_dirent_t *entries = (tmpfs_dirent_t *)TMPFS_BLK(dir->blocks[b]);
+        tmpfs_dirent_t *entries = tmpfs_map(dir->blocks[b]);
+        if (!entries) return -1;
         int per_block = TMPFS_BLOCK_SIZE / sizeof(tmpfs_dirent_t);
         for (int j = 0; j < per_block; j++) {
             if (entries[j].inode != 0 &&
-                strncmp(entries[j].name, name, TMPFS_MAX_NAME) == 0)
-                return (int)entries[j].inode;
+                strncmp(entries[j].name, name, TMPFS_MAX_NAME) == 0) {
+                int ino = (int)entries[j].inode;
+                tmpfs_unmap(entries);
+                return ino;
+            }
         }
+        tmpfs_unmap(entries);
     }
     return -1;
 }
@@ -110,16 +131,19 @@ static int tmpfs_dir_add(uint32_t dir_ino, const char *name, uint32_t child_ino)
 
     /* Try to find a free slot in existing blocks */
     for (uint8_t b = 0; b < dir->num_blocks; b++) {
-        tmpfs_dirent_t *entries = (tmpfs_dirent_t *)TMPFS_BLK(dir->blocks[b]);
+        tmpfs_dirent_t *entries = tmpfs_map(dir->blocks[b]);
+        if (!entries) return -1;
         int per_block = TMPFS_BLOCK_SIZE / sizeof(tmpfs_dirent_t);
         for (int j = 0; j < per_block; j++) {
             if (entries[j].inode == 0) {
                 entries[j].inode = child_ino;
                 strncpy(entries[j].name, name, TMPFS_MAX_NAME - 1);
                 entries[j].name[TMPFS_MAX_NAME - 1] = '\0';
+                tmpfs_unmap(entries);
                 return 0;
             }
         }
+        tmpfs_unmap(entries);
     }
 
     /* Need new block */
@@ -128,10 +152,12 @@ static int tmpfs_dir_add(uint32_t dir_ino, const char *name, uint32_t child_ino)
     if (blk == 0xFFFFFFFF) return -1;
 
     dir->blocks[dir->num_blocks++] = blk;
-    tmpfs_dirent_t *entries = (tmpfs_dirent_t *)TMPFS_BLK(blk);
+    tmpfs_dirent_t *entries = tmpfs_map(blk);
+    if (!entries) return -1;
     entries[0].inode = child_ino;
     strncpy(entries[0].name, name, TMPFS_MAX_NAME - 1);
     entries[0].name[TMPFS_MAX_NAME - 1] = '\0';
+    tmpfs_unmap(entries);
     return 0;
 }
 
@@ -139,16 +165,19 @@ static int tmpfs_dir_remove(uint32_t dir_ino, const char *name) {
     tmpfs_inode_t *dir = &tmpfs_inodes[dir_ino];
 
     for (uint8_t b = 0; b < dir->num_blocks; b++) {
-        tmpfs_dirent_t *entries = (tmpfs_dirent_t *)TMPFS_BLK(dir->blocks[b]);
+        tmpfs_dirent_t *entries = tmpfs_map(dir->blocks[b]);
+        if (!entries) return -1;
         int per_block = TMPFS_BLOCK_SIZE / sizeof(tmpfs_dirent_t);
         for (int j = 0; j < per_block; j++) {
             if (entries[j].inode != 0 &&
                 strncmp(entries[j].name, name, TMPFS_MAX_NAME) == 0) {
                 entries[j].inode = 0;
                 entries[j].name[0] = '\0';
+                tmpfs_unmap(entries);
                 return 0;
             }
         }
+        tmpfs_unmap(entries);
     }
     return -1;
 }
@@ -238,11 +267,13 @@ static int tmpfs_create(void *priv, const char *path, uint8_t is_directory)
         tmpfs_inodes[ino].blocks[0] = blk;
         tmpfs_inodes[ino].num_blocks = 1;
 
-        tmpfs_dirent_t *entries = (tmpfs_dirent_t *)TMPFS_BLK(blk);
+        tmpfs_dirent_t *entries = tmpfs_map(blk);
+        if (!entries) { tmpfs_free_inode(ino); return -1; }
         entries[0].inode = ino;
         strncpy(entries[0].name, ".", TMPFS_MAX_NAME - 1);
         entries[1].inode = parent;
         strncpy(entries[1].name, "..", TMPFS_MAX_NAME - 1);
+        tmpfs_unmap(entries);
     }
 
     if (tmpfs_dir_add(parent, name, ino) != 0) {
@@ -290,7 +321,10 @@ static int tmpfs_read_file(void *priv, const char *path,
     for (uint8_t b = 0; b < node->num_blocks && done < to_read; b++) {
         uint32_t chunk = to_read - done;
         if (chunk > TMPFS_BLOCK_SIZE) chunk = TMPFS_BLOCK_SIZE;
-        memcpy(buf + done, TMPFS_BLK(node->blocks[b]), chunk);
+        void *src = tmpfs_map(node->blocks[b]);
+        if (!src) break;
+        memcpy(buf + done, src, chunk);
+        tmpfs_unmap(src);
         done += chunk;
     }
     *size = done;
@@ -334,8 +368,11 @@ static int tmpfs_write_file(void *priv, const char *path,
         uint32_t chunk = (uint32_t)size - written;
         if (chunk > TMPFS_BLOCK_SIZE) chunk = TMPFS_BLOCK_SIZE;
 
-        memcpy(TMPFS_BLK(blk), data + written, chunk);
         node->blocks[node->num_blocks++] = blk;
+        void *dst = tmpfs_map(blk);
+        if (!dst) break;
+        memcpy(dst, data + written, chunk);
+        tmpfs_unmap(dst);
         written += chunk;
     }
 
@@ -356,7 +393,8 @@ static int tmpfs_readdir(void *priv, const char *path,
 
     int count = 0;
     for (uint8_t b = 0; b < dir->num_blocks; b++) {
-        tmpfs_dirent_t *entries = (tmpfs_dirent_t *)TMPFS_BLK(dir->blocks[b]);
+        tmpfs_dirent_t *entries = tmpfs_map(dir->blocks[b]);
+        if (!entries) break;
         int per_block = TMPFS_BLOCK_SIZE / sizeof(tmpfs_dirent_t);
         for (int j = 0; j < per_block && count < max; j++) {
             if (entries[j].inode == 0) continue;
@@ -372,6 +410,7 @@ static int tmpfs_readdir(void *priv, const char *path,
             out[count].inode = ci;
             count++;
         }
+        tmpfs_unmap(entries);
     }
     return count;
 }
@@ -464,21 +503,13 @@ static vfs_ops_t tmpfs_ops = {
 };
 
 void tmpfs_init(void) {
+    /* Drop any frames from a previous mount */
+    for (uint32_t i = 0; i < TMPFS_NUM_BLOCKS; i++)
+        tmpfs_free_block(i);
     memset(tmpfs_inodes, 0, sizeof(tmpfs_inodes));
     memset(tmpfs_inode_bmp, 0, sizeof(tmpfs_inode_bmp));
     memset(tmpfs_block_bmp, 0, sizeof(tmpfs_block_bmp));
 
-    /* Allocate data blocks (16MB) */
-    if (!tmpfs_data) {
-        tmpfs_data = (uint8_t *)malloc((size_t)TMPFS_NUM_BLOCKS * TMPFS_BLOCK_SIZE);
-        if (!tmpfs_data) {
-            DBG("[TMPFS] Failed to allocate %d KB",
-                TMPFS_NUM_BLOCKS * TMPFS_BLOCK_SIZE / 1024);
-            return;
-        }
-    }
-    memset(tmpfs_data, 0, (size_t)TMPFS_NUM_BLOCKS * TMPFS_BLOCK_SIZE);
-
     /* Initialize root directory (inode 0) */
     tbmp_set(tmpfs_inode_bmp, 0);
     tmpfs_inodes[0].type = INODE_DIR;
@@ -488,14 +519,19 @@ void tmpfs_init(void) {
 
     /* Allocate root dir block with . and .. */
     uint32_t blk = tmpfs_alloc_block();
+    if (blk == 0xFFFFFFFF) {
+        DBG("[TMPFS] Failed to allocate root directory block");
+        return;
+    }
     tmpfs_inodes[0].blocks[0] = blk;
     tmpfs_inodes[0].num_blocks = 1;
 
-    tmpfs_dirent_t *entries = (tmpfs_dirent_t *)TMPFS_BLK(blk);
+    tmpfs_dirent_t *entries = tmpfs_map(blk);
     entries[0].inode = 0;
     strncpy(entries[0].name, ".", TMPFS_MAX_NAME - 1);
     entries[1].inode = 0;
     strncpy(entries[1].name, "..", TMPFS_MAX_NAME - 1);
+    tmpfs_unmap(entries);
 
     vfs_mount("/tmp", &tmpfs_ops, NULL);
 }
@@ -15,9 +15,27 @@
 static vfs_mount_t mount_table[VFS_MAX_MOUNTS];
 static int num_mounts = 0;
 
+/* Active mounts, longest prefix first, so the first match wins */
+static uint8_t mount_order[VFS_MAX_MOUNTS];
+
+static void rebuild_order(void) {
+    int n = 0;
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (!mount_table[i].active) continue;
+        int k = n++;
+        while (k > 0 && mount_table[mount_order[k - 1]].prefix_len <
+                        mount_table[i].prefix_len) {
+            mount_order[k] = mount_order[k - 1];
+            k--;
+        }
+        mount_order[k] = (uint8_t)i;
+    }
+}
+
 void vfs_init(void) {
     memset(mount_table, 0, sizeof(mount_table));
     num_mounts = 0;
+    rebuild_order();
     DBG("[VFS] Initialized (max %d mounts)", VFS_MAX_MOUNTS);
 }
 
@@ -55,6 +73,7 @@ int vfs_mount(const char *path, vfs_ops_t *ops, void *private_data) {
     m->private_data = private_data;
     m->active = 1;
     num_mounts++;
+    rebuild_order();
 
     /* Call mount callback if provided */
     if (ops->mount) {
@@ -76,6 +95,7 @@ int vfs_unmount(const char *path) {
             }
             mount_table[i].active = 0;
             num_mounts--;
+            rebuild_order();
             DBG("[VFS] Unmounted %s", path);
             return 0;
         }
@@ -85,27 +105,31 @@ int vfs_unmount(const char *path) {
 
 /* Longest-prefix match resolution.
  * Returns the mount entry whose prefix most specifically matches the path.
- * Sets *rel_path to the portion of path after the mount prefix. */
+ * Sets *rel_path to the portion of path after the mount prefix.
+ * Mounts are tried longest first, and the first two characters are
+ * compared before the full prefix, so most paths that belong to the root
+ * filesystem are rejected without a strncmp. */
 vfs_mount_t *vfs_resolve(const char *path, const char **rel_path) {
     if (!path) return NULL;
 
     vfs_mount_t *best = NULL;
     uint32_t best_len = 0;
 
-    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
-        if (!mount_table[i].active) continue;
+    for (int k = 0; k < num_mounts; k++) {
+        vfs_mount_t *m = &mount_table[mount_order[k]];
+        uint32_t plen = m->prefix_len;
 
-        uint32_t plen = mount_table[i].prefix_len;
+        if (path[0] != m->prefix[0] || (plen > 1 && path[1] != m->prefix[1]))
+            continue;
 
         /* Check if path starts with this mount's prefix */
-        if (strncmp(path, mount_table[i].prefix, plen) == 0) {
+        if (strncmp(path, m->prefix, plen) == 0) {
             /* Must match at a path boundary:
              * either exact match, or next char is '/' or path ends */
             if (path[plen] == '\0' || path[plen] == '/') {
-                if (plen > best_len) {
-                    best = &mount_table[i];
-                    best_len = plen;
-                }
+                best = m;
+                best_len = plen;
+                break;
             }
         }
     }
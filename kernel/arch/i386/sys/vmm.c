@@ -13,11 +13,18 @@
 static uint32_t kernel_page_directory[1024] __attribute__((aligned(4096)));
 uint32_t kernel_page_tables[IDENTITY_TABLES][1024] __attribute__((aligned(4096)));
 
+/* kmap window: one page table shared by every address space (the PDE is
+ * copied into each user PD), so a slot mapped here is visible everywhere. */
+static uint32_t kmap_page_table[1024] __attribute__((aligned(4096)));
+static uint32_t kmap_used[KMAP_SLOTS / 32];
+
 /* Check if a PT physical address points into the shared kernel_page_tables.
  * Used to implement copy-on-write: if a user PD still references a kernel PT,
  * we must allocate a private copy before modifying it. */
 static int is_kernel_pt(uint32_t pt_phys) {
     uint32_t start = (uint32_t)&kernel_page_tables[0];
+    if (pt_phys == (uint32_t)kmap_page_table)
+        return 1;
     return (pt_phys >= start && pt_phys < start + sizeof(kernel_page_tables));
 }
 
@@ -63,6 +70,13 @@ void vmm_init(multiboot_info_t *mbi) {
         kernel_page_directory[i] = phys | flags;
     }
 
+    /* Replace the identity PSE page over the kmap window with its own page
+     * table (supervisor-only: user code must never see kmap slots). */
+    memset(kmap_page_table, 0, sizeof(kmap_page_table));
+    memset(kmap_used, 0, sizeof(kmap_used));
+    kernel_page_directory[KMAP_BASE >> 22] = (uint32_t)kmap_page_table
+                                             | PTE_PRESENT | PTE_WRITABLE;
+
     /* Load page directory into CR3 and enable paging (CR0 bit 31) */
     uint32_t cr3 = (uint32_t)&kernel_page_directory;
     __asm__ volatile (
@@ -73,7 +87,8 @@ void vmm_init(multiboot_info_t *mbi) {
         : : "r"(cr3) : "eax"
     );
 
-    DBG("[VMM] Paging enabled (4KB: 0-256MB, 4MB PSE: 256MB-4GB). CR3=0x%x", cr3);
+    DBG("[VMM] Paging enabled (4KB: 0-256MB, 4MB PSE: 256MB-4GB, kmap @ 0x%x). CR3=0x%x",
+        KMAP_BASE, cr3);
 }
 
 void vmm_map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
@@ -274,3 +289,63 @@ void vmm_flush_tlb(void) {
     __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
     __asm__ volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
 }
+
+/* ── Highmem access window ───────────────────────────────────── */
+
+void *kmap(uint32_t phys) {
+    phys &= PAGE_MASK;
+    if (phys < PMM_LOWMEM_LIMIT)
+        return (void *)phys;
+
+    uint32_t flags = irq_save();
+    for (uint32_t w = 0; w < KMAP_SLOTS / 32; w++) {
+        if (kmap_used[w] == 0xFFFFFFFF)
+            continue;
+        uint32_t bit = __builtin_ctz(~kmap_used[w]);
+        uint32_t slot = w * 32 + bit;
+        kmap_used[w] |= 1U << bit;
+        irq_restore(flags);
+
+        uint32_t virt = KMAP_BASE + slot * PAGE_SIZE;
+        kmap_page_table[slot] = phys | PTE_PRESENT | PTE_WRITABLE;
+        vmm_invlpg(virt);
+        return (void *)virt;
+    }
+    irq_restore(flags);
+
+    DBG("[VMM] kmap: window exhausted (phys 0x%x)", phys);
+    return NULL;
+}
+
+void kunmap(void *addr) {
+    uint32_t virt = (uint32_t)addr & PAGE_MASK;
+    if (virt < KMAP_BASE || virt >= KMAP_BASE + KMAP_SLOTS * PAGE_SIZE)
+        return;  /* lowmem identity pointer */
+
+    uint32_t slot = (virt - KMAP_BASE) / PAGE_SIZE;
+    kmap_page_table[slot] = 0;
+    vmm_invlpg(virt);
+
+    uint32_t flags = irq_save();
+    kmap_used[slot / 32] &= ~(1U << (slot % 32));
+    irq_restore(flags);
+}
+
+int vmm_zero_frame(uint32_t phys) {
+    void *p = kmap(phys);
+    if (!p) return -1;
+    memset(p, 0, PAGE_SIZE);
+    kunmap(p);
+    return 0;
+}
+
+int vmm_copy_frame(uint32_t dst_phys, uint32_t src_phys) {
+    void *d = kmap(dst_phys);
+    void *s = kmap(src_phys);
+    int rc = (d && s) ? 0 : -1;
+    if (rc == 0)
+        memcpy(d, s, PAGE_SIZE);
+    kunmap(s);
+    kunmap(d);
+    return rc;
+}
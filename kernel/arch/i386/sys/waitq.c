@@ -0,0 +1,121 @@
+/*
+ * waitq.c — Wait queues
+ *
+ * Lets a kernel thread sleep until some event happens (a packet arrives,
+ * a connection changes state) instead of polling for it.  Sleepers are
+ * parked in TASK_STATE_SLEEPING with a deadline, so the scheduler's
+ * timer sweep doubles as the timeout; waitq_wake() makes them READY
+ * early.  Everything runs under irq_save(), which makes the queue safe
+ * to wake from interrupt handlers on this single CPU.
+ *
+ * kmutex_t builds a sleeping lock on a queue: contenders sleep on it
+ * and the final unlock wakes them to retry.
+ */
+
+#include <kernel/waitq.h>
+#include <kernel/task.h>
+#include <kernel/sched.h>
+#include <kernel/idt.h>
+#include <kernel/io.h>
+
+_Static_assert(TASK_MAX <= 32, "waitq_t holds one bit per task slot");
+
+void waitq_init(waitq_t *q) {
+    q->waiters = 0;
+    q->seq = 0;
+}
+
+int waitq_can_block(void) {
+    task_info_t *t = task_get(task_get_current());
+    return sched_is_active() && t && (t->stack_base || t->is_user);
+}
+
+void waitq_sleep(waitq_t *q, uint32_t seq, uint32_t ticks) {
+    uint32_t flags = irq_save();
+    if (q->seq != seq || !(flags & 0x200)) {
+        irq_restore(flags);
+        return;
+    }
+
+    int tid = task_get_current();
+    task_info_t *t = task_get(tid);
+    if (!waitq_can_block() || tid < 0 || tid >= TASK_MAX) {
+        /* Can't be descheduled: wait for the next interrupt instead */
+        __asm__ volatile("sti; hlt");
+        irq_restore(flags);
+        return;
+    }
+
+    q->waiters |= 1u << tid;
+    if (ticks == WAITQ_FOREVER) {
+        t->state = TASK_STATE_BLOCKED;
+    } else {
+        t->sleep_until = pit_get_ticks() + (ticks ? ticks : 1);
+        t->state = TASK_STATE_SLEEPING;
+    }
+    irq_restore(flags);
+    task_yield();
+
+    flags = irq_save();
+    q->waiters &= ~(1u << tid);
+    irq_restore(flags);
+}
+
+void waitq_wake(waitq_t *q) {
+    uint32_t flags = irq_save();
+    q->seq++;
+    uint32_t w = q->waiters;
+    q->waiters = 0;
+    for (int tid = 0; w; tid++, w >>= 1) {
+        task_info_t *t = task_get(tid);
+        if ((w & 1) && t && (t->state == TASK_STATE_SLEEPING ||
+                             t->state == TASK_STATE_BLOCKED))
+            task_unblock(tid);
+    }
+    irq_restore(flags);
+}
+
+/* ── Sleeping lock ───────────────────────────────────────────────── */
+
+void kmutex_init(kmutex_t *m) {
+    m->owner = -1;
+    m->depth = 0;
+    waitq_init(&m->wq);
+}
+
+int kmutex_lock(kmutex_t *m) {
+    int tid = task_get_current();
+    task_info_t *t = task_get(tid);
+    uint32_t flags = irq_save();
+    while (m->owner >= 0 && m->owner != tid) {
+        /* Only an interrupt can get the owner to its unlock.  A user
+         * task's system call has interrupts off just because of the
+         * gate, not to be atomic: halt with them on and let the timer
+         * run the owner.  Kernel code that disabled them can't wait. */
+        if (!(flags & 0x200)) {
+            if (!t || !t->is_user) {
+                irq_restore(flags);
+                return -1;
+            }
+            __asm__ volatile("sti; hlt; cli");
+            continue;
+        }
+        uint32_t seq = waitq_seq(&m->wq);
+        irq_restore(flags);
+        waitq_sleep(&m->wq, seq, WAITQ_FOREVER);
+        flags = irq_save();
+    }
+    m->owner = tid;
+    m->depth++;
+    irq_restore(flags);
+    return 0;
+}
+
+void kmutex_unlock(kmutex_t *m) {
+    uint32_t flags = irq_save();
+    if (m->depth > 0 && --m->depth == 0) {
+        m->owner = -1;
+        waitq_wake(&m->wq);
+    }
+    irq_restore(flags);
+}
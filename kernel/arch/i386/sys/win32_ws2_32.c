@@ -517,7 +517,14 @@ static void WINAPI shim_freeaddrinfo(ws_addrinfo_t *ai) {
 
 static int WINAPI shim_setsockopt(uint32_t s, int level, int optname,
                                    const char *optval, int optlen) {
-    (void)s; (void)level; (void)optname; (void)optval; (void)optlen;
+    int fd = sock_to_fd(s);
+    if (fd < 0 || fd >= MAX_SOCKETS) {
+        wsa_last_error = WSAENOTSOCK;
+        return SOCKET_ERROR;
+    }
+    /* TCP_NODELAY is honoured; other options are accepted and ignored */
+    if (level == IPPROTO_TCP && optname == TCP_NODELAY && optval && optlen >= 1)
+        socket_set_nodelay(fd, optval[0] != 0);
     return 0;
 }
 
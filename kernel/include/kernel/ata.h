@@ -6,6 +6,7 @@
 
 
 #define ATA_SECTOR_SIZE 512
+#define ATA_MAX_SECTORS 256     /* per command; larger requests are split */
 
 #define ATA_SR_BSY  0x80    /* Busy */
 #define ATA_SR_DRDY 0x40    /* Drive ready */
@@ -29,18 +30,27 @@
 #define ATA_CMD_READ_PIO_EXT    0x24
 #define ATA_CMD_WRITE_PIO       0x30
 #define ATA_CMD_WRITE_PIO_EXT   0x34
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_WRITE_DMA_EXT   0x35
 #define ATA_CMD_CACHE_FLUSH     0xE7
 #define ATA_CMD_CACHE_FLUSH_EXT 0xEA
 #define ATA_CMD_IDENTIFY        0xEC
 
 int ata_initialize(void);
 
-int ata_read_sectors(uint32_t lba, uint8_t sector_count, uint8_t* buffer);
+/* Transfers use bus-master DMA (sleeping until IRQ14) when the buffer is
+ * identity-mapped, and fall back to PIO otherwise. */
+int ata_read_sectors(uint32_t lba, uint32_t sector_count, uint8_t* buffer);
 
-int ata_write_sectors(uint32_t lba, uint8_t sector_count, const uint8_t* buffer);
+int ata_write_sectors(uint32_t lba, uint32_t sector_count, const uint8_t* buffer);
 
 int ata_flush(void);
 
 int ata_is_available(void);
 
+/* 1 if a PCI bus-master IDE controller was found */
+int ata_dma_enabled(void);
+
 #endif
@@ -0,0 +1,87 @@
+#ifndef _KERNEL_BCACHE_H
+#define _KERNEL_BCACHE_H
+
+#include <stdint.h>
+
+/* ── Block cache configuration ──────────────────────────────────── */
+
+#define BCACHE_DEFAULT_PAGES  4096   /* 16MB of cached 4KB blocks */
+#define BCACHE_MAX_BUFS       65536  /* one entry per FS block (NUM_BLOCKS) */
+#define BCACHE_HASH_BITS      12
+#define BCACHE_HASH_SIZE      (1u << BCACHE_HASH_BITS)
+#define BCACHE_RUN_MAX        16     /* adjacent blocks merged per write (64KB) */
+#define BCACHE_FLUSH_DEPTH    8      /* runs in flight on virtio-blk */
+
+/* Buffer flags */
+#define BC_VALID    0x01    /* data matches disk (or was initialised) */
+#define BC_DIRTY    0x02    /* modified since last writeback */
+#define BC_REF      0x04    /* CLOCK reference bit */
+#define BC_HASHED   0x08    /* reachable through the hash table */
+
+/* A cached filesystem block.  Callers only touch `block` and `data`;
+ * `data` stays valid until the buffer is released. */
+typedef struct {
+    uint32_t block;
+    uint8_t *data;          /* BLOCK_SIZE bytes, page aligned, identity-mapped */
+    uint32_t hash_next;     /* bucket chain / free list link (index) */
+    uint16_t refcnt;        /* pins: non-zero buffers are never evicted */
+    uint8_t  flags;
+} bcache_buf_t;
+
+typedef struct {
+    uint32_t limit;         /* target number of cached blocks */
+    uint32_t cached;        /* blocks currently in the cache */
+    uint32_t dirty;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;    /* blocks written */
+    uint32_t write_ops;     /* disk requests used to write them */
+    uint32_t read_ops;      /* disk read requests, demand and read-ahead */
+    uint32_t prefetched;    /* blocks brought in by read-ahead */
+    uint32_t io_errors;
+} bcache_stats_t;
+
+/* Drop every cached block and set the soft limit (in blocks).
+ * Buffers already allocated are kept for reuse. */
+void bcache_init(uint32_t max_pages);
+
+/* Change the soft limit.  Without a disk dirty blocks can't be evicted,
+ * so the cache may grow beyond it. */
+void bcache_set_limit(uint32_t max_pages);
+
+/* Pin a block, reading it from disk on a miss.  Returns NULL on I/O error
+ * or when no buffer can be found.  Pair with bcache_release(). */
+bcache_buf_t *bcache_read(uint32_t block);
+
+/* Pin a block for complete overwrite: no disk read, contents zeroed,
+ * buffer marked dirty.  Used for freshly allocated blocks. */
+bcache_buf_t *bcache_zero(uint32_t block);
+
+/* Pin a block the caller is about to overwrite in full: no disk read and
+ * no clearing, so the contents are stale until the caller fills all
+ * BLOCK_SIZE bytes and marks the buffer dirty. */
+bcache_buf_t *bcache_getblk(uint32_t block);
+
+/* Mark a pinned buffer as modified */
+void bcache_dirty(bcache_buf_t *b);
+
+/* Unpin a buffer obtained from bcache_read/zero/getblk (NULL is ignored) */
+void bcache_release(bcache_buf_t *b);
+
+/* Discard a block (it was freed): pending writes are dropped */
+void bcache_forget(uint32_t block);
+
+/* Write back all dirty blocks in block order, merging adjacent ones into
+ * a single request.  Returns 0 on success, -1 on I/O error or when there
+ * is no disk. */
+int bcache_flush(void);
+
+/* Read ahead: bring the uncached blocks of [block, block+count) into the
+ * cache, merging adjacent ones into requests of up to BCACHE_RUN_MAX
+ * blocks.  Returns the number of blocks read; 0 without a disk. */
+uint32_t bcache_prefetch(uint32_t block, uint32_t count);
+
+void bcache_get_stats(bcache_stats_t *out);
+
+#endif
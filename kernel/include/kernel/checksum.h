@@ -0,0 +1,44 @@
+#ifndef _KERNEL_CHECKSUM_H
+#define _KERNEL_CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Internet checksum (RFC 1071).  Partial sums are 32-bit and kept in
+ * the machine's byte order: summing little-endian words gives the
+ * byte-swapped ones'-complement sum, which is stored back as is and so
+ * lands in the packet in network order.  Partial sums can be chained,
+ * but every piece except the last must have an even length. */
+
+/* Add `len` bytes at `data` to the partial sum `sum` */
+uint32_t csum_partial(const void *data, size_t len, uint32_t sum);
+
+/* Partial sum of the TCP/UDP pseudo-header; `len` is the L4 length */
+uint32_t csum_pseudo(const uint8_t src[4], const uint8_t dst[4],
+                     uint8_t proto, uint16_t len);
+
+/* Fold a partial sum to 16 bits, without complementing it */
+static inline uint16_t csum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+/* Value for a checksum field once everything is summed */
+static inline uint16_t csum_finish(uint32_t sum) {
+    return (uint16_t)~csum_fold(sum);
+}
+
+/* Checksum `check` after a 16-bit field covered by it changes from
+ * `from` to `to` (RFC 1624, eqn. 3); all three as read from the packet */
+static inline uint16_t csum_update16(uint16_t check, uint16_t from, uint16_t to) {
+    return csum_finish((uint32_t)(uint16_t)~check + (uint16_t)~from + to);
+}
+
+/* Same for a 32-bit field, e.g. an address */
+static inline uint16_t csum_update32(uint16_t check, uint32_t from, uint32_t to) {
+    check = csum_update16(check, (uint16_t)(from >> 16), (uint16_t)(to >> 16));
+    return csum_update16(check, (uint16_t)from, (uint16_t)to);
+}
+
+#endif
@@ -42,7 +42,10 @@ void tls_prf(const uint8_t *secret, size_t secret_len,
 #define AES128_EXPANDED_KEY_SIZE (4 * (AES128_ROUNDS + 1))  /* 44 uint32_t */
 
 typedef struct {
-    uint32_t rk[AES128_EXPANDED_KEY_SIZE];
+    uint32_t rk[AES128_EXPANDED_KEY_SIZE];   /* little-endian column words */
+    uint32_t drk[AES128_EXPANDED_KEY_SIZE];  /* equivalent inverse cipher */
+    uint8_t  h[16];                          /* GHASH subkey E(K, 0) */
+    uint64_t gh_hh[16], gh_hl[16];           /* 4-bit GHASH table for H */
 } aes128_ctx_t;
 
 void aes128_init(aes128_ctx_t *ctx, const uint8_t key[AES128_KEY_SIZE]);
@@ -53,6 +56,12 @@ void aes128_decrypt_block(const aes128_ctx_t *ctx,
                           const uint8_t in[AES_BLOCK_SIZE],
                           uint8_t out[AES_BLOCK_SIZE]);
 
+/* AES-NI + PCLMULQDQ are used for CBC and GCM when CPUID reports
+ * them.  aes128_accel() says whether they are in use; tests turn them
+ * off with aes128_set_accel(0) to check the portable code. */
+int  aes128_accel(void);
+void aes128_set_accel(int on);
+
 /* CBC mode — caller manages IV, padding */
 void aes128_cbc_encrypt(const aes128_ctx_t *ctx,
                         const uint8_t *iv,
@@ -77,10 +86,54 @@ int aes128_gcm_decrypt(const aes128_ctx_t *ctx,
                        const uint8_t *cipher, size_t cipher_len,
                        uint8_t *plain, const uint8_t tag[16]);
 
-/* ── Big-number (2048-bit) ───────────────────────────────────── */
+/* ── ChaCha20-Poly1305 (RFC 8439) ───────────────────────────── */
+
+#define CHACHA20_KEY_SIZE   32
+#define CHACHA20_NONCE_SIZE 12
 
-#define BN_WORDS 64   /* 64 × 32 = 2048 bits */
+/* XOR len bytes of keystream into in, starting at block `counter` */
+void chacha20_xor(const uint8_t key[CHACHA20_KEY_SIZE],
+                  const uint8_t nonce[CHACHA20_NONCE_SIZE],
+                  uint32_t counter, const uint8_t *in, uint8_t *out,
+                  size_t len);
 
+/* ChaCha20 runs four blocks at a time in SSE2 registers when CPUID
+ * reports SSE2; chacha20_set_accel(0) forces the 32-bit code. */
+int  chacha20_accel(void);
+void chacha20_set_accel(int on);
+
+typedef struct {
+    uint32_t r[5];       /* clamped key half, 26-bit limbs */
+    uint32_t h[5];       /* accumulator */
+    uint32_t pad[4];     /* s, added at the end */
+    uint8_t  buf[16];
+    size_t   buf_len;
+} poly1305_ctx_t;
+
+/* One-time authenticator: the 32-byte key must never be reused */
+void poly1305_init(poly1305_ctx_t *ctx, const uint8_t key[32]);
+void poly1305_update(poly1305_ctx_t *ctx, const uint8_t *data, size_t len);
+void poly1305_final(poly1305_ctx_t *ctx, uint8_t tag[16]);
+
+/* AEAD.  Returns 0 on success, -2 on auth failure (decrypt), in which
+ * case plain is left untouched. */
+int chacha20_poly1305_encrypt(const uint8_t key[CHACHA20_KEY_SIZE],
+                              const uint8_t nonce[CHACHA20_NONCE_SIZE],
+                              const uint8_t *aad, size_t aad_len,
+                              const uint8_t *plain, size_t len,
+                              uint8_t *cipher, uint8_t tag[16]);
+int chacha20_poly1305_decrypt(const uint8_t key[CHACHA20_KEY_SIZE],
+                              const uint8_t nonce[CHACHA20_NONCE_SIZE],
+                              const uint8_t *aad, size_t aad_len,
+                              const uint8_t *cipher, size_t len,
+                              uint8_t *plain, const uint8_t tag[16]);
+
+/* ── Big-number (up to 2048-bit) ─────────────────────────────── */
+
+#define BN_WORDS 64   /* capacity: 64 × 32 = 2048 bits */
+
+/* Operations only touch the words below top, so smaller numbers cost
+ * less; the words above top are kept zero */
 typedef struct {
     uint32_t d[BN_WORDS];
     int      top;     /* index of highest non-zero word + 1 */
@@ -92,11 +145,36 @@ void bn_to_bytes(const bignum_t *a, uint8_t *buf, size_t len);
 int  bn_cmp(const bignum_t *a, const bignum_t *b);
 void bn_add(bignum_t *r, const bignum_t *a, const bignum_t *b);
 void bn_sub(bignum_t *r, const bignum_t *a, const bignum_t *b);
+/* Plain product; it must fit in BN_WORDS words */
+void bn_mul(bignum_t *r, const bignum_t *a, const bignum_t *b);
 void bn_mod(bignum_t *r, const bignum_t *a, const bignum_t *m);
 void bn_mulmod(bignum_t *r, const bignum_t *a, const bignum_t *b, const bignum_t *m);
+/* Sliding-window Montgomery exponentiation for odd moduli */
 void bn_modexp(bignum_t *r, const bignum_t *base, const bignum_t *exp, const bignum_t *mod);
 
-/* ── RSA (public key only) ───────────────────────────────────── */
+/* Montgomery context for an odd modulus n of nw words, R = 2^(32 nw) */
+typedef struct {
+    bignum_t n;
+    bignum_t rr;      /* R^2 mod n, converts into Montgomery form */
+    bignum_t one;     /* R mod n, 1 in Montgomery form */
+    uint32_t n0;      /* -n^-1 mod 2^32 */
+    int      nw;
+} bn_mont_t;
+
+/* -1 if n is even or zero */
+int  bn_mont_init(bn_mont_t *mont, const bignum_t *n);
+/* r = a b R^-1 mod n, for a, b < n */
+void bn_mont_mul(const bn_mont_t *mont, bignum_t *r,
+                 const bignum_t *a, const bignum_t *b);
+void bn_mont_sqr(const bn_mont_t *mont, bignum_t *r, const bignum_t *a);
+/* r = a mod n for any a < n R, without long division */
+void bn_mont_reduce(const bn_mont_t *mont, bignum_t *r, const bignum_t *a);
+/* r = base^exp mod n.  consttime picks fixed windows and masked table
+ * reads, for secret exponents.  -1 if out of memory. */
+int  bn_mont_exp(const bn_mont_t *mont, bignum_t *r, const bignum_t *base,
+                 const bignum_t *exp, int consttime);
+
+/* ── RSA ─────────────────────────────────────────────────────── */
 
 typedef struct {
     bignum_t n;       /* modulus */
@@ -109,6 +187,25 @@ int rsa_encrypt(const rsa_pubkey_t *key,
                 const uint8_t *msg, size_t msg_len,
                 uint8_t *out, size_t out_len);
 
+/* Private key with its CRT parameters (PKCS#1 RSAPrivateKey) */
+typedef struct {
+    bignum_t n, e, d;
+    bignum_t p, q;
+    bignum_t dp, dq;  /* d mod (p-1), d mod (q-1) */
+    bignum_t qinv;    /* q^-1 mod p */
+    size_t   n_bytes;
+} rsa_privkey_t;
+
+/* Raw private operation out = in^d mod n, by the CRT: two half-size
+ * exponentiations mod p and q, recombined with Garner's formula and
+ * checked against the public key.  in and out are n_bytes long. */
+int rsa_private(const rsa_privkey_t *key, const uint8_t *in, uint8_t *out);
+
+/* PKCS#1 v1.5 decrypt: returns the message length, -1 on bad padding */
+int rsa_decrypt(const rsa_privkey_t *key,
+                const uint8_t *cipher, size_t cipher_len,
+                uint8_t *out, size_t out_len);
+
 /* ── ASN.1 / X.509 ──────────────────────────────────────────── */
 
 #include <kernel/ec.h>
@@ -0,0 +1,44 @@
+#ifndef _KERNEL_DCACHE_H
+#define _KERNEL_DCACHE_H
+
+#include <stdint.h>
+
+/* ── Dentry cache configuration ─────────────────────────────────── */
+
+#define DCACHE_ENTRIES    1024
+#define DCACHE_HASH_BITS  9
+#define DCACHE_HASH_SIZE  (1u << DCACHE_HASH_BITS)
+
+/* Inode value of a negative entry: the name is known not to exist */
+#define DCACHE_NEGATIVE   0xFFFFFFFFu
+
+typedef struct {
+    uint32_t entries;       /* entries in use */
+    uint32_t negative;      /* of which negative */
+    uint32_t lookups;
+    uint32_t hits;          /* positive hits */
+    uint32_t neg_hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t invalidations;
+} dcache_stats_t;
+
+/* Drop every entry (mount or format) */
+void dcache_init(void);
+
+/* Look up `name` in directory `parent`.  Returns 1 and sets *ino on a
+ * hit (DCACHE_NEGATIVE for a cached miss), 0 when nothing is cached. */
+int  dcache_lookup(uint32_t parent, const char *name, uint32_t *ino);
+
+/* Remember the result of a directory scan (ino may be DCACHE_NEGATIVE) */
+void dcache_insert(uint32_t parent, const char *name, uint32_t ino);
+
+/* Forget one name, after it was unlinked or renamed */
+void dcache_invalidate(uint32_t parent, const char *name);
+
+/* Forget every name looked up in a directory that is being removed */
+void dcache_purge_dir(uint32_t dir);
+
+void dcache_get_stats(dcache_stats_t *out);
+
+#endif
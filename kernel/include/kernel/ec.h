@@ -33,7 +33,10 @@ void ec_fe_inv(ec_fe_t *r, const ec_fe_t *a);  /* Fermat's little theorem */
 /* Point operations */
 void ec_point_double(ec_point_t *r, const ec_point_t *p);
 void ec_point_add(ec_point_t *r, const ec_point_t *p, const ec_point_t *q);
+/* r = k * p, k big-endian; constant time in k (fixed 4-bit window) */
 void ec_scalar_mul(ec_point_t *r, const uint8_t *k, size_t k_len, const ec_point_t *p);
+/* r = k * G from a precomputed comb table, also constant time */
+void ec_scalar_mul_base(ec_point_t *r, const uint8_t k[32]);
 
 /* Get the P-256 base point G */
 void ec_get_generator(ec_point_t *g);
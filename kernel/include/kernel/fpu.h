@@ -0,0 +1,23 @@
+#ifndef _KERNEL_FPU_H
+#define _KERNEL_FPU_H
+
+#include <stdint.h>
+
+/* CPUID leaf 1 feature flags: bits 0-31 are EDX, bits 32-63 are ECX */
+#define CPU_FEAT_FXSR    (1ULL << 24)
+#define CPU_FEAT_SSE2    (1ULL << 26)
+#define CPU_FEAT_PCLMUL  (1ULL << (32 + 1))
+#define CPU_FEAT_SSSE3   (1ULL << (32 + 9))
+#define CPU_FEAT_AES     (1ULL << (32 + 25))
+
+/* Non-zero if the CPU has every feature in `mask` (CPU_FEAT_*) */
+int cpu_has(uint64_t mask);
+
+/* Task switches don't save the FPU/SSE registers, so kernel code that
+ * uses them brackets each short stretch with these: interrupts go off
+ * and the interrupted context's registers are saved with fxsave until
+ * kernel_fpu_end() puts them back.  Needs CPU_FEAT_FXSR; no nesting. */
+uint32_t kernel_fpu_begin(void);
+void kernel_fpu_end(uint32_t flags);
+
+#endif
@@ -4,20 +4,27 @@
 #include <stddef.h>
 #include <stdint.h>
 
-/* ── FS v4 Geometry ─────────────────────────────────────────────── */
+/* ── FS v5 Geometry ─────────────────────────────────────────────── */
 
 #define BLOCK_SIZE      4096
 #define NUM_BLOCKS      65536       /* 256MB total */
 #define NUM_INODES      4096
-#define DIRECT_BLOCKS   8
 #define MAX_NAME_LEN    28
-#define INDIRECT_PTRS   (BLOCK_SIZE / sizeof(uint32_t))   /* 1024 */
-#define DOUBLE_INDIRECT_PTRS  ((uint32_t)INDIRECT_PTRS * INDIRECT_PTRS) /* 1048576 */
-#define MAX_DIRECT_SIZE (DIRECT_BLOCKS * BLOCK_SIZE)       /* 32KB */
-/* Theoretical max: 32KB + 4MB + 4GB; capped by uint32_t size field */
+/* Capped by the uint32_t size field */
 #define MAX_FILE_SIZE   0xFFFFFFFFU
 
-#define FS_VERSION      4
+/* File data is described by extents (runs of contiguous blocks).  The
+ * first INODE_EXTENTS live in the inode; the rest spill into a chain of
+ * extent blocks, each holding EXTENTS_PER_BLOCK extents followed by the
+ * number of the next block in the chain (0 = last). */
+#define INODE_EXTENTS       5
+#define EXTENT_MAX_LEN      0xFFFF
+#define EXTENTS_PER_BLOCK   (BLOCK_SIZE / 6)                    /* 682 */
+#define EXTENT_NEXT_OFF     (EXTENTS_PER_BLOCK * 6)             /* 4092 */
+#define FS_MAX_EXTENTS      0xFFFF      /* num_extents is 16 bits */
+#define FS_READAHEAD_BLOCKS 64   /* contiguous blocks fetched per read-ahead */
+
+#define FS_VERSION      5
 
 #define INODE_FREE      0
 #define INODE_FILE      1
@@ -27,6 +34,9 @@
 
 #define ROOT_INODE      0
 
+/* Inode flags */
+#define INODE_FL_INDEX  0x01        /* directory uses a hashed index */
+
 #define LS_ALL          0x01
 #define LS_LONG         0x02
 
@@ -42,7 +52,7 @@
 #define DEV_MAJOR_URANDOM 4
 #define DEV_MAJOR_DRM     5   /* /dev/dri/card0 — GPU DRM device */
 
-/* ── Disk Layout (block-based, FS v4) ───────────────────────────── *
+/* ── Disk Layout (block-based, FS v5) ───────────────────────────── *
  *
  *   Block 0:        Superblock (4KB)
  *   Block 1:        Inode bitmap (4KB — covers 32768 bits, room for 4096 inodes)
@@ -66,25 +76,39 @@
 /* Superblock flags */
 #define FS_FLAG_DIRTY   0x01
 
+/* Background writeback */
+#define FS_FLUSH_INTERVAL_MS  1000  /* flusher wakeup period */
+#define FS_DIRTY_EXPIRE_MS    5000  /* max age of unwritten changes */
+#define FS_DIRTY_MAX_BLOCKS   1024  /* flush early past 4MB of dirty data */
+
 typedef struct {
     uint32_t inode;
     char name[MAX_NAME_LEN];
 } dir_entry_t;
 
+typedef struct __attribute__((packed)) {
+    uint32_t start;             /* first physical block */
+    uint16_t len;               /* blocks in the run */
+} fs_extent_t;
+
 typedef struct __attribute__((packed)) {
     uint8_t  type;
     uint16_t mode;              /* rwxrwxrwx in low 9 bits */
     uint16_t owner_uid;
     uint16_t owner_gid;
     uint32_t size;
-    uint32_t blocks[DIRECT_BLOCKS];
-    uint8_t  num_blocks;
-    uint32_t indirect_block;    /* single-indirect block pointer, 0 = none */
-    uint32_t double_indirect;   /* double-indirect block pointer, 0 = none */
+    uint16_t num_extents;       /* extents in file order, no holes */
+    uint32_t extent_block;      /* extents past INODE_EXTENTS, 0 = none */
+    union {
+        fs_extent_t extents[INODE_EXTENTS];
+        struct { uint32_t major, minor; } dev;  /* INODE_CHARDEV */
+    };
     uint32_t created_at;        /* epoch: seconds since 2000-01-01 */
     uint32_t modified_at;
     uint16_t nlink;             /* hard link count */
     uint16_t accessed_hi;       /* high 16 bits of access time (reserved) */
+    uint8_t  flags;             /* INODE_FL_* */
+    uint8_t  _reserved[4];
 } inode_t;  /* 64 bytes packed */
 
 typedef struct {
@@ -113,9 +137,16 @@ int fs_change_directory(const char* dirname);
 int fs_change_directory_by_inode(uint32_t inode_num);
 const char* fs_get_cwd(void);
 
+/* Write everything dirty to disk now.  Filesystem calls only modify the
+ * in-memory state; a flusher thread writes it back once it has been
+ * dirty for FS_DIRTY_EXPIRE_MS, so callers that need durability
+ * (sync, fsync, shutdown) call this directly. */
 int fs_sync(void);
 int fs_load(void);
 
+/* Metadata block writes issued by fs_sync() since boot */
+uint32_t fs_get_meta_writes(void);
+
 /* Permissions */
 int fs_chmod(const char* path, uint16_t mode);
 int fs_chown(const char* path, uint16_t uid, uint16_t gid);
@@ -149,6 +180,15 @@ uint32_t fs_get_cwd_inode(void);
 int fs_read_inode(uint32_t inode_num, inode_t* out_inode);
 int fs_read_block(uint32_t block_num, uint8_t* out_data);
 
+/* Data blocks allocated to an inode, and the physical block backing
+ * logical block `logical` (0 past the end) */
+uint32_t fs_inode_blocks(const inode_t *node);
+uint32_t fs_inode_block_at(const inode_t *node, uint32_t logical);
+
+/* Directory entry slots in directory block `block`: the root block of a
+ * hashed directory holds only "." and ".." ahead of its index */
+uint32_t fs_dir_slots(const inode_t *dir, uint32_t block);
+
 /* Block-level partial read: read 'count' bytes starting at 'offset' from inode.
  * Returns bytes read, or <0 on error. */
 int fs_read_at(uint32_t inode_num, uint8_t *buffer, uint32_t offset, uint32_t count);
@@ -177,8 +217,9 @@ int fs_rename(const char* old_name, const char* new_name);
 /* I/O statistics */
 void fs_get_io_stats(uint32_t *rd_ops, uint32_t *rd_bytes, uint32_t *wr_ops, uint32_t *wr_bytes);
 
-/* Bitmap counting helpers for statfs */
+/* Free-space counters for statfs; free extents measure fragmentation */
 uint32_t fs_count_free_blocks(void);
 uint32_t fs_count_free_inodes(void);
+uint32_t fs_count_free_extents(void);
 
 #endif
@@ -1,10 +1,41 @@
 #ifndef _KERNEL_HTTPD_H
 #define _KERNEL_HTTPD_H
 
+#include <stdint.h>
+
+#define HTTPD_PORT           80
+#define HTTPD_MAX_CONNS      64     /* connections served at once */
+#define HTTPD_BACKLOG        64     /* accept queue beyond that */
+#define HTTPD_MAX_REQUEST    2048   /* request headers, pipelined ones included */
+#define HTTPD_CHUNK          4096   /* file bytes read per step when streaming */
+#define HTTPD_IDLE_TICKS     1200   /* close idle keep-alive connections after 10 s */
+#define HTTPD_MAX_KEEPALIVE  100    /* requests per connection */
+#define HTTPD_CACHE_ENTRIES  32
+#define HTTPD_CACHE_FILE_MAX (64 * 1024)   /* larger files are streamed */
+#define HTTPD_CACHE_BYTES    (512 * 1024)  /* total cached responses */
+
+typedef struct {
+    uint32_t active;        /* open connections */
+    uint32_t accepted;
+    uint32_t requests;
+    uint32_t reused;        /* requests on an already used connection */
+    uint32_t not_found;
+    uint32_t cache_hits;
+    uint32_t cache_misses;  /* cacheable files read from the filesystem */
+    uint32_t cache_entries;
+    uint32_t cache_bytes;
+    uint32_t streamed;      /* responses too large for the cache */
+} httpd_stats_t;
+
 void httpd_initialize(void);
+/* Start serving port HTTPD_PORT from a kernel thread */
 int  httpd_start(void);
+/* Stop the thread and close every connection */
 void httpd_stop(void);
-void httpd_poll(void);
+/* One pass of the event loop: accept, read, parse and send without
+ * blocking; returns non-zero if anything moved */
+int  httpd_poll(void);
 int  httpd_is_running(void);
+void httpd_get_stats(httpd_stats_t *st);
 
 #endif
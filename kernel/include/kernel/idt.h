@@ -17,7 +17,8 @@ typedef void (*irq_handler_t)(registers_t* regs);
 /* Initialize GDT, IDT, PIC, PIT */
 void idt_initialize(void);
 
-/* Register a handler for an IRQ (0-15) */
+/* Register a handler for an IRQ (0-15).  A line can have several
+ * handlers (shared PCI interrupts); each must check its own device. */
 void irq_register_handler(int irq, irq_handler_t handler);
 
 /* PIT timer functions */
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <kernel/netbuf.h>
 
 /* IP Header */
 typedef struct {
@@ -39,7 +40,12 @@ typedef struct {
 /* IP Functions */
 void ip_initialize(void);
 int ip_send_packet(const uint8_t dst_ip[4], uint8_t protocol, const uint8_t* payload, size_t payload_len);
+/* Send the payload held in `nb`, prepending IP and Ethernet headers in
+ * place.  Always consumes `nb`. */
+int ip_send_netbuf(const uint8_t dst_ip[4], uint8_t protocol, netbuf_t* nb);
 void ip_handle_packet(const uint8_t* data, size_t len);
+/* Packet from the loopback device: no address or checksum checks */
+void ip_handle_local(const uint8_t* data, size_t len);
 
 /* ICMP Functions */
 void icmp_initialize(void);
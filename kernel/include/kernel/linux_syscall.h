@@ -30,6 +30,9 @@
 #define LINUX_SYS_readlink        85
 #define LINUX_SYS_munmap          91
 #define LINUX_SYS_ftruncate       93
+#define LINUX_SYS_sync            36
+#define LINUX_SYS_fsync           118
+#define LINUX_SYS_fdatasync       148
 #define LINUX_SYS_wait4           114
 #define LINUX_SYS_clone           120
 #define LINUX_SYS_vfork           190
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <kernel/netbuf.h>
 
 /* Ethernet frame structure */
 typedef struct {
@@ -30,17 +31,82 @@ net_config_t* net_get_config(void);
 /* Set IP address */
 void net_set_ip(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
 
-/* Send/receive packets */
+/* Send/receive packets (copying into and out of a network buffer) */
 int net_send_packet(const uint8_t* data, size_t len);
 int net_receive_packet(uint8_t* buffer, size_t* len);
 
+/* Zero-copy variants: net_send_netbuf() hands the frame in `nb` to the
+ * NIC and always consumes it; net_receive_netbuf() returns the next
+ * received frame (free it with netbuf_free()) or NULL. */
+int net_send_netbuf(netbuf_t* nb);
+
+/* Transmit batching: frames sent between net_tx_begin() and the
+ * matching net_tx_end() may sit in the NIC's ring until the end, so a
+ * burst costs one doorbell instead of one per frame.  Pairs nest. */
+void net_tx_begin(void);
+void net_tx_end(void);
+/* Hand anything held by an open batch to the NIC now (e.g. before
+ * waiting for a reply) */
+void net_tx_flush(void);
+netbuf_t* net_receive_netbuf(void);
+
 /* Network utilities */
 void net_print_mac(const uint8_t mac[6]);
 void net_print_ip(const uint8_t ip[4]);
 
-/* Packet processing */
+/* Receive path: frames are handled by the "netrx" thread, woken by the
+ * NIC interrupt, at most NET_RX_BUDGET per batch.  It also runs the TCP
+ * timers every NET_TIMER_TICKS. */
+#define NET_RX_BUDGET    32
+#define NET_TIMER_TICKS  12     /* 100 ms */
+
+typedef struct {
+    int      threaded;      /* 1 = IRQ-driven thread, 0 = polled */
+    int      irq;
+    uint32_t irqs;          /* receive interrupts taken */
+    uint32_t polls;         /* batches run */
+    uint32_t budget_hits;   /* batches that ran out of budget */
+    uint32_t wakeups;       /* times the thread slept and woke */
+    uint32_t lo_packets;    /* sent through the loopback device */
+    uint32_t lo_bytes;
+    uint32_t lo_drops;      /* loopback queue full */
+    uint32_t csum_hw;       /* TCP/UDP checksums left to the NIC */
+    uint32_t csum_sw;       /* ... finished in software instead */
+    uint32_t tx_batches;    /* net_tx_begin()/end() bursts */
+} net_rx_stats_t;
+
+/* Packet processing.  With the receive thread running this just yields
+ * to it; otherwise it drains the NIC in the caller's context. */
 void net_process_packets(void);
 
+/* Handle up to `budget` queued frames; returns how many were handled */
+int  net_poll(int budget);
+
+/* Non-zero when the IRQ-driven receive thread is running */
+int  net_rx_threaded(void);
+
+/* Non-zero if the caller can sleep until the receive thread wakes it.
+ * Not without the thread, not on the thread itself, and not with
+ * interrupts off (system calls), where nothing would ever run it. */
+int  net_can_sleep(void);
+
+/* Wait for received traffic: take net_wait_seq() before testing the
+ * condition, then net_wait() sleeps until the next batch is processed
+ * or `ticks` pass (or polls the NIC once when it can't sleep). */
+uint32_t net_wait_seq(void);
+void net_wait(uint32_t seq, uint32_t ticks);
+
+void net_get_rx_stats(net_rx_stats_t *out);
+
+/* Loopback: IP packets for 127.0.0.0/8 or our own address are queued
+ * by ip_send_netbuf() and delivered by net_poll() without touching the
+ * NIC, ARP or checksums.  net_loopback_xmit() takes an IP packet (no
+ * Ethernet header) and always consumes `nb`. */
+#define NET_LOOPBACK_QUEUE 128
+
+int  net_is_local(const uint8_t ip[4]);
+int  net_loopback_xmit(netbuf_t* nb);
+
 /* I/O statistics */
 void net_get_stats(uint32_t *tx_pkts, uint32_t *tx_bytes, uint32_t *rx_pkts, uint32_t *rx_bytes);
 
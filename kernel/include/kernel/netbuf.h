@@ -0,0 +1,86 @@
+#ifndef _KERNEL_NETBUF_H
+#define _KERNEL_NETBUF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NETBUF_COUNT     256    /* buffers in the pool */
+#define NETBUF_SIZE      2048   /* bytes per buffer */
+/* Room reserved for headers to be pushed.  The extra 2 bytes put the
+ * start of a frame on a 4-byte boundary once IP/TCP/UDP headers (all
+ * multiples of 4) and the 14-byte Ethernet header are in front of the
+ * payload, which NICs like the RTL8139 need to DMA from it. */
+#define NETBUF_HEADROOM  130
+
+/* A packet buffer from the fixed pool.  `data`/`len` describe the bytes
+ * in use; each layer prepends its header with netbuf_push() instead of
+ * copying the payload into a bigger buffer, so a frame is built once and
+ * handed to the NIC where it lies. */
+typedef struct netbuf {
+    struct netbuf *next;        /* free list / driver queues */
+    uint8_t *head;              /* start of the NETBUF_SIZE buffer */
+    uint8_t *data;              /* first byte of the packet */
+    uint32_t len;               /* bytes from data */
+    uint16_t csum_start;        /* L4 header whose checksum is still to be
+                                   finished, from head; 0 if none */
+    uint16_t csum_offset;       /* its checksum field, from csum_start */
+} netbuf_t;
+
+typedef struct {
+    uint32_t total;
+    uint32_t free;
+    uint32_t min_free;          /* low-water mark */
+    uint32_t allocs;
+    uint32_t fails;
+} netbuf_stats_t;
+
+void netbuf_init(void);
+
+/* Empty buffer with data at NETBUF_HEADROOM; NULL when the pool is dry */
+netbuf_t *netbuf_alloc(void);
+void      netbuf_free(netbuf_t *nb);   /* NULL is ignored */
+
+void netbuf_get_stats(netbuf_stats_t *st);
+
+static inline uint32_t netbuf_headroom(const netbuf_t *nb) {
+    return (uint32_t)(nb->data - nb->head);
+}
+
+static inline uint32_t netbuf_tailroom(const netbuf_t *nb) {
+    return NETBUF_SIZE - netbuf_headroom(nb) - nb->len;
+}
+
+/* Prepend `n` bytes; returns the new start or NULL if there's no room */
+static inline uint8_t *netbuf_push(netbuf_t *nb, uint32_t n) {
+    if (netbuf_headroom(nb) < n) return NULL;
+    nb->data -= n;
+    nb->len += n;
+    return nb->data;
+}
+
+/* Strip `n` bytes from the front; returns the new start or NULL */
+static inline uint8_t *netbuf_pull(netbuf_t *nb, uint32_t n) {
+    if (nb->len < n) return NULL;
+    nb->data += n;
+    nb->len -= n;
+    return nb->data;
+}
+
+/* Append `n` bytes; returns where they go or NULL if there's no room */
+static inline uint8_t *netbuf_put(netbuf_t *nb, uint32_t n) {
+    if (netbuf_tailroom(nb) < n) return NULL;
+    uint8_t *p = nb->data + nb->len;
+    nb->len += n;
+    return p;
+}
+
+/* Leave the checksum of the TCP/UDP header at `l4` to the NIC (or to
+ * net_send_netbuf() when the NIC can't do it).  The field `offset`
+ * bytes into the header must hold the folded pseudo-header sum. */
+static inline void netbuf_csum_partial(netbuf_t *nb, const uint8_t *l4,
+                                       uint16_t offset) {
+    nb->csum_start = (uint16_t)(l4 - nb->head);
+    nb->csum_offset = offset;
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <kernel/netbuf.h>
 
 /* PCnet-FAST III (Am79C973) PCI IDs */
 #define PCNET_VENDOR_ID  0x1022
@@ -33,6 +34,10 @@
 #define PCNET_CSR0_BABL  0x4000  /* Babble error */
 #define PCNET_CSR0_ERR   0x8000  /* Error summary */
 
+/* CSR3 - Interrupt masks */
+#define PCNET_CSR3_IDONM 0x0100  /* Mask initialization done */
+#define PCNET_CSR3_TINTM 0x0200  /* Mask transmit interrupt */
+
 /* Descriptor count (must be power of 2) */
 #define PCNET_RX_COUNT   8
 #define PCNET_TX_COUNT   8
@@ -68,9 +73,18 @@ typedef struct {
 
 /* PCnet functions */
 int  pcnet_initialize(void);
-int  pcnet_send_packet(const uint8_t* data, size_t len);
-int  pcnet_receive_packet(uint8_t* buffer, size_t* len);
+/* Transmit straight from `nb` (always consumed) / next received frame
+ * or NULL, see netbuf.h */
+int  pcnet_send_netbuf(netbuf_t* nb);
+netbuf_t* pcnet_receive_netbuf(void);
 void pcnet_get_mac(uint8_t mac[6]);
 int  pcnet_is_initialized(void);
 
+/* Receive interrupts: the handler acks and disables them (returns 1 if
+ * the interrupt was ours), and the receive thread re-enables them once
+ * the ring is empty. */
+int  pcnet_get_irq(void);
+int  pcnet_irq_ack(void);
+void pcnet_irq_enable(int on);
+
 #endif
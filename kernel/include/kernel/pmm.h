@@ -2,16 +2,45 @@
 #define _KERNEL_PMM_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <kernel/multiboot.h>
 
+/* Largest buddy block: 2^14 frames = 64MB */
+#define PMM_MAX_ORDER 14
+
+/* Frames addressable: the whole 32-bit physical space (1M frames = 4GB) */
+#define PMM_MAX_FRAMES    1048576
+
+/* Frames below this (256MB) are identity-mapped with 4KB pages in every
+   address space and can be dereferenced directly. Frames above are
+   highmem and must be accessed through kmap(). */
+#define PMM_LOWMEM_FRAMES 65536
+#define PMM_LOWMEM_LIMIT  ((uint32_t)PMM_LOWMEM_FRAMES * 4096)
+
+#define PMM_ZONE_NORMAL 0
+#define PMM_ZONE_HIGH   1
+#define PMM_NR_ZONES    2
+
 /* Initialize the physical memory manager from multiboot mmap */
 void pmm_init(multiboot_info_t *mbi);
 
-/* Allocate a single 4KB-aligned physical frame. Returns 0 on failure. */
+/* Allocate a single 4KB-aligned physical frame from lowmem.
+   Returns 0 on failure. */
 uint32_t pmm_alloc_frame(void);
 
-/* Allocate N contiguous 4KB-aligned physical frames (first-fit).
-   Returns the physical address of the first frame, or 0 on failure. */
+/* Allocate a single frame, preferring highmem and falling back to lowmem.
+   The result may not be identity-mapped: access it via kmap().
+   Returns 0 on failure. */
+uint32_t pmm_alloc_frame_high(void);
+
+/* Allocate a naturally aligned block of 2^order frames from the buddy
+   allocator. Free it with pmm_free_contiguous(addr, 1 << order).
+   Returns 0 on failure. */
+uint32_t pmm_alloc_order(uint32_t order);
+
+/* Allocate N contiguous 4KB-aligned physical frames. Served from the
+   smallest buddy block that fits; the unused tail goes back to the free
+   lists. Returns the physical address of the first frame, or 0 on failure. */
 uint32_t pmm_alloc_contiguous(uint32_t n_frames);
 
 /* Free a previously allocated physical frame */
@@ -23,7 +52,26 @@ void pmm_free_contiguous(uint32_t phys_addr, uint32_t n_frames);
 /* Reserve a range of physical addresses (mark frames as used) */
 void pmm_reserve_range(uint32_t phys_start, uint32_t phys_end);
 
-/* Return the number of free frames */
+/* Extend the identity-mapped kernel heap to end at phys_end.  Frames
+   below the heap's high-water mark are already its own; any past that
+   must be free lowmem RAM.  Lowmem is handed out from the top, so they
+   normally are.  Returns -1, taking nothing, if one is not. */
+int pmm_claim_heap(uint32_t phys_end);
+
+/* Return the number of free frames (all zones) */
 uint32_t pmm_free_frame_count(void);
 
+/* Return the number of usable RAM frames reported at boot (all zones) */
+uint32_t pmm_total_frame_count(void);
+
+/* Usable and free frame counts of one zone (PMM_ZONE_*) */
+void pmm_zone_counts(int zone, uint32_t *present, uint32_t *free);
+
+/* Number of free lowmem blocks of the given order */
+uint32_t pmm_free_blocks(uint32_t order);
+
+/* Format /proc/buddyinfo style lines (free blocks per order, one line per
+   populated zone) into buf. Returns the number of characters written. */
+int pmm_buddyinfo(char *buf, size_t max);
+
 #endif
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <kernel/netbuf.h>
 
 /* RTL8139 Vendor/Device IDs */
 #define RTL8139_VENDOR_ID 0x10EC
@@ -122,9 +123,17 @@ typedef struct {
 
 /* RTL8139 Functions */
 int rtl8139_initialize(void);
-int rtl8139_send_packet(const uint8_t* data, size_t len);
-int rtl8139_receive_packet(uint8_t* buffer, size_t* len);
+/* Transmit `nb` (always consumed) / next received frame or NULL */
+int rtl8139_send_netbuf(netbuf_t* nb);
+netbuf_t* rtl8139_receive_netbuf(void);
 void rtl8139_get_mac(uint8_t mac[6]);
 int rtl8139_is_initialized(void);
 
+/* Receive interrupts: the handler acks and masks them (returns 1 if the
+ * interrupt was ours), and the receive thread unmasks them once the
+ * ring is empty. */
+int rtl8139_get_irq(void);
+int rtl8139_irq_ack(void);
+void rtl8139_irq_enable(int on);
+
 #endif
@@ -38,6 +38,7 @@ void socket_close(int fd);
 /* Accessors for syscall layer */
 int  socket_set_nonblock(int fd, int on);
 int  socket_get_nonblock(int fd);
+int  socket_set_nodelay(int fd, int on);   /* TCP_NODELAY */
 int  socket_is_listening(int fd);
 int  socket_get_type(int fd);
 int  socket_get_proto_idx(int fd);
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <kernel/waitq.h>
 
 typedef struct {
     uint16_t src_port;
@@ -24,6 +25,15 @@ typedef struct {
 #define TCP_ACK  0x10
 #define TCP_URG  0x20
 
+/* TCP options */
+#define TCPOPT_EOL        0
+#define TCPOPT_NOP        1
+#define TCPOPT_MSS        2
+#define TCPOPT_WSCALE     3   /* RFC 7323 */
+#define TCPOPT_SACK_PERM  4   /* RFC 2018 */
+#define TCPOPT_SACK       5
+#define TCPOPT_TS         8   /* RFC 7323 */
+
 /* TCP states */
 typedef enum {
     TCP_CLOSED,
@@ -39,38 +49,153 @@ typedef enum {
     TCP_CLOSING
 } tcp_state_t;
 
-#define TCP_MAX_CONNECTIONS 8
-#define TCP_BUFFER_SIZE     4096
+#define TCP_MAX_CONNECTIONS 1024 /* handles; TCBs are allocated per connection */
+#define TCP_HASH_SIZE       256  /* connection hash buckets, a power of two */
+#define TCP_LISTEN_HASH     16   /* listener hash buckets, a power of two */
+#define TCP_BUF_INIT        16384        /* per-direction buffer to start with */
+#define TCP_BUF_MAX         (256 * 1024) /* ceiling for buffer auto-tuning */
+#define TCP_BUF_IDLE        3600         /* free empty buffers after 30 s idle */
+#define TCP_WSCALE          3    /* our window shift: 65535 << 3 covers TCP_BUF_MAX */
 #define TCP_MSS             1400
+#define TCP_MSS_DEFAULT     536  /* peer MSS when its SYN carries no option */
+#define TCP_SACK_BLOCKS     4
 #define TCP_MAX_RETRIES     5
 #define TCP_RTO_INIT        120  /* 1 second in ticks (120Hz) */
-#define TCP_BACKLOG_MAX     4
+#define TCP_RTO_MIN         24   /* 200 ms */
+#define TCP_RTO_MAX         7200 /* 60 seconds */
+#define TCP_INIT_CWND       (10 * TCP_MSS)   /* RFC 6928 initial window */
+#define TCP_DUPACK_THRESH   3    /* duplicate ACKs that trigger fast retransmit */
+#define TCP_DELACK_TICKS    5    /* hold an ACK for at most 40 ms */
+#define TCP_QUICKACKS       16   /* segments ACKed at once after start or loss */
+#define TCP_BACKLOG_MAX     128  /* default accept queue limit */
+#define TCP_SYN_BACKLOG     64   /* half-open connections per listener before SYN cookies */
+#define TCP_TIME_WAIT_TICKS 600  /* 2 * MSL, 5 seconds */
+#define TCP_FIN_TIMEOUT     7200 /* orphans give up on the peer's FIN after 60 s */
 
+/* Byte ring.  The memory is allocated when the first byte arrives and
+ * released again when the ring has been empty for TCP_BUF_IDLE ticks;
+ * `size` survives that, so a connection keeps its tuned capacity. */
 typedef struct {
-    uint8_t  buf[TCP_BUFFER_SIZE];
-    uint16_t head, tail, count;
+    uint8_t *buf;         /* NULL while not allocated */
+    uint32_t size;
+    uint32_t head, tail, count;
+    uint32_t last_use;    /* tick of the last write or drop */
 } tcp_ring_t;
 
+/* Sequence range [start, end) */
 typedef struct {
+    uint32_t start, end;
+} tcp_sack_t;
+
+typedef struct tcb {
     tcp_state_t state;
     uint16_t local_port;
     uint16_t remote_port;
     uint8_t  remote_ip[4];
     uint32_t snd_una;     /* oldest unacked seq */
     uint32_t snd_nxt;     /* next seq to send */
+    uint32_t snd_max;     /* highest seq sent (snd_nxt rewinds on timeout) */
     uint32_t snd_wnd;     /* send window */
     uint32_t rcv_nxt;     /* next expected seq from peer */
     uint32_t rcv_wnd;     /* receive window */
-    tcp_ring_t rx_ring;   /* received data buffer */
-    tcp_ring_t tx_ring;   /* data awaiting send */
+    uint32_t rcv_adv;     /* right edge of the last window advertised */
+    tcp_ring_t rx_ring;   /* received data, then out-of-order data past it */
+    tcp_ring_t tx_ring;   /* unacked + unsent data, starting at snd_una */
+    int      fin_queued;  /* FIN goes out after the last byte of tx_ring */
+    int      fin_acked;
+
+    /* Options agreed in the handshake */
+    uint32_t mss;         /* payload per segment, less option space */
+    uint8_t  ws_ok;       /* window scaling (RFC 7323) */
+    uint8_t  snd_wscale;  /* shift for windows the peer advertises */
+    uint8_t  rcv_wscale;  /* shift for windows we advertise */
+    uint8_t  ts_ok;       /* timestamps (RFC 7323) */
+    uint8_t  sack_ok;     /* selective acknowledgments (RFC 2018) */
+    uint32_t ts_recent;   /* peer's timestamp to echo */
+
+    /* Small segments and ACKs (RFC 896 Nagle, RFC 1122 delayed ACK) */
+    int      nodelay;     /* TCP_NODELAY: don't hold back partial segments */
+    int      ack_pending; /* ACK owed, waiting for data to ride on */
+    uint32_t ack_tick;    /* when it became owed */
+    uint32_t rcv_acked;   /* rcv_nxt in the last ACK sent */
+    int      quickack;    /* segments left to ACK without delay */
+
+    /* SACK: out-of-order data held in rx_ring (newest first), and the
+     * ranges the peer has reported holding */
+    tcp_sack_t rcv_sack[TCP_SACK_BLOCKS];
+    int      rcv_sack_n;
+    tcp_sack_t snd_sack[TCP_SACK_BLOCKS];
+    int      snd_sack_n;
+    uint32_t rtx_high;    /* end of the last hole resent in this recovery */
+
+    /* Receive buffer auto-tuning: bytes read per round trip */
+    uint32_t rcv_rtt;     /* ticks, from timestamps; 0 until sampled */
+    uint32_t rcv_space;
+    uint32_t rcv_space_tick;
+
+    /* Congestion control (NewReno, RFC 5681/6582) */
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t recover;     /* snd_max when fast recovery started */
+    int      in_recovery;
+    int      dupacks;
+
+    /* Round-trip estimate (RFC 6298), in ticks: srtt x8, rttvar x4 */
+    uint32_t srtt;
+    uint32_t rttvar;
+    int      rtt_active;  /* timing the segment ending at rtt_seq */
+    uint32_t rtt_seq;
+    uint32_t rtt_start;
+
     uint32_t rto_ticks;   /* retransmission timeout */
+    uint32_t rtx_tick;    /* when the retransmit timer was (re)started */
     uint32_t last_send_tick;
     int      retries;
+    uint32_t timeouts;    /* retransmission timeouts */
+    uint32_t fast_rtx;    /* fast retransmits */
+    uint32_t segs_out;    /* segments sent */
+    uint32_t retrans;     /* data segments sent again */
     int      is_listen;   /* passive open */
-    int      backlog_queue[TCP_BACKLOG_MAX];
-    int      backlog_head, backlog_tail, backlog_count;
+    waitq_t  wq;          /* woken on state change, data, ACKs and new backlog */
+
+    /* Table linkage */
+    struct tcb *hnext;    /* connection or listener hash chain */
+    int      hashed;
+    int      handle;      /* API index; -1 once the application closed it */
+
+    /* Passive opens: the listener until accepted, and its queue */
+    struct tcb *parent;
+    struct tcb *accept_next;
+    int      queued;      /* on parent's accept queue */
+    struct tcb *accept_head, *accept_tail;
+    int      accept_count;
+    int      backlog;     /* accept queue limit */
+    int      syn_count;   /* children still in SYN_RECEIVED */
 } tcb_t;
 
+/* Snapshot of a connection for /proc and tests */
+typedef struct {
+    tcp_state_t state;
+    uint16_t local_port, remote_port;
+    uint8_t  remote_ip[4];
+    uint32_t snd_una, snd_nxt, rcv_nxt;
+    uint32_t in_flight;   /* bytes sent, not yet acked */
+    uint32_t queued;      /* bytes in the send buffer */
+    uint32_t snd_wnd;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t srtt_ms;     /* 0 until the first sample */
+    uint32_t rto_ms;
+    uint32_t timeouts;
+    uint32_t fast_rtx;
+    uint32_t segs_out;
+    uint32_t retrans;
+    uint32_t snd_buf;     /* allocated buffer bytes, 0 while released */
+    uint32_t rcv_buf;
+    uint8_t  snd_wscale, rcv_wscale;
+    uint8_t  ws_ok, ts_ok, sack_ok;
+} tcp_info_t;
+
 void tcp_initialize(void);
 int  tcp_open(uint16_t local_port, int listen);
 int  tcp_connect(int tcb_idx, const uint8_t dst_ip[4], uint16_t dst_port);
@@ -81,10 +206,39 @@ void tcp_close(int tcb_idx);
 tcp_state_t tcp_get_state(int tcb_idx);
 void tcp_handle_packet(const uint8_t* data, size_t len, const uint8_t src_ip[4]);
 void tcp_timer_tick(void);
+/* Tick at which the earliest delayed ACK must go out; 0 if none waits */
+int  tcp_delack_due(uint32_t *due);
 
 /* Non-blocking helpers for syscall layer */
 int  tcp_has_backlog(int idx);     /* 1 if pending connections exist */
 int  tcp_rx_available(int idx);    /* bytes available in rx ring */
 int  tcp_recv_nb(int idx, uint8_t *buf, size_t len); /* non-blocking recv, -2=EAGAIN */
+/* Non-blocking send: queues what fits and returns the byte count, -2
+ * (EAGAIN) if the send buffer is full */
+int  tcp_send_nb(int idx, const uint8_t *data, size_t len);
+
+/* Fill `out` for connection `idx`; -1 if the index is invalid */
+int  tcp_get_info(int idx, tcp_info_t *out);
+
+/* Stack-wide counters */
+typedef struct {
+    uint32_t tcbs;        /* allocated TCBs, listeners included */
+    uint32_t orphans;     /* closed by the application, still finishing */
+    uint32_t syn_recv;    /* half-open connections */
+    uint32_t time_wait;   /* TIME_WAIT entries */
+    uint32_t cookies_sent;
+    uint32_t cookies_ok;  /* connections created from a returning cookie */
+    uint32_t syn_dropped; /* SYNs dropped on a full accept queue */
+    uint32_t segs_out;
+    uint32_t pure_acks;   /* segments carrying nothing but an ACK */
+} tcp_stats_t;
+
+void tcp_get_stats(tcp_stats_t *st);
+
+/* Limit the accept queue of listener `idx` (listen() backlog) */
+int  tcp_set_backlog(int idx, int backlog);
+
+/* TCP_NODELAY: send partial segments without waiting for ACKs */
+int  tcp_set_nodelay(int idx, int on);
 
 #endif
@@ -15,6 +15,7 @@
 /* TLS 1.2 handshake types */
 #define TLS_HS_CLIENT_HELLO     1
 #define TLS_HS_SERVER_HELLO     2
+#define TLS_HS_NEW_SESSION_TICKET 4
 #define TLS_HS_CERTIFICATE      11
 #define TLS_HS_SERVER_KEY_EXCHANGE 12
 #define TLS_HS_SERVER_HELLO_DONE 14
@@ -29,6 +30,18 @@
 #define TLS_RSA_AES128_GCM_SHA256           0x009C
 #define TLS_ECDHE_RSA_AES128_CBC_SHA256     0xC027
 #define TLS_ECDHE_ECDSA_AES128_GCM_SHA256  0xC02B
+#define TLS_ECDHE_RSA_CHACHA20_POLY1305     0xCCA8   /* RFC 7905 */
+#define TLS_ECDHE_ECDSA_CHACHA20_POLY1305   0xCCA9
+
+/* Extensions */
+#define TLS_EXT_SESSION_TICKET  0x0023   /* RFC 5077 */
+
+/* Client session cache: master secrets of finished handshakes, offered
+ * again to the same host and port by session ID or ticket */
+#define TLS_SESSION_CACHE     8
+#define TLS_SESSION_HOST      128     /* longer host names are not cached */
+#define TLS_SESSION_LIFETIME  3600    /* seconds, unless the ticket says less */
+#define TLS_MAX_TICKET        2048
 
 /* Max TLS record payload */
 #define TLS_MAX_RECORD   16384
@@ -52,8 +65,8 @@ typedef struct {
     /* Active keys (after ChangeCipherSpec) */
     uint8_t  client_write_mac_key[32];
     uint8_t  server_write_mac_key[32];
-    uint8_t  client_write_key[16];
-    uint8_t  server_write_key[16];
+    uint8_t  client_write_key[32];   /* 16 bytes for AES-128 */
+    uint8_t  server_write_key[32];
     aes128_ctx_t client_aes;
     aes128_ctx_t server_aes;
 
@@ -61,10 +74,12 @@ typedef struct {
     uint64_t client_seq;
     uint64_t server_seq;
 
-    /* GCM implicit IVs (4 bytes each, combined with 8-byte explicit nonce) */
-    uint8_t  client_write_iv[4];
-    uint8_t  server_write_iv[4];
+    /* GCM implicit IVs (4 bytes each, combined with 8-byte explicit nonce);
+     * ChaCha20-Poly1305 uses 12 bytes, xored with the sequence number */
+    uint8_t  client_write_iv[12];
+    uint8_t  server_write_iv[12];
     int      is_gcm;             /* 1 if using GCM cipher suite */
+    int      is_chacha;          /* 1 if using ChaCha20-Poly1305 */
 
     /* Encryption active flags */
     int      client_encrypted;
@@ -86,10 +101,33 @@ typedef struct {
     uint16_t cipher_suite;           /* negotiated cipher */
     uint8_t  ecdhe_privkey[32];      /* our ECDHE private key */
     ec_point_t ecdhe_server_pubkey;  /* server's ephemeral EC public key */
+
+    /* Session resumption (RFC 5246 session IDs, RFC 5077 tickets) */
+    uint8_t  session_id[32];
+    uint8_t  session_id_len;
+    int      resuming;               /* offered a cached session */
+    int      resumed;                /* server accepted it: abbreviated handshake */
+    uint8_t *ticket;                 /* offered or newly issued; freed by tls_connect */
+    uint16_t ticket_len;
+    int      new_ticket;             /* ticket came in this handshake */
+    uint32_t ticket_lifetime;        /* seconds, 0 if unspecified */
 } tls_conn_t;
 
-/* Connect TLS over an existing TCP socket */
-int tls_connect(tls_conn_t *conn, int sock_fd, const char *hostname);
+typedef struct {
+    uint32_t full;           /* full handshakes */
+    uint32_t resumed;        /* abbreviated handshakes */
+    uint32_t rejected;       /* cached sessions the server declined */
+    uint32_t tickets;        /* NewSessionTicket messages received */
+    uint32_t cached;         /* sessions in the cache */
+} tls_stats_t;
+
+/* Connect TLS over an existing TCP socket.  host and port key the
+ * session cache: a repeat connection resumes the last session. */
+int tls_connect(tls_conn_t *conn, int sock_fd, const char *hostname, uint16_t port);
+
+void tls_get_stats(tls_stats_t *st);
+/* Forget every cached session */
+void tls_session_flush(void);
 
 /* Send/receive application data */
 int tls_send(tls_conn_t *conn, const uint8_t *data, size_t len);
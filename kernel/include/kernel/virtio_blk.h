@@ -0,0 +1,33 @@
+#ifndef _KERNEL_VIRTIO_BLK_H
+#define _KERNEL_VIRTIO_BLK_H
+
+#include <stdint.h>
+
+#define VBLK_MAX_REQS     32    /* requests in flight on the queue */
+#define VBLK_MAX_SECTORS  256   /* per request; larger transfers are split */
+
+/* Initialize VirtIO block device (returns 1 if found, 0 otherwise) */
+int  virtio_blk_init(void);
+
+/* Check if VirtIO block is active */
+int  virtio_blk_active(void);
+
+/* Capacity in 512-byte sectors */
+uint64_t virtio_blk_capacity(void);
+
+/* Queue a transfer without waiting.  Returns a request id for
+ * virtio_blk_wait(), or -1.  Blocks only when the queue is full.
+ * `count` must be <= VBLK_MAX_SECTORS. */
+int  virtio_blk_submit(uint32_t lba, uint32_t count, void *buf, int write);
+
+/* Wait for a submitted request; returns 0 on success, -1 on error */
+int  virtio_blk_wait(int id);
+
+/* Synchronous transfers of any length (split and pipelined) */
+int  virtio_blk_read(uint32_t lba, uint32_t count, void *buf);
+int  virtio_blk_write(uint32_t lba, uint32_t count, const void *buf);
+
+/* Write back the device's volatile cache */
+int  virtio_blk_flush(void);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _KERNEL_VIRTIO_NET_H
+#define _KERNEL_VIRTIO_NET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/netbuf.h>
+
+#define VNET_RX_BUFS      128   /* receive buffers kept posted */
+#define VNET_TX_BUFS      64    /* transmits in flight */
+#define VNET_MAX_FRAME    1514  /* largest Ethernet frame, without FCS */
+
+/* Pass as csum_start to virtio_net_send_netbuf() when the frame is
+ * complete */
+#define VNET_NO_CSUM      (-1)
+
+/* Initialize VirtIO network device (returns 0 if found, -1 otherwise,
+ * like the other NIC drivers) */
+int  virtio_net_initialize(void);
+int  virtio_net_is_initialized(void);
+void virtio_net_get_mac(uint8_t mac[6]);
+
+/* Queue the frame in `nb` for transmission and return without waiting
+ * for the device, which reads it straight from the buffer; `nb` is
+ * always consumed.  With checksum offload, `csum_start`/`csum_offset`
+ * name the checksum field the device fills in (the field must hold the
+ * pseudo-header sum); VNET_NO_CSUM sends the frame as is. */
+int  virtio_net_send_netbuf(netbuf_t *nb, int csum_start, int csum_offset);
+int  virtio_net_send_packet(const uint8_t *data, size_t len);
+
+/* While held, queued frames are only announced to the device every
+ * few frames; releasing the hold or virtio_net_tx_flush() announces
+ * the rest.  Call with interrupts off (see net_tx_begin()). */
+void virtio_net_tx_hold(int on);
+void virtio_net_tx_flush(void);
+
+/* Next received frame, in the buffer the device wrote it to; NULL when
+ * none is pending */
+netbuf_t *virtio_net_receive_netbuf(void);
+
+/* Non-zero if VIRTIO_NET_F_CSUM was negotiated */
+int  virtio_net_has_csum_offload(void);
+
+/* Receive interrupts: the handler acks them and suppresses further
+ * ones (returns 1 if the interrupt was ours); the receive thread
+ * re-enables them once the ring is empty.  virtio_net_irq_enable(1)
+ * returns 1 if frames arrived while interrupts were off. */
+int  virtio_net_get_irq(void);
+int  virtio_net_irq_ack(void);
+int  virtio_net_irq_enable(int on);
+
+#endif
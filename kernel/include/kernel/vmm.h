@@ -23,6 +23,10 @@
 /* User-space virtual base for per-process mappings (PDE[256] = 1GB) */
 #define USER_SPACE_BASE 0x40000000
 
+/* Kernel window for temporary mappings of highmem frames (PDE[1022]) */
+#define KMAP_BASE       0xFF800000
+#define KMAP_SLOTS      1024
+
 /* Initialize VMM: build identity-mapped page tables and enable paging */
 void vmm_init(multiboot_info_t *mbi);
 
@@ -72,4 +76,17 @@ void vmm_unmap_user_page(uint32_t pd_phys, uint32_t virt);
 /* Flush the entire TLB (reload CR3). */
 void vmm_flush_tlb(void);
 
+/* Map a physical frame into kernel space and return a pointer to it.
+ * Lowmem frames return their identity address; highmem frames take a slot
+ * in the kmap window. Returns NULL if the window is full. Pair with kunmap(). */
+void *kmap(uint32_t phys);
+
+/* Release a pointer returned by kmap(). No-op for identity pointers. */
+void kunmap(void *addr);
+
+/* Zero / copy a whole physical frame, wherever it lives.
+ * Return 0, or -1 if the frame could not be mapped (kmap window full). */
+int vmm_zero_frame(uint32_t phys);
+int vmm_copy_frame(uint32_t dst_phys, uint32_t src_phys);
+
 #endif
@@ -0,0 +1,55 @@
+#ifndef _KERNEL_WAITQ_H
+#define _KERNEL_WAITQ_H
+
+#include <stdint.h>
+
+/* Sleep forever (until woken) */
+#define WAITQ_FOREVER 0xFFFFFFFFu
+
+/* A set of sleeping threads, one bit per task slot (TASK_MAX <= 32).
+ * `seq` counts wakeups so a waiter can't miss one that happens between
+ * testing its condition and going to sleep. */
+typedef struct {
+    volatile uint32_t waiters;
+    volatile uint32_t seq;
+} waitq_t;
+
+void waitq_init(waitq_t *q);
+
+/* Snapshot to take before testing the wait condition */
+static inline uint32_t waitq_seq(const waitq_t *q) { return q->seq; }
+
+/* Sleep until waitq_wake() or `ticks` PIT ticks pass.  Returns at once
+ * if the queue was woken since `seq` was taken.  Contexts that can't
+ * block (the boot task, interrupts disabled) halt until the next
+ * interrupt instead, so callers must re-test their condition in a loop. */
+void waitq_sleep(waitq_t *q, uint32_t seq, uint32_t ticks);
+
+/* Wake every sleeper.  Safe from interrupt handlers. */
+void waitq_wake(waitq_t *q);
+
+/* Non-zero if the current context can block in waitq_sleep() */
+int  waitq_can_block(void);
+
+/* Sleeping lock for state that is touched with interrupts enabled and
+ * must not change across a preemption (disk channels, the filesystem).
+ * The owner may take it again; it is released when every lock has been
+ * matched by an unlock.  Never take one from an interrupt handler. */
+typedef struct {
+    volatile int owner;         /* task id, -1 when free */
+    volatile uint32_t depth;
+    waitq_t wq;
+} kmutex_t;
+
+#define KMUTEX_INIT { -1, 0, { 0, 0 } }
+
+void kmutex_init(kmutex_t *m);
+
+/* Returns 0 once the lock is held.  Waiters that can't block (the boot
+ * task) halt between interrupts, and so do system calls of user tasks,
+ * with interrupts enabled while they wait.  Kernel code that disabled
+ * interrupts itself can't wait and gets -1 if another task holds it. */
+int  kmutex_lock(kmutex_t *m);
+void kmutex_unlock(kmutex_t *m);
+
+#endif
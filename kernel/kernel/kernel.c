@@ -30,6 +30,7 @@
 #include <kernel/drm.h>
 #include <kernel/ac97.h>
 #include <kernel/virtio_input.h>
+#include <kernel/virtio_blk.h>
 #include <kernel/test.h>
 #include <kernel/user.h>
 
@@ -531,6 +532,7 @@ void kernel_main(multiboot_info_t* mbi) {
     mouse_initialize();
     firewall_initialize();
 
+    virtio_blk_init();      /* preferred over IDE when present */
     ata_initialize();
     acpi_initialize();
 
@@ -566,6 +568,7 @@ void kernel_main(multiboot_info_t* mbi) {
         test_run_all();
         printf("[AUTOTEST] Done\n");
 
+        fs_sync();
         acpi_shutdown();
         while (1) asm volatile("hlt");
     } else if (gfx_is_active() && !terminal_mode) {
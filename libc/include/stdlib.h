@@ -19,6 +19,23 @@ typedef struct {
     long rem;
 } ldiv_t;
 
+/* Kernel heap counters, see heap_get_stats() */
+typedef struct {
+    size_t heap_bytes;      /* break - heap start (incl. reserved regions) */
+    size_t arena_bytes;     /* bytes handed to the small-object arena */
+    size_t large_bytes;     /* bytes in allocated page-granular runs */
+    size_t free_bytes;      /* bytes on small bins and free large runs */
+    size_t in_use_bytes;    /* bytes in allocated chunks, incl. headers */
+    size_t peak_bytes;      /* high-water mark of in_use_bytes */
+    unsigned long n_malloc;
+    unsigned long n_free;
+    unsigned long n_large;  /* allocations served by the page path */
+    unsigned long n_split;
+    unsigned long n_coalesce;
+    unsigned long n_grow;   /* small-arena extensions */
+    unsigned long n_fail;
+} heap_stats_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -37,6 +54,7 @@ void* malloc(size_t size);
 void* calloc(size_t nmemb, size_t size);
 void* realloc(void* ptr, size_t size);
 void free(void* ptr);
+size_t malloc_usable_size(void* ptr);
 int atoi(const char* str);
 long atol(const char* str);
 long long atoll(const char* str);
@@ -56,6 +74,7 @@ int rand(void);
 
 size_t heap_used(void);
 size_t heap_total(void);
+void heap_get_stats(heap_stats_t* out);
 
 void qsort(void* base, size_t nmemb, size_t size, int (*compar)(const void*, const void*));
 void* bsearch(const void* key, const void* base, size_t nmemb, size_t size,
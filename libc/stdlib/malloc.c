@@ -4,99 +4,448 @@
 
 #if defined(__is_libk)
 #include <kernel/io.h>
+#include <kernel/pmm.h>
 #endif
 
+/*
+ * Heap allocator.
+ *
+ * Small and medium requests are served from segregated free lists using a
+ * two-level size-class index (first level = power of two, second level =
+ * 16 linear subdivisions).  Two bitmaps locate the first non-empty class
+ * that is guaranteed to fit, so malloc and free are O(1).  Chunks carry
+ * boundary tags: the header records whether the previous chunk is in use
+ * and free chunks store their size in a footer, so neighbours coalesce
+ * without walking the heap.
+ *
+ * Requests of LARGE_THRESHOLD bytes or more take a page-granular path:
+ * they get whole pages carved from the heap break and are recycled through
+ * an address-ordered run list, never through the small bins.
+ */
+
 #define HEAP_MAGIC 0xBEEF
-#define HEAP_MAX   (512 * 1024 * 1024)  /* 512 MB */
+#define HEAP_MAX   (256 * 1024 * 1024)  /* 256 MB */
 #define ALIGN(x)   (((x) + 7) & ~7)
 
-typedef struct block_header {
-    uint32_t size;      /* payload size */
+#define PAGE_SIZE       4096
+#define PAGE_ALIGN(x)   (((x) + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1))
+#define ARENA_GROW      (64 * 1024)      /* minimum small-arena extension */
+#define LARGE_THRESHOLD (128 * 1024)     /* requests >= this use page runs */
+
+/* Chunk flags */
+#define CH_INUSE      0x1
+#define CH_PREV_INUSE 0x2
+#define CH_LARGE      0x4
+
+typedef struct chunk {
+    uint32_t size;      /* chunk size including this header */
     uint16_t magic;
-    uint16_t free;      /* 1 = free, 0 = used */
-    struct block_header* next;
-} block_header_t;
+    uint16_t flags;     /* CH_* */
+} chunk_t;
+
+/* Free small chunk: links live in the payload, size is mirrored in the
+ * last 4 bytes (footer) so the next chunk can find its start. */
+typedef struct free_chunk {
+    chunk_t hdr;
+    struct free_chunk* next;
+    struct free_chunk* prev;
+} free_chunk_t;
+
+/* Free large run, kept in an address-ordered singly-linked list */
+typedef struct large_run {
+    chunk_t hdr;
+    struct large_run* next;
+} large_run_t;
+
+#define CHUNK_HDR  ((uint32_t)sizeof(chunk_t))
+#define MIN_CHUNK  ((uint32_t)ALIGN(sizeof(free_chunk_t) + sizeof(uint32_t)))
+
+/* Size-class index */
+#define SL_BITS    4
+#define SL_COUNT   (1 << SL_BITS)
+#define FL_SHIFT   8                    /* sizes below 256 share level 0 */
+#define FL_COUNT   24                   /* up to 2^(FL_SHIFT+FL_COUNT-1) */
+#define SMALL_STEP ((1 << FL_SHIFT) / SL_COUNT)
 
 extern char _heap_start[];
-static block_header_t* free_list = NULL;
 static char* heap_end = NULL;
 
+static uint32_t fl_bitmap;
+static uint32_t sl_bitmap[FL_COUNT];
+static free_chunk_t* bins[FL_COUNT][SL_COUNT];
+
+static chunk_t* arena_fence;            /* terminator of newest arena segment */
+static large_run_t* large_free;
+
+static heap_stats_t stats;
+
+/* ── Helpers ───────────────────────────────────────────────────────── */
+
+static inline int fls32(uint32_t x) {
+    return 31 - __builtin_clz(x);
+}
+
+static inline chunk_t* chunk_next(chunk_t* c) {
+    return (chunk_t*)((char*)c + c->size);
+}
+
+static inline void chunk_set_footer(chunk_t* c) {
+    *(uint32_t*)((char*)c + c->size - sizeof(uint32_t)) = c->size;
+}
+
+static inline chunk_t* chunk_prev(chunk_t* c) {
+    uint32_t prev_size = ((uint32_t*)c)[-1];
+    return (chunk_t*)((char*)c - prev_size);
+}
+
+static void mapping_insert(uint32_t size, int* fl, int* sl) {
+    if (size < (1U << FL_SHIFT)) {
+        *fl = 0;
+        *sl = size / SMALL_STEP;
+    } else {
+        int bit = fls32(size);
+        *fl = bit - FL_SHIFT + 1;
+        *sl = (size >> (bit - SL_BITS)) & (SL_COUNT - 1);
+    }
+}
+
+/* Round size up to the next class boundary so any chunk in the
+ * resulting class is large enough. */
+static void mapping_search(uint32_t size, int* fl, int* sl) {
+    if (size < (1U << FL_SHIFT))
+        size += SMALL_STEP - 1;
+    else
+        size += (1U << (fls32(size) - SL_BITS)) - 1;
+    mapping_insert(size, fl, sl);
+}
+
+static void bin_insert(free_chunk_t* c) {
+    int fl, sl;
+    mapping_insert(c->hdr.size, &fl, &sl);
+    c->prev = NULL;
+    c->next = bins[fl][sl];
+    if (c->next)
+        c->next->prev = c;
+    bins[fl][sl] = c;
+    fl_bitmap |= 1U << fl;
+    sl_bitmap[fl] |= 1U << sl;
+    stats.free_bytes += c->hdr.size;
+}
+
+static void bin_remove(free_chunk_t* c) {
+    int fl, sl;
+    mapping_insert(c->hdr.size, &fl, &sl);
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        bins[fl][sl] = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    if (!bins[fl][sl]) {
+        sl_bitmap[fl] &= ~(1U << sl);
+        if (!sl_bitmap[fl])
+            fl_bitmap &= ~(1U << fl);
+    }
+    stats.free_bytes -= c->hdr.size;
+}
+
+static free_chunk_t* bin_find(uint32_t size) {
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= FL_COUNT)
+        return NULL;
+
+    uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (!sl_map) {
+        uint32_t fl_map = (fl + 1 < FL_COUNT) ? fl_bitmap & (~0U << (fl + 1)) : 0;
+        if (!fl_map)
+            return NULL;
+        fl = __builtin_ctz(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    return bins[fl][sl];
+}
+
+/* Mark c free, merge it with free neighbours and file it in a bin. */
+static void chunk_release(chunk_t* c) {
+    chunk_t* next = chunk_next(c);
+    if (!(next->flags & CH_INUSE)) {
+        bin_remove((free_chunk_t*)next);
+        c->size += next->size;
+        next->magic = 0;
+        stats.n_coalesce++;
+    }
+    if (!(c->flags & CH_PREV_INUSE)) {
+        chunk_t* prev = chunk_prev(c);
+        bin_remove((free_chunk_t*)prev);
+        prev->size += c->size;
+        /* Absorbed header: a second free() of it must fail the checks */
+        c->magic = 0;
+        c->flags &= ~CH_INUSE;
+        c = prev;
+        stats.n_coalesce++;
+    }
+    c->magic = HEAP_MAGIC;
+    c->flags &= ~CH_INUSE;
+    chunk_set_footer(c);
+    chunk_next(c)->flags &= ~CH_PREV_INUSE;
+    bin_insert((free_chunk_t*)c);
+}
+
 static void heap_init(void) {
-    free_list = (block_header_t*)(void*)_heap_start;
-    free_list->size = 0;
-    free_list->magic = HEAP_MAGIC;
-    free_list->free = 1;
-    free_list->next = NULL;
-    heap_end = (char*)_heap_start + sizeof(block_header_t);
+    heap_end = (char*)PAGE_ALIGN((uintptr_t)_heap_start);
 }
 
-static block_header_t* request_space(block_header_t* last, size_t size) {
-    size_t total = sizeof(block_header_t) + size;
-    char* new_end = heap_end + total;
+static int heap_can_grow(uint32_t bytes) {
+    uintptr_t end = (uintptr_t)heap_end + bytes;
+    if (end < (uintptr_t)heap_end || end - (uintptr_t)_heap_start > HEAP_MAX)
+        return 0;
+#if defined(__is_libk)
+    /* The kernel heap is addressed physically: it must stay in lowmem */
+    if (end > PMM_LOWMEM_LIMIT)
+        return 0;
+#endif
+    return 1;
+}
 
-    if ((size_t)(new_end - (char*)_heap_start) > HEAP_MAX) {
+/* Move the break up by `bytes`.  The heap is identity-mapped physical
+ * memory, so in the kernel the frames behind it are claimed from the PMM
+ * (a no-op before pmm_init, which reserves the initial break itself).
+ * Returns NULL, leaving the break alone, if any of them is in use. */
+static char* heap_extend(uint32_t bytes) {
+    char* old = heap_end;
+#if defined(__is_libk)
+    if (pmm_claim_heap((uint32_t)old + bytes) != 0)
         return NULL;
+#endif
+    heap_end += bytes;
+    return old;
+}
+
+/* ── Small-object arena ────────────────────────────────────────────── */
+
+/* Add at least `need` bytes of free space to the arena.  Extends the
+ * newest segment in place when nothing else has been carved from the
+ * break since, otherwise starts a new segment. */
+static int arena_grow(uint32_t need) {
+    /* Slack of one class step so bin_find's rounded search still hits */
+    uint32_t bytes = PAGE_ALIGN(need + (need >> SL_BITS) + CHUNK_HDR);
+    if (bytes < ARENA_GROW)
+        bytes = ARENA_GROW;
+    if (!heap_can_grow(bytes))
+        return -1;
+    char* base = heap_extend(bytes);
+    if (!base)
+        return -1;
+
+    chunk_t* c;
+    if (arena_fence && (char*)arena_fence + CHUNK_HDR == base) {
+        /* Old fence becomes the header of the new free chunk */
+        c = arena_fence;
+        c->size = bytes;
+    } else {
+        c = (chunk_t*)base;
+        c->size = bytes - CHUNK_HDR;
+        c->flags = CH_PREV_INUSE;
     }
+    c->magic = HEAP_MAGIC;
+    c->flags |= CH_INUSE;
 
-    block_header_t* block = (block_header_t*)heap_end;
-    heap_end = new_end;
+    arena_fence = chunk_next(c);
+    arena_fence->size = CHUNK_HDR;
+    arena_fence->magic = HEAP_MAGIC;
+    arena_fence->flags = CH_INUSE | CH_PREV_INUSE;
 
-    block->size = size;
-    block->magic = HEAP_MAGIC;
-    block->free = 0;
-    block->next = NULL;
+    stats.arena_bytes += bytes;
+    stats.n_grow++;
+    chunk_release(c);
+    return 0;
+}
+
+static void* small_alloc(size_t size) {
+    uint32_t csize = ALIGN(size + CHUNK_HDR);
+    if (csize < MIN_CHUNK)
+        csize = MIN_CHUNK;
 
-    if (last) {
-        last->next = block;
+    free_chunk_t* fc = bin_find(csize);
+    if (!fc) {
+        if (arena_grow(csize) < 0)
+            return NULL;
+        fc = bin_find(csize);
+        if (!fc)
+            return NULL;
     }
+    bin_remove(fc);
 
-    return block;
+    chunk_t* c = &fc->hdr;
+    if (c->size - csize >= MIN_CHUNK) {
+        chunk_t* rem = (chunk_t*)((char*)c + csize);
+        rem->size = c->size - csize;
+        rem->magic = HEAP_MAGIC;
+        rem->flags = CH_PREV_INUSE;
+        chunk_set_footer(rem);
+        bin_insert((free_chunk_t*)rem);
+        c->size = csize;
+        stats.n_split++;
+    } else {
+        chunk_next(c)->flags |= CH_PREV_INUSE;
+    }
+    c->flags |= CH_INUSE;
+    stats.in_use_bytes += c->size;
+    return (void*)(c + 1);
 }
 
+/* ── Page-granular large runs ──────────────────────────────────────── */
+
+static void* large_alloc(size_t size) {
+    if (size > HEAP_MAX)
+        return NULL;
+    uint32_t bytes = PAGE_ALIGN(size + CHUNK_HDR);
+
+    /* First fit over the free runs; keep the tail of a split run */
+    large_run_t** link = &large_free;
+    large_run_t* run = NULL;
+    while (*link) {
+        if ((*link)->hdr.size >= bytes) {
+            run = *link;
+            if (run->hdr.size > bytes) {
+                large_run_t* rest = (large_run_t*)((char*)run + bytes);
+                rest->hdr.size = run->hdr.size - bytes;
+                rest->hdr.magic = HEAP_MAGIC;
+                rest->hdr.flags = CH_LARGE;
+                rest->next = run->next;
+                *link = rest;
+            } else {
+                *link = run->next;
+            }
+            stats.free_bytes -= bytes;
+            break;
+        }
+        link = &(*link)->next;
+    }
+
+    if (!run) {
+        if (!heap_can_grow(bytes))
+            return NULL;
+        run = (large_run_t*)heap_extend(bytes);
+        if (!run)
+            return NULL;
+    }
+
+    run->hdr.size = bytes;
+    run->hdr.magic = HEAP_MAGIC;
+    run->hdr.flags = CH_LARGE | CH_INUSE;
+    stats.large_bytes += bytes;
+    stats.in_use_bytes += bytes;
+    stats.n_large++;
+    return (void*)(&run->hdr + 1);
+}
+
+static void large_free_run(chunk_t* c) {
+    large_run_t* run = (large_run_t*)c;
+    stats.large_bytes -= c->size;
+    stats.in_use_bytes -= c->size;
+    c->flags = CH_LARGE;
+
+    /* Insert address-ordered, merging with both neighbours */
+    large_run_t* prev = NULL;
+    large_run_t* cur = large_free;
+    while (cur && cur < run) {
+        prev = cur;
+        cur = cur->next;
+    }
+    if (cur && (char*)run + run->hdr.size == (char*)cur) {
+        run->hdr.size += cur->hdr.size;
+        stats.free_bytes -= cur->hdr.size;
+        cur = cur->next;
+    }
+    run->next = cur;
+    stats.free_bytes += run->hdr.size;
+    if (prev && (char*)prev + prev->hdr.size == (char*)run) {
+        prev->hdr.size += run->hdr.size;
+        prev->next = run->next;
+        run = prev;
+    } else if (prev) {
+        prev->next = run;
+    } else {
+        large_free = run;
+    }
+
+    /* Give a trailing run back to the break */
+    if ((char*)run + run->hdr.size == heap_end) {
+        large_run_t** l = &large_free;
+        while (*l != run)
+            l = &(*l)->next;
+        *l = NULL;
+        heap_end = (char*)run;
+        stats.free_bytes -= run->hdr.size;
+    }
+}
+
+/* ── Public interface ──────────────────────────────────────────────── */
+
 void* malloc(size_t size) {
     if (size == 0) return NULL;
 
-    size = ALIGN(size);
-
 #if defined(__is_libk)
     uint32_t flags = irq_save();
 #endif
 
-    if (!free_list) {
+    if (!heap_end) {
         heap_init();
     }
 
-    /* First-fit search */
-    block_header_t* current = free_list;
-    block_header_t* last = free_list;
+    void* ptr = (size >= LARGE_THRESHOLD) ? large_alloc(size) : small_alloc(size);
+    if (ptr) {
+        stats.n_malloc++;
+        if (stats.in_use_bytes > stats.peak_bytes)
+            stats.peak_bytes = stats.in_use_bytes;
+    } else {
+        stats.n_fail++;
+    }
 
-    while (current) {
-        if (current->free && current->size >= size) {
-            current->free = 0;
 #if defined(__is_libk)
-            irq_restore(flags);
+    irq_restore(flags);
 #endif
-            return (void*)(current + 1);
-        }
-        last = current;
-        current = current->next;
+    return ptr;
+}
+
+void free(void* ptr) {
+    if (!ptr) return;
+
+    chunk_t* c = (chunk_t*)ptr - 1;
+    if (c->magic != HEAP_MAGIC || !(c->flags & CH_INUSE)) return;
+
+#if defined(__is_libk)
+    uint32_t flags = irq_save();
+#endif
+
+    stats.n_free++;
+    if (c->flags & CH_LARGE) {
+        large_free_run(c);
+    } else {
+        stats.in_use_bytes -= c->size;
+        chunk_release(c);
     }
 
-    /* No free block found, request more space */
-    block_header_t* block = request_space(last, size);
 #if defined(__is_libk)
     irq_restore(flags);
 #endif
-    if (!block) return NULL;
+}
 
-    return (void*)(block + 1);
+size_t malloc_usable_size(void* ptr) {
+    if (!ptr) return 0;
+    chunk_t* c = (chunk_t*)ptr - 1;
+    if (c->magic != HEAP_MAGIC || !(c->flags & CH_INUSE)) return 0;
+    return c->size - CHUNK_HDR;
 }
 
 /* Advance heap past a reserved region (e.g., multiboot modules).
  * Must be called BEFORE the first malloc. Ensures heap allocations
  * won't overlap with data between _heap_start and `addr`. */
 void heap_reserve_to(uint32_t addr) {
-    if (!free_list) {
+    if (!heap_end) {
         heap_init();
     }
     /* Page-align the address */
@@ -107,38 +456,22 @@ void heap_reserve_to(uint32_t addr) {
     }
 }
 
+/* Heap footprint minus bytes sitting on free lists */
 size_t heap_used(void) {
     if (!heap_end) return 0;
-    return (size_t)(heap_end - (char*)_heap_start);
+    return (size_t)(heap_end - (char*)_heap_start) - stats.free_bytes;
 }
 
 size_t heap_total(void) {
     return HEAP_MAX;
 }
 
-void free(void* ptr) {
-    if (!ptr) return;
-
-    block_header_t* header = (block_header_t*)ptr - 1;
-    if (header->magic != HEAP_MAGIC) return;
-
+void heap_get_stats(heap_stats_t* out) {
 #if defined(__is_libk)
     uint32_t flags = irq_save();
 #endif
-
-    header->free = 1;
-
-    /* Coalesce adjacent free blocks */
-    block_header_t* current = free_list;
-    while (current && current->next) {
-        if (current->free && current->next->free) {
-            current->size += sizeof(block_header_t) + current->next->size;
-            current->next = current->next->next;
-        } else {
-            current = current->next;
-        }
-    }
-
+    *out = stats;
+    out->heap_bytes = heap_end ? (size_t)(heap_end - (char*)_heap_start) : 0;
 #if defined(__is_libk)
     irq_restore(flags);
 #endif
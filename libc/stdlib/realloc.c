@@ -2,15 +2,6 @@
 #include <stdint.h>
 #include <string.h>
 
-#define HEAP_MAGIC 0xBEEF
-
-typedef struct block_header {
-    uint32_t size;
-    uint16_t magic;
-    uint16_t free;
-    struct block_header* next;
-} block_header_t;
-
 void* realloc(void* ptr, size_t size) {
     if (ptr == NULL)
         return malloc(size);
@@ -20,12 +11,12 @@ void* realloc(void* ptr, size_t size) {
         return NULL;
     }
 
-    block_header_t* header = (block_header_t*)ptr - 1;
-    if (header->magic != HEAP_MAGIC)
+    size_t cur = malloc_usable_size(ptr);
+    if (cur == 0)
         return NULL;
 
     /* Current block is big enough */
-    if (header->size >= size)
+    if (cur >= size)
         return ptr;
 
     /* Need bigger block */
@@ -33,7 +24,7 @@ void* realloc(void* ptr, size_t size) {
     if (!new_ptr)
         return NULL;
 
-    memcpy(new_ptr, ptr, header->size);
+    memcpy(new_ptr, ptr, cur);
     free(ptr);
     return new_ptr;
 }